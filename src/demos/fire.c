@@ -18,7 +18,9 @@
 #include <mmsystem.h>
 #endif
 
+#include "glad/gl.h"
 #include "glut_wrap.h"
+#include "parallel.h"
 #include "readtex.h"
 
 #define vinit(a,i,j,k) {\
@@ -88,6 +90,21 @@ typedef struct
 }
 part;
 
+/* a vertex of the particle array, laid out as GL_C4UB_V3F */
+typedef struct
+{
+   GLubyte c[4];
+   GLfloat p[3];
+}
+vertex;
+
+/*
+ * The particles are updated in NUMSLICES slices, which a pool of
+ * threads writes into the vertex array.  Each slice has its own random
+ * seed, as rand() would be shared by the threads.
+ */
+#define NUMSLICES 64
+
 static float treepos[NUMTREE][3];
 
 static float black[3] = { 0.0, 0.0, 0.0 };
@@ -123,6 +140,14 @@ static int joyactive = 0;
 
 static part *p;
 
+static int immediate = 0;
+static int nthreads = 0;
+static unsigned seeds[NUMSLICES];
+static GLuint partbuf;          /* streamed vertex buffer, if there is one */
+static vertex *verts;           /* the vertex array when there is not */
+static GLuint shadowid;
+static struct util_pool *pool;
+
 static GLuint groundid;
 static GLuint treeid;
 
@@ -138,46 +163,53 @@ vrnd(void)
    return ((float) rand() / (float) RAND_MAX);
 }
 
+static float
+vrnds(unsigned *seed)
+{
+   *seed = *seed * 1103515245u + 12345u;
+   return (float) (*seed >> 8) / (float) 0xffffff;
+}
+
 static void
-setnewpart(part * p)
+setnewpart(part * p, unsigned *seed)
 {
    float a, v[3], *c;
 
    p->age = 0;
 
-   a = vrnd() * M_PI * 2.0;
+   a = vrnds(seed) * M_PI * 2.0;
 
-   vinit(v, sin(a) * eject_r * vrnd(), 0.15, cos(a) * eject_r * vrnd());
-   vinit(p->p[0], v[0] + vrnd() * ridtri, v[1] + vrnd() * ridtri,
-	 v[2] + vrnd() * ridtri);
-   vinit(p->p[1], v[0] + vrnd() * ridtri, v[1] + vrnd() * ridtri,
-	 v[2] + vrnd() * ridtri);
-   vinit(p->p[2], v[0] + vrnd() * ridtri, v[1] + vrnd() * ridtri,
-	 v[2] + vrnd() * ridtri);
+   vinit(v, sin(a) * eject_r * vrnds(seed), 0.15, cos(a) * eject_r * vrnds(seed));
+   vinit(p->p[0], v[0] + vrnds(seed) * ridtri, v[1] + vrnds(seed) * ridtri,
+	 v[2] + vrnds(seed) * ridtri);
+   vinit(p->p[1], v[0] + vrnds(seed) * ridtri, v[1] + vrnds(seed) * ridtri,
+	 v[2] + vrnds(seed) * ridtri);
+   vinit(p->p[2], v[0] + vrnds(seed) * ridtri, v[1] + vrnds(seed) * ridtri,
+	 v[2] + vrnds(seed) * ridtri);
 
    vinit(p->v, v[0] * eject_vl / (eject_r / 2),
-	 vrnd() * eject_vy + eject_vy / 2, v[2] * eject_vl / (eject_r / 2));
+	 vrnds(seed) * eject_vy + eject_vy / 2, v[2] * eject_vl / (eject_r / 2));
 
    c = blu;
 
-   vinit4(p->c[0], c[0] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[1] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[2] * ((1.0 - RIDCOL) + vrnd() * RIDCOL), 1.0);
-   vinit4(p->c[1], c[0] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[1] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[2] * ((1.0 - RIDCOL) + vrnd() * RIDCOL), 1.0);
-   vinit4(p->c[2], c[0] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[1] * ((1.0 - RIDCOL) + vrnd() * RIDCOL),
-	  c[2] * ((1.0 - RIDCOL) + vrnd() * RIDCOL), 1.0);
+   vinit4(p->c[0], c[0] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[1] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[2] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL), 1.0);
+   vinit4(p->c[1], c[0] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[1] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[2] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL), 1.0);
+   vinit4(p->c[2], c[0] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[1] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL),
+	  c[2] * ((1.0 - RIDCOL) + vrnds(seed) * RIDCOL), 1.0);
 }
 
 static void
-setpart(part * p)
+setpart(part * p, unsigned *seed)
 {
    float fact;
 
    if (p->p[0][1] < 0.1) {
-      setnewpart(p);
+      setnewpart(p, seed);
       return;
    }
 
@@ -210,6 +242,46 @@ setpart(part * p)
    }
 }
 
+static void
+emitpart(const part * p, vertex * v)
+{
+   int i;
+
+   for (i = 0; i < 3; i++) {
+      v[i].c[0] = (GLubyte) (clamp(p->c[i][0]) * 255.0 + 0.5);
+      v[i].c[1] = (GLubyte) (clamp(p->c[i][1]) * 255.0 + 0.5);
+      v[i].c[2] = (GLubyte) (clamp(p->c[i][2]) * 255.0 + 0.5);
+      v[i].c[3] = (GLubyte) (clamp(p->c[i][3]) * 255.0 + 0.5);
+      vequ(v[i].p, p->p[i]);
+   }
+}
+
+/* writes a slice of the particles as they are now, then moves them on */
+static void
+updateslice(void *arg, unsigned slice)
+{
+   vertex *v = (vertex *) arg;
+   int first = np * slice / NUMSLICES;
+   int last = np * (slice + 1) / NUMSLICES;
+   int j;
+
+   for (j = first; j < last; j++) {
+      emitpart(&p[j], &v[3 * j]);
+      setpart(&p[j], &seeds[slice]);
+   }
+}
+
+/*
+ * Writes all the particles to v and updates them.  The GL thread takes
+ * slices too, and only returns when all are done, so the workers never
+ * see the settings change under them.
+ */
+static void
+updateparts(vertex * v)
+{
+   util_pool_run(pool, NUMSLICES, updateslice, v);
+}
+
 static void
 drawtree(float x, float y, float z)
 {
@@ -372,6 +444,99 @@ dojoy(void)
 #endif
 }
 
+static void
+drawimmediate(void)
+{
+   int j;
+
+   if (shadows) {
+      glBegin(GL_TRIANGLES);
+      for (j = 0; j < np; j++) {
+	 glColor4f(black[0], black[1], black[2], p[j].c[0][3]);
+	 glVertex3f(p[j].p[0][0], 0.1, p[j].p[0][2]);
+
+	 glColor4f(black[0], black[1], black[2], p[j].c[1][3]);
+	 glVertex3f(p[j].p[1][0], 0.1, p[j].p[1][2]);
+
+	 glColor4f(black[0], black[1], black[2], p[j].c[2][3]);
+	 glVertex3f(p[j].p[2][0], 0.1, p[j].p[2][2]);
+      }
+      glEnd();
+   }
+
+   glBegin(GL_TRIANGLES);
+   for (j = 0; j < np; j++) {
+      glColor4fv(p[j].c[0]);
+      glVertex3fv(p[j].p[0]);
+
+      glColor4fv(p[j].c[1]);
+      glVertex3fv(p[j].p[1]);
+
+      glColor4fv(p[j].c[2]);
+      glVertex3fv(p[j].p[2]);
+
+      setpart(&p[j], &seeds[0]);
+   }
+   glEnd();
+}
+
+static void
+drawarrays(void)
+{
+   /* projects everything onto the plane y = 0.1 */
+   static const GLfloat flatten[16] = {
+      1.0, 0.0, 0.0, 0.0,
+      0.0, 0.0, 0.0, 0.0,
+      0.0, 0.0, 1.0, 0.0,
+      0.0, 0.1, 0.0, 1.0
+   };
+   vertex *v = verts;
+
+   if (partbuf) {
+      glBindBuffer(GL_ARRAY_BUFFER, partbuf);
+      /* new storage, so that mapping doesn't wait for the last frame */
+      glBufferData(GL_ARRAY_BUFFER, sizeof(vertex) * 3 * np, NULL,
+		   GL_STREAM_DRAW);
+      v = (vertex *) glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+      if (!v) {
+	 fprintf(stderr, "Error mapping the vertex buffer, "
+		 "using a vertex array.\n");
+	 glBindBuffer(GL_ARRAY_BUFFER, 0);
+	 glDeleteBuffers(1, &partbuf);
+	 partbuf = 0;
+	 v = verts = (vertex *) malloc(sizeof(vertex) * 3 * np);
+	 assert(verts);
+      }
+   }
+
+   updateparts(v);
+
+   if (partbuf) {
+      glUnmapBuffer(GL_ARRAY_BUFFER);
+      v = NULL;
+   }
+   glInterleavedArrays(GL_C4UB_V3F, 0, v);
+
+   if (shadows) {
+      /* the same triangles, flattened and blackened by the 1x1 black
+       * texture, which keeps their alpha */
+      glEnable(GL_TEXTURE_2D);
+      glBindTexture(GL_TEXTURE_2D, shadowid);
+      glPushMatrix();
+      glMultMatrixf(flatten);
+      glDrawArrays(GL_TRIANGLES, 0, 3 * np);
+      glPopMatrix();
+      glDisable(GL_TEXTURE_2D);
+   }
+
+   glDrawArrays(GL_TRIANGLES, 0, 3 * np);
+
+   glDisableClientState(GL_COLOR_ARRAY);
+   glDisableClientState(GL_VERTEX_ARRAY);
+   if (partbuf)
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 static void
 drawfire(void)
 {
@@ -456,35 +621,10 @@ drawfire(void)
    glDepthMask(GL_FALSE);
    glDisable(GL_ALPHA_TEST);
 
-   if (shadows) {
-      glBegin(GL_TRIANGLES);
-      for (j = 0; j < np; j++) {
-	 glColor4f(black[0], black[1], black[2], p[j].c[0][3]);
-	 glVertex3f(p[j].p[0][0], 0.1, p[j].p[0][2]);
-
-	 glColor4f(black[0], black[1], black[2], p[j].c[1][3]);
-	 glVertex3f(p[j].p[1][0], 0.1, p[j].p[1][2]);
-
-	 glColor4f(black[0], black[1], black[2], p[j].c[2][3]);
-	 glVertex3f(p[j].p[2][0], 0.1, p[j].p[2][2]);
-      }
-      glEnd();
-   }
-
-   glBegin(GL_TRIANGLES);
-   for (j = 0; j < np; j++) {
-      glColor4fv(p[j].c[0]);
-      glVertex3fv(p[j].p[0]);
-
-      glColor4fv(p[j].c[1]);
-      glVertex3fv(p[j].p[1]);
-
-      glColor4fv(p[j].c[2]);
-      glVertex3fv(p[j].p[2]);
-
-      setpart(&p[j]);
-   }
-   glEnd();
+   if (immediate)
+      drawimmediate();
+   else
+      drawarrays();
 
    glDisable(GL_TEXTURE_2D);
    glDisable(GL_ALPHA_TEST);
@@ -518,7 +658,8 @@ drawfire(void)
       if (t - T0 >= 2000) {
          GLfloat seconds = (t - T0) / 1000.0;
          GLfloat fps = Frames / seconds;
-         sprintf(frbuf, "Frame rate: %f", fps);
+         sprintf(frbuf, "Frame rate: %f (%.2f M particles/s, %d threads)",
+                 fps, fps * np * 1e-6, immediate ? 1 : nthreads);
          printf("%s\n", frbuf);
          fflush(stdout);
          T0 = t;
@@ -678,6 +819,37 @@ inittextures(void)
    glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
 }
 
+static void
+initarrays(void)
+{
+   static const GLubyte black[4] = { 0, 0, 0, 255 };
+   int i;
+
+   for (i = 0; i < NUMSLICES; i++)
+      seeds[i] = (unsigned) rand();
+
+   glGenTextures(1, &shadowid);
+   glBindTexture(GL_TEXTURE_2D, shadowid);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA,
+		GL_UNSIGNED_BYTE, black);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+   if (immediate)
+      return;
+
+   if (GLAD_GL_VERSION_1_5) {
+      glGenBuffers(1, &partbuf);
+   }
+   else {
+      verts = (vertex *) malloc(sizeof(vertex) * 3 * np);
+      assert(verts);
+   }
+
+   pool = util_pool_create(nthreads > 0 ? nthreads : 0);
+   nthreads = util_pool_threads(pool);
+}
+
 static void
 inittree(void)
 {
@@ -698,7 +870,7 @@ inittree(void)
 int
 main(int ac, char **av)
 {
-   int i;
+   int i, j;
 
    fprintf(stderr,
 	   "Fire V1.5\nWritten by David Bucciarelli (tech.hmw@plus.it)\n");
@@ -715,21 +887,39 @@ main(int ac, char **av)
 
    maxage = 1.0 / dt;
 
-   if (ac == 2) {
-      np = atoi(av[1]);
-      if (np <= 0 || np > 1000000) {
-         fprintf(stderr, "Invalid input.\n");
+   glutInitWindowSize(WIDTH, HEIGHT);
+   glutInit(&ac, av);
+
+   /* after glutInit(), which takes out the options that are its own */
+   for (i = 1, j = 0; i < ac; i++) {
+      if (!strcmp(av[i], "-threads") && i + 1 < ac)
+         nthreads = atoi(av[++i]);
+      else if (!strcmp(av[i], "-immediate"))
+         immediate = 1;
+      else if (j == 0) {
+         np = atoi(av[i]);
+         if (np <= 0 || np > 1000000) {
+            fprintf(stderr, "Invalid input.\n");
+            exit(-1);
+         }
+         j++;
+      }
+      else if (j == 1 && i + 1 < ac) {
+         WIDTH = atoi(av[i]);
+         HEIGHT = atoi(av[++i]);
+         j++;
+      }
+      else {
+         fprintf(stderr, "Usage: fire [-threads n] [-immediate] "
+                 "[particles [width height]]\n"
+                 "  -threads n  update the particles on n threads"
+                 " (0, the default, is one per CPU)\n"
+                 "  -immediate  draw in immediate mode, on one thread\n");
          exit(-1);
       }
    }
-
-   if (ac == 4) {
-      WIDTH = atoi(av[2]);
-      HEIGHT = atoi(av[3]);
-   }
-
-   glutInitWindowSize(WIDTH, HEIGHT);
-   glutInit(&ac, av);
+   if (j == 2)
+      glutInitWindowSize(WIDTH, HEIGHT);
 
    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
 
@@ -737,6 +927,7 @@ main(int ac, char **av)
       fprintf(stderr, "Error opening a window.\n");
       exit(-1);
    }
+   gladLoaderLoadGL();
 
    reshape(WIDTH, HEIGHT);
 
@@ -757,8 +948,9 @@ main(int ac, char **av)
    p = (part *) malloc(sizeof(part) * np);
    assert(p);
 
+   initarrays();
    for (i = 0; i < np; i++)
-      setnewpart(&p[i]);
+      setnewpart(&p[i], &seeds[i * NUMSLICES / np]);
 
    inittree();
 
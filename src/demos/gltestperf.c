@@ -10,7 +10,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
 #include "glut_wrap.h"
+#include "stats.h"
+#include "timer.h"
 
 typedef struct
 {
@@ -382,24 +385,45 @@ static benchmark bmarks[NUM_BMARKS] = {
 
 /***************************************************************************/
 
-static void
-dotest0param(benchmark * bmark)
+/* Each test is timed with a monotonic nanosecond clock.  After a two
+ * second calibration picks the number of iterations, Warmup untimed
+ * runs are made and then Reps timed ones, and the statistics of the
+ * timed runs are reported.
+ */
+
+enum format { FORMAT_TEXT, FORMAT_JSON, FORMAT_CSV };
+
+static int Warmup = 1;
+static int Reps = 5;
+static double BmarkTime = BMARKS_TIME;
+static enum format Format = FORMAT_TEXT;
+static FILE *Out;
+static int NumResults = 0;
+
+struct result
 {
-   float stime, etime, dtime, tottime, maxtime, mintime;
-   int num, numelem, calibnum, j;
+   benchmark *bmark;
+   int size;             /* 0 for tests without a size */
+   int iterations;
+   int elements;         /* primitives drawn by one timed run */
+   double pixels;        /* pixels filled by one timed run, or 0 */
+   double *times;        /* Reps timed runs, in seconds, sorted */
+   struct stats stats;
+};
+
+static double
+calibrate(benchmark * bmark, int size)
+{
+   uint64_t stime = timer_get_ns();
+   double dtime = 0.0;
+   int calibnum = 0;
 
    glPushAttrib(GL_ALL_ATTRIB_BITS);
    bmark->init();
-
-   stime = glutGet(GLUT_ELAPSED_TIME);
-
-   dtime = 0.0f;
-   calibnum = 0;
-   while (dtime < 2.0f) {
-      bmark->run(0, 1);
+   while (dtime < 2.0) {
+      bmark->run(size, 1);
       glFinish();
-      etime = glutGet(GLUT_ELAPSED_TIME);
-      dtime = (etime - stime) / 1000.0f;
+      dtime = (timer_get_ns() - stime) * 1e-9;
       calibnum++;
    }
    glPopAttrib();
@@ -407,128 +431,159 @@ dotest0param(benchmark * bmark)
    fprintf(stderr, "Elapsed time for the calibration test (%d): %f\n",
 	   calibnum, dtime);
 
-   num = (int) ((BMARKS_TIME / dtime) * calibnum);
+   return calibnum / dtime;
+}
 
-   if (num < 1)
-      num = 1;
+static double
+timedrun(benchmark * bmark, int size, int num, int *numelem)
+{
+   uint64_t stime, etime;
 
-   fprintf(stderr, "Selected number of benchmark iterations: %d\n", num);
+   glPushAttrib(GL_ALL_ATTRIB_BITS);
+   bmark->init();
 
-   mintime = HUGE_VAL;
-   maxtime = -HUGE_VAL;
+   stime = timer_get_ns();
+   *numelem = bmark->run(size, num);
+   glFinish();
+   etime = timer_get_ns();
 
-   for (tottime = 0.0f, j = 0; j < 5; j++) {
-      glPushAttrib(GL_ALL_ATTRIB_BITS);
-      bmark->init();
+   glPopAttrib();
 
-      stime = glutGet(GLUT_ELAPSED_TIME);
-      numelem = bmark->run(0, num);
-      glFinish();
-      etime = glutGet(GLUT_ELAPSED_TIME);
+   return (etime - stime) * 1e-9;
+}
 
-      glPopAttrib();
+static void
+measure(benchmark * bmark, int size, struct result *res)
+{
+   int num, j;
+
+   num = (int) (BmarkTime * calibrate(bmark, size));
+   if (num < 1)
+      num = 1;
 
-      dtime = (etime - stime) / 1000.0f;
-      tottime += dtime;
+   fprintf(stderr, "Selected number of benchmark iterations: %d\n", num);
 
-      fprintf(stderr, "Elapsed time for run %d: %f\n", j, dtime);
+   for (j = 0; j < Warmup; j++)
+      timedrun(bmark, size, num, &res->elements);
 
-      if (dtime < mintime)
-	 mintime = dtime;
-      if (dtime > maxtime)
-	 maxtime = dtime;
+   res->bmark = bmark;
+   res->size = size;
+   res->iterations = num;
+   res->times = (double *) malloc(Reps * sizeof(double));
+   for (j = 0; j < Reps; j++) {
+      res->times[j] = timedrun(bmark, size, num, &res->elements);
+      fprintf(stderr, "Elapsed time for run %d: %f\n", j, res->times[j]);
    }
 
-   tottime -= mintime + maxtime;
-
-   fprintf(stdout, "%s\n%f %s/sec", bmark->name,
-      (float) numelem / (tottime / 3.0f), bmark->unit);
+   stats_compute(res->times, Reps, &res->stats);
 
    if (bmark->type == 3)
-      fprintf(stdout, ", MPixel Fill/sec: %f\n\n",
-	      ((float) numelem * bmark->size[0] * bmark->size[0]) /
-	      (1000000.0f * tottime / 3.0f));
+      res->pixels = (double) res->elements * bmark->size[0] * bmark->size[0];
+   else if (bmark->type == 2)
+      res->pixels = (double) res->elements * size * size / 2.0;
    else
-      fprintf(stdout, "\n\n");
+      res->pixels = 0.0;
 }
 
-/***************************************************************************/
-
 static void
-dotest1param(benchmark * bmark)
+printjsonstring(const char *s)
 {
-   float stime, etime, dtime, tottime, maxtime, mintime;
-   int num, numelem, calibnum, j, k;
-
-   fprintf(stdout, "%s\n", bmark->name);
-
-   for (j = 0; j < bmark->numsize; j++) {
-      fprintf(stderr, "Current size: %d\n", bmark->size[j]);
-
-      glPushAttrib(GL_ALL_ATTRIB_BITS);
-      bmark->init();
-
-      stime = glutGet(GLUT_ELAPSED_TIME);
-
-      dtime = 0.0f;
-      calibnum = 0;
-      while (dtime < 2.0f) {
-	 bmark->run(bmark->size[j], 1);
-	 glFinish();
-	 etime = glutGet(GLUT_ELAPSED_TIME);
-	 dtime = (etime - stime) / 1000.0f;
-	 calibnum++;
-      }
-      glPopAttrib();
-
-      fprintf(stderr, "Elapsed time for the calibration test (%d): %f\n",
-	      calibnum, dtime);
-
-      num = (int) ((BMARKS_TIME / dtime) * calibnum);
-
-      if (num < 1)
-	 num = 1;
+   fputc('"', Out);
+   for (; *s; s++) {
+      if (*s == '"' || *s == '\\')
+	 fputc('\\', Out);
+      fputc(*s, Out);
+   }
+   fputc('"', Out);
+}
 
-      fprintf(stderr, "Selected number of benchmark iterations: %d\n", num);
+static void
+report(struct result *res)
+{
+   const struct stats *s = &res->stats;
+   double p10 = stats_percentile(res->times, Reps, 10.0);
+   double p90 = stats_percentile(res->times, Reps, 90.0);
+
+   switch (Format) {
+   case FORMAT_TEXT:
+      if (res->size)
+	 fprintf(Out, "SIZE=%03d => ", res->size);
+      fprintf(Out, "%f %s/sec (+-%.1f%%)", res->elements / s->median,
+	      res->bmark->unit, 100.0 * s->stddev / s->mean);
+      if (res->pixels)
+	 fprintf(Out, ", MPixel Fill/sec: %f",
+		 res->pixels / (1000000.0 * s->median));
+      fprintf(Out, res->size ? "\n" : "\n\n");
+      break;
+
+   case FORMAT_JSON:
+      fprintf(Out, "%s\n    {\"name\": ", NumResults ? "," : "");
+      printjsonstring(res->bmark->name);
+      fprintf(Out, ", \"unit\": ");
+      printjsonstring(res->bmark->unit);
+      fprintf(Out, ", \"size\": %d,\n"
+	      "     \"iterations\": %d, \"elements\": %d, "
+	      "\"warmup\": %d, \"reps\": %d,\n"
+	      "     \"time_ns\": {\"min\": %.0f, \"p10\": %.0f, "
+	      "\"median\": %.0f, \"mean\": %.0f, \"p90\": %.0f, "
+	      "\"max\": %.0f, \"stddev\": %.0f},\n"
+	      "     \"rate\": %g, \"mpixels\": %g}",
+	      res->size, res->iterations, res->elements, Warmup, Reps,
+	      s->min * 1e9, p10 * 1e9, s->median * 1e9, s->mean * 1e9,
+	      p90 * 1e9, s->max * 1e9, s->stddev * 1e9,
+	      res->elements / s->median,
+	      res->pixels / (1000000.0 * s->median));
+      break;
+
+   case FORMAT_CSV:
+      fprintf(Out, "\"%s\",%s,%d,%d,%d,%d,%d,"
+	      "%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%g,%g\n",
+	      res->bmark->name, res->bmark->unit, res->size,
+	      res->iterations, res->elements, Warmup, Reps,
+	      s->min * 1e9, p10 * 1e9, s->median * 1e9, s->mean * 1e9,
+	      p90 * 1e9, s->max * 1e9, s->stddev * 1e9,
+	      res->elements / s->median,
+	      res->pixels / (1000000.0 * s->median));
+      break;
+   }
+   fflush(Out);
 
-      mintime = HUGE_VAL;
-      maxtime = -HUGE_VAL;
+   free(res->times);
+   NumResults++;
+}
 
-      for (numelem = 1, tottime = 0.0, k = 0; k < 5; k++) {
-	 glPushAttrib(GL_ALL_ATTRIB_BITS);
-	 bmark->init();
+static void
+dotest0param(benchmark * bmark)
+{
+   struct result res;
 
-	 stime = glutGet(GLUT_ELAPSED_TIME);
-	 numelem = bmark->run(bmark->size[j], num);
-	 glFinish();
-	 etime = glutGet(GLUT_ELAPSED_TIME);
+   if (Format == FORMAT_TEXT)
+      fprintf(Out, "%s\n", bmark->name);
 
-	 glPopAttrib();
+   measure(bmark, 0, &res);
+   report(&res);
+}
 
-	 dtime = (etime - stime) / 1000.0f;
-	 tottime += dtime;
+/***************************************************************************/
 
-	 fprintf(stderr, "Elapsed time for run %d: %f\n", k, dtime);
+static void
+dotest1param(benchmark * bmark)
+{
+   struct result res;
+   int j;
 
-	 if (dtime < mintime)
-	    mintime = dtime;
-	 if (dtime > maxtime)
-	    maxtime = dtime;
-      }
+   if (Format == FORMAT_TEXT)
+      fprintf(Out, "%s\n", bmark->name);
 
-      tottime -= mintime + maxtime;
+   for (j = 0; j < bmark->numsize; j++) {
+      fprintf(stderr, "Current size: %d\n", bmark->size[j]);
 
-      fprintf(stdout, "SIZE=%03d => %f %s/sec", bmark->size[j],
-	      (float) numelem / (tottime / 3.0f), bmark->unit);
-      if (bmark->type == 2)
-	 fprintf(stdout, ", MPixel Fill/sec: %f\n",
-		 ((float) numelem * bmark->size[j] * bmark->size[j] / 2.0f) /
-		 (1000000.0f * tottime / 3.0f));
-      else
-	 fprintf(stdout, "\n");
+      measure(bmark, bmark->size[j], &res);
+      report(&res);
    }
 
-   fprintf(stdout, "\n\n");
+   if (Format == FORMAT_TEXT)
+      fprintf(Out, "\n\n");
 }
 
 /***************************************************************************/
@@ -543,6 +598,20 @@ display(void)
    else
       glDrawBuffer(GL_BACK);
 
+   if (Format == FORMAT_JSON) {
+      fprintf(Out, "{\"vendor\": ");
+      printjsonstring((const char *) glGetString(GL_VENDOR));
+      fprintf(Out, ",\n \"renderer\": ");
+      printjsonstring((const char *) glGetString(GL_RENDERER));
+      fprintf(Out, ",\n \"version\": ");
+      printjsonstring((const char *) glGetString(GL_VERSION));
+      fprintf(Out, ",\n \"results\": [");
+   }
+   else if (Format == FORMAT_CSV)
+      fprintf(Out, "name,unit,size,iterations,elements,warmup,reps,"
+	      "min_ns,p10_ns,median_ns,mean_ns,p90_ns,max_ns,stddev_ns,"
+	      "rate,mpixels\n");
+
    for (i = 0; i < NUM_BMARKS; i++) {
       fprintf(stderr, "Benchmark: %d\n", i);
 
@@ -558,19 +627,72 @@ display(void)
       }
    }
 
+   if (Format == FORMAT_JSON)
+      fprintf(Out, "\n ]\n}\n");
+
+   if (Out != stdout)
+      fclose(Out);
+
    exit(0);
 }
 
+static void
+usage(void)
+{
+   fprintf(stderr,
+	   "Usage: gltestperf [options] [back]\n"
+	   "  -warmup n      untimed runs before the timed ones (default 1)\n"
+	   "  -reps n        timed runs per test and size (default 5)\n"
+	   "  -time secs     target length of each timed run (default %g)\n"
+	   "  -format f      text, json or csv (default text)\n"
+	   "  -o file        write the results to file instead of stdout\n"
+	   "  back           draw to the back buffer\n", BMARKS_TIME);
+   exit(1);
+}
+
 int
 main(int ac, char **av)
 {
-   fprintf(stderr, "GLTest v1.0\nWritten by David Bucciarelli\n");
+   int i;
 
-   if (ac == 2)
-      frontbuffer = 0;
+   fprintf(stderr, "GLTest v1.0\nWritten by David Bucciarelli\n");
 
    glutInitWindowSize(640, 480);
    glutInit(&ac, av);
+
+   Out = stdout;
+   for (i = 1; i < ac; i++) {
+      if (!strcmp(av[i], "-warmup") && i + 1 < ac)
+	 Warmup = atoi(av[++i]);
+      else if (!strcmp(av[i], "-reps") && i + 1 < ac)
+	 Reps = atoi(av[++i]);
+      else if (!strcmp(av[i], "-time") && i + 1 < ac)
+	 BmarkTime = atof(av[++i]);
+      else if (!strcmp(av[i], "-format") && i + 1 < ac) {
+	 i++;
+	 if (!strcmp(av[i], "text"))
+	    Format = FORMAT_TEXT;
+	 else if (!strcmp(av[i], "json"))
+	    Format = FORMAT_JSON;
+	 else if (!strcmp(av[i], "csv"))
+	    Format = FORMAT_CSV;
+	 else
+	    usage();
+      }
+      else if (!strcmp(av[i], "-o") && i + 1 < ac) {
+	 if (!(Out = fopen(av[++i], "w"))) {
+	    perror(av[i]);
+	    exit(1);
+	 }
+      }
+      else if (av[i][0] == '-')
+	 usage();
+      else
+	 frontbuffer = 0;    /* any other argument, as before */
+   }
+   if (Warmup < 0 || Reps < 1 || BmarkTime <= 0.0)
+      usage();
+
    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
    glutCreateWindow("OpenGL/Mesa Performances");
    glutDisplayFunc(display);
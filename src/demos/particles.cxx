@@ -6,10 +6,18 @@
  *            Humanware s.r.l.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
 
 #include "particles.h"
 
+#define RAIN_BLOCK 1024
+
 #define vinit(a,i,j,k) {\
   (a)[0]=i;\
   (a)[1]=j;\
@@ -217,3 +225,339 @@ void rainParticle::randomHeight(void)
 
   oldpos[1]=pos[1]-partLength*vel[1];
 }
+
+/////////////////////////////////////////
+// Structure of arrays particles
+/////////////////////////////////////////
+
+static float *growArray(float *a, unsigned long n)
+{
+  a=(float *)realloc(a,sizeof(float)*n);
+  if(!a) {
+    fprintf(stderr,"Out of memory for %lu particles.\n",n);
+    exit(-1);
+  }
+
+  return(a);
+}
+
+// Small per-slice generator for respawning, so that slices of a
+// system can be updated at the same time without sharing rand().
+static float srnd(unsigned int *s)
+{
+  *s^=*s<<13;
+  *s^=*s>>17;
+  *s^=*s<<5;
+
+  return((*s>>8)*(1.0f/16777216.0f));
+}
+
+particleArrays::particleArrays()
+{
+  px=py=pz=NULL;
+  vx=vy=vz=NULL;
+  age=NULL;
+
+  vinit(acc,0.0f,0.0f,0.0f);
+
+  particleNum=0;
+  capacity=0;
+}
+
+particleArrays::~particleArrays()
+{
+  reset();
+}
+
+void particleArrays::reserve(unsigned long n)
+{
+  if(n<=capacity)
+    return;
+
+  if(n<2*capacity)
+    n=2*capacity;
+  if(n<1024)
+    n=1024;
+
+  px=growArray(px,n);
+  py=growArray(py,n);
+  pz=growArray(pz,n);
+  vx=growArray(vx,n);
+  vy=growArray(vy,n);
+  vz=growArray(vz,n);
+  age=growArray(age,n);
+
+  capacity=n;
+}
+
+// Adds n particles at rest at the origin and returns the index of
+// the first one.
+unsigned long particleArrays::spawn(unsigned long n)
+{
+  unsigned long first=particleNum;
+
+  reserve(particleNum+n);
+
+  memset(px+first,0,sizeof(float)*n);
+  memset(py+first,0,sizeof(float)*n);
+  memset(pz+first,0,sizeof(float)*n);
+  memset(vx+first,0,sizeof(float)*n);
+  memset(vy+first,0,sizeof(float)*n);
+  memset(vz+first,0,sizeof(float)*n);
+  memset(age+first,0,sizeof(float)*n);
+
+  particleNum+=n;
+
+  return(first);
+}
+
+void particleArrays::reset(void)
+{
+  free(px);
+  free(py);
+  free(pz);
+  free(vx);
+  free(vy);
+  free(vz);
+  free(age);
+
+  px=py=pz=NULL;
+  vx=vy=vz=NULL;
+  age=NULL;
+
+  particleNum=0;
+  capacity=0;
+}
+
+void particleArrays::setAcceleration(float x, float y, float z)
+{
+  vinit(acc,x,y,z);
+}
+
+// Same step as particle::elapsedTime(), for count particles from first.
+void particleArrays::integrate(unsigned long first, unsigned long count,
+			       float dt)
+{
+  float * __restrict x=px+first;
+  float * __restrict y=py+first;
+  float * __restrict z=pz+first;
+  float * __restrict u=vx+first;
+  float * __restrict v=vy+first;
+  float * __restrict w=vz+first;
+  float * __restrict a=age+first;
+  const float ax=dt*acc[0],ay=dt*acc[1],az=dt*acc[2];
+  unsigned long i=0;
+
+#ifdef __SSE__
+  const __m128 dt4=_mm_set1_ps(dt);
+  const __m128 ax4=_mm_set1_ps(ax),ay4=_mm_set1_ps(ay),az4=_mm_set1_ps(az);
+
+  for(;i+4<=count;i+=4) {
+    __m128 u4=_mm_add_ps(_mm_loadu_ps(u+i),ax4);
+    __m128 v4=_mm_add_ps(_mm_loadu_ps(v+i),ay4);
+    __m128 w4=_mm_add_ps(_mm_loadu_ps(w+i),az4);
+
+    _mm_storeu_ps(u+i,u4);
+    _mm_storeu_ps(v+i,v4);
+    _mm_storeu_ps(w+i,w4);
+
+    _mm_storeu_ps(x+i,_mm_add_ps(_mm_loadu_ps(x+i),_mm_mul_ps(dt4,u4)));
+    _mm_storeu_ps(y+i,_mm_add_ps(_mm_loadu_ps(y+i),_mm_mul_ps(dt4,v4)));
+    _mm_storeu_ps(z+i,_mm_add_ps(_mm_loadu_ps(z+i),_mm_mul_ps(dt4,w4)));
+
+    _mm_storeu_ps(a+i,_mm_add_ps(_mm_loadu_ps(a+i),dt4));
+  }
+#endif
+
+  for(;i<count;i++) {
+    a[i]+=dt;
+
+    u[i]+=ax;
+    v[i]+=ay;
+    w[i]+=az;
+
+    x[i]+=dt*u[i];
+    y[i]+=dt*v[i];
+    z[i]+=dt*w[i];
+  }
+}
+
+/////////////////////////////////////////
+// Rain (structure of arrays)
+/////////////////////////////////////////
+
+rainSystem::rainSystem()
+{
+  vinit(min,0.0f,0.0f,0.0f);
+  vinit(max,0.0f,0.0f,0.0f);
+  partLength=0.2f;
+
+  seed=1;
+
+  lines=NULL;
+  colors=NULL;
+  linesNum=0;
+
+  setAcceleration(0.0f,-0.98f,0.0f);
+}
+
+rainSystem::~rainSystem()
+{
+  free(lines);
+  free(colors);
+}
+
+void rainSystem::setRainingArea(float minx, float miny, float minz,
+				float maxx, float maxy, float maxz)
+{
+  vinit(min,minx,miny,minz);
+  vinit(max,maxx,maxy,maxz);
+}
+
+// Same as rainParticle::init().
+void rainSystem::respawn(unsigned long i, unsigned int *s)
+{
+  age[i]=0.0f;
+
+  vx[i]=vy[i]=vz[i]=0.0f;
+
+  px[i]=min[0]+(max[0]-min[0])*srnd(s);
+  py[i]=max[1]+0.2f*max[1]*srnd(s);
+  pz[i]=min[2]+(max[2]-min[2])*srnd(s);
+}
+
+// Adds n drops spread over the whole height of the raining area, like
+// a rainParticle followed by randomHeight().
+void rainSystem::addRain(unsigned long n)
+{
+  unsigned long first=spawn(n);
+  unsigned int s=(unsigned int)rand()|1;
+
+  for(unsigned long i=first;i<first+n;i++) {
+    respawn(i,&s);
+    py[i]=(max[1]-min[1])*srnd(&s)+min[1];
+  }
+}
+
+// Moves count drops from first by dt, wraps them around the sides of
+// the raining area and restarts the ones that hit the ground.  Disjoint
+// slices may be updated concurrently as long as each passes its own
+// frame seed through; the drops restarted depend only on (frame, first).
+void rainSystem::update(unsigned long first, unsigned long count, float dt,
+			unsigned int frame)
+{
+  const float minx=min[0],maxx=max[0],sizex=max[0]-min[0];
+  const float minz=min[2],maxz=max[2],sizez=max[2]-min[2];
+  const float miny=min[1];
+  unsigned int s;
+
+  s=(frame*2654435761u)^((unsigned int)first*0x9e3779b9u);
+  s|=1;
+
+  // work through the slice in blocks that stay in the L1 cache between
+  // the integration and the wrapping passes
+  for(unsigned long b=first;b<first+count;b+=RAIN_BLOCK) {
+    unsigned long n=first+count-b<RAIN_BLOCK ? first+count-b : RAIN_BLOCK;
+    float * __restrict x=px+b;
+    float * __restrict y=py+b;
+    float * __restrict z=pz+b;
+    unsigned long i=0;
+
+    integrate(b,n,dt);
+
+#ifdef __SSE__
+    const __m128 minx4=_mm_set1_ps(minx),maxx4=_mm_set1_ps(maxx);
+    const __m128 minz4=_mm_set1_ps(minz),maxz4=_mm_set1_ps(maxz);
+    const __m128 sizex4=_mm_set1_ps(sizex),sizez4=_mm_set1_ps(sizez);
+    const __m128 miny4=_mm_set1_ps(miny);
+
+    for(;i+4<=n;i+=4) {
+      __m128 x4=_mm_loadu_ps(x+i);
+      __m128 z4=_mm_loadu_ps(z+i);
+
+      x4=_mm_add_ps(x4,_mm_and_ps(_mm_cmplt_ps(x4,minx4),sizex4));
+      z4=_mm_add_ps(z4,_mm_and_ps(_mm_cmplt_ps(z4,minz4),sizez4));
+      x4=_mm_sub_ps(x4,_mm_and_ps(_mm_cmpgt_ps(x4,maxx4),sizex4));
+      z4=_mm_sub_ps(z4,_mm_and_ps(_mm_cmpgt_ps(z4,maxz4),sizez4));
+
+      _mm_storeu_ps(x+i,x4);
+      _mm_storeu_ps(z+i,z4);
+
+      if(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(y+i),miny4)))
+	for(unsigned long j=i;j<i+4;j++)
+	  if(y[j]<miny)
+	    respawn(b+j,&s);
+    }
+#endif
+
+    for(;i<n;i++) {
+      if(x[i]<minx)
+	x[i]+=sizex;
+      if(z[i]<minz)
+	z[i]+=sizez;
+
+      if(x[i]>maxx)
+	x[i]-=sizex;
+      if(z[i]>maxz)
+	z[i]-=sizez;
+
+      if(y[i]<miny)
+	respawn(b+i,&s);
+    }
+  }
+}
+
+// Writes the line for count drops from first into v, as the old
+// position (pos - length*vel) followed by the current one.
+void rainSystem::getLines(float *v, unsigned long first,
+			  unsigned long count) const
+{
+  const float *x=px+first,*y=py+first,*z=pz+first;
+  const float *u=vx+first,*w=vy+first,*t=vz+first;
+  const float l=partLength;
+
+  for(unsigned long i=0;i<count;i++) {
+    v[6*i+0]=x[i]-l*u[i];
+    v[6*i+1]=y[i]-l*w[i];
+    v[6*i+2]=z[i]-l*t[i];
+    v[6*i+3]=x[i];
+    v[6*i+4]=y[i];
+    v[6*i+5]=z[i];
+  }
+}
+
+void rainSystem::addTime(float dt)
+{
+  update(0,particleNum,dt,seed++);
+}
+
+void rainSystem::draw(void)
+{
+  static const float tail[4]={0.7f,0.95f,1.0f,0.0f};
+  static const float head[4]={0.3f,0.7f,1.0f,1.0f};
+
+  if(!particleNum)
+    return;
+
+  if(linesNum<particleNum) {
+    lines=growArray(lines,6*capacity);
+    colors=growArray(colors,8*capacity);
+    for(unsigned long i=linesNum;i<capacity;i++) {
+      memcpy(colors+8*i,tail,sizeof(tail));
+      memcpy(colors+8*i+4,head,sizeof(head));
+    }
+    linesNum=capacity;
+  }
+
+  getLines(lines,0,particleNum);
+
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  glVertexPointer(3,GL_FLOAT,0,lines);
+  glColorPointer(4,GL_FLOAT,0,colors);
+
+  glDrawArrays(GL_LINES,0,(GLsizei)(2*particleNum));
+
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+}
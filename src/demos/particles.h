@@ -78,4 +78,71 @@ class rainParticle : public particle {
   void randomHeight(void);
 };
 
+/////////////////////////////////////////
+// Structure of arrays particles
+/////////////////////////////////////////
+
+// Particles stored as one contiguous array per component rather than
+// one heap object per particle, so a whole system is updated by a
+// handful of straight loops the compiler can vectorize.
+
+class particleArrays {
+ protected:
+  float *px,*py,*pz;
+  float *vx,*vy,*vz;
+  float *age;        // in seconds
+
+  float acc[3];      // shared by every particle
+
+  unsigned long particleNum;
+  unsigned long capacity;
+
+  void reserve(unsigned long);
+ public:
+  particleArrays();
+  virtual ~particleArrays();
+
+  unsigned long spawn(unsigned long);
+
+  void reset(void);
+
+  void setAcceleration(float, float, float);
+
+  void integrate(unsigned long, unsigned long, float);
+
+  unsigned long size(void) const { return particleNum; };
+};
+
+class rainSystem : public particleArrays {
+ protected:
+  float min[3];
+  float max[3];
+  float partLength;
+
+  unsigned int seed;
+
+  float *lines;      // two vertices per particle, for draw()
+  float *colors;
+  unsigned long linesNum;
+
+  void respawn(unsigned long, unsigned int *);
+ public:
+  rainSystem();
+  ~rainSystem();
+
+  void setRainingArea(float, float, float,
+		      float, float, float);
+  void setLength(float l) { partLength=l; };
+  float getLength(void) const { return partLength; };
+
+  void addRain(unsigned long);
+
+  void update(unsigned long, unsigned long, float, unsigned int);
+  void getLines(float *, unsigned long, unsigned long) const;
+
+  void addTime(float);
+
+  void draw(void);
+};
+
 #endif
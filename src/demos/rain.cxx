@@ -11,12 +11,19 @@
 #include <string.h>
 #include <math.h>
 #include <time.h>
+#include <limits.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include "glad/gl.h"
 #include "glut_wrap.h"
 
 #include "particles.h"
 extern "C" {
 #include "readtex.h"
 }
+#include "timer.h"
 
 #ifdef _WIN32
 #include <windows.h>
@@ -26,6 +33,8 @@ extern "C" {
 static int WIDTH=640;
 static int HEIGHT=480;
 static int NUMPART=7500;
+// glDrawArrays() takes the two vertices of every drop as a GLsizei
+#define MAXPART (INT_MAX/2)
 
 #define FRAME 50
 
@@ -61,34 +70,153 @@ static float v=0.0;
 static float alpha=-90.0;
 static float beta=90.0;
 
-static particleSystem *ps;
-
-static float gettime()
+static rainSystem *ps;
+static float rainlength=0.2f;
+
+// Threaded mode: the drops are updated by a pool of worker threads,
+// each writing its slice of lines straight into one region of a
+// persistently mapped vertex buffer, while the GL thread draws the
+// region filled during the previous frame.
+#define NUMREGIONS 3
+
+static int nthreads=0;
+
+static GLuint linebuf,colorbuf;
+static float *linemap;
+static GLsync fences[NUMREGIONS];
+static int lastregion=-1;
+static unsigned int rainframe=0;
+
+static std::mutex poolmutex;
+static std::condition_variable poolwake,pooldone;
+static std::vector<std::thread> pool;
+static unsigned int jobframe=0;
+static int jobpending=0;
+static float jobdt;
+static float *jobdst;
+static bool poolquit=false;
+
+// wall clock time: clock() would add up the CPU time of every thread
+static float elapsed(double &told)
 {
-  static clock_t told=0;
-  clock_t tnew,ris;
+  double tnew,ris;
 
-  tnew=clock();
+  tnew=timer_get_seconds();
 
   ris=tnew-told;
 
   told=tnew;
 
-  return(ris/(float)CLOCKS_PER_SEC);
+  return((float)ris);
+}
+
+static float gettime()
+{
+  static double told=timer_get_seconds();
+
+  return(elapsed(told));
 }
 
 static float gettimerain()
 {
-  static clock_t told=0;
-  clock_t tnew,ris;
+  static double told=timer_get_seconds();
 
-  tnew=clock();
+  return(elapsed(told));
+}
 
-  ris=tnew-told;
+static void worker(int id)
+{
+  unsigned int seen=0;
 
-  told=tnew;
+  for(;;) {
+    std::unique_lock<std::mutex> lock(poolmutex);
+    poolwake.wait(lock,[&]{ return poolquit || jobframe!=seen; });
+    if(poolquit)
+      return;
+
+    seen=jobframe;
+    float dt=jobdt;
+    float *dst=jobdst;
+    lock.unlock();
+
+    unsigned long n=ps->size();
+    unsigned long first=n*id/nthreads;
+    unsigned long count=n*(id+1)/nthreads-first;
+
+    ps->update(first,count,dt,seen);
+    ps->getLines(dst+6*first,first,count);
+
+    lock.lock();
+    if(--jobpending==0)
+      pooldone.notify_one();
+  }
+}
+
+static void startrain(float dt, int region)
+{
+  std::lock_guard<std::mutex> lock(poolmutex);
+
+  jobdt=dt;
+  jobdst=linemap+6*ps->size()*region;
+  jobpending=nthreads;
+  jobframe=++rainframe;
+  poolwake.notify_all();
+}
+
+static void finishrain(void)
+{
+  std::unique_lock<std::mutex> lock(poolmutex);
+
+  pooldone.wait(lock,[]{ return jobpending==0; });
+}
+
+static void stopthreads(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(poolmutex);
+    poolquit=true;
+    poolwake.notify_all();
+  }
+
+  for(size_t i=0;i<pool.size();i++)
+    pool[i].join();
+  pool.clear();
+}
+
+// Draws the region the workers filled last frame, fences it, and sets
+// them going on the next one once the GPU has finished reading it.
+static void drawthreadedrain(void)
+{
+  int region;
+
+  if(lastregion>=0) {
+    glBindBuffer(GL_ARRAY_BUFFER,colorbuf);
+    glColorPointer(4,GL_UNSIGNED_BYTE,0,NULL);
+    glBindBuffer(GL_ARRAY_BUFFER,linebuf);
+    glVertexPointer(3,GL_FLOAT,0,
+		    (void *)(sizeof(float)*6*ps->size()*lastregion));
+    glBindBuffer(GL_ARRAY_BUFFER,0);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glDrawArrays(GL_LINES,0,(GLsizei)(2*ps->size()));
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+
+    fences[lastregion]=glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,0);
+  }
 
-  return(ris/(float)CLOCKS_PER_SEC);
+  region=(lastregion+1)%NUMREGIONS;
+  if(fences[region]) {
+    while(glClientWaitSync(fences[region],GL_SYNC_FLUSH_COMMANDS_BIT,
+			   1000000000)==GL_TIMEOUT_EXPIRED)
+      ;
+    glDeleteSync(fences[region]);
+    fences[region]=0;
+  }
+
+  startrain(gettimerain(),region);
+  lastregion=region;
 }
 
 static void calcposobs(void)
@@ -101,7 +229,7 @@ static void calcposobs(void)
   obs[1]+=v*dir[1];
   obs[2]+=v*dir[2];
 
-  rainParticle::setRainingArea(obs[0]-7.0f,-0.2f,obs[2]-7.0f,obs[0]+7.0f,8.0f,obs[2]+7.0f);
+  ps->setRainingArea(obs[0]-7.0f,-0.2f,obs[2]-7.0f,obs[0]+7.0f,8.0f,obs[2]+7.0f);
 }
 
 static void printstring(void *font, const char *string)
@@ -159,6 +287,11 @@ static void drawrain(void)
   static char frbuf[80];
   float fr;
 
+  // the workers read the raining area and drop length
+  if(nthreads)
+    finishrain();
+  ps->setLength(rainlength);
+
   glEnable(GL_DEPTH_TEST);
 
   if(fog)
@@ -198,15 +331,23 @@ static void drawrain(void)
   glShadeModel(GL_SMOOTH);
   glEnable(GL_BLEND);
 
-  ps->draw();
-  ps->addTime(gettimerain());
+  if(nthreads)
+    drawthreadedrain();
+  else {
+    ps->draw();
+    ps->addTime(gettimerain());
+  }
 
   glShadeModel(GL_FLAT);
 
 
   if((count % FRAME)==0) {
     fr=gettime();
-    sprintf(frbuf,"Frame rate: %f",FRAME/fr);
+    if(nthreads)
+      sprintf(frbuf,"Frame rate: %f (%lu drops, %d threads)",FRAME/fr,
+	      ps->size(),nthreads);
+    else
+      sprintf(frbuf,"Frame rate: %f (%lu drops)",FRAME/fr,ps->size());
   }
 
   glDisable(GL_TEXTURE_2D);
@@ -270,10 +411,10 @@ static void key(unsigned char key, int x, int y)
     break;
 
   case 'l':
-    rainParticle::setLength(rainParticle::getLength()+0.025f);
+    rainlength+=0.025f;
     break;
   case 'k':
-    rainParticle::setLength(rainParticle::getLength()-0.025f);
+    rainlength-=0.025f;
     break;
 
   case 'h':
@@ -318,22 +459,165 @@ static void inittextures(void)
 
 static void initparticle(void)
 {
-  ps=new particleSystem;
+  ps=new rainSystem;
 
-  rainParticle::setRainingArea(-7.0f,-0.2f,-7.0f,7.0f,8.0f,7.0f);
+  ps->setRainingArea(-7.0f,-0.2f,-7.0f,7.0f,8.0f,7.0f);
+
+  ps->addRain(NUMPART);
+}
+
+static void initthreads(void)
+{
+  static const GLubyte tail[4]={179,242,255,0};
+  static const GLubyte head[4]={77,179,255,255};
+  unsigned long n=ps->size();
+  GLsizeiptr size=(GLsizeiptr)(sizeof(float)*6*n*NUMREGIONS);
+  GLubyte *colors;
+
+  if(!nthreads)
+    return;
+
+  if(!(GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage) ||
+     !(GLAD_GL_VERSION_3_2 || GLAD_GL_ARB_sync)) {
+    fprintf(stderr,"GL_ARB_buffer_storage and GL_ARB_sync are needed for "
+	    "threaded updates, using one thread.\n");
+    nthreads=0;
+    return;
+  }
+
+  colors=(GLubyte *)malloc(8*n);
+  for(unsigned long i=0;i<n;i++) {
+    memcpy(colors+8*i,tail,4);
+    memcpy(colors+8*i+4,head,4);
+  }
+  glGenBuffers(1,&colorbuf);
+  glBindBuffer(GL_ARRAY_BUFFER,colorbuf);
+  glBufferData(GL_ARRAY_BUFFER,8*n,colors,GL_STATIC_DRAW);
+  free(colors);
+
+  glGenBuffers(1,&linebuf);
+  glBindBuffer(GL_ARRAY_BUFFER,linebuf);
+  glBufferStorage(GL_ARRAY_BUFFER,size,NULL,GL_MAP_WRITE_BIT|
+		  GL_MAP_PERSISTENT_BIT|GL_MAP_COHERENT_BIT);
+  linemap=(float *)glMapBufferRange(GL_ARRAY_BUFFER,0,size,GL_MAP_WRITE_BIT|
+				    GL_MAP_PERSISTENT_BIT|
+				    GL_MAP_COHERENT_BIT);
+  glBindBuffer(GL_ARRAY_BUFFER,0);
+  if(!linemap) {
+    fprintf(stderr,"Error mapping the vertex buffer, using one thread.\n");
+    nthreads=0;
+    return;
+  }
+
+  for(int i=0;i<nthreads;i++)
+    pool.push_back(std::thread(worker,i));
+  atexit(stopthreads);
+}
+
+// Times the per-frame particle work for n drops, once with the
+// particleSystem of rainParticle objects and once with rainSystem.
+static void benchmark(unsigned long n)
+{
+  const float dt=1.0f/60.0f;
+  particleSystem *old;
+  rainSystem *soa;
+  float *lines;
+  double t0,t1;
+  int frames;
 
-  for(int i=0;i<NUMPART;i++) {
+  printf("%lu particles\n",n);
+
+  rainParticle::setRainingArea(-7.0f,-0.2f,-7.0f,7.0f,8.0f,7.0f);
+  old=new particleSystem;
+  for(unsigned long i=0;i<n;i++) {
     rainParticle *p=new rainParticle;
     p->randomHeight();
 
-    ps->addParticle((particle *)p);
+    old->addParticle((particle *)p);
   }
+
+  soa=new rainSystem;
+  soa->setRainingArea(-7.0f,-0.2f,-7.0f,7.0f,8.0f,7.0f);
+  t0=timer_get_seconds();
+  soa->addRain(n);
+  t1=timer_get_seconds();
+  printf("  spawn:           %8.2f ms\n",(t1-t0)*1000.0);
+
+  frames=0;
+  t0=timer_get_seconds();
+  do {
+    old->addTime(dt);
+    frames++;
+    t1=timer_get_seconds();
+  } while(t1-t0<1.0);
+  printf("  particleSystem:  %8.2f ms/frame  %8.1f Mparticles/s\n",
+	 (t1-t0)*1000.0/frames,n*frames/(t1-t0)/1e6);
+
+  frames=0;
+  t0=timer_get_seconds();
+  do {
+    soa->addTime(dt);
+    frames++;
+    t1=timer_get_seconds();
+  } while(t1-t0<1.0);
+  printf("  rainSystem:      %8.2f ms/frame  %8.1f Mparticles/s\n",
+	 (t1-t0)*1000.0/frames,n*frames/(t1-t0)/1e6);
+
+  lines=(float *)malloc(sizeof(float)*6*n);
+  frames=0;
+  t0=timer_get_seconds();
+  do {
+    soa->getLines(lines,0,n);
+    frames++;
+    t1=timer_get_seconds();
+  } while(t1-t0<1.0);
+  printf("  rainSystem lines:%8.2f ms/frame  %8.1f Mparticles/s\n",
+	 (t1-t0)*1000.0/frames,n*frames/(t1-t0)/1e6);
+
+  free(lines);
+  delete soa;
+  delete old;
+}
+
+static void usage(void)
+{
+  fprintf(stderr,"Usage: rain [--particles n] [--threads n]\n"
+	  "       rain --bench [n]\n"
+	  "  --particles n  number of drops, 1 to %d\n"
+	  "  --threads n    update the drops on n threads"
+	  " (0 is one per CPU)\n"
+	  "  --bench [n]    time the particle engines on n drops"
+	  " (1000000 by default)\n",MAXPART);
+}
+
+static int parsecount(const char *s,long max,long *n)
+{
+  char *end;
+
+  *n=strtol(s,&end,0);
+  return(end!=s && *end=='\0' && *n>0 && *n<=max);
 }
 
 int main(int ac,char **av)
 {
+  long n;
+
   fprintf(stderr,"Rain V1.0\nWritten by David Bucciarelli (humanware@plus.it)\n");
 
+  // the benchmark needs no window, so it runs before glutInit()
+  for(int i=1;i<ac;i++) {
+    if(!strcmp(av[i],"--bench")) {
+      n=1000000;
+
+      if(i+1<ac && av[i+1][0]!='-' && !parsecount(av[i+1],LONG_MAX,&n)) {
+        usage();
+        exit(-1);
+      }
+      benchmark((unsigned long)n);
+      return(0);
+    }
+  }
+
   /* Default settings */
 
   WIDTH=640;
@@ -343,6 +627,26 @@ int main(int ac,char **av)
   glutInitWindowSize(WIDTH,HEIGHT);
   glutInit(&ac,av);
 
+  for(int i=1;i<ac;i++) {
+    if(!strcmp(av[i],"--particles") && i+1<ac) {
+      if(!parsecount(av[++i],MAXPART,&n)) {
+        fprintf(stderr,"The number of particles must be between 1 and %d.\n",
+		MAXPART);
+        exit(-1);
+      }
+      NUMPART=(int)n;
+    } else if(!strcmp(av[i],"--threads") && i+1<ac) {
+      nthreads=atoi(av[++i]);
+      if(nthreads<=0)
+        nthreads=(int)std::thread::hardware_concurrency();
+      if(nthreads<=0)
+        nthreads=1;
+    } else {
+      usage();
+      exit(-1);
+    }
+  }
+
   glutInitDisplayMode(GLUT_RGB|GLUT_DEPTH|GLUT_DOUBLE);
 
   if(!(win=glutCreateWindow("Rain"))) {
@@ -350,6 +654,8 @@ int main(int ac,char **av)
     exit(-1);
   }
 
+  gladLoaderLoadGL();
+
   reshape(WIDTH,HEIGHT);
 
   inittextures();
@@ -365,6 +671,7 @@ int main(int ac,char **av)
   glFogf(GL_FOG_DENSITY,0.1);
 
   initparticle();
+  initthreads();
 
   glutKeyboardFunc(key);
   glutSpecialFunc(special);
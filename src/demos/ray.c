@@ -16,6 +16,88 @@
 #endif
 
 #include "glut_wrap.h"
+#include "parallel.h"
+#include "timer.h"
+
+/*
+ * The texture maps are ray traced PACKET texels at a time, with the
+ * pk_* operations on PACKET floats: AVX or SSE when the compiler
+ * targets them, plain C floats otherwise.  Comparisons give a vmask,
+ * which pk_sel() uses to pick between two values lane by lane.
+ */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define PACKET 8
+typedef __m256 vfloat;
+typedef __m256 vmask;
+#define pk_set(a)        _mm256_set1_ps(a)
+#define pk_load(p)       _mm256_loadu_ps(p)
+#define pk_store(p, a)   _mm256_storeu_ps(p, a)
+#define pk_add           _mm256_add_ps
+#define pk_sub           _mm256_sub_ps
+#define pk_mul           _mm256_mul_ps
+#define pk_div           _mm256_div_ps
+#define pk_sqrt          _mm256_sqrt_ps
+#define pk_min           _mm256_min_ps
+#define pk_max           _mm256_max_ps
+#define pk_trunc(a)      _mm256_cvtepi32_ps(_mm256_cvttps_epi32(a))
+#define pk_lt(a, b)      _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define pk_le(a, b)      _mm256_cmp_ps(a, b, _CMP_LE_OQ)
+#define pk_eq(a, b)      _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+#define pk_and           _mm256_and_ps
+#define pk_or            _mm256_or_ps
+#define pk_sel(m, a, b)  _mm256_blendv_ps(b, a, m)
+#define pk_any(m)        _mm256_movemask_ps(m)
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define PACKET 4
+typedef __m128 vfloat;
+typedef __m128 vmask;
+#define pk_set(a)        _mm_set1_ps(a)
+#define pk_load(p)       _mm_loadu_ps(p)
+#define pk_store(p, a)   _mm_storeu_ps(p, a)
+#define pk_add           _mm_add_ps
+#define pk_sub           _mm_sub_ps
+#define pk_mul           _mm_mul_ps
+#define pk_div           _mm_div_ps
+#define pk_sqrt          _mm_sqrt_ps
+#define pk_min           _mm_min_ps
+#define pk_max           _mm_max_ps
+#define pk_trunc(a)      _mm_cvtepi32_ps(_mm_cvttps_epi32(a))
+#define pk_lt            _mm_cmplt_ps
+#define pk_le            _mm_cmple_ps
+#define pk_eq            _mm_cmpeq_ps
+#define pk_and           _mm_and_ps
+#define pk_or            _mm_or_ps
+#define pk_sel(m, a, b)  _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b))
+#define pk_any(m)        _mm_movemask_ps(m)
+#else
+#define PACKET 1
+typedef float vfloat;
+typedef int vmask;
+#define pk_set(a)        ((float) (a))
+#define pk_load(p)       (*(p))
+#define pk_store(p, a)   (*(p) = (a))
+#define pk_add(a, b)     ((a) + (b))
+#define pk_sub(a, b)     ((a) - (b))
+#define pk_mul(a, b)     ((a) * (b))
+#define pk_div(a, b)     ((a) / (b))
+#define pk_sqrt(a)       ((float) sqrt(a))
+#define pk_min(a, b)     ((a) < (b) ? (a) : (b))
+#define pk_max(a, b)     ((a) > (b) ? (a) : (b))
+#define pk_trunc(a)      ((float) (int) (a))
+#define pk_lt(a, b)      ((a) < (b))
+#define pk_le(a, b)      ((a) <= (b))
+#define pk_eq(a, b)      ((a) == (b))
+#define pk_and(a, b)     ((a) & (b))
+#define pk_or(a, b)      ((a) | (b))
+#define pk_sel(m, a, b)  ((m) ? (a) : (b))
+#define pk_any(m)        (m)
+#endif
+
+#define pk_dot(a, b) \
+   pk_add(pk_add(pk_mul((a)[0], (b)[0]), pk_mul((a)[1], (b)[1])), \
+          pk_mul((a)[2], (b)[2]))
 
 static int WIDTH = 640;
 static int HEIGHT = 480;
@@ -26,41 +108,34 @@ static GLint Frames = 0;
 #define BASESIZE 7.5f
 #define SPHERE_RADIUS 0.75f
 
-#define TEX_CHECK_WIDTH 256
-#define TEX_CHECK_HEIGHT 256
+#define TEX_CHECK_WIDTH 512
+#define TEX_CHECK_HEIGHT 512
 #define TEX_CHECK_SLOT_SIZE (TEX_CHECK_HEIGHT/16)
 #define TEX_CHECK_NUMSLOT (TEX_CHECK_HEIGHT/TEX_CHECK_SLOT_SIZE)
 
-#define TEX_REFLECT_WIDTH 256
-#define TEX_REFLECT_HEIGHT 256
+#define TEX_REFLECT_WIDTH 512
+#define TEX_REFLECT_HEIGHT 512
 #define TEX_REFLECT_SLOT_SIZE (TEX_REFLECT_HEIGHT/16)
 #define TEX_REFLECT_NUMSLOT (TEX_REFLECT_HEIGHT/TEX_REFLECT_SLOT_SIZE)
 
-#define EPSILON 0.0001
+#if TEX_CHECK_WIDTH % PACKET || TEX_REFLECT_WIDTH % PACKET
+#error "the texture widths must be a multiple of PACKET"
+#endif
+
+/* every frame the slots of both maps are traced by a pool of threads */
+#define NUMJOBS (TEX_CHECK_NUMSLOT + TEX_REFLECT_NUMSLOT)
 
-#define clamp255(a)  ( (a)<(0.0f) ? (0.0f) : ((a)>(255.0f) ? (255.0f) : (a)) )
+#define EPSILON 0.0001
 
 #ifndef fabs
 #define fabs(x) ((x)<0.0f?-(x):(x))
 #endif
 
-#define vequ(a,b) { (a)[0]=(b)[0]; (a)[1]=(b)[1]; (a)[2]=(b)[2]; }
-#define vsub(a,b,c) { (a)[0]=(b)[0]-(c)[0]; (a)[1]=(b)[1]-(c)[1]; (a)[2]=(b)[2]-(c)[2]; }
-#define	dprod(a,b) ((a)[0]*(b)[0]+(a)[1]*(b)[1]+(a)[2]*(b)[2])
-#define vnormalize(a,b) { \
-  register float m_norm; \
-  m_norm=sqrt((double)dprod((a),(a))); \
-  (a)[0] /=m_norm; \
-  (a)[1] /=m_norm; \
-  (a)[2] /=m_norm; }
-
 static GLubyte checkmap[TEX_CHECK_HEIGHT][TEX_CHECK_WIDTH][3];
 static GLuint checkid;
-static int checkmap_currentslot = 0;
 
 static GLubyte reflectmap[TEX_REFLECT_HEIGHT][TEX_REFLECT_WIDTH][3];
 static GLuint reflectid;
-static int reflectmap_currentslot = 0;
 
 static GLuint lightdlist;
 static GLuint objdlist;
@@ -68,7 +143,12 @@ static GLuint objdlist;
 static float lightpos[3] = { 2.1, 2.1, 2.8 };
 static float objpos[3] = { 0.0, 0.0, 1.0 };
 
-static float sphere_pos[TEX_CHECK_HEIGHT][TEX_REFLECT_WIDTH][3];
+/* x, y and z planes, to be loaded a packet at a time */
+static float sphere_pos[3][TEX_REFLECT_HEIGHT][TEX_REFLECT_WIDTH];
+
+static int nthreads = 0;
+static struct util_pool *pool;
+static double mapstime = 0.0;
 
 static int win = 0;
 
@@ -294,216 +374,204 @@ printhelp(void)
 	       "2 - Toggle the sphere texture map window");
 }
 
-static GLboolean
-seelight(float p[3], float dir[3])
+static void
+pk_normalize(vfloat v[3])
 {
-   float c[3], b, a, d, t, dist[3];
-
-   vsub(c, p, objpos);
-   b = -dprod(c, dir);
-   a = dprod(c, c) - SPHERE_RADIUS * SPHERE_RADIUS;
-
-   if ((d = b * b - a) < 0.0 || (b < 0.0 && a > 0.0))
-      return GL_FALSE;
-
-   d = sqrt(d);
-
-   t = b - d;
+   vfloat m = pk_sqrt(pk_dot(v, v));
 
-   if (t < EPSILON) {
-      t = b + d;
-      if (t < EPSILON)
-	 return GL_FALSE;
-   }
-
-   vsub(dist, lightpos, p);
-   if (dprod(dist, dist) < t * t)
-      return GL_FALSE;
-
-   return GL_TRUE;
+   v[0] = pk_div(v[0], m);
+   v[1] = pk_div(v[1], m);
+   v[2] = pk_div(v[2], m);
 }
 
-static int
-colorcheckmap(float ppos[3], float c[3])
+/*
+ * Returns the mask of the points p that see the light along dir, i.e.
+ * whose ray towards it doesn't hit the sphere before the light.
+ */
+static vmask
+seelight(const vfloat p[3], const vfloat dir[3])
 {
-   static float norm[3] = { 0.0f, 0.0f, 1.0f };
-   float ldir[3], vdir[3], h[3], dfact, kfact, r, g, b;
-   int x, y;
-
-   x = (int) ((ppos[0] + BASESIZE / 2) * (10.0f / BASESIZE));
-   if ((x < 0) || (x > 10))
-      return GL_FALSE;
-
-   y = (int) ((ppos[1] + BASESIZE / 2) * (10.0f / BASESIZE));
-   if ((y < 0) || (y > 10))
-      return GL_FALSE;
-
-   r = 255.0f;
-   if (y & 1) {
-      if (x & 1)
-	 g = 255.0f;
-      else
-	 g = 0.0f;
-   }
-   else {
-      if (x & 1)
-	 g = 0.0f;
-      else
-	 g = 255.0f;
-   }
-   b = 0.0f;
-
-   vsub(ldir, lightpos, ppos);
-   vnormalize(ldir, ldir);
+   const vfloat zero = pk_set(0.0f), eps = pk_set(EPSILON);
+   vfloat c[3], dist[3], b, a, d, t;
+   vmask miss;
+
+   c[0] = pk_sub(p[0], pk_set(objpos[0]));
+   c[1] = pk_sub(p[1], pk_set(objpos[1]));
+   c[2] = pk_sub(p[2], pk_set(objpos[2]));
+   b = pk_sub(zero, pk_dot(c, dir));
+   a = pk_sub(pk_dot(c, c), pk_set(SPHERE_RADIUS * SPHERE_RADIUS));
+
+   d = pk_sub(pk_mul(b, b), a);
+   miss = pk_or(pk_lt(d, zero), pk_and(pk_lt(b, zero), pk_lt(zero, a)));
+
+   d = pk_sqrt(pk_max(d, zero));
+   t = pk_sub(b, d);
+   t = pk_sel(pk_lt(t, eps), pk_add(b, d), t);
+   miss = pk_or(miss, pk_lt(t, eps));
+
+   dist[0] = pk_sub(pk_set(lightpos[0]), p[0]);
+   dist[1] = pk_sub(pk_set(lightpos[1]), p[1]);
+   dist[2] = pk_sub(pk_set(lightpos[2]), p[2]);
+   return pk_or(miss, pk_lt(pk_dot(dist, dist), pk_mul(t, t)));
+}
 
-   if (seelight(ppos, ldir)) {
-      c[0] = r * 0.05f;
-      c[1] = g * 0.05f;
-      c[2] = b * 0.05f;
+/*
+ * Shades the points (x, y, 0) of the checkered plane into c.  Returns
+ * the mask of the points that are on the board; c is undefined for
+ * the others.
+ */
+static vmask
+colorcheckmap(vfloat x, vfloat y, vfloat c[3])
+{
+   const vfloat zero = pk_set(0.0f), full = pk_set(255.0f);
+   const vfloat half = pk_set(BASESIZE / 2), scale = pk_set(10.0f / BASESIZE);
+   vfloat ppos[3], ldir[3], vdir[3], cx, cy, sum, g, dfact, kfact;
+   vmask onboard, lit;
+
+   cx = pk_trunc(pk_mul(pk_add(x, half), scale));
+   cy = pk_trunc(pk_mul(pk_add(y, half), scale));
+   onboard = pk_and(pk_and(pk_le(zero, cx), pk_le(cx, pk_set(10.0f))),
+		    pk_and(pk_le(zero, cy), pk_le(cy, pk_set(10.0f))));
+   if (!pk_any(onboard))
+      return onboard;
+
+   /* yellow where cx + cy is even, red where it is odd */
+   sum = pk_add(cx, cy);
+   g = pk_sel(pk_eq(pk_mul(pk_trunc(pk_mul(sum, pk_set(0.5f))),
+			   pk_set(2.0f)), sum), full, zero);
+
+   ppos[0] = x;
+   ppos[1] = y;
+   ppos[2] = zero;
+
+   ldir[0] = pk_sub(pk_set(lightpos[0]), x);
+   ldir[1] = pk_sub(pk_set(lightpos[1]), y);
+   ldir[2] = pk_set(lightpos[2]);
+   pk_normalize(ldir);
+
+   lit = seelight(ppos, ldir);
+
+   /* the normal is (0, 0, 1) */
+   dfact = pk_max(ldir[2], zero);
+
+   vdir[0] = pk_sub(pk_set(obs[0]), x);
+   vdir[1] = pk_sub(pk_set(obs[1]), y);
+   vdir[2] = pk_set(obs[2]);
+   pk_normalize(vdir);
+   kfact = pk_mul(pk_set(0.5f), pk_add(vdir[2], ldir[2]));
+   kfact = pk_mul(kfact, kfact);
+   kfact = pk_mul(pk_mul(pk_mul(kfact, kfact), kfact), pk_set(7.0f * 255.0f));
+
+   c[0] = pk_min(pk_add(pk_mul(full, dfact), kfact), full);
+   c[1] = pk_min(pk_add(pk_mul(g, dfact), kfact), full);
+   c[2] = pk_min(kfact, full);
+
+   c[0] = pk_sel(lit, c[0], pk_set(255.0f * 0.05f));
+   c[1] = pk_sel(lit, c[1], pk_mul(g, pk_set(0.05f)));
+   c[2] = pk_sel(lit, c[2], zero);
+
+   return onboard;
+}
 
-      return GL_TRUE;
+static void
+storetexels(GLubyte *texel, const vfloat c[3])
+{
+   float r[PACKET], g[PACKET], b[PACKET];
+   int i;
+
+   pk_store(r, c[0]);
+   pk_store(g, c[1]);
+   pk_store(b, c[2]);
+   for (i = 0; i < PACKET; i++) {
+      texel[3 * i + 0] = (GLubyte) r[i];
+      texel[3 * i + 1] = (GLubyte) g[i];
+      texel[3 * i + 2] = (GLubyte) b[i];
    }
-
-   dfact = dprod(ldir, norm);
-   if (dfact < 0.0f)
-      dfact = 0.0f;
-
-   vsub(vdir, obs, ppos);
-   vnormalize(vdir, vdir);
-   h[0] = 0.5f * (vdir[0] + ldir[0]);
-   h[1] = 0.5f * (vdir[1] + ldir[1]);
-   h[2] = 0.5f * (vdir[2] + ldir[2]);
-   kfact = dprod(h, norm);
-   kfact = pow(kfact, 6.0) * 7.0 * 255.0;
-
-   r = r * dfact + kfact;
-   g = g * dfact + kfact;
-   b = b * dfact + kfact;
-
-   c[0] = clamp255(r);
-   c[1] = clamp255(g);
-   c[2] = clamp255(b);
-
-   return GL_TRUE;
 }
 
 static void
 updatecheckmap(int slot)
 {
-   float c[3], ppos[3];
+   static const float lanes[8] = { 0, 1, 2, 3, 4, 5, 6, 7 };
+   const vfloat lane = pk_load(lanes);
+   vfloat c[3], ppos[2];
    int x, y;
 
-   glBindTexture(GL_TEXTURE_2D, checkid);
-
-   ppos[2] = 0.0f;
    for (y = slot * TEX_CHECK_SLOT_SIZE; y < (slot + 1) * TEX_CHECK_SLOT_SIZE;
 	y++) {
-      ppos[1] = (y / (float) TEX_CHECK_HEIGHT) * BASESIZE - BASESIZE / 2;
-
-      for (x = 0; x < TEX_CHECK_WIDTH; x++) {
-	 ppos[0] = (x / (float) TEX_CHECK_WIDTH) * BASESIZE - BASESIZE / 2;
-
-	 colorcheckmap(ppos, c);
-	 checkmap[y][x][0] = (GLubyte) c[0];
-	 checkmap[y][x][1] = (GLubyte) c[1];
-	 checkmap[y][x][2] = (GLubyte) c[2];
+      ppos[1] = pk_set((y / (float) TEX_CHECK_HEIGHT) * BASESIZE - BASESIZE / 2);
+
+      for (x = 0; x < TEX_CHECK_WIDTH; x += PACKET) {
+	 ppos[0] = pk_add(pk_set((float) x), lane);
+	 ppos[0] = pk_sub(pk_mul(pk_mul(ppos[0],
+					pk_set(1.0f / TEX_CHECK_WIDTH)),
+				 pk_set(BASESIZE)),
+			  pk_set(BASESIZE / 2));
+
+	 /* all of the texture is on the board */
+	 colorcheckmap(ppos[0], ppos[1], c);
+	 storetexels(checkmap[y][x], c);
       }
    }
-
-   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, slot * TEX_CHECK_SLOT_SIZE,
-		   TEX_CHECK_WIDTH, TEX_CHECK_SLOT_SIZE, GL_RGB,
-		   GL_UNSIGNED_BYTE,
-		   &checkmap[slot * TEX_CHECK_SLOT_SIZE][0][0]);
-
 }
 
 static void
 updatereflectmap(int slot)
 {
-   float rf, r, g, b, t, dfact, kfact, rdir[3];
-   float rcol[3], ppos[3], norm[3], ldir[3], h[3], vdir[3], planepos[3];
-   int x, y;
-
-   glBindTexture(GL_TEXTURE_2D, reflectid);
+   const vfloat zero = pk_set(0.0f), eps = pk_set(EPSILON);
+   vfloat ppos[3], norm[3], ldir[3], vdir[3], rdir[3], h[3], rcol[3], c[3];
+   vfloat rf, t, dfact, kfact, s;
+   vmask hit, lit;
+   int x, y, i;
 
    for (y = slot * TEX_REFLECT_SLOT_SIZE;
 	y < (slot + 1) * TEX_REFLECT_SLOT_SIZE; y++)
-      for (x = 0; x < TEX_REFLECT_WIDTH; x++) {
-	 ppos[0] = sphere_pos[y][x][0] + objpos[0];
-	 ppos[1] = sphere_pos[y][x][1] + objpos[1];
-	 ppos[2] = sphere_pos[y][x][2] + objpos[2];
-
-	 vsub(norm, ppos, objpos);
-	 vnormalize(norm, norm);
-
-	 vsub(ldir, lightpos, ppos);
-	 vnormalize(ldir, ldir);
-	 vsub(vdir, obs, ppos);
-	 vnormalize(vdir, vdir);
-
-	 rf = 2.0f * dprod(norm, vdir);
-	 if (rf > EPSILON) {
-	    rdir[0] = rf * norm[0] - vdir[0];
-	    rdir[1] = rf * norm[1] - vdir[1];
-	    rdir[2] = rf * norm[2] - vdir[2];
-
-	    t = -objpos[2] / rdir[2];
-
-	    if (t > EPSILON) {
-	       planepos[0] = objpos[0] + t * rdir[0];
-	       planepos[1] = objpos[1] + t * rdir[1];
-	       planepos[2] = 0.0f;
-
-	       if (!colorcheckmap(planepos, rcol))
-		  rcol[0] = rcol[1] = rcol[2] = 0.0f;
-	    }
-	    else
-	       rcol[0] = rcol[1] = rcol[2] = 0.0f;
+      for (x = 0; x < TEX_REFLECT_WIDTH; x += PACKET) {
+	 for (i = 0; i < 3; i++) {
+	    ppos[i] = pk_add(pk_load(&sphere_pos[i][y][x]), pk_set(objpos[i]));
+	    norm[i] = pk_sub(ppos[i], pk_set(objpos[i]));
+	    ldir[i] = pk_sub(pk_set(lightpos[i]), ppos[i]);
+	    vdir[i] = pk_sub(pk_set(obs[i]), ppos[i]);
 	 }
-	 else
-	    rcol[0] = rcol[1] = rcol[2] = 0.0f;
-
-	 dfact = 0.1f * dprod(ldir, norm);
-
-	 if (dfact < 0.0f) {
-	    dfact = 0.0f;
-	    kfact = 0.0f;
+	 pk_normalize(norm);
+	 pk_normalize(ldir);
+	 pk_normalize(vdir);
+
+	 /* the color of the plane in the reflected direction */
+	 rf = pk_mul(pk_set(2.0f), pk_dot(norm, vdir));
+	 hit = pk_lt(eps, rf);
+	 for (i = 0; i < 3; i++)
+	    rdir[i] = pk_sub(pk_mul(rf, norm[i]), vdir[i]);
+
+	 t = pk_div(pk_set(-objpos[2]), rdir[2]);
+	 hit = pk_and(hit, pk_lt(eps, t));
+
+	 rcol[0] = rcol[1] = rcol[2] = zero;
+	 if (pk_any(hit))
+	    hit = pk_and(hit, colorcheckmap(pk_add(pk_set(objpos[0]),
+						   pk_mul(t, rdir[0])),
+					    pk_add(pk_set(objpos[1]),
+						   pk_mul(t, rdir[1])),
+					    rcol));
+
+	 dfact = pk_mul(pk_set(0.1f), pk_dot(ldir, norm));
+	 lit = pk_le(zero, dfact);
+
+	 for (i = 0; i < 3; i++)
+	    h[i] = pk_mul(pk_set(0.5f), pk_add(vdir[i], ldir[i]));
+	 kfact = pk_dot(h, norm);
+	 kfact = pk_mul(kfact, kfact);
+	 kfact = pk_mul(kfact, kfact);
+	 kfact = pk_sel(pk_lt(kfact, pk_set(1.0e-10f)), zero, kfact);
+
+	 s = pk_sel(lit, pk_mul(pk_add(dfact, kfact), pk_set(255.0f)), zero);
+	 for (i = 0; i < 3; i++) {
+	    c[i] = pk_add(s, pk_sel(hit, rcol[i], zero));
+	    c[i] = pk_max(pk_min(c[i], pk_set(255.0f)), zero);
 	 }
-	 else {
-	    h[0] = 0.5f * (vdir[0] + ldir[0]);
-	    h[1] = 0.5f * (vdir[1] + ldir[1]);
-	    h[2] = 0.5f * (vdir[2] + ldir[2]);
-	    kfact = dprod(h, norm);
-            kfact = pow(kfact, 4.0);
-            if (kfact < 1.0e-10)
-               kfact = 0.0;
-         }
-
-	 r = dfact + kfact;
-	 g = dfact + kfact;
-	 b = dfact + kfact;
-
-	 r *= 255.0f;
-	 g *= 255.0f;
-	 b *= 255.0f;
-
-	 r += rcol[0];
-	 g += rcol[1];
-	 b += rcol[2];
-
-	 r = clamp255(r);
-	 g = clamp255(g);
-	 b = clamp255(b);
-
-	 reflectmap[y][x][0] = (GLubyte) r;
-	 reflectmap[y][x][1] = (GLubyte) g;
-	 reflectmap[y][x][2] = (GLubyte) b;
-      }
 
-   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, slot * TEX_REFLECT_SLOT_SIZE,
-		   TEX_REFLECT_WIDTH, TEX_REFLECT_SLOT_SIZE, GL_RGB,
-		   GL_UNSIGNED_BYTE,
-		   &reflectmap[slot * TEX_REFLECT_SLOT_SIZE][0][0]);
+	 storetexels(reflectmap[y][x], c);
+      }
 }
 
 static void
@@ -586,15 +654,46 @@ dojoy(void)
 #endif
 }
 
+static void
+runjob(void *arg, unsigned job)
+{
+   (void) arg;
+
+   if (job < TEX_CHECK_NUMSLOT)
+      updatecheckmap(job);
+   else
+      updatereflectmap(job - TEX_CHECK_NUMSLOT);
+}
+
+static void
+initthreads(void)
+{
+   pool = util_pool_create(nthreads > 0 ? nthreads : 0);
+   nthreads = util_pool_threads(pool);
+}
+
+/*
+ * Traces both maps in full and uploads them.  The GL thread takes
+ * slots too, and only returns when all are done, so the workers never
+ * see the positions change under them.
+ */
 static void
 updatemaps(void)
 {
-   updatecheckmap(checkmap_currentslot);
-   checkmap_currentslot = (checkmap_currentslot + 1) % TEX_CHECK_NUMSLOT;
+   uint64_t t0 = timer_get_ns();
+
+   util_pool_run(pool, NUMJOBS, runjob, NULL);
 
-   updatereflectmap(reflectmap_currentslot);
-   reflectmap_currentslot =
-      (reflectmap_currentslot + 1) % TEX_REFLECT_NUMSLOT;
+   glBindTexture(GL_TEXTURE_2D, checkid);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+		   TEX_CHECK_WIDTH, TEX_CHECK_HEIGHT, GL_RGB,
+		   GL_UNSIGNED_BYTE, checkmap);
+   glBindTexture(GL_TEXTURE_2D, reflectid);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0,
+		   TEX_REFLECT_WIDTH, TEX_REFLECT_HEIGHT, GL_RGB,
+		   GL_UNSIGNED_BYTE, reflectmap);
+
+   mapstime += (timer_get_ns() - t0) * 1e-9;
 }
 
 static void
@@ -723,10 +822,12 @@ draw(void)
       if (t - T0 >= 2000) {
          GLfloat seconds = (t - T0) / 1000.0;
          GLfloat fps = Frames / seconds;
-         sprintf(frbuf, "Frame rate: %f", fps);
+         sprintf(frbuf, "Frame rate: %f (maps %.2f ms, %d threads)", fps,
+                 1000.0 * mapstime / Frames, nthreads);
          printf("%s\n", frbuf);
          T0 = t;
          Frames = 0;
+         mapstime = 0.0;
       }
    }
 }
@@ -734,8 +835,6 @@ draw(void)
 static void
 inittextures(void)
 {
-   int y;
-
    glGenTextures(1, &checkid);
    glBindTexture(GL_TEXTURE_2D, checkid);
 
@@ -749,11 +848,6 @@ inittextures(void)
    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-   for (y = 0; y < TEX_CHECK_NUMSLOT; y++)
-      updatecheckmap(y);
-
-
-
    glGenTextures(1, &reflectid);
    glBindTexture(GL_TEXTURE_2D, reflectid);
 
@@ -767,10 +861,7 @@ inittextures(void)
    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-   for (y = 0; y < TEX_REFLECT_NUMSLOT; y++)
-      updatereflectmap(y);
-
-
+   updatemaps();
 }
 
 static void
@@ -791,9 +882,9 @@ initspherepos(void)
 	 sb = sin(beta);
 	 cb = cos(beta);
 
-	 sphere_pos[y][x][0] = SPHERE_RADIUS * sa * sb;
-	 sphere_pos[y][x][1] = SPHERE_RADIUS * ca * sb;
-	 sphere_pos[y][x][2] = SPHERE_RADIUS * cb;
+	 sphere_pos[0][y][x] = SPHERE_RADIUS * sa * sb;
+	 sphere_pos[1][y][x] = SPHERE_RADIUS * ca * sb;
+	 sphere_pos[2][y][x] = SPHERE_RADIUS * cb;
       }
    }
 }
@@ -827,6 +918,8 @@ initdlists(void)
 int
 main(int ac, char **av)
 {
+   int i;
+
    fprintf(stderr,
 	   "Ray V1.0\nWritten by David Bucciarelli (tech.hmw@plus.it)\n");
 
@@ -845,6 +938,17 @@ main(int ac, char **av)
    glutInitWindowSize(WIDTH, HEIGHT);
    glutInit(&ac, av);
 
+   for (i = 1; i < ac; i++) {
+      if (!strcmp(av[i], "-threads") && i + 1 < ac)
+	 nthreads = atoi(av[++i]);
+      else {
+	 fprintf(stderr, "Usage: ray [-threads n]\n"
+		 "  -threads n  trace the maps on n threads"
+		 " (0, the default, is one per CPU)\n");
+	 return -1;
+      }
+   }
+
    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
 
    if (!(win = glutCreateWindow("Ray"))) {
@@ -870,6 +974,7 @@ main(int ac, char **av)
    calcposobs();
 
    initspherepos();
+   initthreads();
 
    inittextures();
    initdlists();
@@ -204,12 +204,17 @@ eglutInit(int argc, char **argv)
       else if (strcmp(argv[i], "-info") == 0) {
          _eglut->verbose = 1;
       }
+      else if (strcmp(argv[i], "-headless") == 0)
+         _eglut->headless = 1;
+      else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc)
+         _eglut->frames = atoi(argv[++i]);
    }
 
    _eglut->wsi = _eglutGetWindowSystemInterface();
 
    _eglutNativeInitDisplay();
-   _eglut->dpy = eglGetDisplay(_eglut->native_dpy);
+   if (_eglut->dpy == EGL_NO_DISPLAY)
+      _eglut->dpy = eglGetDisplay(_eglut->native_dpy);
 
    if (!eglInitialize(_eglut->dpy, &_eglut->major, &_eglut->minor))
       _eglutFatal("failed to initialize EGL display");
@@ -60,6 +60,8 @@ struct eglut_state {
    const char *display_name;
    int verbose;
    int init_time;
+   int headless;
+   int frames;     /* frames to draw when headless */
 
    EGLUTidleCB idle_cb;
 
@@ -69,7 +71,7 @@ struct eglut_state {
    EGLNativeDisplayType native_dpy;
    EGLint surface_type;
 
-   EGLDisplay dpy;
+   EGLDisplay dpy; /* set by native display init, or from native_dpy */
    EGLint major, minor;
 
    struct eglut_window *current;
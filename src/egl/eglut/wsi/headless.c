@@ -0,0 +1,181 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Headless backend: renders to a pbuffer on a display that needs no
+ * window system, from EGL_MESA_platform_surfaceless or else
+ * EGL_EXT_platform_device.  The event loop draws a fixed number of
+ * frames as fast as it can, then reports the frame times and returns,
+ * which turns the eglut demos into benchmarks that can run in a CI
+ * container, e.g. "es2gears -headless -frames 1000" on llvmpipe.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "EGL/egl.h"
+#include "EGL/eglext.h"
+
+#include "eglutint.h"
+#include "wsi.h"
+
+#include "stats.h"
+#include "timer.h"
+
+static int
+has_extension(const char *extensions, const char *name)
+{
+   size_t len = strlen(name);
+   const char *p = extensions;
+
+   while (p && (p = strstr(p, name))) {
+      if ((p == extensions || p[-1] == ' ') &&
+          (p[len] == ' ' || p[len] == '\0'))
+         return 1;
+      p += len;
+   }
+   return 0;
+}
+
+static EGLDisplay
+get_device_display(PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display)
+{
+   PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+      eglGetProcAddress("eglQueryDevicesEXT");
+   EGLDeviceEXT devices[16];
+   EGLint num_devices, i;
+
+   if (!query_devices ||
+       !query_devices(16, devices, &num_devices))
+      return EGL_NO_DISPLAY;
+
+   /* the first device that gives a display that initializes */
+   for (i = 0; i < num_devices; i++) {
+      EGLDisplay dpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT,
+                                            devices[i], NULL);
+      if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, NULL, NULL))
+         return dpy;
+   }
+   return EGL_NO_DISPLAY;
+}
+
+static void
+init_display(void)
+{
+   const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+
+   if (!extensions || !has_extension(extensions, "EGL_EXT_platform_base"))
+      _eglutFatal("headless rendering needs EGL_EXT_platform_base");
+
+   get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+   if (!get_platform_display)
+      _eglutFatal("failed to get eglGetPlatformDisplayEXT");
+
+   /* initialized here, so a surfaceless display that can't be still
+    * leaves the device ones to try (eglutInit() initializing it again
+    * is harmless)
+    */
+   if (has_extension(extensions, "EGL_MESA_platform_surfaceless")) {
+      EGLDisplay dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                            EGL_DEFAULT_DISPLAY, NULL);
+      if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, NULL, NULL))
+         _eglut->dpy = dpy;
+   }
+   if (_eglut->dpy == EGL_NO_DISPLAY &&
+       has_extension(extensions, "EGL_EXT_platform_device"))
+      _eglut->dpy = get_device_display(get_platform_display);
+   if (_eglut->dpy == EGL_NO_DISPLAY)
+      _eglutFatal("failed to get a surfaceless or device display");
+
+   _eglut->surface_type = EGL_PBUFFER_BIT;
+}
+
+static void
+fini_display(void)
+{
+}
+
+static void
+init_window(struct eglut_window *win, const char *title,
+            int x, int y, int w, int h)
+{
+   EGLint attribs[] = {
+      EGL_WIDTH, w,
+      EGL_HEIGHT, h,
+      EGL_NONE
+   };
+
+   win->native.u.surface = eglCreatePbufferSurface(_eglut->dpy,
+         win->config, attribs);
+   if (win->native.u.surface == EGL_NO_SURFACE)
+      _eglutFatal("failed to create a pbuffer surface");
+   win->native.width = w;
+   win->native.height = h;
+}
+
+static void
+fini_window(struct eglut_window *win)
+{
+   eglDestroySurface(_eglut->dpy, win->native.u.surface);
+}
+
+static void
+event_loop(void)
+{
+   struct eglut_window *win = _eglut->current;
+   int frames = _eglut->frames > 0 ? _eglut->frames : 500;
+   double *times = malloc(frames * sizeof(double));
+   uint64_t start, last;
+   double elapsed;
+   struct stats s;
+   int i;
+
+   if (!times)
+      _eglutFatal("failed to allocate frame times");
+
+   start = last = timer_get_ns();
+   for (i = 0; i < frames; i++) {
+      uint64_t now;
+
+      /* the idle callback animates; every frame is drawn regardless */
+      if (_eglut->idle_cb)
+         _eglut->idle_cb();
+      _eglut->redisplay = 0;
+
+      if (win->display_cb)
+         win->display_cb();
+      eglSwapBuffers(_eglut->dpy, win->surface);
+      /* nothing presents a pbuffer, so wait for the frame to be drawn */
+      eglWaitClient();
+
+      now = timer_get_ns();
+      times[i] = (now - last) * 1e-6;
+      last = now;
+   }
+   elapsed = (last - start) * 1e-9;
+
+   stats_compute(times, frames, &s);
+   printf("%d frames of %dx%d in %.3f seconds = %.3f FPS\n",
+          frames, win->native.width, win->native.height,
+          elapsed, frames / elapsed);
+   printf("frame time: median %.3f ms, min %.3f, max %.3f, 95%% %.3f\n",
+          s.median, s.min, s.max, stats_percentile(times, frames, 95.0));
+   free(times);
+
+   /* the window and display stay, as with the other backends: demos
+    * clean up their GL objects after eglutMainLoop() returns */
+}
+
+struct eglut_wsi_interface
+headless_wsi_interface(void)
+{
+   return (struct eglut_wsi_interface) {
+      .init_display = init_display,
+      .fini_display = fini_display,
+      .init_window = init_window,
+      .fini_window = fini_window,
+      .event_loop = event_loop,
+   };
+}
@@ -28,6 +28,9 @@
 struct eglut_wsi_interface
 _eglutGetWindowSystemInterface(void)
 {
+   if (_eglut->headless)
+      return headless_wsi_interface();
+
 #if defined(WAYLAND_SUPPORT) && defined(X11_SUPPORT)
    const char *wayland_dpy = getenv("WAYLAND_DISPLAY");
    return wayland_dpy && *wayland_dpy ? wayland_wsi_interface() :
@@ -36,6 +39,8 @@ _eglutGetWindowSystemInterface(void)
    return wayland_wsi_interface();
 #elif defined(X11_SUPPORT)
    return x11_wsi_interface();
+#else
+   return headless_wsi_interface();
 #endif
 }
 
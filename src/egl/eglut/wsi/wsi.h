@@ -47,6 +47,9 @@ struct eglut_wsi_interface
 x11_wsi_interface(void);
 #endif
 
+struct eglut_wsi_interface
+headless_wsi_interface(void);
+
 struct eglut_wsi_interface
 _eglutGetWindowSystemInterface(void);
 
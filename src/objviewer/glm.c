@@ -11,7 +11,17 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <assert.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include <sys/stat.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "glm.h"
 #include "readtex.h"
 
@@ -29,16 +39,6 @@ typedef unsigned char boolean;
 enum { X, Y, Z, W };			/* elements of a vertex */
 
 
-/* typedefs */
-
-/* _GLMnode: general purpose node
- */
-typedef struct _GLMnode {
-  uint           index;
-  boolean        averaged;
-  struct _GLMnode* next;
-} GLMnode;
-
 /* strdup is actually not a standard ANSI C or POSIX routine
    so implement a private one.  OpenVMS does not have a strdup; Linux's
    standard libc doesn't declare strdup by default (unless BSD or SVID
@@ -131,61 +131,146 @@ _glmNormalize(float* n)
  * equal (within a certain threshold) or FALSE if not. An epsilon
  * that works fairly well is 0.000001.
  *
- * u - array of 3 floats (float u[3])
- * v - array of 3 floats (float v[3])
+ * u    - array of size floats
+ * v    - array of size floats
+ * size - number of components (2 or 3)
  */
 static boolean
-_glmEqual(float* u, float* v, float epsilon)
+_glmEqual(float* u, float* v, uint size, float epsilon)
 {
-  if (_glmAbs(u[0] - v[0]) < epsilon &&
-      _glmAbs(u[1] - v[1]) < epsilon &&
-      _glmAbs(u[2] - v[2]) < epsilon)
-  {
-    return TRUE;
+  uint i;
+
+  for (i = 0; i < size; i++) {
+    if (!(_glmAbs(u[i] - v[i]) < epsilon))
+      return FALSE;
   }
-  return FALSE;
+  return TRUE;
+}
+
+/* _glmWeldCell: returns the coordinate of the grid cell (of the given
+ * size) that a vector component falls in.
+ */
+static long long
+_glmWeldCell(float x, double cellsize)
+{
+  double cell = floor(x / cellsize);
+
+  /* keep far-away (and not-a-number) components representable */
+  if (!(cell > -4e18))
+    cell = -4e18;
+  if (cell > 4e18)
+    cell = 4e18;
+  return (long long)cell;
+}
+
+/* _glmWeldHash: returns the hash table bucket for a grid cell */
+static uint
+_glmWeldHash(long long* cell, uint size, uint mask)
+{
+  static const unsigned long long primes[3] = {
+    73856093ull, 19349663ull, 83492791ull
+  };
+  unsigned long long hash = 0;
+  uint i;
+
+  for (i = 0; i < size; i++)
+    hash ^= (unsigned long long)cell[i] * primes[i];
+  hash ^= hash >> 29;
+  return (uint)hash & mask;
 }
 
 /* _glmWeldVectors: eliminate (weld) vectors that are within an
- * epsilon of each other.
+ * epsilon of each other.  Each vector is replaced by the first kept
+ * vector within epsilon of it, if there is one.
  *
- * vectors    - array of float[3]'s to be welded
- * numvectors - number of float[3]'s in vectors
+ * The kept vectors are bucketed in a hash of grid cells 2 * epsilon
+ * wide, so anything within epsilon of a vector is in one of at most
+ * two cells along each axis, and welding takes linear rather than
+ * quadratic time.
+ *
+ * vectors    - array of float[size]'s to be welded
+ * numvectors - number of float[size]'s in vectors
+ * size       - number of components per vector (2 or 3)
  * epsilon    - maximum difference between vectors
+ * remap      - array of numvectors+1 uints, filled in with the index
+ *              of each vector in the returned array
  *
  */
 static float*
-_glmWeldVectors(float* vectors, uint* numvectors, float epsilon)
+_glmWeldVectors(float* vectors, uint* numvectors, uint size, float epsilon,
+                uint* remap)
 {
-  float* copies;
-  uint   copied;
-  uint   i, j;
-
-  copies = (float*)malloc(sizeof(float) * 3 * (*numvectors + 1));
-  memcpy(copies, vectors, (sizeof(float) * 3 * (*numvectors + 1)));
+  float*    copies;
+  float*    v;
+  uint*     buckets;		/* last copy in each bucket, 0 if none */
+  uint*     next;		/* previous copy in the same bucket */
+  uint      copied, mask, probe, match;
+  uint      i, j, k;
+  double    cellsize = 2.0 * epsilon;
+  long long lo[3], hi[3], cell[3];
+
+  copies = (float*)malloc(sizeof(float) * size * (*numvectors + 1));
+  next = (uint*)malloc(sizeof(uint) * (*numvectors + 1));
+  for (mask = 1; mask < 2 * *numvectors; mask <<= 1)
+    ;
+  mask--;
+  buckets = (uint*)calloc(mask + 1, sizeof(uint));
+  if (!copies || !next || !buckets) {
+    fprintf(stderr, "glmWeld() failed: out of memory.\n");
+    exit(1);
+  }
+  memcpy(copies, vectors, sizeof(float) * size);
 
-  copied = 1;
+  copied = 0;
+  remap[0] = 0;
   for (i = 1; i <= *numvectors; i++) {
-    for (j = 1; j <= copied; j++) {
-      if (_glmEqual(&vectors[3 * i], &copies[3 * j], epsilon)) {
-	goto duplicate;
+    v = &vectors[size * i];
+
+    /* look for the first copy within epsilon in the cells that the
+       epsilon box around this vector touches */
+    match = 0;
+    if (epsilon > 0) {
+      for (k = 0; k < size; k++) {
+        lo[k] = _glmWeldCell(v[k] - epsilon, cellsize);
+        hi[k] = _glmWeldCell(v[k] + epsilon, cellsize);
+        if (hi[k] > lo[k] + 1)
+          hi[k] = lo[k] + 1;
+      }
+      for (probe = 0; probe < (1u << size); probe++) {
+        for (k = 0; k < size; k++) {
+          cell[k] = lo[k] + ((probe >> k) & 1);
+          if (cell[k] > hi[k])
+            break;
+        }
+        if (k < size)
+          continue;
+        for (j = buckets[_glmWeldHash(cell, size, mask)]; j; j = next[j]) {
+          if ((!match || j < match) &&
+              _glmEqual(v, &copies[size * j], size, epsilon))
+            match = j;
+        }
       }
     }
 
     /* must not be any duplicates -- add to the copies array */
-    copies[3 * copied + 0] = vectors[3 * i + 0];
-    copies[3 * copied + 1] = vectors[3 * i + 1];
-    copies[3 * copied + 2] = vectors[3 * i + 2];
-    j = copied;				/* pass this along for below */
-    copied++;
+    if (!match) {
+      copied++;
+      memcpy(&copies[size * copied], v, sizeof(float) * size);
+      for (k = 0; k < size; k++)
+        cell[k] = _glmWeldCell(v[k], cellsize);
+      j = _glmWeldHash(cell, size, mask);
+      next[copied] = buckets[j];
+      buckets[j] = copied;
+      match = copied;
+    }
 
-  duplicate:
-    /* set the first component of this vector to point at the correct
-       index into the new copies array */
-    vectors[3 * i + 0] = (float)j;
+    remap[i] = match;
   }
 
-  *numvectors = copied-1;
+  free(buckets);
+  free(next);
+
+  *numvectors = copied;
   return copies;
 }
 
@@ -222,6 +307,8 @@ _glmAddGroup(GLMmodel* model, char* name)
     group->material = 0;
     group->numtriangles = 0;
     group->triangles = NULL;
+    group->triIndexes = NULL;
+    group->lods = NULL;
     group->next = model->groups;
     model->groups = group;
     model->numgroups++;
@@ -475,447 +562,970 @@ _glmWriteMTL(GLMmodel* model, char* modelpath, char* mtllibname)
 }
 
 
-/* _glmFirstPass: first pass at a Wavefront OBJ file that gets all the
- * statistics of the model (such as #vertices, #normals, etc)
+/* GLMfile: the whole contents of a file, mapped (or read) into memory
+ */
+typedef struct {
+  const char* data;			/* file contents, not NUL terminated */
+  size_t      size;			/* number of bytes at data */
+  boolean     mapped;			/* data is an mmap()ed view */
+} GLMfile;
+
+/* _glmOpenFile: map an entire file into memory so it can be parsed in
+ * place.  Falls back to reading it into a malloc'ed buffer where mmap
+ * isn't available.  Returns FALSE if the file can't be read.
  *
- * model - properly initialized GLMmodel structure
- * file  - (fopen'd) file descriptor
+ * file     - GLMfile structure to fill in
+ * filename - name of the file to open
  */
-static void
-_glmFirstPass(GLMmodel* model, FILE* file)
+static boolean
+_glmOpenFile(GLMfile* file, const char* filename)
 {
-  uint    numvertices;		/* number of vertices in model */
-  uint    numnormals;			/* number of normals in model */
-  uint    numtexcoords;		/* number of texcoords in model */
-  uint    numtriangles;		/* number of triangles in model */
-  GLMgroup* group;			/* current group */
-  unsigned  v, n, t;
-  char      buf[128];
+  FILE* f;
+  long  size;
+  char* data;
 
-  /* make a default group */
-  group = _glmAddGroup(model, "default");
+  file->data   = NULL;
+  file->size   = 0;
+  file->mapped = FALSE;
 
-  numvertices = numnormals = numtexcoords = numtriangles = 0;
-  while(fscanf(file, "%s", buf) != EOF) {
-    switch(buf[0]) {
-    case '#':				/* comment */
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      break;
-    case 'v':				/* v, vn, vt */
-      switch(buf[1]) {
-      case '\0':			/* vertex */
-	/* eat up rest of line */
-	fgets(buf, sizeof(buf), file);
-	numvertices++;
-	break;
-      case 'n':				/* normal */
-	/* eat up rest of line */
-	fgets(buf, sizeof(buf), file);
-	numnormals++;
-	break;
-      case 't':				/* texcoord */
-	/* eat up rest of line */
-	fgets(buf, sizeof(buf), file);
-	numtexcoords++;
-	break;
-      default:
-	printf("_glmFirstPass(): Unknown token \"%s\".\n", buf);
-	exit(1);
-	break;
+#ifndef _WIN32
+  {
+    struct stat st;
+    void* map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+      return FALSE;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      if (st.st_size == 0) {
+        close(fd);
+        return TRUE;
       }
-      break;
-    case 'm':
-      fgets(buf, sizeof(buf), file);
-      sscanf(buf, "%s %s", buf, buf);
-      model->mtllibname = stralloc(buf);
-      _glmReadMTL(model, buf);
-      break;
-    case 'u':
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      break;
-    case 'g':				/* group */
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      sscanf(buf, "%s", buf);
-      group = _glmAddGroup(model, buf);
-      break;
-    case 'f':				/* face */
-      v = n = t = 0;
-      fscanf(file, "%s", buf);
-      /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-      if (strstr(buf, "//")) {
-	/* v//n */
-	sscanf(buf, "%u//%u", &v, &n);
-	fscanf(file, "%u//%u", &v, &n);
-	fscanf(file, "%u//%u", &v, &n);
-	numtriangles++;
-	group->numtriangles++;
-	while(fscanf(file, "%u//%u", &v, &n) > 0) {
-	  numtriangles++;
-	  group->numtriangles++;
-	}
-      } else if (sscanf(buf, "%u/%u/%u", &v, &t, &n) == 3) {
-	/* v/t/n */
-	fscanf(file, "%u/%u/%u", &v, &t, &n);
-	fscanf(file, "%u/%u/%u", &v, &t, &n);
-	numtriangles++;
-	group->numtriangles++;
-	while(fscanf(file, "%u/%u/%u", &v, &t, &n) > 0) {
-	  numtriangles++;
-	  group->numtriangles++;
-	}
-      } else if (sscanf(buf, "%u/%u", &v, &t) == 2) {
-	/* v/t */
-	fscanf(file, "%u/%u", &v, &t);
-	fscanf(file, "%u/%u", &v, &t);
-	numtriangles++;
-	group->numtriangles++;
-	while(fscanf(file, "%u/%u", &v, &t) > 0) {
-	  numtriangles++;
-	  group->numtriangles++;
-	}
-      } else {
-	/* v */
-	fscanf(file, "%u", &v);
-	fscanf(file, "%u", &v);
-	numtriangles++;
-	group->numtriangles++;
-	while(fscanf(file, "%u", &v) > 0) {
-	  numtriangles++;
-	  group->numtriangles++;
-	}
+      map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+        file->data   = map;
+        file->size   = st.st_size;
+        file->mapped = TRUE;
+        close(fd);
+        return TRUE;
       }
-      break;
-
-    default:
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      break;
     }
+    close(fd);
   }
-
-#if 0
-  /* announce the model statistics */
-  printf(" Vertices: %d\n", numvertices);
-  printf(" Normals: %d\n", numnormals);
-  printf(" Texcoords: %d\n", numtexcoords);
-  printf(" Triangles: %d\n", numtriangles);
-  printf(" Groups: %d\n", model->numgroups);
 #endif
 
-  /* set the stats in the model structure */
-  model->numvertices  = numvertices;
-  model->numnormals   = numnormals;
-  model->numtexcoords = numtexcoords;
-  model->numtriangles = numtriangles;
+  f = fopen(filename, "rb");
+  if (!f)
+    return FALSE;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  if (size < 0) {
+    fclose(f);
+    return FALSE;
+  }
+  data = (char*)malloc(size ? size : 1);
+  if (!data || fread(data, 1, size, f) != (size_t)size) {
+    free(data);
+    fclose(f);
+    return FALSE;
+  }
+  fclose(f);
 
-  /* allocate memory for the triangles in each group */
-  group = model->groups;
-  while(group) {
-    group->triangles = (uint*)malloc(sizeof(uint) * group->numtriangles);
-    group->numtriangles = 0;
-    group = group->next;
+  file->data = data;
+  file->size = size;
+  return TRUE;
+}
+
+/* _glmCloseFile: release a file opened with _glmOpenFile()
+ */
+static void
+_glmCloseFile(GLMfile* file)
+{
+#ifndef _WIN32
+  if (file->mapped) {
+    munmap((void*)file->data, file->size);
+    file->data = NULL;
+    return;
   }
+#endif
+  free((void*)file->data);
+  file->data = NULL;
 }
 
-/* _glmSecondPass: second pass at a Wavefront OBJ file that gets all
- * the data.
+/* _glmGrow: make room for at least count+1 elements in a growable
+ * array, doubling its capacity as needed.  Returns the (possibly
+ * moved) array.
  *
- * model - properly initialized GLMmodel structure
- * file  - (fopen'd) file descriptor
+ * array    - the array, or NULL
+ * capacity - number of elements currently allocated
+ * count    - number of elements currently in use
+ * size     - size of one element in bytes
  */
-static void
-_glmSecondPass(GLMmodel* model, FILE* file)
-{
-  uint    numvertices;		/* number of vertices in model */
-  uint    numnormals;			/* number of normals in model */
-  uint    numtexcoords;		/* number of texcoords in model */
-  uint    numtriangles;		/* number of triangles in model */
-  float*  vertices;			/* array of vertices  */
-  float*  normals;			/* array of normals */
-  float*  texcoords;			/* array of texture coordinates */
-  GLMgroup* group;			/* current group pointer */
-  uint    material;			/* current material */
-  uint    v, n, t;
-  char      buf[128];
-
-  /* set the pointer shortcuts */
-  vertices     = model->vertices;
-  normals      = model->normals;
-  texcoords    = model->texcoords;
-  group        = model->groups;
-
-  /* on the second pass through the file, read all the data into the
-     allocated arrays */
-  numvertices = numnormals = numtexcoords = 1;
-  numtriangles = 0;
-  material = 0;
-  while(fscanf(file, "%s", buf) != EOF) {
-    switch(buf[0]) {
-    case '#':				/* comment */
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      break;
-    case 'v':				/* v, vn, vt */
-      switch(buf[1]) {
-      case '\0':			/* vertex */
-	fscanf(file, "%f %f %f",
-	       &vertices[3 * numvertices + X],
-	       &vertices[3 * numvertices + Y],
-	       &vertices[3 * numvertices + Z]);
-	numvertices++;
-	break;
-      case 'n':				/* normal */
-	fscanf(file, "%f %f %f",
-	       &normals[3 * numnormals + X],
-	       &normals[3 * numnormals + Y],
-	       &normals[3 * numnormals + Z]);
-	numnormals++;
-	break;
-      case 't':				/* texcoord */
-	fscanf(file, "%f %f",
-	       &texcoords[2 * numtexcoords + X],
-	       &texcoords[2 * numtexcoords + Y]);
-	numtexcoords++;
-	break;
-      }
-      break;
-    case 'u':
-      fgets(buf, sizeof(buf), file);
-      sscanf(buf, "%s %s", buf, buf);
-      material = _glmFindMaterial(model, buf);
-      if (!group->material)
-         group->material = material;
-      /*printf("material %s = %u\n", buf, material);*/
-      break;
-    case 'g':				/* group */
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      sscanf(buf, "%s", buf);
-      group = _glmFindGroup(model, buf);
-      group->material = material;
-      /*printf("GROUP %s  material %u\n", buf, material);*/
-      break;
-    case 'f':				/* face */
-      v = n = t = 0;
-      fscanf(file, "%s", buf);
-      /* can be one of %d, %d//%d, %d/%d, %d/%d/%d %d//%d */
-      if (strstr(buf, "//")) {
-	/* v//n */
-	sscanf(buf, "%u//%u", &v, &n);
-	T(numtriangles).vindices[0] = v;
-	T(numtriangles).nindices[0] = n;
-	fscanf(file, "%u//%u", &v, &n);
-	T(numtriangles).vindices[1] = v;
-	T(numtriangles).nindices[1] = n;
-	fscanf(file, "%u//%u", &v, &n);
-	T(numtriangles).vindices[2] = v;
-	T(numtriangles).nindices[2] = n;
-	group->triangles[group->numtriangles++] = numtriangles;
-	numtriangles++;
-	while(fscanf(file, "%u//%u", &v, &n) > 0) {
-	  T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-	  T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-	  T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-	  T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-	  T(numtriangles).vindices[2] = v;
-	  T(numtriangles).nindices[2] = n;
-	  group->triangles[group->numtriangles++] = numtriangles;
-	  numtriangles++;
-	}
-      } else if (sscanf(buf, "%u/%u/%u", &v, &t, &n) == 3) {
-	/* v/t/n */
-	T(numtriangles).vindices[0] = v;
-	T(numtriangles).tindices[0] = t;
-	T(numtriangles).nindices[0] = n;
-	fscanf(file, "%u/%u/%u", &v, &t, &n);
-	T(numtriangles).vindices[1] = v;
-	T(numtriangles).tindices[1] = t;
-	T(numtriangles).nindices[1] = n;
-	fscanf(file, "%u/%u/%u", &v, &t, &n);
-	T(numtriangles).vindices[2] = v;
-	T(numtriangles).tindices[2] = t;
-	T(numtriangles).nindices[2] = n;
-	group->triangles[group->numtriangles++] = numtriangles;
-	numtriangles++;
-	while(fscanf(file, "%u/%u/%u", &v, &t, &n) > 0) {
-	  T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-	  T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-	  T(numtriangles).nindices[0] = T(numtriangles-1).nindices[0];
-	  T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-	  T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-	  T(numtriangles).nindices[1] = T(numtriangles-1).nindices[2];
-	  T(numtriangles).vindices[2] = v;
-	  T(numtriangles).tindices[2] = t;
-	  T(numtriangles).nindices[2] = n;
-	  group->triangles[group->numtriangles++] = numtriangles;
-	  numtriangles++;
-	}
-      } else if (sscanf(buf, "%u/%u", &v, &t) == 2) {
-	/* v/t */
-	T(numtriangles).vindices[0] = v;
-	T(numtriangles).tindices[0] = t;
-	fscanf(file, "%u/%u", &v, &t);
-	T(numtriangles).vindices[1] = v;
-	T(numtriangles).tindices[1] = t;
-	fscanf(file, "%u/%u", &v, &t);
-	T(numtriangles).vindices[2] = v;
-	T(numtriangles).tindices[2] = t;
-	group->triangles[group->numtriangles++] = numtriangles;
-	numtriangles++;
-	while(fscanf(file, "%u/%u", &v, &t) > 0) {
-	  T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-	  T(numtriangles).tindices[0] = T(numtriangles-1).tindices[0];
-	  T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-	  T(numtriangles).tindices[1] = T(numtriangles-1).tindices[2];
-	  T(numtriangles).vindices[2] = v;
-	  T(numtriangles).tindices[2] = t;
-	  group->triangles[group->numtriangles++] = numtriangles;
-	  numtriangles++;
-	}
-      } else {
-	/* v */
-	sscanf(buf, "%u", &v);
-	T(numtriangles).vindices[0] = v;
-	fscanf(file, "%u", &v);
-	T(numtriangles).vindices[1] = v;
-	fscanf(file, "%u", &v);
-	T(numtriangles).vindices[2] = v;
-	group->triangles[group->numtriangles++] = numtriangles;
-	numtriangles++;
-	while(fscanf(file, "%u", &v) > 0) {
-	  T(numtriangles).vindices[0] = T(numtriangles-1).vindices[0];
-	  T(numtriangles).vindices[1] = T(numtriangles-1).vindices[2];
-	  T(numtriangles).vindices[2] = v;
-	  group->triangles[group->numtriangles++] = numtriangles;
-	  numtriangles++;
-	}
-      }
-      break;
+static void*
+_glmGrow(void* array, uint* capacity, uint count, size_t size)
+{
+  uint newcapacity;
 
-    default:
-      /* eat up rest of line */
-      fgets(buf, sizeof(buf), file);
-      break;
-    }
-  }
+  if (count < *capacity)
+    return array;
 
-#if 0
-  /* announce the memory requirements */
-  printf(" Memory: %d bytes\n",
-	 numvertices  * 3*sizeof(float) +
-	 numnormals   * 3*sizeof(float) * (numnormals ? 1 : 0) +
-	 numtexcoords * 3*sizeof(float) * (numtexcoords ? 1 : 0) +
-	 numtriangles * sizeof(GLMtriangle));
-#endif
+  newcapacity = *capacity ? *capacity * 2 : 4096;
+  array = realloc(array, size * newcapacity);
+  if (!array) {
+    fprintf(stderr, "glmReadOBJ() failed: out of memory.\n");
+    exit(1);
+  }
+  *capacity = newcapacity;
+  return array;
 }
 
+#define _GLM_ISSPACE(c) ((c) == ' ' || (c) == '\t' || (c) == '\r' || \
+                         (c) == '\f' || (c) == '\v')
+#define _GLM_ISDIGIT(c) ((unsigned)((c) - '0') < 10)
 
+/* _glmSkipSpace: skip blanks, but not the end of the line */
+static const char*
+_glmSkipSpace(const char* p, const char* end)
+{
+  while (p < end && _GLM_ISSPACE(*p))
+    p++;
+  return p;
+}
 
+/* _glmNextLine: return the start of the line following p */
+static const char*
+_glmNextLine(const char* p, const char* end)
+{
+  p = memchr(p, '\n', end - p);
+  return p ? p + 1 : end;
+}
 
-/* public functions */
+/* _glmTokenEnd: return the end of the (non-blank) token at p */
+static const char*
+_glmTokenEnd(const char* p, const char* end)
+{
+  while (p < end && !_GLM_ISSPACE(*p) && *p != '\n')
+    p++;
+  return p;
+}
 
-/* glmUnitize: "unitize" a model by translating it to the origin and
- * scaling it to fit in a unit cube around the origin.  Returns the
- * scalefactor used.
- *
- * model - properly initialized GLMmodel structure
+/* _glmParseName: copy the next token on the line into buf.  Returns
+ * the position just past the token.  An empty token leaves buf = "".
  */
-float
-glmUnitize(GLMmodel* model)
+static const char*
+_glmParseName(const char* p, const char* end, char* buf, size_t size)
 {
-  uint  i;
-  float maxx, minx, maxy, miny, maxz, minz;
-  float cx, cy, cz, w, h, d;
-  float scale;
+  const char* q;
+  size_t len;
+
+  p = _glmSkipSpace(p, end);
+  q = _glmTokenEnd(p, end);
+  len = q - p;
+  if (len >= size)
+    len = size - 1;
+  memcpy(buf, p, len);
+  buf[len] = '\0';
+  return q;
+}
 
-  assert(model);
-  assert(model->vertices);
+/* _glmParseFloat: parse a decimal floating point number at p (after
+ * optional blanks).  The common [-]ddd.ddd[e[-]dd] forms are handled
+ * directly; anything else is handed to strtod().  Returns the position
+ * just past the number, or p if there was no number (value is then 0).
+ */
+static const char*
+_glmParseFloat(const char* p, const char* end, float* value)
+{
+  static const double pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const char* start;
+  unsigned long long mantissa = 0;
+  int digits = 0, exponent = 0;
+  boolean negative = FALSE;
+  double d;
+
+  p = _glmSkipSpace(p, end);
+  start = p;
+
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+  for (; p < end && _GLM_ISDIGIT(*p); p++, digits++) {
+    if (digits < 19)
+      mantissa = mantissa * 10 + (*p - '0');
+    else
+      exponent++;
+  }
+  if (p < end && *p == '.') {
+    for (p++; p < end && _GLM_ISDIGIT(*p); p++, digits++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exponent--;
+      }
+    }
+  }
+  if (digits == 0) {
+    /* inf, nan, hex floats, garbage... */
+    char buf[64];
+    char* q;
+    size_t len = _glmTokenEnd(start, end) - start;
+
+    if (len >= sizeof(buf))
+      len = sizeof(buf) - 1;
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    d = strtod(buf, &q);
+    *value = (float)d;
+    return start + (q - buf);
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    boolean negexp = FALSE;
+    int e = 0;
+
+    if (q < end && (*q == '-' || *q == '+')) {
+      negexp = *q == '-';
+      q++;
+    }
+    if (q < end && _GLM_ISDIGIT(*q)) {
+      for (; q < end && _GLM_ISDIGIT(*q); q++) {
+        if (e < 10000)
+          e = e * 10 + (*q - '0');
+      }
+      exponent += negexp ? -e : e;
+      p = q;
+    }
+  }
 
-  /* get the max/mins */
-  maxx = minx = model->vertices[3 + X];
-  maxy = miny = model->vertices[3 + Y];
-  maxz = minz = model->vertices[3 + Z];
-  for (i = 1; i <= model->numvertices; i++) {
-    if (maxx < model->vertices[3 * i + X])
-      maxx = model->vertices[3 * i + X];
-    if (minx > model->vertices[3 * i + X])
-      minx = model->vertices[3 * i + X];
+  /* exact for mantissas below 2^53 and |exponent| <= 22 */
+  d = (double)mantissa;
+  if (exponent < 0) {
+    if (exponent >= -22)
+      d /= pow10[-exponent];
+    else
+      d *= pow(10.0, exponent);
+  } else if (exponent > 0) {
+    if (exponent <= 22)
+      d *= pow10[exponent];
+    else
+      d *= pow(10.0, exponent);
+  }
+  *value = (float)(negative ? -d : d);
+  return p;
+}
 
-    if (maxy < model->vertices[3 * i + Y])
-      maxy = model->vertices[3 * i + Y];
-    if (miny > model->vertices[3 * i + Y])
-      miny = model->vertices[3 * i + Y];
+/* _glmParseIndex: parse an OBJ index at p.  Negative indices are
+ * relative to the end of the list read so far.  Returns the position
+ * just past the index, or p if there was none (index is then 0).
+ */
+static const char*
+_glmParseIndex(const char* p, const char* end, int* index)
+{
+  boolean negative = FALSE;
+  const char* start;
+  int value = 0;
 
-    if (maxz < model->vertices[3 * i + Z])
-      maxz = model->vertices[3 * i + Z];
-    if (minz > model->vertices[3 * i + Z])
-      minz = model->vertices[3 * i + Z];
+  if (p < end && *p == '-') {
+    negative = TRUE;
+    p++;
   }
+  start = p;
+  while (p < end && _GLM_ISDIGIT(*p))
+    value = value * 10 + (*p++ - '0');
 
-  /* calculate model width, height, and depth */
-  w = _glmAbs(maxx) + _glmAbs(minx);
-  h = _glmAbs(maxy) + _glmAbs(miny);
-  d = _glmAbs(maxz) + _glmAbs(minz);
+  if (p == start) {
+    *index = 0;
+    return negative ? p - 1 : p;
+  }
+  *index = negative ? -value : value;
+  return p;
+}
 
-  /* calculate center of the model */
-  cx = (maxx + minx) / 2.0;
-  cy = (maxy + miny) / 2.0;
-  cz = (maxz + minz) / 2.0;
 
-  /* calculate unitizing scale factor */
-  scale = 2.0 / _glmMax(_glmMax(w, h), d);
+/* threads */
 
-  /* translate around center then scale */
-  for (i = 1; i <= model->numvertices; i++) {
-    model->vertices[3 * i + X] -= cx;
-    model->vertices[3 * i + Y] -= cy;
-    model->vertices[3 * i + Z] -= cz;
-    model->vertices[3 * i + X] *= scale;
-    model->vertices[3 * i + Y] *= scale;
-    model->vertices[3 * i + Z] *= scale;
-  }
+/* number of threads to use, 0 = one per CPU */
+static uint _glmNumThreads = 0;
 
-  return scale;
+/* _glmThreadCount: return the number of worker threads to use */
+static uint
+_glmThreadCount(void)
+{
+#ifdef HAVE_PTHREAD
+  long cpus;
+
+  if (_glmNumThreads)
+    return _glmNumThreads;
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return cpus > 1 ? (uint)cpus : 1;
+#else
+  return 1;
+#endif
 }
 
-/* glmDimensions: Calculates the dimensions (width, height, depth) of
- * a model.
- *
- * model      - initialized GLMmodel structure
- * dimensions - array of 3 floats (float dimensions[3])
+typedef void (*GLMworkfunc)(void* data, uint index);
+
+typedef struct {
+  GLMworkfunc func;
+  void*       data;
+  uint        index;
+  boolean     running;			/* has a thread to join */
+} GLMwork;
+
+#ifdef HAVE_PTHREAD
+static void*
+_glmWorker(void* arg)
+{
+  GLMwork* work = (GLMwork*)arg;
+
+  work->func(work->data, work->index);
+  return NULL;
+}
+#endif
+
+/* _glmParallel: call func(data, i) for every i in [0, count), each on
+ * its own thread, and wait for all of them to finish.
  */
-void
-glmDimensions(GLMmodel* model, float* dimensions)
+static void
+_glmParallel(uint count, GLMworkfunc func, void* data)
 {
+#ifdef HAVE_PTHREAD
+  pthread_t* threads;
+  GLMwork*   work;
   uint i;
-  float maxx, minx, maxy, miny, maxz, minz;
-
-  assert(model);
-  assert(model->vertices);
-  assert(dimensions);
 
-  /* get the max/mins */
-  maxx = minx = model->vertices[3 + X];
-  maxy = miny = model->vertices[3 + Y];
-  maxz = minz = model->vertices[3 + Z];
-  for (i = 1; i <= model->numvertices; i++) {
-    if (maxx < model->vertices[3 * i + X])
-      maxx = model->vertices[3 * i + X];
-    if (minx > model->vertices[3 * i + X])
-      minx = model->vertices[3 * i + X];
+  if (count > 1) {
+    threads = (pthread_t*)malloc(sizeof(pthread_t) * count);
+    work = (GLMwork*)malloc(sizeof(GLMwork) * count);
 
-    if (maxy < model->vertices[3 * i + Y])
-      maxy = model->vertices[3 * i + Y];
-    if (miny > model->vertices[3 * i + Y])
-      miny = model->vertices[3 * i + Y];
+    for (i = 0; i < count; i++) {
+      work[i].func  = func;
+      work[i].data  = data;
+      work[i].index = i;
+      work[i].running = FALSE;
+    }
+    /* the calling thread takes the first item itself */
+    for (i = 1; i < count; i++) {
+      if (pthread_create(&threads[i], NULL, _glmWorker, &work[i]) == 0)
+        work[i].running = TRUE;
+      else
+        _glmWorker(&work[i]);
+    }
+    func(data, 0);
+    for (i = 1; i < count; i++) {
+      if (work[i].running)
+        pthread_join(threads[i], NULL);
+    }
 
-    if (maxz < model->vertices[3 * i + Z])
-      maxz = model->vertices[3 * i + Z];
-    if (minz > model->vertices[3 * i + Z])
-      minz = model->vertices[3 * i + Z];
+    free(work);
+    free(threads);
+    return;
+  }
+#endif
+  {
+    uint i;
+
+    for (i = 0; i < count; i++)
+      func(data, i);
+  }
+}
+
+
+/* chunked parsing
+ *
+ * The file is split at line boundaries into chunks which are parsed
+ * independently (and concurrently).  OBJ indices are global, so the
+ * triangles of a chunk can be used as is; only relative (negative)
+ * indices need the number of elements read by earlier chunks, so they
+ * are stored chunk-relative with GLM_RELATIVE set and rebased when
+ * stitching.  Group and material statements depend on state carried
+ * over from earlier chunks and are recorded as events, which are
+ * replayed in file order once every chunk has been parsed.
+ */
+
+#define GLM_RELATIVE 0x80000000u
+
+enum { GLM_EVENT_GROUP, GLM_EVENT_USEMTL, GLM_EVENT_MTLLIB };
+
+/* GLMevent: a group/material statement found in a chunk
+ */
+typedef struct {
+  uint  type;				/* GLM_EVENT_* */
+  uint  triangle;			/* chunk triangles before it */
+  char* name;				/* group/material/library name */
+} GLMevent;
+
+/* GLMchunk: the data parsed from one piece of the file.  The arrays
+ * are 1-based like the GLMmodel ones.
+ */
+typedef struct {
+  const char*  begin;			/* first byte of the chunk */
+  const char*  end;			/* one past the last byte */
+
+  uint         numvertices, maxvertices;
+  float*       vertices;
+  uint         numnormals, maxnormals;
+  float*       normals;
+  uint         numtexcoords, maxtexcoords;
+  float*       texcoords;
+  uint         numtriangles, maxtriangles;
+  GLMtriangle* triangles;
+
+  uint         numevents, maxevents;
+  GLMevent*    events;
+
+  boolean      relative;		/* has GLM_RELATIVE indices */
+
+  /* where this chunk's data starts in the model (set when stitching) */
+  uint         vertexbase, normalbase, texcoordbase, trianglebase;
+} GLMchunk;
+
+/* GLMrange: a run of consecutive triangles belonging to one group
+ */
+typedef struct {
+  GLMgroup* group;
+  uint      first, count;
+} GLMrange;
+
+/* _glmAddEvent: record a group/material statement in a chunk */
+static void
+_glmAddEvent(GLMchunk* chunk, uint type, const char* name)
+{
+  GLMevent* event;
+
+  chunk->events = _glmGrow(chunk->events, &chunk->maxevents,
+                           chunk->numevents, sizeof(GLMevent));
+  event = &chunk->events[chunk->numevents++];
+  event->type = type;
+  event->triangle = chunk->numtriangles;
+  event->name = stralloc(name);
+}
+
+/* _glmResolveIndex: turn a parsed index into a (global, 1-based) one.
+ * Relative indices can only be resolved against the chunk's own count
+ * here; they are marked GLM_RELATIVE and rebased when stitching.
+ *
+ * index - index as found in the file
+ * count - index the next element in the chunk would get
+ */
+static uint
+_glmResolveIndex(GLMchunk* chunk, int index, uint count)
+{
+  if (index >= 0)
+    return (uint)index;
+
+  chunk->relative = TRUE;
+  return GLM_RELATIVE | ((count + (uint)index) & ~GLM_RELATIVE);
+}
+
+/* _glmRebaseIndex: resolve a GLM_RELATIVE index given the global index
+ * of the chunk's first element.
+ */
+static uint
+_glmRebaseIndex(uint index, uint base)
+{
+  if (!(index & GLM_RELATIVE))
+    return index;
+
+  /* sign-extend the 31-bit chunk-relative index */
+  if (index & (GLM_RELATIVE >> 1))
+    index |= GLM_RELATIVE;
+  else
+    index &= ~GLM_RELATIVE;
+  return base - 1 + index;
+}
+
+/* _glmParseChunk: parse the OBJ statements in one chunk of the file.
+ *
+ * chunk - chunk with begin/end set and everything else zeroed
+ */
+static void
+_glmParseChunk(GLMchunk* chunk)
+{
+  const char* p   = chunk->begin;
+  const char* end = chunk->end;
+  char        buf[128];
+
+  while (p < end) {
+    const char* keyword = _glmSkipSpace(p, end);
+    const char* q = _glmTokenEnd(keyword, end);
+    size_t len = q - keyword;
+
+    p = q;
+    if (len == 0 || keyword[0] == '#') {
+      /* blank line or comment */
+    } else if (keyword[0] == 'v' && len == 1) {
+      uint i = chunk->numvertices + 1;
+
+      chunk->vertices = _glmGrow(chunk->vertices, &chunk->maxvertices, i,
+                                 3 * sizeof(float));
+      p = _glmParseFloat(p, end, &chunk->vertices[3 * i + X]);
+      p = _glmParseFloat(p, end, &chunk->vertices[3 * i + Y]);
+      p = _glmParseFloat(p, end, &chunk->vertices[3 * i + Z]);
+      chunk->numvertices++;
+    } else if (keyword[0] == 'v' && len == 2 && keyword[1] == 'n') {
+      uint i = chunk->numnormals + 1;
+
+      chunk->normals = _glmGrow(chunk->normals, &chunk->maxnormals, i,
+                                3 * sizeof(float));
+      p = _glmParseFloat(p, end, &chunk->normals[3 * i + X]);
+      p = _glmParseFloat(p, end, &chunk->normals[3 * i + Y]);
+      p = _glmParseFloat(p, end, &chunk->normals[3 * i + Z]);
+      chunk->numnormals++;
+    } else if (keyword[0] == 'v' && len == 2 && keyword[1] == 't') {
+      uint i = chunk->numtexcoords + 1;
+
+      chunk->texcoords = _glmGrow(chunk->texcoords, &chunk->maxtexcoords, i,
+                                  2 * sizeof(float));
+      p = _glmParseFloat(p, end, &chunk->texcoords[2 * i + X]);
+      p = _glmParseFloat(p, end, &chunk->texcoords[2 * i + Y]);
+      chunk->numtexcoords++;
+    } else if (keyword[0] == 'v') {
+      printf("_glmParseChunk(): Unknown token \"%.*s\".\n", (int)len, keyword);
+    } else if (keyword[0] == 'f' && len == 1) {
+      /* each vertex can be one of v, v//n, v/t, v/t/n; polygons are
+         split into a triangle fan around the first vertex */
+      GLMtriangle* tri;
+      uint v[3], t[3], n[3];
+      uint count = 0;
+
+      for (;;) {
+        uint k = count < 2 ? count : 2;
+        int index;
+
+        p = _glmSkipSpace(p, end);
+        if (p == end || !(_GLM_ISDIGIT(*p) || *p == '-'))
+          break;
+
+        p = _glmParseIndex(p, end, &index);
+        v[k] = _glmResolveIndex(chunk, index, chunk->numvertices + 1);
+        t[k] = n[k] = 0;
+        if (p < end && *p == '/') {
+          p++;
+          if (p < end && *p != '/') {
+            p = _glmParseIndex(p, end, &index);
+            t[k] = _glmResolveIndex(chunk, index, chunk->numtexcoords + 1);
+          }
+          if (p < end && *p == '/') {
+            p = _glmParseIndex(p + 1, end, &index);
+            n[k] = _glmResolveIndex(chunk, index, chunk->numnormals + 1);
+          }
+        }
+        p = _glmTokenEnd(p, end);
+        count++;
+
+        if (count >= 3) {
+          chunk->triangles = _glmGrow(chunk->triangles, &chunk->maxtriangles,
+                                      chunk->numtriangles,
+                                      sizeof(GLMtriangle));
+          tri = &chunk->triangles[chunk->numtriangles++];
+          tri->vindices[0] = v[0];
+          tri->vindices[1] = v[1];
+          tri->vindices[2] = v[2];
+          tri->tindices[0] = t[0];
+          tri->tindices[1] = t[1];
+          tri->tindices[2] = t[2];
+          tri->nindices[0] = n[0];
+          tri->nindices[1] = n[1];
+          tri->nindices[2] = n[2];
+          tri->findex = 0;
+
+          /* the next triangle of the fan reuses the first and last */
+          v[1] = v[2];
+          t[1] = t[2];
+          n[1] = n[2];
+        }
+      }
+    } else if (keyword[0] == 'g' && len == 1) {
+      p = _glmParseName(p, end, buf, sizeof(buf));
+      _glmAddEvent(chunk, GLM_EVENT_GROUP, buf[0] ? buf : "default");
+    } else if (len == 6 && !strncmp(keyword, "mtllib", 6)) {
+      p = _glmParseName(p, end, buf, sizeof(buf));
+      _glmAddEvent(chunk, GLM_EVENT_MTLLIB, buf);
+    } else if (len == 6 && !strncmp(keyword, "usemtl", 6)) {
+      p = _glmParseName(p, end, buf, sizeof(buf));
+      _glmAddEvent(chunk, GLM_EVENT_USEMTL, buf);
+    }
+
+    /* eat up rest of line */
+    p = _glmNextLine(p, end);
+  }
+}
+
+/* _glmParseChunkWork: _glmParallel() callback parsing chunk index */
+static void
+_glmParseChunkWork(void* data, uint index)
+{
+  _glmParseChunk(&((GLMchunk*)data)[index]);
+}
+
+/* GLMstitch: what _glmCopyChunk() needs to put a chunk in place
+ */
+typedef struct {
+  GLMmodel* model;
+  GLMchunk* chunks;
+} GLMstitch;
+
+/* _glmCopyChunk: _glmParallel() callback copying chunk index to its
+ * place in the model's arrays, rebasing relative indices, and freeing
+ * the chunk's arrays.  Arrays the model adopted are NULL by now.
+ */
+static void
+_glmCopyChunk(void* data, uint index)
+{
+  GLMstitch*   stitch = (GLMstitch*)data;
+  GLMmodel*    model  = stitch->model;
+  GLMchunk*    chunk  = &stitch->chunks[index];
+  GLMtriangle* tri;
+  uint         i, j;
+
+  if (chunk->vertices) {
+    memcpy(&model->vertices[3 * chunk->vertexbase], &chunk->vertices[3],
+           sizeof(float) * 3 * chunk->numvertices);
+    free(chunk->vertices);
+  }
+  if (chunk->normals) {
+    memcpy(&model->normals[3 * chunk->normalbase], &chunk->normals[3],
+           sizeof(float) * 3 * chunk->numnormals);
+    free(chunk->normals);
+  }
+  if (chunk->texcoords) {
+    memcpy(&model->texcoords[2 * chunk->texcoordbase], &chunk->texcoords[2],
+           sizeof(float) * 2 * chunk->numtexcoords);
+    free(chunk->texcoords);
+  }
+  if (chunk->triangles) {
+    memcpy(&model->triangles[chunk->trianglebase], chunk->triangles,
+           sizeof(GLMtriangle) * chunk->numtriangles);
+    free(chunk->triangles);
+  }
+
+  if (chunk->relative) {
+    for (i = 0; i < chunk->numtriangles; i++) {
+      tri = &model->triangles[chunk->trianglebase + i];
+      for (j = 0; j < 3; j++) {
+        tri->vindices[j] = _glmRebaseIndex(tri->vindices[j],
+                                           chunk->vertexbase);
+        tri->nindices[j] = _glmRebaseIndex(tri->nindices[j],
+                                           chunk->normalbase);
+        tri->tindices[j] = _glmRebaseIndex(tri->tindices[j],
+                                           chunk->texcoordbase);
+      }
+    }
+  }
+}
+
+/* _glmReplayEvents: apply the group and material statements of all
+ * chunks in file order, then build each group's triangle list.  The
+ * material libraries are read first, as the old first pass did, so a
+ * usemtl may come before the mtllib that defines it.
+ *
+ * model     - model the chunks were stitched into
+ * chunks    - array of parsed chunks
+ * numchunks - number of chunks
+ */
+static void
+_glmReplayEvents(GLMmodel* model, GLMchunk* chunks, uint numchunks)
+{
+  GLMrange* ranges = NULL;		/* triangle runs per group */
+  uint      numranges = 0, maxranges = 0;
+  GLMgroup* group;			/* current group */
+  uint      material;			/* current material */
+  uint      first, last;
+  uint      c, e, i;
+
+  for (c = 0; c < numchunks; c++) {
+    for (e = 0; e < chunks[c].numevents; e++) {
+      GLMevent* event = &chunks[c].events[e];
+
+      if (event->type == GLM_EVENT_MTLLIB) {
+        if (model->mtllibname)
+          free(model->mtllibname);
+        model->mtllibname = stralloc(event->name);
+        _glmReadMTL(model, event->name);
+      }
+    }
+  }
+
+  /* make a default group */
+  group = _glmAddGroup(model, "default");
+  material = 0;
+  first = 0;
+
+  for (c = 0; c <= numchunks; c++) {
+    uint numevents = c < numchunks ? chunks[c].numevents : 0;
+
+    for (e = 0; e <= numevents; e++) {
+      GLMevent* event = e < numevents ? &chunks[c].events[e] : NULL;
+
+      /* the triangles up to here belong to the current group */
+      if (event)
+        last = chunks[c].trianglebase + event->triangle;
+      else if (c < numchunks)
+        continue;
+      else
+        last = model->numtriangles;
+      if (last > first) {
+        ranges = _glmGrow(ranges, &maxranges, numranges, sizeof(GLMrange));
+        ranges[numranges].group = group;
+        ranges[numranges].first = first;
+        ranges[numranges].count = last - first;
+        numranges++;
+        first = last;
+      }
+      if (!event)
+        break;
+
+      switch (event->type) {
+      case GLM_EVENT_GROUP:
+        group = _glmAddGroup(model, event->name);
+        group->material = material;
+        break;
+      case GLM_EVENT_MTLLIB:		/* read above */
+        break;
+      case GLM_EVENT_USEMTL:
+        material = _glmFindMaterial(model, event->name);
+        if (!group->material)
+          group->material = material;
+        break;
+      }
+      free(event->name);
+    }
+    if (c < numchunks)
+      free(chunks[c].events);
+  }
+
+  /* now that the group sizes are known, distribute the triangles */
+  for (i = 0; i < numranges; i++)
+    ranges[i].group->numtriangles += ranges[i].count;
+  for (group = model->groups; group; group = group->next) {
+    group->triangles = (uint*)malloc(sizeof(uint) * group->numtriangles);
+    group->numtriangles = 0;
+  }
+  for (i = 0; i < numranges; i++) {
+    group = ranges[i].group;
+    for (last = ranges[i].first; last < ranges[i].first + ranges[i].count;
+         last++)
+      group->triangles[group->numtriangles++] = last;
+  }
+  free(ranges);
+}
+
+/* smallest chunk worth handing to a thread of its own */
+#define GLM_MIN_CHUNK (1 << 20)
+
+/* _glmParseOBJ: parse the contents of a Wavefront OBJ file.  The file
+ * is split into chunks that are parsed in parallel and then stitched
+ * together into the model.
+ *
+ * model - properly initialized GLMmodel structure
+ * data  - file contents (need not be NUL terminated)
+ * size  - number of bytes at data
+ */
+static void
+_glmParseOBJ(GLMmodel* model, const char* data, size_t size)
+{
+  const char* end = data + size;
+  const char* begin;
+  GLMchunk*   chunks;
+  GLMchunk*   chunk;
+  GLMstitch   stitch;
+  uint        numchunks;
+  uint        numvertices, numnormals, numtexcoords, numtriangles;
+  uint        i;
+
+  /* split the file at line boundaries */
+  numchunks = _glmThreadCount();
+  if (numchunks > size / GLM_MIN_CHUNK)
+    numchunks = size / GLM_MIN_CHUNK;
+  if (numchunks < 1)
+    numchunks = 1;
+
+  chunks = (GLMchunk*)calloc(numchunks, sizeof(GLMchunk));
+  begin = data;
+  for (i = 0; i < numchunks; i++) {
+    const char* split = data + size / numchunks * (i + 1);
+
+    chunks[i].begin = begin;
+    if (i == numchunks - 1)
+      chunks[i].end = end;
+    else
+      chunks[i].end = _glmNextLine(split > begin ? split : begin, end);
+    begin = chunks[i].end;
+  }
+
+  _glmParallel(numchunks, _glmParseChunkWork, chunks);
+
+  /* lay the chunks out one after another */
+  numvertices = numnormals = numtexcoords = 1;
+  numtriangles = 0;
+  for (i = 0; i < numchunks; i++) {
+    chunk = &chunks[i];
+    chunk->vertexbase   = numvertices;
+    chunk->normalbase   = numnormals;
+    chunk->texcoordbase = numtexcoords;
+    chunk->trianglebase = numtriangles;
+    numvertices  += chunk->numvertices;
+    numnormals   += chunk->numnormals;
+    numtexcoords += chunk->numtexcoords;
+    numtriangles += chunk->numtriangles;
+  }
+  model->numvertices  = numvertices - 1;
+  model->numnormals   = numnormals - 1;
+  model->numtexcoords = numtexcoords - 1;
+  model->numtriangles = numtriangles;
+
+  if (numchunks == 1) {
+    /* nothing to stitch; adopt the arrays, giving back the slack */
+    chunk = &chunks[0];
+    model->vertices = (float*)realloc(chunk->vertices,
+                                      sizeof(float) * 3 * numvertices);
+    if (model->numnormals)
+      model->normals = (float*)realloc(chunk->normals,
+                                       sizeof(float) * 3 * numnormals);
+    if (model->numtexcoords)
+      model->texcoords = (float*)realloc(chunk->texcoords,
+                                         sizeof(float) * 2 * numtexcoords);
+    model->triangles = (GLMtriangle*)realloc(chunk->triangles,
+                                 sizeof(GLMtriangle) * (numtriangles + 1));
+    chunk->vertices = chunk->normals = chunk->texcoords = NULL;
+    chunk->triangles = NULL;
+  } else {
+    model->vertices = (float*)malloc(sizeof(float) * 3 * numvertices);
+    if (model->numnormals)
+      model->normals = (float*)malloc(sizeof(float) * 3 * numnormals);
+    if (model->numtexcoords)
+      model->texcoords = (float*)malloc(sizeof(float) * 2 * numtexcoords);
+    model->triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) *
+                                            (numtriangles + 1));
+  }
+  if (!model->vertices || !model->triangles ||
+      (model->numnormals && !model->normals) ||
+      (model->numtexcoords && !model->texcoords)) {
+    fprintf(stderr, "glmReadOBJ() failed: out of memory.\n");
+    exit(1);
+  }
+
+  stitch.model  = model;
+  stitch.chunks = chunks;
+  _glmParallel(numchunks, _glmCopyChunk, &stitch);
+
+  _glmReplayEvents(model, chunks, numchunks);
+
+  free(chunks);
+}
+
+
+
+/* public functions */
+
+/* glmUnitize: "unitize" a model by translating it to the origin and
+ * scaling it to fit in a unit cube around the origin.  Returns the
+ * scalefactor used.
+ *
+ * model - properly initialized GLMmodel structure
+ */
+float
+glmUnitize(GLMmodel* model)
+{
+  uint  i;
+  float maxx, minx, maxy, miny, maxz, minz;
+  float cx, cy, cz, w, h, d;
+  float scale;
+
+  assert(model);
+  assert(model->vertices);
+
+  /* get the max/mins */
+  maxx = minx = model->vertices[3 + X];
+  maxy = miny = model->vertices[3 + Y];
+  maxz = minz = model->vertices[3 + Z];
+  for (i = 1; i <= model->numvertices; i++) {
+    if (maxx < model->vertices[3 * i + X])
+      maxx = model->vertices[3 * i + X];
+    if (minx > model->vertices[3 * i + X])
+      minx = model->vertices[3 * i + X];
+
+    if (maxy < model->vertices[3 * i + Y])
+      maxy = model->vertices[3 * i + Y];
+    if (miny > model->vertices[3 * i + Y])
+      miny = model->vertices[3 * i + Y];
+
+    if (maxz < model->vertices[3 * i + Z])
+      maxz = model->vertices[3 * i + Z];
+    if (minz > model->vertices[3 * i + Z])
+      minz = model->vertices[3 * i + Z];
+  }
+
+  /* calculate model width, height, and depth */
+  w = _glmAbs(maxx) + _glmAbs(minx);
+  h = _glmAbs(maxy) + _glmAbs(miny);
+  d = _glmAbs(maxz) + _glmAbs(minz);
+
+  /* calculate center of the model */
+  cx = (maxx + minx) / 2.0;
+  cy = (maxy + miny) / 2.0;
+  cz = (maxz + minz) / 2.0;
+
+  /* calculate unitizing scale factor */
+  scale = 2.0 / _glmMax(_glmMax(w, h), d);
+
+  /* translate around center then scale */
+  for (i = 1; i <= model->numvertices; i++) {
+    model->vertices[3 * i + X] -= cx;
+    model->vertices[3 * i + Y] -= cy;
+    model->vertices[3 * i + Z] -= cz;
+    model->vertices[3 * i + X] *= scale;
+    model->vertices[3 * i + Y] *= scale;
+    model->vertices[3 * i + Z] *= scale;
+  }
+
+  return scale;
+}
+
+/* glmDimensions: Calculates the dimensions (width, height, depth) of
+ * a model.
+ *
+ * model      - initialized GLMmodel structure
+ * dimensions - array of 3 floats (float dimensions[3])
+ */
+void
+glmDimensions(GLMmodel* model, float* dimensions)
+{
+  uint i;
+  float maxx, minx, maxy, miny, maxz, minz;
+
+  assert(model);
+  assert(model->vertices);
+  assert(dimensions);
+
+  /* get the max/mins */
+  maxx = minx = model->vertices[3 + X];
+  maxy = miny = model->vertices[3 + Y];
+  maxz = minz = model->vertices[3 + Z];
+  for (i = 1; i <= model->numvertices; i++) {
+    if (maxx < model->vertices[3 * i + X])
+      maxx = model->vertices[3 * i + X];
+    if (minx > model->vertices[3 * i + X])
+      minx = model->vertices[3 * i + X];
+
+    if (maxy < model->vertices[3 * i + Y])
+      maxy = model->vertices[3 * i + Y];
+    if (miny > model->vertices[3 * i + Y])
+      miny = model->vertices[3 * i + Y];
+
+    if (maxz < model->vertices[3 * i + Z])
+      maxz = model->vertices[3 * i + Z];
+    if (minz > model->vertices[3 * i + Z])
+      minz = model->vertices[3 * i + Z];
   }
 
   /* calculate model width, height, and depth */
@@ -1034,30 +1644,278 @@ glmFacetNormals(GLMmodel* model)
   }
 }
 
-/* glmVertexNormals: Generates smooth vertex normals for a model.
- * First builds a list of all the triangles each vertex is in.  Then
- * loops through each vertex in the list averaging all the facet
- * normals of the triangles each vertex is in.  Finally, sets the
- * normal index in the triangle for the vertex to the generated smooth
- * normal.  If the dot product of a facet normal and the facet normal
- * associated with the first triangle in the list of triangles the
- * current vertex is in is greater than the cosine of the angle
- * parameter to the function, that facet normal is not added into the
- * average normal calculation and the corresponding vertex is given
- * the facet normal.  This tends to preserve hard edges.  The angle to
- * use depends on the model, but 90 degrees is usually a good start.
- *
- * model - initialized GLMmodel structure
- * angle - maximum angle (in degrees) to smooth across
+/* GLMnormals: what the glmVertexNormals() passes share.  The triangles
+ * around each vertex are kept in compressed sparse row form: those of
+ * vertex v are triangles[first[v]] up to triangles[first[v + 1]],
+ * newest first.
  */
-void
-glmVertexNormals(GLMmodel* model, float angle)
+typedef struct {
+  GLMmodel* model;
+  uint*     first;			/* row start for each vertex */
+  uint*     triangles;			/* triangles around each vertex */
+  boolean*  averaged;			/* per row entry: smoothed? */
+  uint*     normal;			/* first normal of each vertex */
+  float     cos_angle;			/* smoothing threshold */
+  uint      numranges;			/* vertices are split this many ways */
+} GLMnormals;
+
+/* _glmNormalsRange: the vertices [begin, end) in range index of a
+ * GLMnormals split
+ */
+static void
+_glmNormalsRange(GLMnormals* normals, uint index, uint* begin, uint* end)
 {
-  GLMnode*  node;
-  GLMnode*  tail;
-  GLMnode** members;
-  float*  normals;
-  uint    numnormals;
+  uint numvertices = normals->model->numvertices;
+
+  *begin = 1 + (uint)((unsigned long long)numvertices * index /
+                      normals->numranges);
+  *end = 1 + (uint)((unsigned long long)numvertices * (index + 1) /
+                    normals->numranges);
+}
+
+/* _glmNormalsCount: _glmParallel() callback deciding which triangles
+ * around each vertex are smoothed together, and counting the normals
+ * each vertex will need.
+ */
+static void
+_glmNormalsCount(void* data, uint index)
+{
+  GLMnormals* normals = (GLMnormals*)data;
+  GLMmodel*   model = normals->model;
+  float*      facet;
+  float*      dir;
+  uint        i, j, begin, end, count;
+  boolean     avg;
+
+  _glmNormalsRange(normals, index, &begin, &end);
+  for (i = begin; i < end; i++) {
+    if (normals->first[i] == normals->first[i + 1])
+      fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
+
+    /* only average if the dot product of the angle between the two
+       facet normals is greater than the cosine of the threshold
+       angle -- or, said another way, the angle between the two
+       facet normals is less than (or equal to) the threshold angle */
+    count = 0;
+    avg = FALSE;
+    for (j = normals->first[i]; j < normals->first[i + 1]; j++) {
+      facet = &model->facetnorms[3 * T(normals->triangles[j]).findex];
+      dir = &model->facetnorms[3 *
+                    T(normals->triangles[normals->first[i]]).findex];
+      normals->averaged[j] = _glmDot(facet, dir) > normals->cos_angle;
+      if (normals->averaged[j])
+        avg = TRUE;
+      else
+        count++;			/* gets the facet normal */
+    }
+    normals->normal[i] = count + avg;	/* plus the average, if any */
+  }
+}
+
+/* _glmNormalsWrite: _glmParallel() callback storing the normals of
+ * each vertex and pointing the triangle corners at them.
+ */
+static void
+_glmNormalsWrite(void* data, uint index)
+{
+  GLMnormals* normals = (GLMnormals*)data;
+  GLMmodel*   model = normals->model;
+  GLMtriangle* triangle;
+  float*      facet;
+  float       average[3];
+  uint        i, j, begin, end, next, avg;
+  boolean     any;
+
+  _glmNormalsRange(normals, index, &begin, &end);
+  for (i = begin; i < end; i++) {
+    next = normals->normal[i];
+
+    /* calculate an average normal for this vertex by averaging the
+       facet normal of every triangle this vertex is in */
+    average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
+    any = FALSE;
+    for (j = normals->first[i]; j < normals->first[i + 1]; j++) {
+      if (normals->averaged[j]) {
+        facet = &model->facetnorms[3 * T(normals->triangles[j]).findex];
+        average[0] += facet[0];
+        average[1] += facet[1];
+        average[2] += facet[2];
+        any = TRUE;
+      }
+    }
+
+    avg = 0;
+    if (any) {
+      /* normalize the averaged normal */
+      _glmNormalize(average);
+
+      /* add the normal to the vertex normals list */
+      model->normals[3 * next + 0] = average[0];
+      model->normals[3 * next + 1] = average[1];
+      model->normals[3 * next + 2] = average[2];
+      avg = next;
+      next++;
+    }
+
+    /* set the normal of this vertex in each triangle it is in */
+    for (j = normals->first[i]; j < normals->first[i + 1]; j++) {
+      triangle = &T(normals->triangles[j]);
+      if (!normals->averaged[j]) {
+        /* if this one wasn't averaged, use the facet normal */
+        facet = &model->facetnorms[3 * triangle->findex];
+        model->normals[3 * next + 0] = facet[0];
+        model->normals[3 * next + 1] = facet[1];
+        model->normals[3 * next + 2] = facet[2];
+      }
+      if (triangle->vindices[0] == i)
+        triangle->nindices[0] = normals->averaged[j] ? avg : next;
+      else if (triangle->vindices[1] == i)
+        triangle->nindices[1] = normals->averaged[j] ? avg : next;
+      else if (triangle->vindices[2] == i)
+        triangle->nindices[2] = normals->averaged[j] ? avg : next;
+      if (!normals->averaged[j])
+        next++;
+    }
+  }
+}
+
+/* smallest number of vertices worth a thread in glmVertexNormals() */
+#define GLM_MIN_NORMALS_RANGE 16384
+
+/* glmVertexNormals: Generates smooth vertex normals for a model.
+ * First builds a list of all the triangles each vertex is in.  Then
+ * loops through each vertex in the list averaging all the facet
+ * normals of the triangles each vertex is in.  Finally, sets the
+ * normal index in the triangle for the vertex to the generated smooth
+ * normal.  If the dot product of a facet normal and the facet normal
+ * associated with the first triangle in the list of triangles the
+ * current vertex is in is greater than the cosine of the angle
+ * parameter to the function, that facet normal is not added into the
+ * average normal calculation and the corresponding vertex is given
+ * the facet normal.  This tends to preserve hard edges.  The angle to
+ * use depends on the model, but 90 degrees is usually a good start.
+ *
+ * The lists are built in two counting passes into flat arrays, and
+ * the vertices are then split between threads: one pass counts the
+ * normals each vertex needs, which gives every vertex its place in
+ * the normals array, and a second pass fills them in.
+ *
+ * model - initialized GLMmodel structure
+ * angle - maximum angle (in degrees) to smooth across
+ */
+void
+glmVertexNormals(GLMmodel* model, float angle)
+{
+  GLMnormals normals;
+  uint       numvertices = model->numvertices;
+  uint       numnormals;
+  uint       count;
+  uint       i, j, v;
+
+  assert(model);
+  assert(model->facetnorms);
+
+  /* calculate the cosine of the angle (in degrees) */
+  normals.cos_angle = cos(angle * M_PI / 180.0);
+  normals.model = model;
+
+  /* nuke any previous normals */
+  if (model->normals)
+    free(model->normals);
+
+  /* count the triangles each vertex is in, and turn the counts into
+     row starts */
+  normals.first = (uint*)calloc(numvertices + 2, sizeof(uint));
+  normals.triangles = (uint*)malloc(sizeof(uint) *
+                                    (3 * model->numtriangles + 1));
+  normals.averaged = (boolean*)malloc(3 * model->numtriangles + 1);
+  normals.normal = (uint*)malloc(sizeof(uint) * (numvertices + 1));
+  if (!normals.first || !normals.triangles || !normals.averaged ||
+      !normals.normal) {
+    fprintf(stderr, "glmVertexNormals() failed: out of memory.\n");
+    exit(1);
+  }
+  for (i = 0; i < model->numtriangles; i++) {
+    normals.first[T(i).vindices[0]]++;
+    normals.first[T(i).vindices[1]]++;
+    normals.first[T(i).vindices[2]]++;
+  }
+  count = 0;
+  for (v = 1; v <= numvertices + 1; v++) {
+    j = normals.first[v];
+    normals.first[v] = count;
+    count += j;
+  }
+
+  /* fill in the rows, newest triangle first (the order the lists
+     used to be built in, which the averaging depends on) */
+  for (v = 1; v <= numvertices; v++)
+    normals.normal[v] = normals.first[v];
+  for (i = model->numtriangles; i-- > 0; ) {
+    for (j = 0; j < 3; j++) {
+      v = T(i).vindices[j];
+      normals.triangles[normals.normal[v]++] = i;
+    }
+  }
+
+  normals.numranges = _glmThreadCount();
+  if (normals.numranges > numvertices / GLM_MIN_NORMALS_RANGE)
+    normals.numranges = numvertices / GLM_MIN_NORMALS_RANGE;
+  if (normals.numranges < 1)
+    normals.numranges = 1;
+
+  /* how many normals each vertex needs decides where they go */
+  _glmParallel(normals.numranges, _glmNormalsCount, &normals);
+  numnormals = 1;
+  for (v = 1; v <= numvertices; v++) {
+    count = normals.normal[v];
+    normals.normal[v] = numnormals;
+    numnormals += count;
+  }
+
+  model->numnormals = numnormals - 1;
+  model->normals = (float*)malloc(sizeof(float) * 3 * (numnormals));
+  if (!model->normals) {
+    fprintf(stderr, "glmVertexNormals() failed: out of memory.\n");
+    exit(1);
+  }
+  _glmParallel(normals.numranges, _glmNormalsWrite, &normals);
+
+  free(normals.first);
+  free(normals.triangles);
+  free(normals.averaged);
+  free(normals.normal);
+
+  printf("glmVertexNormals(): %d normals generated\n", model->numnormals);
+}
+
+
+/* GLMnode: a triangle in the list of those around a vertex, as
+ * glmVertexNormalsLists() builds them
+ */
+typedef struct _GLMnode {
+  uint           index;
+  boolean        averaged;
+  struct _GLMnode* next;
+} GLMnode;
+
+/* glmVertexNormalsLists: the original glmVertexNormals(), which keeps
+ * a malloc'ed linked list of the triangles around each vertex and
+ * walks the vertices on a single thread.  It gives the same normals
+ * and indices as glmVertexNormals(); objview --bench-normals times the
+ * two against each other.
+ *
+ * model - initialized GLMmodel structure
+ * angle - maximum angle (in degrees) to smooth across
+ */
+void
+glmVertexNormalsLists(GLMmodel* model, float angle)
+{
+  GLMnode*  node;
+  GLMnode*  tail;
+  GLMnode** members;
+  float*  normals;
+  uint    numnormals;
   float   average[3];
   float   dot, cos_angle;
   uint    i, avg;
@@ -1107,7 +1965,7 @@ glmVertexNormals(GLMmodel* model, float angle)
        facet normal of every triangle this vertex is in */
     node = members[i];
     if (!node)
-      fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
+      fprintf(stderr, "glmVertexNormalsLists(): vertex w/o a triangle\n");
     average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
     avg = 0;
     while (node) {
@@ -1198,7 +2056,7 @@ glmVertexNormals(GLMmodel* model, float angle)
   }
   free(normals);
 
-  printf("glmVertexNormals(): %d normals generated\n", model->numnormals);
+  printf("glmVertexNormalsLists(): %d normals generated\n", model->numnormals);
 }
 
 
@@ -1348,6 +2206,11 @@ glmDelete(GLMmodel* model)
   if (model->texcoords)  free(model->texcoords);
   if (model->facetnorms) free(model->facetnorms);
   if (model->triangles)  free(model->triangles);
+  glmFreeBuffers(model);
+  if (model->cache) {
+    _glmCloseFile((GLMfile*)model->cache);
+    free(model->cache);
+  }
   if (model->materials) {
     for (i = 0; i < model->nummaterials; i++)
       free(model->materials[i].name);
@@ -1358,6 +2221,12 @@ glmDelete(GLMmodel* model)
     model->groups = model->groups->next;
     free(group->name);
     free(group->triangles);
+    free(group->triIndexes);
+    if (group->lods) {
+      for (i = 0; i < model->numlods; i++)
+        free(group->lods[i].triIndexes);
+      free(group->lods);
+    }
     free(group);
   }
 
@@ -1385,6 +2254,17 @@ glmDefaultMaterial(void)
 }
 
 
+/* glmSetThreads: Sets the number of threads glmReadOBJ() may use to
+ * parse large files.
+ *
+ * numthreads - number of threads, 0 for one per CPU (the default)
+ */
+void
+glmSetThreads(uint numthreads)
+{
+  _glmNumThreads = numthreads;
+}
+
 /* glmReadOBJ: Reads a model description from a Wavefront .OBJ file.
  * Returns a pointer to the created object which should be free'd with
  * glmDelete().
@@ -1395,11 +2275,10 @@ GLMmodel*
 glmReadOBJ(char* filename)
 {
   GLMmodel* model;
-  FILE*     file;
+  GLMfile   file;
 
-  /* open the file */
-  file = fopen(filename, "r");
-  if (!file) {
+  /* map the file */
+  if (!_glmOpenFile(&file, filename)) {
     fprintf(stderr, "glmReadOBJ() failed: can't open data file \"%s\".\n",
 	    filename);
     exit(1);
@@ -1432,32 +2311,18 @@ glmReadOBJ(char* filename)
   model->position[1]   = 0.0;
   model->position[2]   = 0.0;
   model->scale         = 1.0;
+  model->vertexdata    = NULL;
+  model->indexdata     = NULL;
+  model->numindexes    = 0;
+  model->cache         = NULL;
+  model->numlods       = 0;
+  model->lodError[0]   = 0.0;
+  model->lod           = 0;
 
-  /* make a first pass through the file to get a count of the number
-     of vertices, normals, texcoords & triangles */
-  _glmFirstPass(model, file);
-
-  /* allocate memory */
-  model->vertices = (float*)malloc(sizeof(float) *
-				     3 * (model->numvertices + 1));
-  model->triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) *
-					  model->numtriangles);
-  if (model->numnormals) {
-    model->normals = (float*)malloc(sizeof(float) *
-				      3 * (model->numnormals + 1));
-  }
-  if (model->numtexcoords) {
-    model->texcoords = (float*)malloc(sizeof(float) *
-					2 * (model->numtexcoords + 1));
-  }
-
-  /* rewind to beginning of file and read in the data this pass */
-  rewind(file);
-
-  _glmSecondPass(model, file);
+  /* read everything in a single pass over the in-memory file */
+  _glmParseOBJ(model, file.data, file.size);
 
-  /* close the file */
-  fclose(file);
+  _glmCloseFile(&file);
 
   if (!model->materials) {
      model->materials = glmDefaultMaterial();
@@ -1645,8 +2510,40 @@ glmWriteOBJ(GLMmodel* model, char* filename, uint mode)
   fclose(file);
 }
 
-/* glmWeld: eliminate (weld) vectors that are within an epsilon of
- * each other.
+/* _glmWeldArray: weld one of the model's vector arrays and point the
+ * triangles' indices (at offset within GLMtriangle) at the result.
+ * Returns the number of vectors removed.
+ */
+static uint
+_glmWeldArray(GLMmodel* model, float** vectors, uint* numvectors, uint size,
+              size_t offset, float epsilon)
+{
+  float* copies;
+  uint*  remap;
+  uint*  indices;
+  uint   count = *numvectors;
+  uint   i, j;
+
+  remap = (uint*)malloc(sizeof(uint) * (count + 1));
+  copies = _glmWeldVectors(*vectors, numvectors, size, epsilon, remap);
+
+  for (i = 0; i < model->numtriangles; i++) {
+    indices = (uint*)((char*)&T(i) + offset);
+    for (j = 0; j < 3; j++)
+      indices[j] = remap[indices[j]];
+  }
+
+  /* free space for the old vectors, and give back what welding saved */
+  free(*vectors);
+  free(remap);
+  *vectors = (float*)realloc(copies, sizeof(float) * size *
+                             (*numvectors + 1));
+
+  return count - *numvectors;
+}
+
+/* glmWeld: eliminate (weld) vertices, normals and texture coordinates
+ * that are within an epsilon of each other.
  *
  * model      - initialized GLMmodel structure
  * epsilon    - maximum difference between vertices
@@ -1656,41 +2553,26 @@ glmWriteOBJ(GLMmodel* model, char* filename, uint mode)
 void
 glmWeld(GLMmodel* model, float epsilon)
 {
-  float* vectors;
-  float* copies;
-  uint   numvectors;
-  uint   i;
+  uint removed;
 
   /* vertices */
-  numvectors = model->numvertices;
-  vectors    = model->vertices;
-  copies = _glmWeldVectors(vectors, &numvectors, epsilon);
-
-  printf("glmWeld(): %d redundant vertices.\n",
-	 model->numvertices - numvectors - 1);
+  removed = _glmWeldArray(model, &model->vertices, &model->numvertices, 3,
+                          offsetof(GLMtriangle, vindices), epsilon);
+  printf("glmWeld(): %u redundant vertices.\n", removed);
 
-  for (i = 0; i < model->numtriangles; i++) {
-    T(i).vindices[0] = (uint)vectors[3 * T(i).vindices[0] + 0];
-    T(i).vindices[1] = (uint)vectors[3 * T(i).vindices[1] + 0];
-    T(i).vindices[2] = (uint)vectors[3 * T(i).vindices[2] + 0];
+  /* normals */
+  if (model->numnormals) {
+    removed = _glmWeldArray(model, &model->normals, &model->numnormals, 3,
+                            offsetof(GLMtriangle, nindices), epsilon);
+    printf("glmWeld(): %u redundant normals.\n", removed);
   }
 
-  /* free space for old vertices */
-  free(vectors);
-
-  /* allocate space for the new vertices */
-  model->numvertices = numvectors;
-  model->vertices = (float*)malloc(sizeof(float) *
-				     3 * (model->numvertices + 1));
-
-  /* copy the optimized vertices into the actual vertex list */
-  for (i = 1; i <= model->numvertices; i++) {
-    model->vertices[3 * i + 0] = copies[3 * i + 0];
-    model->vertices[3 * i + 1] = copies[3 * i + 1];
-    model->vertices[3 * i + 2] = copies[3 * i + 2];
+  /* texcoords */
+  if (model->numtexcoords) {
+    removed = _glmWeldArray(model, &model->texcoords, &model->numtexcoords,
+                            2, offsetof(GLMtriangle, tindices), epsilon);
+    printf("glmWeld(): %u redundant texcoords.\n", removed);
   }
-
-  free(copies);
 }
 
 
@@ -1767,67 +2649,1707 @@ glmReIndex(GLMmodel *model)
 
 
 
+/* vertex cache size glmOptimize() and glmCacheStats() assume by default */
+#define GLM_VERTEX_CACHE 16
+
+/* glmCacheStats: Simulates a FIFO post-transform vertex cache over the
+ * model's index arrays (as drawn by glmDrawVBO()) and reports the
+ * average cache miss ratio (vertices transformed per triangle, 0.5 at
+ * best on a big regular mesh, 3 at worst) and average transform to
+ * vertex ratio (vertices transformed per vertex used, 1 at best).
+ *
+ * model     - initialized GLMmodel structure that has been glmReIndex()ed
+ * cachesize - number of cache entries (0 for a typical 16)
+ * acmr      - returns the average cache miss ratio
+ * atvr      - returns the average transform to vertex ratio
+ */
 void
-glmPrint(const GLMmodel *model)
+glmCacheStats(const GLMmodel* model, uint cachesize, float* acmr,
+              float* atvr)
 {
-  uint i, j, grp, n;
   GLMgroup* group;
-  uint totalTris = 0;
+  uint*     stamp;			/* miss count when a vertex was loaded */
+  uint      misses = 0, triangles = 0, used = 0;
+  uint      i, v;
 
-  grp = 0;
+  if (!cachesize)
+    cachesize = GLM_VERTEX_CACHE;
 
-  printf("%u vertices\n", model->numvertices);
-  printf("%u normals\n", model->numnormals);
-  printf("%u texcoords\n", model->numtexcoords);
+  /* a vertex is still cached if fewer than cachesize misses happened
+     since it was loaded (stamps are offset by one; 0 = never loaded) */
+  stamp = (uint*)calloc(model->numvertices + 1, sizeof(uint));
+  for (group = model->groups; group; group = group->next) {
+    for (i = 0; i < 3 * group->numtriangles; i++) {
+      v = group->triIndexes[i];
+      if (!stamp[v])
+        used++;
+      if (!stamp[v] || misses + 1 - stamp[v] >= cachesize) {
+        misses++;
+        stamp[v] = misses;
+      }
+    }
+    triangles += group->numtriangles;
+  }
+  free(stamp);
 
-  for (group = model->groups; group; group = group->next, grp++) {
-     printf("Group %u:\n", grp);
-     printf("  Min index %u, max index %u\n", group->minIndex, group->maxIndex);
+  *acmr = triangles ? (float)misses / triangles : 0.0;
+  *atvr = used ? (float)misses / used : 0.0;
+}
 
-#if 0
-    if (mode & GLM_MATERIAL) {
-      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT,
-		   model->materials[group->material].ambient);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE,
-		   model->materials[group->material].diffuse);
-      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR,
-		   model->materials[group->material].specular);
-       glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS,
-  		  model->materials[group->material].shininess);
+/* _glmTipsify: reorder a triangle list for the post-transform vertex
+ * cache, following "Fast Triangle Reordering for Vertex Locality and
+ * Reduced Overdraw" (Sander, Nehab and Barczak, 2007).  Fans out from
+ * one vertex at a time, moving on to a neighbour that is still in the
+ * cache when it can, or else back along the stack of recently used
+ * vertices.
+ *
+ * indices      - 3 * numtriangles vertex indices, 0 to numvertices-1
+ * numtriangles - number of triangles
+ * numvertices  - number of vertices
+ * cachesize    - number of cache entries
+ * order        - returns the triangles in their new order
+ */
+static void
+_glmTipsify(uint* indices, uint numtriangles, uint numvertices,
+            uint cachesize, uint* order)
+{
+  uint*    first;			/* adjacency: row start per vertex */
+  uint*    adjacent;			/* adjacency: triangles per vertex */
+  uint*    live;			/* triangles left to emit, per vertex */
+  uint*    stamp;			/* cache timestamp, per vertex */
+  uint*    stack;			/* dead-end stack of used vertices */
+  uint*    candidates;
+  boolean* emitted;
+  uint     numstack = 0, numcandidates, numorder = 0;
+  uint     time = cachesize + 1;	/* current cache time */
+  uint     cursor = 0;			/* next vertex to try once stuck */
+  uint     i, j, t, v, best;
+  int      f, priority, bestpriority;
+
+  first = (uint*)calloc(numvertices + 1, sizeof(uint));
+  adjacent = (uint*)malloc(sizeof(uint) * 3 * numtriangles);
+  live = (uint*)calloc(numvertices, sizeof(uint));
+  stamp = (uint*)calloc(numvertices, sizeof(uint));
+  stack = (uint*)malloc(sizeof(uint) * 3 * numtriangles);
+  candidates = (uint*)malloc(sizeof(uint) * 3 * numtriangles);
+  emitted = (boolean*)calloc(numtriangles, sizeof(boolean));
+  if (!first || !adjacent || !live || !stamp || !stack || !candidates ||
+      !emitted) {
+    fprintf(stderr, "glmOptimize() failed: out of memory.\n");
+    exit(1);
+  }
+
+  /* vertex -> triangle adjacency */
+  for (i = 0; i < 3 * numtriangles; i++)
+    live[indices[i]]++;
+  for (v = 0; v < numvertices; v++)
+    first[v + 1] = first[v] + live[v];
+  for (v = 0; v < numvertices; v++)
+    stamp[v] = first[v];		/* borrowed as fill positions */
+  for (i = 0; i < 3 * numtriangles; i++)
+    adjacent[stamp[indices[i]]++] = i / 3;
+  memset(stamp, 0, sizeof(uint) * numvertices);
+
+  f = numtriangles ? (int)indices[0] : -1;
+  while (f >= 0) {
+    /* emit all of f's remaining triangles */
+    numcandidates = 0;
+    for (j = first[f]; j < first[f + 1]; j++) {
+      t = adjacent[j];
+      if (emitted[t])
+        continue;
+      emitted[t] = TRUE;
+      order[numorder++] = t;
+      for (i = 0; i < 3; i++) {
+        v = indices[3 * t + i];
+        stack[numstack++] = v;
+        candidates[numcandidates++] = v;
+        live[v]--;
+        if (time - stamp[v] > cachesize) {
+          stamp[v] = time;
+          time++;
+        }
+      }
     }
 
-    if (mode & GLM_COLOR) {
-      glColor3fv(model->materials[group->material].diffuse);
+    /* pick the candidate that will still be in the cache when its
+       remaining triangles are emitted, and has been there longest */
+    best = 0;
+    bestpriority = -1;
+    for (j = 0; j < numcandidates; j++) {
+      v = candidates[j];
+      if (live[v] > 0) {
+        priority = 0;
+        if (time - stamp[v] + 2 * live[v] <= cachesize)
+          priority = time - stamp[v];
+        if (priority > bestpriority) {
+          bestpriority = priority;
+          best = v;
+        }
+      }
     }
-#endif
-    totalTris += group->numtriangles;
 
-    printf("  %u triangles\n", group->numtriangles);
-    n = group->numtriangles;
-    if (n > 10)
-      n = 10;
+    if (bestpriority >= 0) {
+      f = best;
+      continue;
+    }
 
-    for (i = 0; i < n; i++) {
+    /* dead end: back up through recently used vertices, then on
+       through the rest in order */
+    f = -1;
+    while (numstack > 0) {
+      v = stack[--numstack];
+      if (live[v] > 0) {
+        f = v;
+        break;
+      }
+    }
+    while (f < 0 && cursor < 3 * numtriangles) {
+      v = indices[cursor++];
+      if (live[v] > 0)
+        f = v;
+    }
+  }
 
-       printf("    %u: vert ", i);
-       for (j = 0; j < 3; j++) {
-          printf("%u ", T(group->triangles[i]).vindices[j]);
-       }
+  free(first);
+  free(adjacent);
+  free(live);
+  free(stamp);
+  free(stack);
+  free(candidates);
+  free(emitted);
+}
 
-       printf("    normal ");
-       for (j = 0; j < 3; j++) {
-          printf("%u ", T(group->triangles[i]).nindices[j]);
-       }
+/* cache miss ratio a soft cluster may reach, relative to that of the
+   hard cluster it is split from (the paper's lambda) */
+#define GLM_OVERDRAW_THRESHOLD 1.05f
 
-       printf("    tex ");
-       for (j = 0; j < 3; j++) {
-          printf("%u ", T(group->triangles[i]).tindices[j]);
-       }
+/* GLMcluster: a run of triangles that _glmSortClusters() keeps together
+ */
+typedef struct {
+  float key;				/* occlusion potential */
+  uint  first, count;			/* triangles, in cache order */
+} GLMcluster;
+
+/* _glmCacheTriangle: run one triangle through a FIFO cache model
+ * (a vertex is cached while fewer than cachesize misses have happened
+ * since it was loaded) and return how many of its vertices missed
+ */
+static uint
+_glmCacheTriangle(const uint* triangle, uint* stamp, uint* time,
+                  uint cachesize)
+{
+  uint i, v, misses = 0;
+
+  for (i = 0; i < 3; i++) {
+    v = triangle[i];
+    if (*time - stamp[v] > cachesize) {
+      stamp[v] = *time;
+      (*time)++;
+      misses++;
+    }
+  }
+  return misses;
+}
 
-       printf("\n");
+/* _glmCompareClusters: qsort() comparison, most likely occluder first,
+ * then in cache order
+ */
+static int
+_glmCompareClusters(const void* a, const void* b)
+{
+  const GLMcluster* x = (const GLMcluster*)a;
+  const GLMcluster* y = (const GLMcluster*)b;
+
+  if (x->key != y->key)
+    return x->key > y->key ? -1 : 1;
+  return x->first < y->first ? -1 : (x->first > y->first);
+}
+
+/* _glmSortClusters: the overdraw half of Tipsify.  Cuts a vertex cache
+ * order into clusters and draws them outermost first, so that on
+ * average the triangles nearer the viewer are drawn before those
+ * they hide.  The cuts go where a triangle misses the cache on all
+ * three vertices (the cache has been flushed anyway), and inside those
+ * pieces as soon as the miss ratio from the start of the cluster is no
+ * more than GLM_OVERDRAW_THRESHOLD times that of the whole piece, which
+ * keeps the cache cost of moving the clusters around small.  Clusters
+ * are sorted on the dot product of their normal with the direction
+ * from the centroid of the mesh to theirs.
+ *
+ * indices      - 3 * numtriangles vertex indices, 0 to numvertices-1
+ * order        - the triangles in cache order, reordered in place
+ * numtriangles - number of triangles
+ * numvertices  - number of vertices
+ * cachesize    - number of cache entries
+ * vertices     - model vertex positions
+ * global       - model vertex of each of the numvertices vertices
+ */
+static void
+_glmSortClusters(const uint* indices, uint* order, uint numtriangles,
+                 uint numvertices, uint cachesize, const float* vertices,
+                 const uint* global)
+{
+  GLMcluster* clusters;
+  uint*       hard;			/* first triangle of each piece */
+  uint*       stamp;
+  uint*       copy;
+  float*      centroids;		/* area weighted, per triangle */
+  float*      normals;			/* area weighted, per triangle */
+  float       center[3], c[3], n[3], u[3], v[3], area, total, threshold;
+  const float* p[3];
+  uint        numhard = 0, numclusters = 0, time = cachesize + 1;
+  uint        h, i, j, k, t, start, end, misses;
+
+  if (numtriangles < 2)
+    return;
+
+  clusters = (GLMcluster*)malloc(sizeof(GLMcluster) * numtriangles);
+  hard = (uint*)malloc(sizeof(uint) * numtriangles);
+  stamp = (uint*)calloc(numvertices, sizeof(uint));
+  copy = (uint*)malloc(sizeof(uint) * numtriangles);
+  centroids = (float*)malloc(sizeof(float) * 3 * numtriangles);
+  normals = (float*)malloc(sizeof(float) * 3 * numtriangles);
+  if (!clusters || !hard || !stamp || !copy || !centroids || !normals) {
+    fprintf(stderr, "glmOptimize() failed: out of memory.\n");
+    exit(1);
+  }
+
+  /* hard boundaries: the cache is cold again */
+  for (i = 0; i < numtriangles; i++) {
+    if (_glmCacheTriangle(&indices[3 * order[i]], stamp, &time,
+                          cachesize) == 3)
+      hard[numhard++] = i;
+  }
+  if (!numhard || hard[0] != 0) {
+    memmove(hard + 1, hard, sizeof(uint) * numhard);
+    hard[0] = 0;
+    numhard++;
+  }
+
+  /* soft boundaries, simulating each cluster from a cold cache */
+  for (h = 0; h < numhard; h++) {
+    start = hard[h];
+    end = h + 1 < numhard ? hard[h + 1] : numtriangles;
+
+    time += cachesize + 1;
+    misses = 0;
+    for (i = start; i < end; i++)
+      misses += _glmCacheTriangle(&indices[3 * order[i]], stamp, &time,
+                                  cachesize);
+    threshold = GLM_OVERDRAW_THRESHOLD * misses / (end - start);
+
+    time += cachesize + 1;
+    misses = 0;
+    clusters[numclusters].first = start;
+    for (i = start; i < end; i++) {
+      misses += _glmCacheTriangle(&indices[3 * order[i]], stamp, &time,
+                                  cachesize);
+      if (i + 1 < end &&
+          misses <= threshold * (i + 1 - clusters[numclusters].first)) {
+        clusters[numclusters].count = i + 1 - clusters[numclusters].first;
+        numclusters++;
+        clusters[numclusters].first = i + 1;
+        time += cachesize + 1;
+        misses = 0;
+      }
     }
+    clusters[numclusters].count = end - clusters[numclusters].first;
+    numclusters++;
   }
-  printf("Total tris: %u\n", totalTris);
+
+  /* area weighted centroid and normal of each triangle, and of the
+     whole mesh */
+  center[0] = center[1] = center[2] = 0.0;
+  total = 0.0;
+  for (i = 0; i < numtriangles; i++) {
+    t = order[i];
+    for (j = 0; j < 3; j++)
+      p[j] = &vertices[3 * global[indices[3 * t + j]]];
+    for (k = 0; k < 3; k++) {
+      u[k] = p[1][k] - p[0][k];
+      v[k] = p[2][k] - p[0][k];
+    }
+    _glmCross(u, v, &normals[3 * i]);
+    area = (float)sqrt(_glmDot(&normals[3 * i], &normals[3 * i]));
+    for (k = 0; k < 3; k++) {
+      centroids[3 * i + k] = area * (p[0][k] + p[1][k] + p[2][k]) / 3.0f;
+      center[k] += centroids[3 * i + k];
+    }
+    total += area;
+  }
+  if (total > 0.0)
+    for (k = 0; k < 3; k++)
+      center[k] /= total;
+
+  for (h = 0; h < numclusters; h++) {
+    c[0] = c[1] = c[2] = 0.0;
+    n[0] = n[1] = n[2] = 0.0;
+    total = 0.0;
+    for (i = clusters[h].first; i < clusters[h].first + clusters[h].count;
+         i++) {
+      for (k = 0; k < 3; k++) {
+        c[k] += centroids[3 * i + k];
+        n[k] += normals[3 * i + k];
+      }
+      total += (float)sqrt(_glmDot(&normals[3 * i], &normals[3 * i]));
+    }
+    clusters[h].key = 0.0;
+    area = (float)sqrt(_glmDot(n, n));
+    if (total > 0.0 && area > 0.0) {
+      for (k = 0; k < 3; k++)
+        c[k] = c[k] / total - center[k];
+      clusters[h].key = _glmDot(c, n) / area;
+    }
+  }
+
+  qsort(clusters, numclusters, sizeof(GLMcluster), _glmCompareClusters);
+
+  memcpy(copy, order, sizeof(uint) * numtriangles);
+  for (h = 0, i = 0; h < numclusters; h++) {
+    memcpy(&order[i], &copy[clusters[h].first],
+           sizeof(uint) * clusters[h].count);
+    i += clusters[h].count;
+  }
+
+  free(clusters);
+  free(hard);
+  free(stamp);
+  free(copy);
+  free(centroids);
+  free(normals);
+}
+
+/* _glmReorderTriangles: reorder one index list for the vertex cache
+ * with _glmTipsify(), then for overdraw with _glmSortClusters(),
+ * working in a small index space of its own.
+ *
+ * vertices     - model vertex positions
+ * triIndexes   - 3 * numtriangles vertex indices, reordered in place
+ * triangles    - model triangle of each entry, reordered to match
+ *                (may be NULL)
+ * numtriangles - number of triangles
+ * cachesize    - number of cache entries
+ * local        - scratch array of numvertices+1 uints, all ~0u (and
+ *                left that way)
+ */
+static void
+_glmReorderTriangles(const float* vertices, uint* triIndexes,
+                     uint* triangles, uint numtriangles, uint cachesize,
+                     uint* local)
+{
+  uint* global;				/* per local vertex: model index */
+  uint* indices;
+  uint* order;
+  uint* copy;
+  uint  numlocal = 0;
+  uint  i, j, v;
+
+  global = (uint*)malloc(sizeof(uint) * (3 * numtriangles + 1));
+  indices = (uint*)malloc(sizeof(uint) * (3 * numtriangles + 1));
+  order = (uint*)malloc(sizeof(uint) * (numtriangles + 1));
+  copy = (uint*)malloc(sizeof(uint) * (numtriangles + 1));
+  if (!global || !indices || !order || !copy) {
+    fprintf(stderr, "glmOptimize() failed: out of memory.\n");
+    exit(1);
+  }
+
+  for (i = 0; i < 3 * numtriangles; i++) {
+    v = triIndexes[i];
+    if (local[v] == ~0u) {
+      local[v] = numlocal;
+      global[numlocal++] = v;
+    }
+    indices[i] = local[v];
+  }
+
+  _glmTipsify(indices, numtriangles, numlocal, cachesize, order);
+  _glmSortClusters(indices, order, numtriangles, numlocal, cachesize,
+                   vertices, global);
+
+  for (i = 0; i < numtriangles; i++) {
+    for (j = 0; j < 3; j++)
+      triIndexes[3 * i + j] = global[indices[3 * order[i] + j]];
+  }
+  if (triangles) {
+    for (i = 0; i < numtriangles; i++)
+      copy[i] = triangles[order[i]];
+    memcpy(triangles, copy, sizeof(uint) * numtriangles);
+  }
+
+  for (i = 0; i < numlocal; i++)
+    local[global[i]] = ~0u;
+
+  free(global);
+  free(indices);
+  free(order);
+  free(copy);
+}
+
+/* _glmRemapIndices: renumber the vertices in an index list, and
+ * return the smallest and largest new index
+ */
+static void
+_glmRemapIndices(uint* indices, uint count, const uint* remap,
+                 uint* minIndex, uint* maxIndex)
+{
+  uint i, v;
+
+  *minIndex = ~0u;
+  *maxIndex = 0;
+  for (i = 0; i < count; i++) {
+    v = remap[indices[i]];
+    indices[i] = v;
+    if (v < *minIndex)
+      *minIndex = v;
+    if (v > *maxIndex)
+      *maxIndex = v;
+  }
+}
+
+/* glmOptimize: Reorders the triangles of every group so that vertices
+ * get reused while they are still in the GPU's post-transform cache,
+ * then moves clusters of them around so that those facing out of the
+ * mesh are drawn first, which cuts overdraw from most directions at
+ * little cost to the cache.  Finally renumbers the vertices in the
+ * order they're first used, so they're fetched (more or less)
+ * sequentially.  Prints the cache miss ratios (see glmCacheStats())
+ * before and after.
+ *
+ * model     - initialized GLMmodel structure that has been glmReIndex()ed
+ * cachesize - number of cache entries to optimize for (0 for 16)
+ */
+void
+glmOptimize(GLMmodel* model, uint cachesize)
+{
+  GLMgroup* group;
+  uint*     local;			/* scratch for _glmReorderTriangles */
+  uint*     remap;
+  float*    array;
+  float     acmr, atvr, newacmr, newatvr;
+  uint      numvertices = model->numvertices;
+  uint      i, j, l, v, next;
+
+  assert(model);
+  assert(!model->numnormals || model->numnormals == numvertices);
+  assert(!model->numtexcoords || model->numtexcoords == numvertices);
+
+  if (!cachesize)
+    cachesize = GLM_VERTEX_CACHE;
+
+  glmCacheStats(model, cachesize, &acmr, &atvr);
+
+  local = (uint*)malloc(sizeof(uint) * (numvertices + 1));
+  remap = (uint*)malloc(sizeof(uint) * (numvertices + 1));
+  if (!local || !remap) {
+    fprintf(stderr, "glmOptimize() failed: out of memory.\n");
+    exit(1);
+  }
+  for (v = 0; v <= numvertices; v++)
+    local[v] = ~0u;
+
+  /* reorder each group's triangles (and any coarser levels of it) */
+  for (group = model->groups; group; group = group->next) {
+    _glmReorderTriangles(model->vertices, group->triIndexes,
+                         group->triangles, group->numtriangles, cachesize,
+                         local);
+    for (l = 0; l < model->numlods; l++)
+      _glmReorderTriangles(model->vertices, group->lods[l].triIndexes, NULL,
+                           group->lods[l].numtriangles, cachesize, local);
+  }
+
+  /* number the vertices in the order they're first drawn; any that
+     aren't drawn at all go at the end */
+  for (v = 0; v <= numvertices; v++)
+    remap[v] = 0;
+  next = 1;
+  for (group = model->groups; group; group = group->next) {
+    for (i = 0; i < 3 * group->numtriangles; i++) {
+      v = group->triIndexes[i];
+      if (!remap[v])
+        remap[v] = next++;
+    }
+  }
+  for (v = 1; v <= numvertices; v++) {
+    if (!remap[v])
+      remap[v] = next++;
+  }
+
+  for (group = model->groups; group; group = group->next) {
+    _glmRemapIndices(group->triIndexes, 3 * group->numtriangles, remap,
+                     &group->minIndex, &group->maxIndex);
+    for (l = 0; l < model->numlods; l++)
+      _glmRemapIndices(group->lods[l].triIndexes,
+                       3 * group->lods[l].numtriangles, remap,
+                       &group->lods[l].minIndex, &group->lods[l].maxIndex);
+  }
+  for (i = 0; i < model->numtriangles; i++) {
+    for (j = 0; j < 3; j++) {
+      v = remap[T(i).vindices[j]];
+      T(i).vindices[j] = v;
+      T(i).nindices[j] = v;
+      T(i).tindices[j] = v;
+    }
+  }
+
+  /* move the vertex data to match */
+  array = (float*)malloc(sizeof(float) * 3 * (numvertices + 1));
+  for (v = 0; v <= numvertices; v++)
+    memcpy(&array[3 * remap[v]], &model->vertices[3 * v], sizeof(float) * 3);
+  free(model->vertices);
+  model->vertices = array;
+  if (model->numnormals) {
+    array = (float*)malloc(sizeof(float) * 3 * (numvertices + 1));
+    for (v = 0; v <= numvertices; v++)
+      memcpy(&array[3 * remap[v]], &model->normals[3 * v],
+             sizeof(float) * 3);
+    free(model->normals);
+    model->normals = array;
+  }
+  if (model->numtexcoords) {
+    array = (float*)malloc(sizeof(float) * 2 * (numvertices + 1));
+    for (v = 0; v <= numvertices; v++)
+      memcpy(&array[2 * remap[v]], &model->texcoords[2 * v],
+             sizeof(float) * 2);
+    free(model->texcoords);
+    model->texcoords = array;
+  }
+
+  free(local);
+  free(remap);
+
+  glmCacheStats(model, cachesize, &newacmr, &newatvr);
+  printf("glmOptimize(): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+         acmr, newacmr, atvr, newatvr);
+}
+
+
+/* levels of detail */
+
+/* GLMquadric: error quadric of a vertex (the symmetric 4x4 matrix
+ * summing the squared distances to the planes of the triangles around
+ * it) and the total area of those triangles
+ */
+typedef struct {
+  double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+  double area;
+} GLMquadric;
+
+/* GLMcollapse: a candidate edge collapse, moving vertex from onto
+ * vertex to
+ */
+typedef struct {
+  float cost;
+  uint  from, to;
+} GLMcollapse;
+
+/* GLMsimplify: state shared by the glmBuildLODs() passes */
+typedef struct {
+  GLMmodel*   model;
+  GLMquadric* quadrics;			/* per vertex */
+  boolean*    locked;			/* per vertex: on a border */
+  boolean*    touched;			/* per vertex: changed in this pass */
+  uint*       remap;			/* per vertex: where it collapsed to */
+  uint*       first;			/* vertex -> triangle adjacency */
+  uint*       adjacent;
+  GLMcollapse* best;			/* per vertex: cheapest collapse */
+  GLMcollapse* collapses;		/* candidates, cheapest first */
+  float       error;			/* largest collapse error so far */
+} GLMsimplify;
+
+/* _glmQuadricAdd: add quadric r to quadric q */
+static void
+_glmQuadricAdd(GLMquadric* q, const GLMquadric* r)
+{
+  q->a2 += r->a2; q->ab += r->ab; q->ac += r->ac; q->ad += r->ad;
+  q->b2 += r->b2; q->bc += r->bc; q->bd += r->bd;
+  q->c2 += r->c2; q->cd += r->cd;
+  q->d2 += r->d2;
+  q->area += r->area;
+}
+
+/* _glmQuadricError: evaluate a quadric at a point, giving the mean
+ * squared distance to its planes
+ */
+static double
+_glmQuadricError(const GLMquadric* q, const float* p)
+{
+  double x = p[0], y = p[1], z = p[2];
+  double e;
+
+  e = q->a2 * x * x + 2 * q->ab * x * y + 2 * q->ac * x * z +
+      2 * q->ad * x + q->b2 * y * y + 2 * q->bc * y * z + 2 * q->bd * y +
+      q->c2 * z * z + 2 * q->cd * z + q->d2;
+  if (e < 0.0)
+    e = 0.0;				/* rounding */
+  return q->area > 0.0 ? e / q->area : e;
+}
+
+/* _glmCompareCollapses: qsort() comparison, cheapest collapse first */
+static int
+_glmCompareCollapses(const void* a, const void* b)
+{
+  const GLMcollapse* x = (const GLMcollapse*)a;
+  const GLMcollapse* y = (const GLMcollapse*)b;
+
+  if (x->cost != y->cost)
+    return x->cost < y->cost ? -1 : 1;
+  if (x->from != y->from)
+    return x->from < y->from ? -1 : 1;
+  return x->to < y->to ? -1 : (x->to > y->to);
+}
+
+/* _glmCompareEdges: qsort() comparison for packed (min, max) edges */
+static int
+_glmCompareEdges(const void* a, const void* b)
+{
+  unsigned long long x = *(const unsigned long long*)a;
+  unsigned long long y = *(const unsigned long long*)b;
+
+  return x < y ? -1 : (x > y);
+}
+
+/* _glmLodPrepare: compute the vertex quadrics and lock the vertices
+ * that must not move: those on the open border of the mesh, on a
+ * non-manifold edge, or shared between groups.
+ */
+static void
+_glmLodPrepare(GLMsimplify* s, uint* indices, uint* groupof, uint count)
+{
+  GLMmodel*           model = s->model;
+  unsigned long long* edges;
+  uint*               group;
+  float               u[3], v[3], n[3];
+  float*              p[3];
+  GLMquadric          q;
+  double              area, d;
+  uint                i, j, k, a, b;
+
+  /* plane quadrics, weighted by triangle area */
+  for (i = 0; i < count; i++) {
+    for (k = 0; k < 3; k++)
+      p[k] = &model->vertices[3 * indices[3 * i + k]];
+    for (k = 0; k < 3; k++) {
+      u[k] = p[1][k] - p[0][k];
+      v[k] = p[2][k] - p[0][k];
+    }
+    _glmCross(u, v, n);
+    area = 0.5 * sqrt((double)n[0] * n[0] + (double)n[1] * n[1] +
+                      (double)n[2] * n[2]);
+    if (area <= 0.0)
+      continue;
+    _glmNormalize(n);
+    d = -(n[0] * p[0][0] + n[1] * p[0][1] + n[2] * p[0][2]);
+    q.a2 = area * n[0] * n[0]; q.ab = area * n[0] * n[1];
+    q.ac = area * n[0] * n[2]; q.ad = area * n[0] * d;
+    q.b2 = area * n[1] * n[1]; q.bc = area * n[1] * n[2];
+    q.bd = area * n[1] * d;
+    q.c2 = area * n[2] * n[2]; q.cd = area * n[2] * d;
+    q.d2 = area * d * d;
+    q.area = area;
+    for (k = 0; k < 3; k++)
+      _glmQuadricAdd(&s->quadrics[indices[3 * i + k]], &q);
+  }
+
+  /* vertices in more than one group */
+  group = (uint*)malloc(sizeof(uint) * (model->numvertices + 1));
+  for (i = 0; i <= model->numvertices; i++)
+    group[i] = ~0u;
+  for (i = 0; i < 3 * count; i++) {
+    j = indices[i];
+    if (group[j] == ~0u)
+      group[j] = groupof[i / 3];
+    else if (group[j] != groupof[i / 3])
+      s->locked[j] = TRUE;
+  }
+  free(group);
+
+  /* edges used by one triangle (border) or more than two */
+  edges = (unsigned long long*)malloc(sizeof(unsigned long long) *
+                                      (3 * count + 1));
+  for (i = 0; i < count; i++) {
+    for (k = 0; k < 3; k++) {
+      a = indices[3 * i + k];
+      b = indices[3 * i + (k + 1) % 3];
+      if (a > b) {
+        j = a; a = b; b = j;
+      }
+      edges[3 * i + k] = ((unsigned long long)a << 32) | b;
+    }
+  }
+  qsort(edges, 3 * count, sizeof(unsigned long long), _glmCompareEdges);
+  for (i = 0; i < 3 * count; i = j) {
+    for (j = i + 1; j < 3 * count && edges[j] == edges[i]; j++)
+      ;
+    if (j - i != 2) {
+      s->locked[edges[i] >> 32] = TRUE;
+      s->locked[edges[i] & 0xffffffffu] = TRUE;
+    }
+  }
+  free(edges);
+}
+
+/* _glmLodFlips: returns TRUE if moving vertex from onto vertex to
+ * would flip (or flatten) any of the triangles that stay
+ */
+static boolean
+_glmLodFlips(GLMsimplify* s, uint* indices, uint from, uint to)
+{
+  float* vertices = s->model->vertices;
+  float  u[3], v[3], before[3], after[3];
+  float* p[3];
+  uint   i, j, k, t;
+
+  for (i = s->first[from]; i < s->first[from + 1]; i++) {
+    t = s->adjacent[i];
+    if (indices[3 * t] == to || indices[3 * t + 1] == to ||
+        indices[3 * t + 2] == to)
+      continue;				/* goes away */
+    for (k = 0; k < 3; k++)
+      p[k] = &vertices[3 * indices[3 * t + k]];
+    for (j = 0; j < 3; j++) {
+      u[j] = p[1][j] - p[0][j];
+      v[j] = p[2][j] - p[0][j];
+    }
+    _glmCross(u, v, before);
+    for (k = 0; k < 3; k++)
+      if (indices[3 * t + k] == from)
+        p[k] = &vertices[3 * to];
+    for (j = 0; j < 3; j++) {
+      u[j] = p[1][j] - p[0][j];
+      v[j] = p[2][j] - p[0][j];
+    }
+    _glmCross(u, v, after);
+    if (_glmDot(before, after) <= 0.0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* _glmLodSimplify: collapse edges, cheapest first, until no more than
+ * target triangles are left (or nothing more can be collapsed).
+ * Returns the number of triangles left; indices and groupof are
+ * compacted in place.
+ */
+static uint
+_glmLodSimplify(GLMsimplify* s, uint* indices, uint* groupof, uint count,
+                uint target)
+{
+  GLMmodel*   model = s->model;
+  GLMquadric  q;
+  GLMcollapse* c;
+  uint        numcollapses, numvertices = model->numvertices;
+  uint        collapsed, removed;
+  uint        i, j, k, t, v;
+  float       cost;
+
+  while (count > target) {
+    /* vertex -> triangle adjacency of what's left */
+    memset(s->first, 0, sizeof(uint) * (numvertices + 2));
+    for (i = 0; i < 3 * count; i++)
+      s->first[indices[i] + 1]++;
+    for (v = 0; v <= numvertices; v++)
+      s->first[v + 1] += s->first[v];
+    for (i = 0; i < 3 * count; i++)
+      s->adjacent[s->first[indices[i]]++] = i / 3;
+    for (v = numvertices + 1; v > 0; v--)
+      s->first[v] = s->first[v - 1];
+    s->first[0] = 0;
+
+    /* price every edge collapse, both ways, and keep the cheapest one
+       for each vertex */
+    for (v = 0; v <= numvertices; v++)
+      s->best[v].to = 0;
+    for (i = 0; i < count; i++) {
+      for (k = 0; k < 3; k++) {
+        uint a = indices[3 * i + k];
+        uint b = indices[3 * i + (k + 1) % 3];
+
+        for (j = 0; j < 2; j++) {
+          if (!s->locked[a] && a != b) {
+            q = s->quadrics[a];
+            _glmQuadricAdd(&q, &s->quadrics[b]);
+            cost = _glmQuadricError(&q, &model->vertices[3 * b]);
+            c = &s->best[a];
+            if (!c->to || cost < c->cost || (cost == c->cost && b < c->to)) {
+              c->cost = cost;
+              c->from = a;
+              c->to = b;
+            }
+          }
+          t = a; a = b; b = t;
+        }
+      }
+    }
+    numcollapses = 0;
+    for (v = 1; v <= numvertices; v++) {
+      if (s->best[v].to)
+        s->collapses[numcollapses++] = s->best[v];
+    }
+    qsort(s->collapses, numcollapses, sizeof(GLMcollapse),
+          _glmCompareCollapses);
+
+    /* take the cheapest ones that don't touch each other */
+    memset(s->touched, 0, sizeof(boolean) * (numvertices + 1));
+    collapsed = removed = 0;
+    for (i = 0; i < numcollapses && count - removed > target; i++) {
+      c = &s->collapses[i];
+      if (s->touched[c->from] || s->touched[c->to] ||
+          _glmLodFlips(s, indices, c->from, c->to))
+        continue;
+
+      for (j = s->first[c->from]; j < s->first[c->from + 1]; j++) {
+        t = s->adjacent[j];
+        for (k = 0; k < 3; k++) {
+          s->touched[indices[3 * t + k]] = TRUE;
+          if (indices[3 * t + k] == c->to)
+            removed++;
+        }
+      }
+      s->remap[c->from] = c->to;
+      _glmQuadricAdd(&s->quadrics[c->to], &s->quadrics[c->from]);
+      if (sqrt(c->cost) > s->error)
+        s->error = sqrt(c->cost);
+      collapsed++;
+    }
+    if (!collapsed)
+      break;
+
+    /* move the collapsed vertices and drop the triangles that died */
+    for (i = 0, t = 0; i < count; i++) {
+      uint a = s->remap[indices[3 * i + 0]];
+      uint b = s->remap[indices[3 * i + 1]];
+      uint d = s->remap[indices[3 * i + 2]];
+
+      if (a == b || b == d || d == a)
+        continue;
+      indices[3 * t + 0] = a;
+      indices[3 * t + 1] = b;
+      indices[3 * t + 2] = d;
+      groupof[t] = groupof[i];
+      t++;
+    }
+    count = t;
+  }
+
+  return count;
+}
+
+/* glmBuildLODs: Builds up to GLM_MAX_LODS coarser levels of detail by
+ * quadric edge collapse (Garland and Heckbert, "Surface Simplification
+ * Using Quadric Error Metrics"), each with about half the triangles of
+ * the one before.  Vertices only ever collapse onto other vertices, so
+ * the levels share the model's vertex data and only add index data.
+ * Vertices on group and mesh borders are kept where they are, so the
+ * groups still fit together.  The error of each level is the largest
+ * (root mean square) distance a collapse moved the surface by.
+ *
+ * model        - initialized GLMmodel structure that has been glmReIndex()ed
+ * mintriangles - stop when a level would have fewer triangles than this
+ */
+void
+glmBuildLODs(GLMmodel* model, uint mintriangles)
+{
+  GLMsimplify s;
+  GLMgroup*   group;
+  GLMlod*     lod;
+  uint*       indices;
+  uint*       groupof;
+  uint*       local;
+  uint        count, newcount, level, g, i, v;
+
+  assert(model);
+
+  /* throw away any previous levels */
+  for (group = model->groups; group; group = group->next) {
+    if (group->lods) {
+      for (level = 0; level < model->numlods; level++)
+        free(group->lods[level].triIndexes);
+      free(group->lods);
+    }
+    group->lods = (GLMlod*)calloc(GLM_MAX_LODS, sizeof(GLMlod));
+  }
+  model->numlods = 0;
+  model->lodError[0] = 0.0;
+  model->lod = 0;
+
+  /* start from the full detail triangles, and which group they're in */
+  indices = (uint*)malloc(sizeof(uint) * (3 * model->numtriangles + 1));
+  groupof = (uint*)malloc(sizeof(uint) * (model->numtriangles + 1));
+  count = 0;
+  for (group = model->groups, g = 0; group; group = group->next, g++) {
+    memcpy(&indices[3 * count], group->triIndexes,
+           sizeof(uint) * 3 * group->numtriangles);
+    for (i = 0; i < group->numtriangles; i++)
+      groupof[count++] = g;
+  }
+
+  s.model = model;
+  s.quadrics = (GLMquadric*)calloc(model->numvertices + 1, sizeof(GLMquadric));
+  s.locked = (boolean*)calloc(model->numvertices + 1, sizeof(boolean));
+  s.touched = (boolean*)malloc(sizeof(boolean) * (model->numvertices + 1));
+  s.remap = (uint*)malloc(sizeof(uint) * (model->numvertices + 1));
+  s.first = (uint*)malloc(sizeof(uint) * (model->numvertices + 2));
+  s.adjacent = (uint*)malloc(sizeof(uint) * (3 * count + 1));
+  s.best = (GLMcollapse*)malloc(sizeof(GLMcollapse) *
+                                (model->numvertices + 1));
+  s.collapses = (GLMcollapse*)malloc(sizeof(GLMcollapse) *
+                                     (model->numvertices + 1));
+  s.error = 0.0;
+  local = (uint*)malloc(sizeof(uint) * (model->numvertices + 1));
+  if (!indices || !groupof || !s.quadrics || !s.locked || !s.touched ||
+      !s.remap || !s.first || !s.adjacent || !s.best || !s.collapses ||
+      !local) {
+    fprintf(stderr, "glmBuildLODs() failed: out of memory.\n");
+    exit(1);
+  }
+  for (v = 0; v <= model->numvertices; v++) {
+    s.remap[v] = v;
+    local[v] = ~0u;
+  }
+
+  _glmLodPrepare(&s, indices, groupof, count);
+
+  for (level = 1; level <= GLM_MAX_LODS; level++) {
+    if (count / 2 < mintriangles)
+      break;
+    newcount = _glmLodSimplify(&s, indices, groupof, count, count / 2);
+    if (newcount > count - count / 4)
+      break;				/* not getting anywhere */
+    count = newcount;
+
+    /* split the level back up by group, and order it for the cache */
+    for (group = model->groups; group; group = group->next)
+      group->lods[level - 1].numtriangles = 0;
+    for (group = model->groups, g = 0; group; group = group->next, g++) {
+      lod = &group->lods[level - 1];
+      for (i = 0; i < count; i++)
+        if (groupof[i] == g)
+          lod->numtriangles++;
+      lod->triIndexes = (uint*)malloc(sizeof(uint) *
+                                      (3 * lod->numtriangles + 1));
+      lod->numtriangles = 0;
+      lod->minIndex = ~0u;
+      lod->maxIndex = 0;
+      for (i = 0; i < count; i++) {
+        if (groupof[i] != g)
+          continue;
+        memcpy(&lod->triIndexes[3 * lod->numtriangles], &indices[3 * i],
+               sizeof(uint) * 3);
+        lod->numtriangles++;
+      }
+      for (i = 0; i < 3 * lod->numtriangles; i++) {
+        if (lod->triIndexes[i] < lod->minIndex)
+          lod->minIndex = lod->triIndexes[i];
+        if (lod->triIndexes[i] > lod->maxIndex)
+          lod->maxIndex = lod->triIndexes[i];
+      }
+      _glmReorderTriangles(model->vertices, lod->triIndexes, NULL,
+                           lod->numtriangles, GLM_VERTEX_CACHE, local);
+    }
+
+    model->numlods = level;
+    model->lodError[level] = s.error;
+    printf("glmBuildLODs(): level %u, %u triangles, error %g\n",
+           level, count, s.error);
+  }
+
+  free(indices);
+  free(groupof);
+  free(s.quadrics);
+  free(s.locked);
+  free(s.touched);
+  free(s.remap);
+  free(s.first);
+  free(s.adjacent);
+  free(s.best);
+  free(s.collapses);
+  free(local);
+}
+
+/* glmChooseLOD: Returns the coarsest level of detail whose error,
+ * projected to the screen, is no more than maxerror pixels.
+ *
+ * model         - initialized GLMmodel structure
+ * pixelsperunit - pixels covered by one model unit at the model's
+ *                 nearest point
+ * maxerror      - largest acceptable error, in pixels
+ */
+uint
+glmChooseLOD(const GLMmodel* model, float pixelsperunit, float maxerror)
+{
+  uint lod;
+
+  for (lod = model->numlods; lod > 0; lod--) {
+    if (model->lodError[lod] * pixelsperunit <= maxerror)
+      break;
+  }
+  return lod;
+}
+
+
+
+void
+glmPrint(const GLMmodel *model)
+{
+  uint i, j, grp, n;
+  GLMgroup* group;
+  uint totalTris = 0;
+
+  grp = 0;
+
+  printf("%u vertices\n", model->numvertices);
+  printf("%u normals\n", model->numnormals);
+  printf("%u texcoords\n", model->numtexcoords);
+
+  for (group = model->groups; group; group = group->next, grp++) {
+     printf("Group %u:\n", grp);
+     printf("  Min index %u, max index %u\n", group->minIndex, group->maxIndex);
+
+#if 0
+    if (mode & GLM_MATERIAL) {
+      glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT,
+		   model->materials[group->material].ambient);
+      glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE,
+		   model->materials[group->material].diffuse);
+      glMaterialfv(GL_FRONT_AND_BACK, GL_SPECULAR,
+		   model->materials[group->material].specular);
+       glMaterialf(GL_FRONT_AND_BACK, GL_SHININESS,
+  		  model->materials[group->material].shininess);
+    }
+
+    if (mode & GLM_COLOR) {
+      glColor3fv(model->materials[group->material].diffuse);
+    }
+#endif
+    totalTris += group->numtriangles;
+
+    printf("  %u triangles\n", group->numtriangles);
+    n = group->numtriangles;
+    if (n > 10)
+      n = 10;
+
+    for (i = 0; i < n; i++) {
+
+       printf("    %u: vert ", i);
+       for (j = 0; j < 3; j++) {
+          printf("%u ", T(group->triangles[i]).vindices[j]);
+       }
+
+       printf("    normal ");
+       for (j = 0; j < 3; j++) {
+          printf("%u ", T(group->triangles[i]).nindices[j]);
+       }
+
+       printf("    tex ");
+       for (j = 0; j < 3; j++) {
+          printf("%u ", T(group->triangles[i]).tindices[j]);
+       }
+
+       printf("\n");
+    }
+  }
+  printf("Total tris: %u\n", totalTris);
+}
+
+
+/* binary cache */
+
+/* A cache file holds a model exactly as glmMakeVBOs() wants it, so it
+ * can be mapped and handed to OpenGL without parsing or copying:
+ *
+ *   GLMcacheheader
+ *   GLMcachematerial[nummaterials]
+ *   GLMcachegroup[numgroups]		(in model->groups order)
+ *   float vertexdata[(numvertices + 1) * vertexsize]
+ *   uint  indexdata[numindexes]
+ *   char  strings[]			(NUL terminated names)
+ *
+ * Every section starts at a multiple of GLM_CACHE_ALIGN bytes.  The
+ * header records the size, inode and modification time (to the
+ * nanosecond, where stat() has it) of the .obj file the cache was
+ * built from, and the parameters it was processed with; a cache that
+ * doesn't match is ignored.
+ */
+
+#define GLM_CACHE_MAGIC   0x434d4c47u	/* "GLMC" in little endian */
+#define GLM_CACHE_VERSION 6
+#define GLM_CACHE_ALIGN   16
+#define GLM_CACHE_SUFFIX  ".glmc"
+#define GLM_CACHE_NONE    0xffffffffu	/* no string */
+
+/* nanoseconds of a stat() modification time, where there are any */
+#if defined(__APPLE__)
+#define GLM_MTIME_NSEC(st) ((st)->st_mtimespec.tv_nsec)
+#elif defined(_WIN32)
+#define GLM_MTIME_NSEC(st) 0
+#else
+#define GLM_MTIME_NSEC(st) ((st)->st_mtim.tv_nsec)
+#endif
+
+/* GLMcachestamp: identifies the version of the .obj file a cache was
+ * built from
+ */
+typedef struct {
+  unsigned long long size;
+  unsigned long long ino;
+  long long          mtime;		/* seconds */
+  unsigned long long mtimensec;
+} GLMcachestamp;
+
+typedef struct {
+  uint   magic;				/* GLM_CACHE_MAGIC */
+  uint   version;			/* GLM_CACHE_VERSION */
+  GLMcachestamp src;			/* the .obj file */
+  GLMcacheparams params;		/* how it was processed */
+  uint   numvertices;
+  uint   numnormals;
+  uint   numtexcoords;
+  uint   numtriangles;
+  uint   numindexes;
+  uint   nummaterials;
+  uint   numgroups;
+  uint   vertexsize;			/* floats per vertex */
+  uint   posoffset, normoffset, texoffset;	/* bytes into a vertex */
+  uint   mtllibname;			/* string offset */
+  uint   numlods;			/* coarser levels of detail */
+  float  lodError[GLM_MAX_LODS + 1];	/* error of each level */
+  uint   materialoffset;		/* byte offsets of the sections */
+  uint   groupoffset;
+  uint   vertexoffset;
+  uint   indexoffset;
+  uint   stringoffset;
+  uint   size;				/* size of the whole file */
+} GLMcacheheader;
+
+typedef struct {
+  uint  name;				/* string offset */
+  uint  map_kd;				/* string offset */
+  float diffuse[4];
+  float ambient[4];
+  float specular[4];
+  float emmissive[4];
+  float shininess;
+} GLMcachematerial;
+
+typedef struct {
+  uint numtriangles;
+  uint minindex, maxindex;
+  uint indexoffset;			/* bytes into the index section */
+} GLMcacherange;
+
+typedef struct {
+  uint name;				/* string offset */
+  uint material;
+  GLMcacherange full;			/* full detail triangles */
+  GLMcacherange lods[GLM_MAX_LODS];	/* coarser levels */
+} GLMcachegroup;
+
+/* _glmCachePath: return the name of the cache file for a model file
+ * (malloc'ed)
+ */
+static char*
+_glmCachePath(const char* filename)
+{
+  char* path;
+
+  path = (char*)malloc(strlen(filename) + strlen(GLM_CACHE_SUFFIX) + 1);
+  strcpy(path, filename);
+  strcat(path, GLM_CACHE_SUFFIX);
+  return path;
+}
+
+/* _glmCacheStamp: fill in the stamp of a file from its stat() */
+static void
+_glmCacheStamp(const struct stat* st, GLMcachestamp* stamp)
+{
+  memset(stamp, 0, sizeof(*stamp));
+  stamp->size      = (unsigned long long)st->st_size;
+  stamp->ino       = (unsigned long long)st->st_ino;
+  stamp->mtime     = (long long)st->st_mtime;
+  stamp->mtimensec = (unsigned long long)GLM_MTIME_NSEC(st);
+}
+
+/* _glmSameStamp: whether two stamps are of the same version of a file */
+static boolean
+_glmSameStamp(const GLMcachestamp* a, const GLMcachestamp* b)
+{
+  return a->size == b->size && a->ino == b->ino &&
+         a->mtime == b->mtime && a->mtimensec == b->mtimensec;
+}
+
+/* _glmSameParams: whether a model was processed the way a reader wants */
+static boolean
+_glmSameParams(const GLMcacheparams* a, const GLMcacheparams* b)
+{
+  return a->smoothingangle == b->smoothingangle &&
+         a->cachesize == b->cachesize &&
+         a->lodtriangles == b->lodtriangles;
+}
+
+/* _glmCacheAttribOK: check that an attribute of n floats at a byte
+ * offset lies within a vertex of vertexsize floats
+ */
+static boolean
+_glmCacheAttribOK(uint offset, uint n, uint vertexsize)
+{
+  return offset % sizeof(float) == 0 &&
+         offset / sizeof(float) + n <= vertexsize;
+}
+
+/* _glmCacheAlign: round a byte offset up to the section alignment */
+static uint
+_glmCacheAlign(uint offset)
+{
+  return (offset + GLM_CACHE_ALIGN - 1) & ~(GLM_CACHE_ALIGN - 1);
+}
+
+/* _glmCacheString: add a string to a cache string table and return
+ * its offset in the table (GLM_CACHE_NONE for NULL).
+ */
+static uint
+_glmCacheString(char** strings, uint* size, uint* max, const char* string)
+{
+  uint offset = *size;
+  uint length;
+
+  if (!string)
+    return GLM_CACHE_NONE;
+  length = strlen(string) + 1;
+  while (*size + length > *max) {
+    *max = *max ? *max * 2 : 256;
+    *strings = (char*)realloc(*strings, *max);
+  }
+  memcpy(*strings + offset, string, length);
+  *size += length;
+  return offset;
+}
+
+/* _glmCacheWrite: pad a cache file out to offset and write a section
+ * there.  Returns FALSE on a write error.
+ */
+static boolean
+_glmCacheWrite(FILE* file, uint offset, const void* data, size_t size)
+{
+  static const char zeros[GLM_CACHE_ALIGN] = { 0 };
+  long pad = (long)offset - ftell(file);
+
+  if (pad < 0 || pad > GLM_CACHE_ALIGN ||
+      fwrite(zeros, 1, pad, file) != (size_t)pad)
+    return FALSE;
+  return size == 0 || fwrite(data, 1, size, file) == size;
+}
+
+/* _glmCacheName: look up a string in a mapped cache; NULL if invalid */
+static const char*
+_glmCacheName(const GLMcacheheader* header, uint offset)
+{
+  const char* strings = (const char*)header + header->stringoffset;
+  uint        size    = header->size - header->stringoffset;
+
+  if (offset >= size || !memchr(strings + offset, 0, size - offset))
+    return NULL;
+  return strings + offset;
+}
+
+/* glmMakeBuffers: Builds the interleaved vertex array and the single
+ * index array that glmMakeVBOs() uploads, unless the model already has
+ * them (from glmReadCache()).
+ *
+ * model - initialized GLMmodel structure that has been glmReIndex()ed
+ */
+void
+glmMakeBuffers(GLMmodel* model)
+{
+  GLMgroup* group;
+  GLMlod* lod;
+  uint vertexFloats, i, j, l;
+  float* buffer;
+
+  if (model->vertexdata)
+    return;
+
+  vertexFloats = 3;
+  model->posOffset = 0;
+
+  if (model->numnormals > 0) {
+    assert(model->numnormals == model->numvertices);
+    model->normOffset = vertexFloats * sizeof(float);
+    vertexFloats += 3;
+  }
+
+  if (model->numtexcoords > 0) {
+    assert(model->numtexcoords == model->numvertices);
+    model->texOffset = vertexFloats * sizeof(float);
+    vertexFloats += 2;
+  }
+
+  model->vertexSize = vertexFloats;
+
+  /* vertex 0 is unused but kept so the 1-based indices work as is */
+  buffer = (float*)malloc((model->numvertices + 1) * vertexFloats *
+                          sizeof(float));
+  memset(buffer, 0, vertexFloats * sizeof(float));
+  for (i = 1; i <= model->numvertices; i++) {
+    j = 0;
+    buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 0];
+    buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 1];
+    buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 2];
+    if (model->numnormals > 0) {
+      buffer[i * vertexFloats + j++] = model->normals[i * 3 + 0];
+      buffer[i * vertexFloats + j++] = model->normals[i * 3 + 1];
+      buffer[i * vertexFloats + j++] = model->normals[i * 3 + 2];
+    }
+    if (model->numtexcoords > 0) {
+      buffer[i * vertexFloats + j++] = model->texcoords[i * 2 + 0];
+      buffer[i * vertexFloats + j++] = model->texcoords[i * 2 + 1];
+    }
+  }
+  model->vertexdata = buffer;
+
+  /* all the groups' indices, one after another, then those of each
+     coarser level in turn */
+  model->numindexes = 0;
+  for (group = model->groups; group; group = group->next) {
+    model->numindexes += 3 * group->numtriangles;
+    for (l = 0; l < model->numlods; l++)
+      model->numindexes += 3 * group->lods[l].numtriangles;
+  }
+
+  model->indexdata = (uint*)malloc((model->numindexes + 1) * sizeof(uint));
+  i = 0;
+  for (group = model->groups; group; group = group->next) {
+    group->indexVboOffset = i * sizeof(uint);
+    if (group->numtriangles > 0) {
+      memcpy(&model->indexdata[i], group->triIndexes,
+             3 * group->numtriangles * sizeof(uint));
+      i += 3 * group->numtriangles;
+    }
+  }
+  for (l = 0; l < model->numlods; l++) {
+    for (group = model->groups; group; group = group->next) {
+      lod = &group->lods[l];
+      lod->indexVboOffset = i * sizeof(uint);
+      if (lod->numtriangles > 0) {
+        memcpy(&model->indexdata[i], lod->triIndexes,
+               3 * lod->numtriangles * sizeof(uint));
+        i += 3 * lod->numtriangles;
+      }
+    }
+  }
+}
+
+/* glmFreeBuffers: Frees the arrays built by glmMakeBuffers() (once
+ * they have been uploaded, say).  Arrays that live in a mapped cache
+ * are kept.
+ *
+ * model - initialized GLMmodel structure
+ */
+void
+glmFreeBuffers(GLMmodel* model)
+{
+  if (model->cache)
+    return;
+  free(model->vertexdata);
+  free(model->indexdata);
+  model->vertexdata = NULL;
+  model->indexdata = NULL;
+}
+
+/* glmWriteCache: Writes a binary cache of a model next to the .obj
+ * file it was read from (filename + ".glmc"), for glmReadCache() to
+ * pick up next time.  The model should be fully processed (normals
+ * generated, glmReIndex()ed): the cache stores the result, not the
+ * steps.  Returns 0 on success, -1 if the cache couldn't be written.
+ *
+ * model    - initialized GLMmodel structure
+ * filename - name of the .obj file the model was read from
+ * params   - how the model was processed, recorded for glmReadCache()
+ */
+int
+glmWriteCache(GLMmodel* model, char* filename, const GLMcacheparams* params)
+{
+  GLMcacheheader    header;
+  GLMcachematerial* materials;
+  GLMcachegroup*    groups;
+  GLMgroup*         group;
+  struct stat       st;
+  char*             strings = NULL;
+  uint              stringsize = 0, maxstrings = 0;
+  char*             path;
+  FILE*             file;
+  uint              i, l, ok;
+
+  if (model->cache)
+    return 0;
+  if (stat(filename, &st) != 0)
+    return -1;
+
+  glmMakeBuffers(model);
+
+  memset(&header, 0, sizeof(header));
+  header.magic        = GLM_CACHE_MAGIC;
+  header.version      = GLM_CACHE_VERSION;
+  _glmCacheStamp(&st, &header.src);
+  header.params       = *params;
+  header.numvertices  = model->numvertices;
+  header.numnormals   = model->numnormals;
+  header.numtexcoords = model->numtexcoords;
+  header.numtriangles = model->numtriangles;
+  header.numindexes   = model->numindexes;
+  header.nummaterials = model->nummaterials;
+  header.numgroups    = model->numgroups;
+  header.vertexsize   = model->vertexSize;
+  header.posoffset    = model->posOffset;
+  header.normoffset   = model->normOffset;
+  header.texoffset    = model->texOffset;
+  header.mtllibname   = _glmCacheString(&strings, &stringsize, &maxstrings,
+                                        model->mtllibname);
+  header.numlods      = model->numlods;
+  memcpy(header.lodError, model->lodError,
+         sizeof(float) * (model->numlods + 1));
+
+  materials = (GLMcachematerial*)calloc(model->nummaterials + 1,
+                                        sizeof(GLMcachematerial));
+  for (i = 0; i < model->nummaterials; i++) {
+    GLMmaterial* material = &model->materials[i];
+
+    materials[i].name = _glmCacheString(&strings, &stringsize, &maxstrings,
+                                        material->name);
+    materials[i].map_kd = _glmCacheString(&strings, &stringsize, &maxstrings,
+                                          material->map_kd);
+    memcpy(materials[i].diffuse, material->diffuse, sizeof(float) * 4);
+    memcpy(materials[i].ambient, material->ambient, sizeof(float) * 4);
+    memcpy(materials[i].specular, material->specular, sizeof(float) * 4);
+    memcpy(materials[i].emmissive, material->emmissive, sizeof(float) * 4);
+    materials[i].shininess = material->shininess;
+  }
+
+  groups = (GLMcachegroup*)calloc(model->numgroups + 1,
+                                  sizeof(GLMcachegroup));
+  for (group = model->groups, i = 0; group; group = group->next, i++) {
+    groups[i].name = _glmCacheString(&strings, &stringsize, &maxstrings,
+                                     group->name);
+    groups[i].material          = group->material;
+    groups[i].full.numtriangles = group->numtriangles;
+    groups[i].full.minindex     = group->minIndex;
+    groups[i].full.maxindex     = group->maxIndex;
+    groups[i].full.indexoffset  = group->indexVboOffset;
+    for (l = 0; l < model->numlods; l++) {
+      groups[i].lods[l].numtriangles = group->lods[l].numtriangles;
+      groups[i].lods[l].minindex     = group->lods[l].minIndex;
+      groups[i].lods[l].maxindex     = group->lods[l].maxIndex;
+      groups[i].lods[l].indexoffset  = group->lods[l].indexVboOffset;
+    }
+  }
+
+  /* lay out the sections */
+  header.materialoffset = _glmCacheAlign(sizeof(header));
+  header.groupoffset    = _glmCacheAlign(header.materialoffset +
+                            model->nummaterials * sizeof(GLMcachematerial));
+  header.vertexoffset   = _glmCacheAlign(header.groupoffset +
+                            model->numgroups * sizeof(GLMcachegroup));
+  header.indexoffset    = _glmCacheAlign(header.vertexoffset +
+                            (model->numvertices + 1) * model->vertexSize *
+                            sizeof(float));
+  header.stringoffset   = _glmCacheAlign(header.indexoffset +
+                            model->numindexes * sizeof(uint));
+  header.size           = header.stringoffset + stringsize;
+
+  /* write to a temporary file and rename it into place, so a reader
+     never sees a partial cache */
+  path = (char*)malloc(strlen(filename) + strlen(GLM_CACHE_SUFFIX) + 5);
+  sprintf(path, "%s%s.tmp", filename, GLM_CACHE_SUFFIX);
+  file = fopen(path, "wb");
+  ok = file != NULL;
+  if (ok) {
+    ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && _glmCacheWrite(file, header.materialoffset, materials,
+                              model->nummaterials * sizeof(GLMcachematerial));
+    ok = ok && _glmCacheWrite(file, header.groupoffset, groups,
+                              model->numgroups * sizeof(GLMcachegroup));
+    ok = ok && _glmCacheWrite(file, header.vertexoffset, model->vertexdata,
+                              (model->numvertices + 1) * model->vertexSize *
+                              sizeof(float));
+    ok = ok && _glmCacheWrite(file, header.indexoffset, model->indexdata,
+                              model->numindexes * sizeof(uint));
+    ok = ok && _glmCacheWrite(file, header.stringoffset, strings,
+                              stringsize);
+    ok = (fclose(file) == 0) && ok;
+  }
+  if (ok) {
+    char* cachepath = _glmCachePath(filename);
+
+    remove(cachepath);
+    ok = rename(path, cachepath) == 0;
+    free(cachepath);
+  }
+  if (!ok)
+    remove(path);
+
+  free(path);
+  free(strings);
+  free(groups);
+  free(materials);
+
+  return ok ? 0 : -1;
+}
+
+/* _glmCacheRangeOK: check that a cached index range lies within the
+ * index data and the vertices
+ */
+static boolean
+_glmCacheRangeOK(const GLMmodel* model, const GLMcacherange* range)
+{
+  return range->indexoffset / sizeof(uint) + 3.0 * range->numtriangles <=
+           model->numindexes &&
+         range->maxindex <= model->numvertices;
+}
+
+/* glmReadCache: Reads a model from the binary cache glmWriteCache()
+ * left next to a .obj file.  Returns NULL if there is no cache, or it
+ * is out of date with respect to the .obj file, or was processed with
+ * other parameters, or is unreadable.
+ *
+ * The cache is mapped and the model's vertexdata and indexdata point
+ * straight into it, ready for glmMakeVBOs().  The model has no
+ * vertices, normals, texcoords or triangles arrays, so it can be
+ * drawn with glmDrawVBO() but not edited.
+ *
+ * filename - name of the .obj file the cache was built from
+ * params   - how the model should have been processed
+ */
+GLMmodel*
+glmReadCache(char* filename, const GLMcacheparams* params)
+{
+  const GLMcacheheader*   header;
+  const GLMcachematerial* materials;
+  const GLMcachegroup*    groups;
+  GLMmodel*               model;
+  GLMgroup*               group;
+  GLMgroup**              tail;
+  GLMfile*                file;
+  struct stat             st;
+  GLMcachestamp           stamp;
+  const char*             name;
+  char*                   path;
+  uint                    i, l;
+
+  if (stat(filename, &st) != 0)
+    return NULL;
+  _glmCacheStamp(&st, &stamp);
+
+  file = (GLMfile*)malloc(sizeof(GLMfile));
+  path = _glmCachePath(filename);
+  if (!_glmOpenFile(file, path)) {
+    free(path);
+    free(file);
+    return NULL;
+  }
+  free(path);
+
+  /* make sure it's a cache of this very file, and hangs together */
+  header = (const GLMcacheheader*)file->data;
+  if (file->size < sizeof(GLMcacheheader) ||
+      header->magic != GLM_CACHE_MAGIC ||
+      header->version != GLM_CACHE_VERSION ||
+      header->numlods > GLM_MAX_LODS ||
+      !_glmSameStamp(&header->src, &stamp) ||
+      !_glmSameParams(&header->params, params) ||
+      header->size != file->size ||
+      !_glmCacheAttribOK(header->posoffset, 3, header->vertexsize) ||
+      (header->numnormals &&
+       !_glmCacheAttribOK(header->normoffset, 3, header->vertexsize)) ||
+      (header->numtexcoords &&
+       !_glmCacheAttribOK(header->texoffset, 2, header->vertexsize)) ||
+      header->materialoffset > header->groupoffset ||
+      header->groupoffset - header->materialoffset <
+        header->nummaterials * sizeof(GLMcachematerial) ||
+      header->vertexoffset < header->groupoffset ||
+      header->vertexoffset - header->groupoffset <
+        header->numgroups * sizeof(GLMcachegroup) ||
+      header->indexoffset < header->vertexoffset ||
+      (header->indexoffset - header->vertexoffset) / sizeof(float) <
+        (header->numvertices + 1.0) * header->vertexsize ||
+      header->stringoffset < header->indexoffset ||
+      (header->stringoffset - header->indexoffset) / sizeof(uint) <
+        header->numindexes ||
+      header->stringoffset > header->size) {
+    _glmCloseFile(file);
+    free(file);
+    return NULL;
+  }
+  materials = (const GLMcachematerial*)(file->data + header->materialoffset);
+  groups = (const GLMcachegroup*)(file->data + header->groupoffset);
+
+  model = (GLMmodel*)calloc(1, sizeof(GLMmodel));
+  model->pathname     = stralloc(filename);
+  model->numvertices  = header->numvertices;
+  model->numnormals   = header->numnormals;
+  model->numtexcoords = header->numtexcoords;
+  model->numtriangles = header->numtriangles;
+  model->scale        = 1.0;
+  model->vertexSize   = header->vertexsize;
+  model->posOffset    = header->posoffset;
+  model->normOffset   = header->normoffset;
+  model->texOffset    = header->texoffset;
+  model->vertexdata   = (float*)(file->data + header->vertexoffset);
+  model->indexdata    = (uint*)(file->data + header->indexoffset);
+  model->numindexes   = header->numindexes;
+  model->cache        = file;
+  if ((name = _glmCacheName(header, header->mtllibname)))
+    model->mtllibname = stralloc(name);
+
+  model->nummaterials = header->nummaterials;
+  model->materials = (GLMmaterial*)calloc(model->nummaterials + 1,
+                                          sizeof(GLMmaterial));
+  for (i = 0; i < model->nummaterials; i++) {
+    GLMmaterial* material = &model->materials[i];
+
+    if ((name = _glmCacheName(header, materials[i].name)))
+      material->name = stralloc(name);
+    if ((name = _glmCacheName(header, materials[i].map_kd)))
+      material->map_kd = stralloc(name);
+    memcpy(material->diffuse, materials[i].diffuse, sizeof(float) * 4);
+    memcpy(material->ambient, materials[i].ambient, sizeof(float) * 4);
+    memcpy(material->specular, materials[i].specular, sizeof(float) * 4);
+    memcpy(material->emmissive, materials[i].emmissive, sizeof(float) * 4);
+    material->shininess = materials[i].shininess;
+  }
+
+  /* rebuild the group list in its original order */
+  model->numlods = header->numlods;
+  memcpy(model->lodError, header->lodError,
+         sizeof(float) * (model->numlods + 1));
+  tail = &model->groups;
+  for (i = 0; i < header->numgroups; i++) {
+    group = (GLMgroup*)calloc(1, sizeof(GLMgroup));
+    name = _glmCacheName(header, groups[i].name);
+    group->name           = stralloc(name ? name : "default");
+    group->material       = groups[i].material;
+    group->numtriangles   = groups[i].full.numtriangles;
+    group->minIndex       = groups[i].full.minindex;
+    group->maxIndex       = groups[i].full.maxindex;
+    group->indexVboOffset = groups[i].full.indexoffset;
+    if (!_glmCacheRangeOK(model, &groups[i].full))
+      group->numtriangles = 0;
+    group->lods = (GLMlod*)calloc(GLM_MAX_LODS, sizeof(GLMlod));
+    for (l = 0; l < model->numlods; l++) {
+      group->lods[l].numtriangles   = groups[i].lods[l].numtriangles;
+      group->lods[l].minIndex       = groups[i].lods[l].minindex;
+      group->lods[l].maxIndex       = groups[i].lods[l].maxindex;
+      group->lods[l].indexVboOffset = groups[i].lods[l].indexoffset;
+      if (!_glmCacheRangeOK(model, &groups[i].lods[l]))
+        group->lods[l].numtriangles = 0;
+    }
+    if (group->material >= model->nummaterials)
+      group->material = 0;
+    *tail = group;
+    tail = &group->next;
+    model->numgroups++;
+  }
+
+  return model;
 }
 
 
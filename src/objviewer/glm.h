@@ -21,6 +21,8 @@ typedef unsigned int uint;
 #define GLM_COLOR    (1 << 3)		/* render with colors */
 #define GLM_MATERIAL (1 << 4)		/* render with materials */
 
+#define GLM_MAX_LODS 8			/* most levels of detail built */
+
 
 /* structs */
 
@@ -50,6 +52,15 @@ typedef struct {
   uint findex;			/* index of triangle facet normal */
 } GLMtriangle;
 
+/* GLMlod: Structure that defines a coarser level of detail of a group.
+ */
+typedef struct {
+  uint            numtriangles;	/* number of triangles at this level */
+  uint*           triIndexes;		/* vertex indices, 3 per triangle */
+  uint            minIndex, maxIndex;
+  uint            indexVboOffset;       /* offset into index VBO for elements */
+} GLMlod;
+
 /* GLMgroup: Structure that defines a group in a model.
  */
 typedef struct _GLMgroup {
@@ -60,6 +71,7 @@ typedef struct _GLMgroup {
   uint *          triIndexes;
   uint            minIndex, maxIndex;
   uint            indexVboOffset;       /* offset into index VBO for elements */
+  GLMlod*         lods;			/* model->numlods coarser levels */
   struct _GLMgroup* next;		/* pointer to next group in model */
 } GLMgroup;
 
@@ -99,6 +111,15 @@ typedef struct {
   uint posOffset;   /* offset of position within vertex, in bytes */
   uint normOffset;   /* offset of normal within vertex, in bytes */
   uint texOffset;   /* offset of texcoord within vertex, in bytes */
+
+  float* vertexdata;  /* interleaved vertex data for the VBO */
+  uint*  indexdata;   /* all groups' indices for the index VBO */
+  uint   numindexes;  /* number of indices in indexdata */
+  void*  cache;       /* mapped cache file backing the above, if any */
+
+  uint   numlods;     /* number of coarser levels of detail */
+  float  lodError[GLM_MAX_LODS + 1]; /* error of each level, in model units */
+  uint   lod;         /* level glmDrawVBO() draws, 0 = full detail */
 } GLMmodel;
 
 
@@ -167,6 +188,16 @@ glmFacetNormals(GLMmodel* model);
 void
 glmVertexNormals(GLMmodel* model, float angle);
 
+/* glmVertexNormalsLists: the original, single-threaded implementation
+ * of glmVertexNormals(), with the same results.  Kept as the reference
+ * for objview --bench-normals.
+ *
+ * model - initialized GLMmodel structure
+ * angle - maximum angle (in degrees) to smooth across
+ */
+void
+glmVertexNormalsLists(GLMmodel* model, float angle);
+
 /* glmLinearTexture: Generates texture coordinates according to a
  * linear projection of the texture map.  It generates these by
  * linearly mapping the vertices onto a square.
@@ -206,6 +237,14 @@ glmDelete(GLMmodel* model);
 GLMmodel*
 glmReadOBJ(char* filename);
 
+/* glmSetThreads: Sets the number of threads glmReadOBJ() may use to
+ * parse large files.
+ *
+ * numthreads - number of threads, 0 for one per CPU (the default)
+ */
+void
+glmSetThreads(uint numthreads);
+
 /* glmWriteOBJ: Writes a model description in Wavefront .OBJ format to
  * a file.
  *
@@ -249,8 +288,8 @@ glmDraw(GLMmodel* model, uint mode);
 uint
 glmList(GLMmodel* model, uint mode);
 
-/* glmWeld: eliminate (weld) vectors that are within an epsilon of
- * each other.
+/* glmWeld: eliminate (weld) vertices, normals and texture coordinates
+ * that are within an epsilon of each other.
  *
  * model      - initialized GLMmodel structure
  * epsilon    - maximum difference between vertices
@@ -263,9 +302,103 @@ glmWeld(GLMmodel* model, float epsilon);
 void
 glmReIndex(GLMmodel *model);
 
+/* glmOptimize: Reorders each group's triangles for the post-transform
+ * vertex cache, then in clusters so that those facing out of the model
+ * are drawn first (less overdraw), and renumbers the vertices in the
+ * order they are first used.  Prints the cache miss ratios before and
+ * after.
+ *
+ * model     - initialized GLMmodel structure that has been glmReIndex()ed
+ * cachesize - number of cache entries to optimize for (0 for 16)
+ */
+void
+glmOptimize(GLMmodel* model, uint cachesize);
+
+/* glmCacheStats: Simulates a FIFO post-transform vertex cache over the
+ * model's index arrays and returns the average cache miss ratio
+ * (vertices transformed per triangle) and average transform to vertex
+ * ratio (vertices transformed per vertex used).
+ *
+ * model     - initialized GLMmodel structure that has been glmReIndex()ed
+ * cachesize - number of cache entries (0 for 16)
+ * acmr      - returns the average cache miss ratio
+ * atvr      - returns the average transform to vertex ratio
+ */
+void
+glmCacheStats(const GLMmodel* model, uint cachesize, float* acmr,
+              float* atvr);
+
+/* glmBuildLODs: Builds up to GLM_MAX_LODS coarser levels of detail by
+ * quadric edge collapse, each with about half the triangles of the one
+ * before.  The levels reuse the model's vertices, so they only add
+ * index data.  Group and mesh borders are kept intact.
+ *
+ * model        - initialized GLMmodel structure that has been glmReIndex()ed
+ * mintriangles - stop when a level would have fewer triangles than this
+ */
+void
+glmBuildLODs(GLMmodel* model, uint mintriangles);
+
+/* glmChooseLOD: Returns the coarsest level of detail whose error,
+ * projected to the screen, is no more than maxerror pixels.
+ *
+ * model         - initialized GLMmodel structure
+ * pixelsperunit - pixels covered by one model unit at the model's
+ *                 nearest point
+ * maxerror      - largest acceptable error, in pixels
+ */
+uint
+glmChooseLOD(const GLMmodel* model, float pixelsperunit, float maxerror);
+
 void
 glmMakeVBOs(GLMmodel *model);
 
+/* glmMakeBuffers: Builds the interleaved vertex array and the single
+ * index array that glmMakeVBOs() uploads, unless the model already has
+ * them (from glmReadCache()).
+ *
+ * model - initialized GLMmodel structure that has been glmReIndex()ed
+ */
+void
+glmMakeBuffers(GLMmodel* model);
+
+/* glmFreeBuffers: Frees the arrays built by glmMakeBuffers().
+ *
+ * model - initialized GLMmodel structure
+ */
+void
+glmFreeBuffers(GLMmodel* model);
+
+/* GLMcacheparams: Structure that records how a cached model was
+ * processed.  A cache is only used by a reader passing the same values.
+ */
+typedef struct {
+  float smoothingangle;		/* glmVertexNormals() angle, if generated */
+  int   cachesize;		/* glmOptimize() cache size, -1 if not run */
+  int   lodtriangles;		/* glmBuildLODs() mintriangles, -1 if not run */
+} GLMcacheparams;
+
+/* glmWriteCache: Writes a binary cache of a fully processed model
+ * next to the .obj file it was read from.  Returns 0 on success.
+ *
+ * model    - initialized GLMmodel structure that has been glmReIndex()ed
+ * filename - name of the .obj file the model was read from
+ * params   - how the model was processed
+ */
+int
+glmWriteCache(GLMmodel* model, char* filename, const GLMcacheparams* params);
+
+/* glmReadCache: Maps the binary cache written by glmWriteCache() for
+ * a .obj file.  Returns NULL if there is none, it is out of date or it
+ * was processed with other parameters.  The model is ready for
+ * glmMakeVBOs() but can't be edited.
+ *
+ * filename - name of the .obj file the cache was built from
+ * params   - how the model should have been processed
+ */
+GLMmodel*
+glmReadCache(char* filename, const GLMcacheparams* params);
+
 void
 glmDrawVBO(GLMmodel *model);
 
@@ -278,6 +411,21 @@ glmShaderMaterial(GLMmaterial *mat);
 void
 glmLoadTextures(GLMmodel *model);
 
+/* glmStreamTextures: Like glmLoadTextures(), but the textures are
+ * loaded in the background with texstream_load_2d().  Results from
+ * texstream_poll() must be passed to glmStreamedTexture().
+ */
+void
+glmStreamTextures(GLMmodel *model);
+
+/* glmStreamedTexture: Installs a texture that came back from
+ * texstream_poll().  Returns 1 if it was one of the model's.
+ */
+struct texstream_result;
+
+int
+glmStreamedTexture(GLMmodel *model, const struct texstream_result *result);
+
 void
 glmSpecularTexture(GLMmodel *model, uint cubeTex);
 
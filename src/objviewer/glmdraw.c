@@ -10,6 +10,7 @@
 #include "glm.h"
 #include "readtex.h"
 #include "shaderutil.h"
+#include "texstream.h"
 
 
 /* defines */
@@ -154,90 +155,30 @@ glmDraw(GLMmodel* model, GLuint mode)
 void
 glmMakeVBOs(GLMmodel *model)
 {
-   uint bytes, vertexFloats, i;
-   float *buffer;
-   GLMgroup* group;
-   unsigned totalIndexes;
-   GLubyte *ibuffer, *ib;
+   /* interleaved vertices and indices, built now or mapped from a cache */
+   glmMakeBuffers(model);
 
    /*
     * Vertex data
     */
-   vertexFloats = 3;
-   model->posOffset = 0;
-
-   if (model->numnormals > 0) {
-      assert(model->numnormals == model->numvertices);
-      model->normOffset = vertexFloats * sizeof(GLfloat);
-      vertexFloats += 3;
-   }
-
-   if (model->numtexcoords > 0) {
-      assert(model->numtexcoords == model->numvertices);
-      model->texOffset = vertexFloats * sizeof(GLfloat);
-      vertexFloats += 2;
-   }
-
-   model->vertexSize = vertexFloats;
-
-   bytes = (model->numvertices + 1) * vertexFloats * sizeof(float);
-
-   buffer = (float *) malloc(bytes);
-   for (i = 0; i < model->numvertices; i++) {
-      /* copy vertex pos */
-      uint j = 0;
-      buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 0];
-      buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 1];
-      buffer[i * vertexFloats + j++] = model->vertices[i * 3 + 2];
-      if (model->numnormals > 0) {
-         buffer[i * vertexFloats + j++] = model->normals[i * 3 + 0];
-         buffer[i * vertexFloats + j++] = model->normals[i * 3 + 1];
-         buffer[i * vertexFloats + j++] = model->normals[i * 3 + 2];
-      }
-      if (model->numtexcoords > 0) {
-         buffer[i * vertexFloats + j++] = model->texcoords[i * 2 + 0];
-         buffer[i * vertexFloats + j++] = model->texcoords[i * 2 + 1];
-      }
-   }
-
    glGenBuffersARB(1, &model->vbo);
    glBindBufferARB(GL_ARRAY_BUFFER_ARB, model->vbo);
-   glBufferDataARB(GL_ARRAY_BUFFER_ARB, bytes, buffer, GL_STATIC_DRAW_ARB);
+   glBufferDataARB(GL_ARRAY_BUFFER_ARB,
+                   (model->numvertices + 1) * model->vertexSize * sizeof(float),
+                   model->vertexdata, GL_STATIC_DRAW_ARB);
    glBindBufferARB(GL_ARRAY_BUFFER_ARB, 0);
 
-   free(buffer);
-
    /*
     * Index data
     */
-   totalIndexes = 0;
-   for (group = model->groups; group; group = group->next) {
-      if (group->numtriangles > 0) {
-         totalIndexes += 3 * group->numtriangles;
-      }
-   }
-
    glGenBuffersARB(1, &model->index_vbo);
    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, model->index_vbo);
-   glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB, totalIndexes * sizeof(GLuint),
-                   NULL, GL_STATIC_DRAW_ARB);
-   ibuffer = (GLubyte *) glMapBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB,
-                                        GL_WRITE_ONLY);
-   ib = ibuffer;
-
-   for (group = model->groups; group; group = group->next) {
-      if (group->numtriangles > 0) {
-         int bytes = 3 * group->numtriangles * sizeof(uint);
-         memcpy(ib, group->triIndexes, bytes);
-         totalIndexes += 3 * group->numtriangles;
-         group->indexVboOffset = ib - ibuffer;
-         ib += bytes;
-      }
-   }
-
-   glUnmapBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB);
-
+   glBufferDataARB(GL_ELEMENT_ARRAY_BUFFER_ARB,
+                   model->numindexes * sizeof(GLuint),
+                   model->indexdata, GL_STATIC_DRAW_ARB);
    glBindBufferARB(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+
+   glmFreeBuffers(model);
 }
 
 
@@ -274,6 +215,18 @@ _glmLoadTexture(GLMmaterial *mat)
   }
 }
 
+
+/* the shader is specialized for the textures, make it again */
+static void
+_glmResetShader(GLMmaterial *mat)
+{
+   if (mat->prog) {
+      glDeleteProgram(mat->prog);
+      mat->prog = 0;
+   }
+}
+
+
 void
 glmLoadTextures(GLMmodel *model)
 {
@@ -286,6 +239,44 @@ glmLoadTextures(GLMmodel *model)
 }
 
 
+void
+glmStreamTextures(GLMmodel *model)
+{
+   uint i;
+
+   for (i = 0; i < model->nummaterials; i++) {
+      GLMmaterial *mat = &model->materials[i];
+      if (mat->map_kd)
+         texstream_load_2d(mat->map_kd, GL_RGB, TEXSTREAM_MIPMAP, mat);
+   }
+}
+
+
+int
+glmStreamedTexture(GLMmodel *model, const struct texstream_result *result)
+{
+   uint i;
+
+   for (i = 0; i < model->nummaterials; i++) {
+      GLMmaterial *mat = &model->materials[i];
+
+      if (result->data != mat)
+         continue;
+
+      if (result->texture) {
+         mat->texture_kd = result->texture;
+         _glmResetShader(mat);
+      }
+      else {
+         free(mat->map_kd);
+         mat->map_kd = NULL;
+      }
+      return 1;
+   }
+   return 0;
+}
+
+
 void
 glmDrawVBO(GLMmodel *model)
 {
@@ -319,7 +310,20 @@ glmDrawVBO(GLMmodel *model)
    glScalef(model->scale, model->scale, model->scale);
 
    for (group = model->groups; group; group = group->next) {
-      if (group->numtriangles > 0) {
+      uint numtriangles = group->numtriangles;
+      uint minIndex = group->minIndex, maxIndex = group->maxIndex;
+      uint offset = group->indexVboOffset;
+
+      /* a coarser level of detail, if one was picked */
+      if (model->lod > 0 && model->lod <= model->numlods) {
+         const GLMlod *lod = &group->lods[model->lod - 1];
+         numtriangles = lod->numtriangles;
+         minIndex = lod->minIndex;
+         maxIndex = lod->maxIndex;
+         offset = lod->indexVboOffset;
+      }
+
+      if (numtriangles > 0) {
 
          if (group->material != prevMaterial) {
             glmShaderMaterial(&model->materials[group->material]);
@@ -327,10 +331,10 @@ glmDrawVBO(GLMmodel *model)
          }
 
          glDrawRangeElements(GL_TRIANGLES,
-                             group->minIndex, group->maxIndex,
-                             3 * group->numtriangles,
+                             minIndex, maxIndex,
+                             3 * numtriangles,
                              GL_UNSIGNED_INT,
-                             (void *) (GLintptr) group->indexVboOffset);
+                             (void *) (GLintptr) offset);
       }
    }
 
@@ -496,6 +500,8 @@ glmSpecularTexture(GLMmodel *model, uint cubeTex)
    uint i;
 
    for (i = 0; i < model->nummaterials; i++) {
+      if (!model->materials[i].texture_ks != !cubeTex)
+         _glmResetShader(&model->materials[i]);
       model->materials[i].texture_ks = cubeTex;
    }
 }
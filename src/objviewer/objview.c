@@ -8,14 +8,18 @@
 #include <math.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 #include <stdarg.h>
+#include <sys/stat.h>
 #include "glad/gl.h"
 #include "glut_wrap.h"
 #include "glm.h"
 #include "skybox.h"
+#include "texstream.h"
 #include "trackball.h"
 #include "shaderutil.h"
+#include "timer.h"
 
 
 static char *Model_file = NULL;		/* name of the obect file */
@@ -28,6 +32,11 @@ static GLuint SkyboxTex;
 static GLboolean Skybox = GL_TRUE;
 static GLboolean Cull = GL_TRUE;
 static GLboolean WireFrame = GL_FALSE;
+static GLboolean UseCache = GL_TRUE;	/* use/write the binary model cache */
+/* how load_model() and load_only() process a model, for the cache */
+static const GLMcacheparams CacheParams = { 90.0, 0, 1000 };
+static GLboolean UseLod = GL_TRUE;	/* pick a level of detail per frame */
+static GLfloat LodError = 1.0;		/* largest LOD error, in pixels */
 static GLenum FrontFace = GL_CCW;
 static GLfloat Yrot = 0.0;
 static GLint WinWidth = 1024, WinHeight = 768;
@@ -138,20 +147,206 @@ ComputeFPS(void)
 
 
 static void
-init_model(void)
+load_model(void)
 {
+   /* a fully processed model from a previous run, if there is one */
+   if (UseCache) {
+      Model = glmReadCache(Model_file, &CacheParams);
+      if (Model)
+         return;
+   }
+
    /* read in the model */
    Model = glmReadOBJ(Model_file);
    glmUnitize(Model);
    glmFacetNormals(Model);
    if (Model->numnormals == 0) {
-      GLfloat smoothing_angle = 90.0;
       printf("Generating normals.\n");
-      glmVertexNormals(Model, smoothing_angle);
+      glmVertexNormals(Model, CacheParams.smoothingangle);
+   }
+   glmReIndex(Model);
+   glmOptimize(Model, CacheParams.cachesize);
+   glmBuildLODs(Model, CacheParams.lodtriangles);
+
+   /* best effort; the model's directory may well be read-only */
+   if (UseCache)
+      glmWriteCache(Model, Model_file, &CacheParams);
+}
+
+
+/**
+ * Time the CPU-side loading stages and exit without opening a window.
+ */
+static void
+load_only(void)
+{
+   struct stat st;
+   double t0, t1, t2, t3, t4, t5, t6, mb;
+
+   if (stat(Model_file, &st) != 0) {
+      fprintf(stderr, "objview: can't stat %s\n", Model_file);
+      exit(1);
+   }
+   mb = st.st_size / (1024.0 * 1024.0);
+
+   if (UseCache) {
+      t0 = timer_get_seconds();
+      Model = glmReadCache(Model_file, &CacheParams);
+      t1 = timer_get_seconds();
+      if (Model) {
+         printf("%s: %u vertices, %u triangles, %u groups (cached)\n",
+                Model_file, Model->numvertices, Model->numtriangles,
+                Model->numgroups);
+         printf("  cache:   %8.2f ms\n", (t1 - t0) * 1000.0);
+         glmDelete(Model);
+         exit(0);
+      }
    }
 
-   glmLoadTextures(Model);
+   t0 = timer_get_seconds();
+   Model = glmReadOBJ(Model_file);
+   t1 = timer_get_seconds();
+   glmUnitize(Model);
+   glmFacetNormals(Model);
+   if (Model->numnormals == 0)
+      glmVertexNormals(Model, CacheParams.smoothingangle);
+   t2 = timer_get_seconds();
    glmReIndex(Model);
+   t3 = timer_get_seconds();
+   glmOptimize(Model, CacheParams.cachesize);
+   t4 = timer_get_seconds();
+   glmBuildLODs(Model, CacheParams.lodtriangles);
+   t5 = timer_get_seconds();
+   if (UseCache)
+      glmWriteCache(Model, Model_file, &CacheParams);
+   t6 = timer_get_seconds();
+
+   printf("%s: %u vertices, %u triangles, %u groups\n", Model_file,
+          Model->numvertices, Model->numtriangles, Model->numgroups);
+   printf("  parse:   %8.2f ms  (%.1f MB, %.1f MB/s)\n",
+          (t1 - t0) * 1000.0, mb, mb / (t1 - t0));
+   printf("  normals: %8.2f ms\n", (t2 - t1) * 1000.0);
+   printf("  reindex: %8.2f ms\n", (t3 - t2) * 1000.0);
+   printf("  optimize:%8.2f ms\n", (t4 - t3) * 1000.0);
+   printf("  lods:    %8.2f ms  (%u levels)\n", (t5 - t4) * 1000.0,
+          Model->numlods);
+   if (UseCache)
+      printf("  cache:   %8.2f ms (written)\n", (t6 - t5) * 1000.0);
+   printf("  total:   %8.2f ms\n", (t6 - t0) * 1000.0);
+
+   glmDelete(Model);
+   exit(0);
+}
+
+
+#define BENCH_RUNS 10
+
+typedef void (*normals_func)(GLMmodel *model, float angle);
+
+/* best of BENCH_RUNS calls, in milliseconds */
+static double
+time_normals(GLMmodel *model, normals_func func, float angle)
+{
+   double best = 0.0;
+   int i;
+
+   for (i = 0; i < BENCH_RUNS; i++) {
+      double t0 = timer_get_seconds(), t;
+
+      func(model, angle);
+      t = (timer_get_seconds() - t0) * 1000.0;
+      if (i == 0 || t < best)
+         best = t;
+   }
+   return best;
+}
+
+
+/* copies the model's normals and normal indices, for comparison */
+static void
+save_normals(const GLMmodel *model, float **normals, GLuint **indices)
+{
+   GLuint i;
+
+   *normals = malloc(sizeof(float) * 3 * (model->numnormals + 1));
+   *indices = malloc(sizeof(GLuint) * 3 * model->numtriangles);
+   if (!*normals || !*indices) {
+      fprintf(stderr, "objview: out of memory\n");
+      exit(1);
+   }
+   memcpy(*normals, model->normals,
+          sizeof(float) * 3 * (model->numnormals + 1));
+   for (i = 0; i < model->numtriangles; i++)
+      memcpy(*indices + 3 * i, model->triangles[i].nindices,
+             sizeof(GLuint) * 3);
+}
+
+
+/**
+ * Times glmVertexNormals() against glmVertexNormalsLists(), the
+ * original implementation, and checks that both make the same normals
+ * at a few smoothing angles.
+ */
+static void
+bench_normals(void)
+{
+   static const float angles[] = { 0.0, 30.0, 90.0 };
+   double lists, flat;
+   unsigned a;
+   int same = 1;
+
+   Model = glmReadOBJ(Model_file);
+   if (!Model) {
+      fprintf(stderr, "objview: can't read %s\n", Model_file);
+      exit(1);
+   }
+   glmFacetNormals(Model);
+
+   for (a = 0; a < sizeof(angles) / sizeof(angles[0]); a++) {
+      float *normals;
+      GLuint *indices, i, numnormals;
+
+      glmVertexNormalsLists(Model, angles[a]);
+      save_normals(Model, &normals, &indices);
+      numnormals = Model->numnormals;
+
+      glmVertexNormals(Model, angles[a]);
+      /* normal 0 is never used */
+      if (Model->numnormals != numnormals ||
+          memcmp(Model->normals + 3, normals + 3,
+                 sizeof(float) * 3 * numnormals) != 0)
+         same = 0;
+      for (i = 0; same && i < Model->numtriangles; i++) {
+         if (memcmp(Model->triangles[i].nindices, indices + 3 * i,
+                    sizeof(GLuint) * 3) != 0)
+            same = 0;
+      }
+      free(normals);
+      free(indices);
+   }
+
+   lists = time_normals(Model, glmVertexNormalsLists, 90.0);
+   flat = time_normals(Model, glmVertexNormals, 90.0);
+
+   printf("%s: %u vertices, %u triangles\n", Model_file,
+          Model->numvertices, Model->numtriangles);
+   printf("  glmVertexNormals(90), best of %d:\n", BENCH_RUNS);
+   printf("  lists:   %8.2f ms\n", lists);
+   printf("  flat:    %8.2f ms  (%.1fx)\n", flat, lists / flat);
+   printf("  results: %s at 0, 30 and 90 degrees\n",
+          same ? "identical" : "DIFFERENT");
+
+   glmDelete(Model);
+   exit(same ? 0 : 1);
+}
+
+
+static void
+init_model(void)
+{
+   load_model();
+
+   glmStreamTextures(Model);
    glmMakeVBOs(Model);
    if (0)
       glmPrint(Model);
@@ -160,13 +355,40 @@ init_model(void)
 static void
 init_skybox(void)
 {
-   SkyboxTex = LoadSkyBoxCubeTexture("alpine_east.rgb",
-                                     "alpine_west.rgb",
-                                     "alpine_up.rgb",
-                                     "alpine_down.rgb",
-                                     "alpine_south.rgb",
-                                     "alpine_north.rgb");
-   glmSpecularTexture(Model, SkyboxTex);
+   /* SkyboxTex is set by poll_textures() once the images are in */
+   StreamSkyBoxCubeTexture("alpine_east.rgb",
+                           "alpine_west.rgb",
+                           "alpine_up.rgb",
+                           "alpine_down.rgb",
+                           "alpine_south.rgb",
+                           "alpine_north.rgb",
+                           &SkyboxTex);
+}
+
+
+/**
+ * Install the textures that have finished loading in the background.
+ * Until then the model is drawn untextured and without the skybox.
+ */
+static void
+poll_textures(void)
+{
+   struct texstream_result result;
+
+   while (texstream_poll(&result)) {
+      if (result.data == &SkyboxTex) {
+         SkyboxTex = result.texture;
+         if (Skybox)
+            glmSpecularTexture(Model, SkyboxTex);
+      }
+      else {
+         glmStreamedTexture(Model, &result);
+      }
+   }
+
+   /* keep drawing while textures are loading, even if not animating */
+   if (texstream_pending())
+      glutPostRedisplay();
 }
 
 
@@ -210,12 +432,32 @@ Idle(void)
 }
 
 
+/**
+ * Pick the coarsest level of detail whose error stays under LodError
+ * pixels at the model's nearest point (the projection is set up in
+ * reshape(), the model is unitized and scaled by Scale).
+ */
+static GLuint
+choose_lod(void)
+{
+   float radius = Scale * (1.7321 + (NumInstances > 1 ? 1.4 : 0.0));
+   float nearest = 3.0 + View.Distance - radius;
+
+   if (nearest < 1.0)
+      nearest = 1.0;
+   return glmChooseLOD(Model, WinHeight / nearest * Scale * Model->scale,
+                       LodError);
+}
+
+
 static void
 display(void)
 {
    GLfloat rot[4][4];
    float fps;
 
+   poll_textures();
+
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
    glPushMatrix();
@@ -227,7 +469,7 @@ display(void)
 
       glUseProgram(0);
 
-      if (Skybox)
+      if (Skybox && SkyboxTex)
          DrawSkyBoxCubeTexture(SkyboxTex);
 
       if (WireFrame)
@@ -240,6 +482,8 @@ display(void)
       else
          glDisable(GL_CULL_FACE);
 
+      Model->lod = UseLod ? choose_lod() : 0;
+
       if (NumInstances == 1) {
          glmDrawVBO(Model);
       }
@@ -277,6 +521,8 @@ display(void)
            Model->numgroups);
       text(5, glutGet(GLUT_WINDOW_HEIGHT) - (5+20*7), 20, "%d materials",
            Model->nummaterials);
+      text(5, glutGet(GLUT_WINDOW_HEIGHT) - (5+20*8), 20, "LOD %d of %d",
+           Model->lod, Model->numlods);
    }
 
    glutSwapBuffers();
@@ -305,6 +551,7 @@ keyboard(unsigned char key, int x, int y)
       printf("s            -  Toggle skybox\n");
       printf("z/Z          -  Scale model smaller/larger\n");
       printf("i            -  Show model info/stats\n");
+      printf("l            -  Toggle level of detail selection\n");
       printf("q/escape     -  Quit\n\n");
       break;
    case 'a':
@@ -324,6 +571,10 @@ keyboard(unsigned char key, int x, int y)
    case 'i':
       Stats = !Stats;
       break;
+   case 'l':
+      UseLod = !UseLod;
+      printf("Level of detail: %s\n", UseLod ? "on" : "off");
+      break;
    case 'p':
       Performance = !Performance;
       break;
@@ -357,6 +608,8 @@ keyboard(unsigned char key, int x, int y)
       break;
    case 'q':
    case 27:
+      /* stop the streaming threads while the context is still current */
+      texstream_shutdown();
       exit(0);
       break;
    }
@@ -464,18 +717,46 @@ DoFeatureChecks(void)
 int
 main(int argc, char** argv)
 {
-   glutInitWindowSize(WinWidth, WinHeight);
-   glutInit(&argc, argv);
+   GLboolean loadOnly = GL_FALSE;
+   GLboolean benchNormals = GL_FALSE;
+   int i;
 
-   if (argc > 1) {
-      Model_file = argv[1];
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--load-only") == 0)
+         loadOnly = GL_TRUE;
+      else if (strcmp(argv[i], "--bench-normals") == 0)
+         benchNormals = GL_TRUE;
+      else if (strcmp(argv[i], "--no-cache") == 0)
+         UseCache = GL_FALSE;
+      else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+         glmSetThreads(atoi(argv[++i]));
+   }
+
+   /* no window system needed just to time the loader */
+   if (!loadOnly && !benchNormals) {
+      glutInitWindowSize(WinWidth, WinHeight);
+      glutInit(&argc, argv);
+   }
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "--threads") == 0)
+         i++;
+      else if (argv[i][0] != '-') {
+         Model_file = argv[i];
+         break;
+      }
    }
    if (!Model_file) {
-      fprintf(stderr, "usage: objview file.obj\n");
+      fprintf(stderr, "usage: objview [--load-only] [--bench-normals] [--no-cache] [--threads n] file.obj\n");
       fprintf(stderr, "(using default bunny.obj)\n");
       Model_file = "bunny.obj";
    }
 
+   if (loadOnly)
+      load_only();
+   if (benchNormals)
+      bench_normals();
+
    glutInitDisplayMode(GLUT_RGB | GLUT_DEPTH | GLUT_DOUBLE);
    glutCreateWindow("objview");
 
@@ -502,6 +783,7 @@ main(int argc, char** argv)
    glutAddMenuEntry("[Z] Scale model larger", 'Z');
    glutAddMenuEntry("[p] Toggle performance indicator", 'p');
    glutAddMenuEntry("[i] Show model stats", 'i');
+   glutAddMenuEntry("[l] Toggle level of detail", 'l');
    glutAddMenuEntry("", 0);
    glutAddMenuEntry("[q] Quit", 27);
    glutAttachMenu(GLUT_RIGHT_BUTTON);
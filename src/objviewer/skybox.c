@@ -8,6 +8,7 @@
 #include "glad/gl.h"
 #include "readtex.h"
 #include "skybox.h"
+#include "texstream.h"
 
 
 static int
@@ -100,6 +101,30 @@ LoadSkyBoxCubeTexture(const char *filePosX,
 }
 
 
+/**
+ * Like LoadSkyBoxCubeTexture(), but the images are loaded in the
+ * background.  The texture comes back from texstream_poll() with data.
+ */
+void
+StreamSkyBoxCubeTexture(const char *filePosX,
+                        const char *fileNegX,
+                        const char *filePosY,
+                        const char *fileNegY,
+                        const char *filePosZ,
+                        const char *fileNegZ,
+                        void *data)
+{
+   const char *files[6] = {
+      filePosX, fileNegX, filePosY, fileNegY, filePosZ, fileNegZ
+   };
+
+   /* flipped as in load() */
+   texstream_load_cube(files, GL_RGB,
+                       TEXSTREAM_MIPMAP | TEXSTREAM_FLIP_X | TEXSTREAM_FLIP_Y,
+                       data);
+}
+
+
 #define eps1 0.99
 #define br   20.0  /* box radius */
 
@@ -11,6 +11,15 @@ LoadSkyBoxCubeTexture(const char *filePosX,
                       const char *filePosZ,
                       const char *fileNegZ);
 
+extern void
+StreamSkyBoxCubeTexture(const char *filePosX,
+                        const char *fileNegX,
+                        const char *filePosY,
+                        const char *fileNegY,
+                        const char *filePosZ,
+                        const char *fileNegZ,
+                        void *data);
+
 extern void
 DrawSkyBoxCubeTexture(GLuint tex);
 
@@ -0,0 +1,615 @@
+/*
+ * Batch off-screen rendering with OSMesa on several threads.
+ *
+ * Renders the osdemo scene as an animation, turning it a little each
+ * frame.  Each thread has its own OSMesa context and takes work from a
+ * shared queue: whole frames by default, or tiles of the frames with
+ * -tile.  Tiles are rendered straight into the frame's image through
+ * OSMESA_ROW_LENGTH, so nothing is copied.  The thread finishing a
+ * frame's last tile writes it out, if asked to.  Frames can also be
+ * streamed to stdout or to a command, e.g. a video encoder; they go out
+ * in order, each written by the thread that completes the next one due.
+ *
+ * At the end the throughput (frames/s, Mpixels/s) and the spread of the
+ * per-tile render times are reported, which makes this a scaling test
+ * for the software rasterizers as well as a headless batch renderer.
+ * With llvmpipe, setting LP_NUM_THREADS=0 keeps each context's
+ * rasterization on the thread that issued it, so the thread count here
+ * is the number of cores in use.
+ *
+ * Usage: osbatch [options]
+ *   -threads n    number of rendering threads (default: one per CPU)
+ *   -scale        run with 1, 2, 4, ... up to that many threads and
+ *                 report the speedup of each over one thread (this
+ *                 only times the rendering, so it can't be used with -o)
+ *   -size WxH     frame size (default 400x400)
+ *   -frames n     number of frames (default 64)
+ *   -tile n       split frames into n x n pixel tiles
+ *   -o pattern    write frames to files, e.g. frame%04d.png, as PNG,
+ *                 QOI, PPM or raw RGB by extension or else TGA.
+ *                 "-" streams PPM frames to stdout and "|command" to
+ *                 the command, e.g. "|ffmpeg -i - out.mp4".
+ *
+ * This program is in the public domain.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "GL/osmesa.h"
+#include "gl_wrap.h"
+#include "imagewrite.h"
+#include "stats.h"
+#include "timer.h"
+
+
+#define MAX_THREADS 64
+
+struct frame
+{
+   GLubyte *pixels;
+   unsigned tiles_done;
+};
+
+struct worker
+{
+   unsigned tiles;
+   double busy;                 /* seconds spent rendering */
+   double *tile_times;          /* in ms, one per tile rendered */
+   int failed;
+#ifdef HAVE_PTHREAD
+   pthread_t thread;
+#endif
+};
+
+static int Width = 400;
+static int Height = 400;
+static int NumFrames = 64;
+static int TileSize = 0;        /* 0: whole frames */
+static const char *OutPattern = NULL;
+static enum imagewrite_format OutFormat;
+static FILE *OutStream = NULL;  /* streaming to stdout or a command */
+static FILE *Report;            /* stderr when streaming to stdout */
+
+static int TilesX, TilesY;
+static struct frame *Frames;
+static unsigned NextItem, NumItems;
+static unsigned NextToWrite;    /* next frame due on OutStream */
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t Lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t StreamLock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+static void
+lock(void)
+{
+#ifdef HAVE_PTHREAD
+   pthread_mutex_lock(&Lock);
+#endif
+}
+
+
+static void
+unlock(void)
+{
+#ifdef HAVE_PTHREAD
+   pthread_mutex_unlock(&Lock);
+#endif
+}
+
+
+static void
+Sphere(float radius, int slices, int stacks)
+{
+   GLUquadric *q = gluNewQuadric();
+   gluQuadricNormals(q, GLU_SMOOTH);
+   gluSphere(q, radius, slices, stacks);
+   gluDeleteQuadric(q);
+}
+
+
+static void
+Cone(float base, float height, int slices, int stacks)
+{
+   GLUquadric *q = gluNewQuadric();
+   gluQuadricDrawStyle(q, GLU_FILL);
+   gluQuadricNormals(q, GLU_SMOOTH);
+   gluCylinder(q, base, 0.0, height, slices, stacks);
+   gluDeleteQuadric(q);
+}
+
+
+static void
+Torus(float innerRadius, float outerRadius, int sides, int rings)
+{
+   /* from GLUT... */
+   int i, j;
+   GLfloat theta, phi, theta1;
+   GLfloat cosTheta, sinTheta;
+   GLfloat cosTheta1, sinTheta1;
+   const GLfloat ringDelta = 2.0 * M_PI / rings;
+   const GLfloat sideDelta = 2.0 * M_PI / sides;
+
+   theta = 0.0;
+   cosTheta = 1.0;
+   sinTheta = 0.0;
+   for (i = rings - 1; i >= 0; i--) {
+      theta1 = theta + ringDelta;
+      cosTheta1 = cos(theta1);
+      sinTheta1 = sin(theta1);
+      glBegin(GL_QUAD_STRIP);
+      phi = 0.0;
+      for (j = sides; j >= 0; j--) {
+         GLfloat cosPhi, sinPhi, dist;
+
+         phi += sideDelta;
+         cosPhi = cos(phi);
+         sinPhi = sin(phi);
+         dist = outerRadius + innerRadius * cosPhi;
+
+         glNormal3f(cosTheta1 * cosPhi, -sinTheta1 * cosPhi, sinPhi);
+         glVertex3f(cosTheta1 * dist, -sinTheta1 * dist, innerRadius * sinPhi);
+         glNormal3f(cosTheta * cosPhi, -sinTheta * cosPhi, sinPhi);
+         glVertex3f(cosTheta * dist, -sinTheta * dist,  innerRadius * sinPhi);
+      }
+      glEnd();
+      theta = theta1;
+      cosTheta = cosTheta1;
+      sinTheta = sinTheta1;
+   }
+}
+
+
+/*
+ * Render the part [x0, x1) x [y0, y1) of the given frame into the
+ * current buffer, which is that part's size.
+ */
+static void
+render_tile(int frame, int x0, int y0, int x1, int y1)
+{
+   GLfloat light_ambient[] = { 0.0, 0.0, 0.0, 1.0 };
+   GLfloat light_diffuse[] = { 1.0, 1.0, 1.0, 1.0 };
+   GLfloat light_specular[] = { 1.0, 1.0, 1.0, 1.0 };
+   GLfloat light_position[] = { 1.0, 1.0, 1.0, 0.0 };
+   GLfloat red_mat[]   = { 1.0, 0.2, 0.2, 1.0 };
+   GLfloat green_mat[] = { 0.2, 1.0, 0.2, 1.0 };
+   GLfloat blue_mat[]  = { 0.2, 0.2, 1.0, 1.0 };
+   /* the whole frame covers [-2.5, 2.5] along its shorter side */
+   GLdouble sx = 5.0 / (Width < Height ? Width : Height);
+   GLdouble angle = 360.0 * frame / NumFrames;
+
+   glViewport(0, 0, x1 - x0, y1 - y0);
+
+   glLightfv(GL_LIGHT0, GL_AMBIENT, light_ambient);
+   glLightfv(GL_LIGHT0, GL_DIFFUSE, light_diffuse);
+   glLightfv(GL_LIGHT0, GL_SPECULAR, light_specular);
+   glLightfv(GL_LIGHT0, GL_POSITION, light_position);
+
+   glEnable(GL_LIGHTING);
+   glEnable(GL_LIGHT0);
+   glEnable(GL_DEPTH_TEST);
+
+   glMatrixMode(GL_PROJECTION);
+   glLoadIdentity();
+   glOrtho((x0 - Width * 0.5) * sx, (x1 - Width * 0.5) * sx,
+           (y0 - Height * 0.5) * sx, (y1 - Height * 0.5) * sx,
+           -10.0, 10.0);
+   glMatrixMode(GL_MODELVIEW);
+   glLoadIdentity();
+
+   glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+   glPushMatrix();
+   glRotatef(20.0, 1.0, 0.0, 0.0);
+   glRotatef(angle, 0.0, 1.0, 0.0);
+
+   glPushMatrix();
+   glTranslatef(-0.75, 0.5, 0.0);
+   glRotatef(90.0, 1.0, 0.0, 0.0);
+   glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, red_mat );
+   Torus(0.275, 0.85, 20, 20);
+   glPopMatrix();
+
+   glPushMatrix();
+   glTranslatef(-0.75, -0.5, 0.0);
+   glRotatef(270.0, 1.0, 0.0, 0.0);
+   glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, green_mat );
+   Cone(1.0, 2.0, 16, 1);
+   glPopMatrix();
+
+   glPushMatrix();
+   glTranslatef(0.75, 0.0, -1.0);
+   glMaterialfv( GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, blue_mat );
+   Sphere(1.0, 20, 20);
+   glPopMatrix();
+
+   glPopMatrix();
+
+   /* the tile has to be in memory before anyone looks at the frame */
+   glFinish();
+}
+
+
+/*
+ * Write out, in order, the frames that are complete from the next one due
+ * on the stream.  Called by every thread completing a frame after it has
+ * counted its tile, so whichever completes the frame due writes it and
+ * any that were finished ahead of it.
+ */
+static void
+stream_frames(void)
+{
+   const unsigned tiles = TilesX * TilesY;
+
+#ifdef HAVE_PTHREAD
+   pthread_mutex_lock(&StreamLock);
+#endif
+   for (;;) {
+      int ready;
+
+      lock();
+      ready = NextToWrite < (unsigned) NumFrames &&
+              Frames[NextToWrite].tiles_done == tiles;
+      unlock();
+      if (!ready)
+         break;
+
+      if (!imagewrite(OutStream, OutFormat, Frames[NextToWrite].pixels,
+                      Width, Height, IMAGEWRITE_BGRA | IMAGEWRITE_BOTTOM_UP))
+         fprintf(stderr, "osbatch: couldn't write frame %u\n", NextToWrite);
+      free(Frames[NextToWrite].pixels);
+      Frames[NextToWrite].pixels = NULL;
+      NextToWrite++;
+   }
+#ifdef HAVE_PTHREAD
+   pthread_mutex_unlock(&StreamLock);
+#endif
+}
+
+
+static void
+finish_frame(int frame)
+{
+   if (OutStream) {
+      stream_frames();
+      return;
+   }
+   if (OutPattern) {
+      char filename[1000];
+
+      /* rendered as BGRA with the origin at the bottom left */
+      snprintf(filename, sizeof(filename), OutPattern, frame);
+      if (!imagewrite_file(filename, OutFormat, Frames[frame].pixels,
+                           Width, Height,
+                           IMAGEWRITE_BGRA | IMAGEWRITE_BOTTOM_UP))
+         fprintf(stderr, "osbatch: couldn't write %s\n", filename);
+   }
+   free(Frames[frame].pixels);
+   Frames[frame].pixels = NULL;
+}
+
+
+static void *
+worker_main(void *data)
+{
+   struct worker *w = (struct worker *) data;
+   OSMesaContext ctx;
+
+#if OSMESA_MAJOR_VERSION * 100 + OSMESA_MINOR_VERSION >= 305
+   ctx = OSMesaCreateContextExt( OSMESA_BGRA, 24, 0, 0, NULL );
+#else
+   ctx = OSMesaCreateContext( OSMESA_BGRA, NULL );
+#endif
+   if (!ctx) {
+      fprintf(stderr, "osbatch: OSMesaCreateContext failed!\n");
+      w->failed = 1;
+      return NULL;
+   }
+
+   for (;;) {
+      unsigned item, tiles = TilesX * TilesY;
+      int frame, tx, ty, x0, y0, x1, y1;
+      GLubyte *pixels;
+      uint64_t start;
+      double elapsed;
+      int done;
+
+      /* the next tile, and the image of its frame */
+      lock();
+      item = NextItem++;
+      if (item >= NumItems) {
+         unlock();
+         break;
+      }
+      frame = item / tiles;
+      if (!Frames[frame].pixels)
+         Frames[frame].pixels = (GLubyte *) malloc((size_t) Width * Height * 4);
+      pixels = Frames[frame].pixels;
+      unlock();
+
+      if (!pixels) {
+         fprintf(stderr, "osbatch: out of memory!\n");
+         w->failed = 1;
+         break;
+      }
+
+      tx = (item % tiles) % TilesX;
+      ty = (item % tiles) / TilesX;
+      x0 = tx * TileSize;
+      y0 = ty * TileSize;
+      x1 = TileSize && x0 + TileSize < Width ? x0 + TileSize : Width;
+      y1 = TileSize && y0 + TileSize < Height ? y0 + TileSize : Height;
+
+      start = timer_get_ns();
+      if (!OSMesaMakeCurrent(ctx, pixels + ((size_t) y0 * Width + x0) * 4,
+                             GL_UNSIGNED_BYTE, x1 - x0, y1 - y0)) {
+         fprintf(stderr, "osbatch: OSMesaMakeCurrent failed!\n");
+         w->failed = 1;
+         break;
+      }
+      /* rows are a whole frame apart */
+      OSMesaPixelStore(OSMESA_ROW_LENGTH, Width);
+      render_tile(frame, x0, y0, x1, y1);
+      elapsed = (timer_get_ns() - start) * 1e-9;
+      w->tile_times[w->tiles++] = elapsed * 1e3;
+      w->busy += elapsed;
+
+      lock();
+      done = ++Frames[frame].tiles_done == tiles;
+      unlock();
+      if (done)
+         finish_frame(frame);
+   }
+
+   OSMesaDestroyContext(ctx);
+   return NULL;
+}
+
+
+/*
+ * Render all the frames on the given number of threads.
+ * Returns the elapsed time in seconds, or a negative value on failure.
+ */
+static double
+run_batch(unsigned threads, int report)
+{
+   struct worker workers[MAX_THREADS];
+   double *all_times;
+   unsigned i, count = 0;
+   uint64_t start;
+   double elapsed;
+   int failed = 0;
+
+   Frames = (struct frame *) calloc(NumFrames, sizeof(struct frame));
+   all_times = (double *) malloc(NumItems * sizeof(double));
+   if (!Frames || !all_times) {
+      fprintf(stderr, "osbatch: out of memory!\n");
+      exit(1);
+   }
+   NextItem = 0;
+   NextToWrite = 0;
+
+   for (i = 0; i < threads; i++) {
+      workers[i].tiles = 0;
+      workers[i].busy = 0.0;
+      workers[i].failed = 0;
+      workers[i].tile_times = (double *) malloc(NumItems * sizeof(double));
+      if (!workers[i].tile_times) {
+         fprintf(stderr, "osbatch: out of memory!\n");
+         exit(1);
+      }
+   }
+
+   start = timer_get_ns();
+#ifdef HAVE_PTHREAD
+   for (i = 0; i < threads; i++) {
+      if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i])) {
+         fprintf(stderr, "osbatch: couldn't start thread %u\n", i);
+         exit(1);
+      }
+   }
+   for (i = 0; i < threads; i++)
+      pthread_join(workers[i].thread, NULL);
+#else
+   worker_main(&workers[0]);
+#endif
+   elapsed = (timer_get_ns() - start) * 1e-9;
+
+   for (i = 0; i < threads; i++) {
+      failed |= workers[i].failed;
+      memcpy(all_times + count, workers[i].tile_times,
+             workers[i].tiles * sizeof(double));
+      count += workers[i].tiles;
+      free(workers[i].tile_times);
+   }
+
+   if (report && !failed) {
+      struct stats s;
+
+      for (i = 0; i < threads; i++)
+         fprintf(Report, "thread %2u: %5u tiles, busy %.3f s (%.0f%%)\n",
+                 i, workers[i].tiles, workers[i].busy,
+                 100.0 * workers[i].busy / elapsed);
+      stats_compute(all_times, count, &s);
+      fprintf(Report,
+              "tile time: median %.3f ms, min %.3f, max %.3f, 95%% %.3f\n",
+              s.median, s.min, s.max, stats_percentile(all_times, count, 95.0));
+   }
+
+   for (i = 0; i < (unsigned) NumFrames; i++)
+      free(Frames[i].pixels);
+   free(Frames);
+   free(all_times);
+
+   return failed ? -1.0 : elapsed;
+}
+
+
+static void
+print_rate(unsigned threads, double elapsed, double base)
+{
+   double mpix = (double) Width * Height * NumFrames * 1e-6;
+
+   fprintf(Report, "%2u thread(s): %.3f s, %.1f frames/s, %.1f Mpix/s",
+           threads, elapsed, NumFrames / elapsed, mpix / elapsed);
+   if (base > 0.0)
+      fprintf(Report, ", speedup %.2fx", base / elapsed);
+   fprintf(Report, "\n");
+}
+
+
+/*
+ * The -o pattern is passed to snprintf() with the frame number, so it
+ * must have exactly one int conversion (%d or %i, with flags, width
+ * and precision) and no other conversion than %%.
+ */
+static int
+valid_pattern(const char *pattern)
+{
+   const char *p;
+   int conversions = 0;
+
+   for (p = strchr(pattern, '%'); p; p = strchr(p, '%')) {
+      p++;
+      if (*p == '%') {
+         p++;
+         continue;
+      }
+      p += strspn(p, "-+ #0");
+      p += strspn(p, "0123456789");
+      if (*p == '.') {
+         p++;
+         p += strspn(p, "0123456789");
+      }
+      if (*p != 'd' && *p != 'i')
+         return 0;
+      conversions++;
+   }
+   return conversions == 1;
+}
+
+
+static void
+usage(void)
+{
+   fprintf(stderr, "Usage:\n");
+   fprintf(stderr, "  osbatch [-threads n] [-scale] [-size WxH] [-frames n]\n"
+                   "          [-tile n] [-o pattern | - | \"|command\"]\n");
+   exit(1);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+   unsigned threads = 0;
+   int scale = 0;
+   double elapsed;
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+         threads = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-scale"))
+         scale = 1;
+      else if (!strcmp(argv[i], "-size") && i + 1 < argc) {
+         if (sscanf(argv[++i], "%dx%d", &Width, &Height) != 2)
+            usage();
+      }
+      else if (!strcmp(argv[i], "-frames") && i + 1 < argc)
+         NumFrames = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-tile") && i + 1 < argc)
+         TileSize = atoi(argv[++i]);
+      else if (!strcmp(argv[i], "-o") && i + 1 < argc)
+         OutPattern = argv[++i];
+      else
+         usage();
+   }
+   if (Width < 1 || Height < 1 || Width > 65535 || Height > 65535 ||
+       NumFrames < 1 || TileSize < 0)
+      usage();
+   /* every pass renders all the frames again */
+   if (scale && OutPattern) {
+      fprintf(stderr, "osbatch: -scale can't be used with -o\n");
+      return 1;
+   }
+
+#ifdef HAVE_PTHREAD
+   if (!threads) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (unsigned) cpus : 1;
+   }
+   if (threads > MAX_THREADS)
+      threads = MAX_THREADS;
+#else
+   threads = 1;
+#endif
+
+   Report = stdout;
+   if (OutPattern) {
+      if (!strcmp(OutPattern, "-") || OutPattern[0] == '|') {
+         OutFormat = IMAGEWRITE_PPM;
+         OutStream = imagewrite_open(OutPattern);
+         if (!OutStream) {
+            fprintf(stderr, "osbatch: couldn't open %s\n", OutPattern);
+            return 1;
+         }
+         if (OutStream == stdout)
+            Report = stderr;
+      }
+      else if (!valid_pattern(OutPattern)) {
+         fprintf(stderr, "osbatch: the -o pattern needs exactly one %%d "
+                 "for the frame number (and %%%% for a %%)\n");
+         return 1;
+      }
+      else
+         OutFormat = imagewrite_format_for_name(OutPattern, IMAGEWRITE_TGA);
+   }
+
+   TilesX = TileSize ? (Width + TileSize - 1) / TileSize : 1;
+   TilesY = TileSize ? (Height + TileSize - 1) / TileSize : 1;
+   NumItems = (unsigned) NumFrames * TilesX * TilesY;
+
+   fprintf(Report, "%d frame(s) of %dx%d", NumFrames, Width, Height);
+   if (TileSize)
+      fprintf(Report, " in %dx%d tiles of %dx%d", TilesX, TilesY, TileSize, TileSize);
+   fprintf(Report, "\n");
+
+   if (scale) {
+      double base = 0.0;
+      unsigned n;
+
+      for (n = 1; ; n = n * 2 < threads ? n * 2 : threads) {
+         elapsed = run_batch(n, 0);
+         if (elapsed < 0.0)
+            return 1;
+         if (n == 1)
+            base = elapsed;
+         print_rate(n, elapsed, base);
+         if (n == threads)
+            break;
+      }
+   }
+   else {
+      elapsed = run_batch(threads, 1);
+      if (elapsed < 0.0)
+         return 1;
+      print_rate(threads, elapsed, 0.0);
+   }
+
+   if (OutStream && !imagewrite_close(OutStream, OutPattern)) {
+      fprintf(stderr, "osbatch: error writing to %s\n", OutPattern);
+      return 1;
+   }
+
+   return 0;
+}
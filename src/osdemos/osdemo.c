@@ -14,6 +14,9 @@
  * ASCII PPM output added by Brian Paul.
  *
  * Usage: osdemo [filename]
+ *
+ * The file is written as PNG, QOI, PPM or raw RGB according to its
+ * extension, or Targa otherwise.  "-" writes to stdout.
  */
 
 
@@ -23,6 +26,7 @@
 #include <string.h>
 #include "GL/osmesa.h"
 #include "gl_wrap.h"
+#include "imagewrite.h"
 
 
 #define SAVE_TARGA
@@ -153,96 +157,23 @@ render_image(void)
 }
 
 
-#ifdef SAVE_TARGA
-
 static void
-write_targa(const char *filename, const GLubyte *buffer, int width, int height)
+write_image(const char *filename, const GLubyte *buffer, int width, int height)
 {
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLubyte *ptr = buffer;
-      printf ("osdemo, writing tga file \n");
-      fputc (0x00, f);	/* ID Length, 0 => No ID	*/
-      fputc (0x00, f);	/* Color Map Type, 0 => No color map included	*/
-      fputc (0x02, f);	/* Image Type, 2 => Uncompressed, True-color Image */
-      fputc (0x00, f);	/* Next five bytes are about the color map entries */
-      fputc (0x00, f);	/* 2 bytes Index, 2 bytes length, 1 byte size */
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);	/* X-origin of Image	*/
-      fputc (0x00, f);
-      fputc (0x00, f);	/* Y-origin of Image	*/
-      fputc (0x00, f);
-      fputc (Width & 0xff, f);      /* Image Width	*/
-      fputc ((Width>>8) & 0xff, f);
-      fputc (Height & 0xff, f);     /* Image Height	*/
-      fputc ((Height>>8) & 0xff, f);
-      fputc (0x18, f);		/* Pixel Depth, 0x18 => 24 Bits	*/
-      fputc (0x20, f);		/* Image Descriptor	*/
-      fclose(f);
-      f = fopen( filename, "ab" );  /* reopen in binary append mode */
-      for (y=height-1; y>=0; y--) {
-         for (x=0; x<width; x++) {
-            i = (y*width + x) * 4;
-            fputc(ptr[i+2], f); /* write blue */
-            fputc(ptr[i+1], f); /* write green */
-            fputc(ptr[i], f);   /* write red */
-         }
-      }
-   }
-}
-
+   /* the extension picks the format, e.g. .png, .qoi or .ppm */
+#ifdef SAVE_TARGA
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_TGA);
 #else
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_PPM);
+#endif
 
-static void
-write_ppm(const char *filename, const GLubyte *buffer, int width, int height)
-{
-   const int binary = 0;
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLubyte *ptr = buffer;
-      if (binary) {
-         fprintf(f,"P6\n");
-         fprintf(f,"# ppm-file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width,height);
-         fprintf(f,"255\n");
-         fclose(f);
-         f = fopen( filename, "ab" );  /* reopen in binary append mode */
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               fputc(ptr[i], f);   /* write red */
-               fputc(ptr[i+1], f); /* write green */
-               fputc(ptr[i+2], f); /* write blue */
-            }
-         }
-      }
-      else {
-         /*ASCII*/
-         int counter = 0;
-         fprintf(f,"P3\n");
-         fprintf(f,"# ascii ppm file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width, height);
-         fprintf(f,"255\n");
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               fprintf(f, " %3d %3d %3d", ptr[i], ptr[i+1], ptr[i+2]);
-               counter++;
-               if (counter % 5 == 0)
-                  fprintf(f, "\n");
-            }
-         }
-      }
-      fclose(f);
-   }
+   if (!imagewrite_file(filename, format, buffer, width, height,
+                        IMAGEWRITE_BOTTOM_UP))
+      fprintf(stderr, "osdemo: error writing %s\n", filename);
 }
 
-#endif
-
 
 
 int
@@ -301,11 +232,7 @@ main(int argc, char *argv[])
    render_image();
 
    if (filename != NULL) {
-#ifdef SAVE_TARGA
-      write_targa(filename, buffer, Width, Height);
-#else
-      write_ppm(filename, buffer, Width, Height);
-#endif
+      write_image(filename, buffer, Width, Height);
    }
    else {
       printf("Specify a filename if you want to make an image file\n");
@@ -13,6 +13,7 @@
 #include <stdlib.h>
 #include "GL/osmesa.h"
 #include "gl_wrap.h"
+#include "imagewrite.h"
 
 
 #define SAVE_TARGA
@@ -105,99 +106,32 @@ static void render_image( void )
 }
 
 
-#ifdef SAVE_TARGA
-
 static void
-write_targa(const char *filename, const GLushort *buffer, int width, int height)
+write_image(const char *filename, const GLushort *buffer, int width, int height)
 {
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLushort *ptr = buffer;
-      printf ("osdemo, writing tga file \n");
-      fputc (0x00, f);	/* ID Length, 0 => No ID	*/
-      fputc (0x00, f);	/* Color Map Type, 0 => No color map included	*/
-      fputc (0x02, f);	/* Image Type, 2 => Uncompressed, True-color Image */
-      fputc (0x00, f);	/* Next five bytes are about the color map entries */
-      fputc (0x00, f);	/* 2 bytes Index, 2 bytes length, 1 byte size */
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);	/* X-origin of Image	*/
-      fputc (0x00, f);
-      fputc (0x00, f);	/* Y-origin of Image	*/
-      fputc (0x00, f);
-      fputc (WIDTH & 0xff, f);      /* Image Width	*/
-      fputc ((WIDTH>>8) & 0xff, f);
-      fputc (HEIGHT & 0xff, f);     /* Image Height	*/
-      fputc ((HEIGHT>>8) & 0xff, f);
-      fputc (0x18, f);		/* Pixel Depth, 0x18 => 24 Bits	*/
-      fputc (0x20, f);		/* Image Descriptor	*/
-      fclose(f);
-      f = fopen( filename, "ab" );  /* reopen in binary append mode */
-      for (y=height-1; y>=0; y--) {
-         for (x=0; x<width; x++) {
-            i = (y*width + x) * 4;
-            /* just write 8 high bits */
-            fputc(ptr[i+2] >> 8, f); /* write blue */
-            fputc(ptr[i+1] >> 8, f); /* write green */
-            fputc(ptr[i] >> 8, f);   /* write red */
-         }
-      }
-   }
-}
-
+   /* the extension picks the format, e.g. .png, .qoi or .ppm */
+#ifdef SAVE_TARGA
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_TGA);
 #else
-
-static void
-write_ppm(const char *filename, const GLushort *buffer, int width, int height)
-{
-   const int binary = 0;
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLushort *ptr = buffer;
-      if (binary) {
-         fprintf(f,"P6\n");
-         fprintf(f,"# ppm-file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width,height);
-         fprintf(f,"255\n");
-         fclose(f);
-         f = fopen( filename, "ab" );  /* reopen in binary append mode */
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               /* just write 8 high bits */
-               fputc(ptr[i] >> 8, f);   /* write red */
-               fputc(ptr[i+1] >> 8, f); /* write green */
-               fputc(ptr[i+2] >> 8, f); /* write blue */
-            }
-         }
-      }
-      else {
-         /*ASCII*/
-         int counter = 0;
-         fprintf(f,"P3\n");
-         fprintf(f,"# ascii ppm file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width, height);
-         fprintf(f,"255\n");
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               /* just write 8 high bits */
-               fprintf(f, " %3d %3d %3d", ptr[i] >> 8, ptr[i+1] >> 8, ptr[i+2] >> 8);
-               counter++;
-               if (counter % 5 == 0)
-                  fprintf(f, "\n");
-            }
-         }
-      }
-      fclose(f);
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_PPM);
+#endif
+   GLubyte *rgba = (GLubyte *) malloc(width * height * 4);
+   int i;
+
+   if (!rgba)
+      return;
+   for (i = 0; i < width * height * 4; i++) {
+      /* just keep the 8 high bits */
+      rgba[i] = buffer[i] >> 8;
    }
+   if (!imagewrite_file(filename, format, rgba, width, height,
+                        IMAGEWRITE_BOTTOM_UP))
+      fprintf(stderr, "error writing %s\n", filename);
+   free(rgba);
 }
 
-#endif
-
 
 int main( int argc, char *argv[] )
 {
@@ -231,11 +165,7 @@ int main( int argc, char *argv[] )
    render_image();
 
    if (argc>1) {
-#ifdef SAVE_TARGA
-      write_targa(argv[1], buffer, WIDTH, HEIGHT);
-#else
-      write_ppm(argv[1], buffer, WIDTH, HEIGHT);
-#endif
+      write_image(argv[1], buffer, WIDTH, HEIGHT);
    }
    else {
       printf("Specify a filename if you want to make an image file\n");
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include "GL/osmesa.h"
 #include "gl_wrap.h"
+#include "imagewrite.h"
 
 
 #define SAVE_TARGA
@@ -105,117 +106,32 @@ static void render_image( void )
 }
 
 
-#ifdef SAVE_TARGA
-
 static void
-write_targa(const char *filename, const GLfloat *buffer, int width, int height)
+write_image(const char *filename, const GLfloat *buffer, int width, int height)
 {
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLfloat *ptr = buffer;
-      printf ("osdemo, writing tga file \n");
-      fputc (0x00, f);	/* ID Length, 0 => No ID	*/
-      fputc (0x00, f);	/* Color Map Type, 0 => No color map included	*/
-      fputc (0x02, f);	/* Image Type, 2 => Uncompressed, True-color Image */
-      fputc (0x00, f);	/* Next five bytes are about the color map entries */
-      fputc (0x00, f);	/* 2 bytes Index, 2 bytes length, 1 byte size */
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);
-      fputc (0x00, f);	/* X-origin of Image	*/
-      fputc (0x00, f);
-      fputc (0x00, f);	/* Y-origin of Image	*/
-      fputc (0x00, f);
-      fputc (WIDTH & 0xff, f);      /* Image Width	*/
-      fputc ((WIDTH>>8) & 0xff, f);
-      fputc (HEIGHT & 0xff, f);     /* Image Height	*/
-      fputc ((HEIGHT>>8) & 0xff, f);
-      fputc (0x18, f);		/* Pixel Depth, 0x18 => 24 Bits	*/
-      fputc (0x20, f);		/* Image Descriptor	*/
-      fclose(f);
-      f = fopen( filename, "ab" );  /* reopen in binary append mode */
-      for (y=height-1; y>=0; y--) {
-         for (x=0; x<width; x++) {
-            int r, g, b;
-            i = (y*width + x) * 4;
-            r = (int) (ptr[i+0] * 255.0);
-            g = (int) (ptr[i+1] * 255.0);
-            b = (int) (ptr[i+2] * 255.0);
-            if (r > 255) r = 255;
-            if (g > 255) g = 255;
-            if (b > 255) b = 255;
-            fputc(b, f); /* write blue */
-            fputc(g, f); /* write green */
-            fputc(r, f); /* write red */
-         }
-      }
-   }
-}
-
+   /* the extension picks the format, e.g. .png, .qoi or .ppm */
+#ifdef SAVE_TARGA
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_TGA);
 #else
-
-static void
-write_ppm(const char *filename, const GLfloat *buffer, int width, int height)
-{
-   const int binary = 0;
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLfloat *ptr = buffer;
-      if (binary) {
-         fprintf(f,"P6\n");
-         fprintf(f,"# ppm-file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width,height);
-         fprintf(f,"255\n");
-         fclose(f);
-         f = fopen( filename, "ab" );  /* reopen in binary append mode */
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               int r, g, b;
-               i = (y*width + x) * 4;
-               r = (int) (ptr[i+0] * 255.0);
-               g = (int) (ptr[i+1] * 255.0);
-               b = (int) (ptr[i+2] * 255.0);
-               if (r > 255) r = 255;
-               if (g > 255) g = 255;
-               if (b > 255) b = 255;
-               fputc(r, f);   /* write red */
-               fputc(g, f); /* write green */
-               fputc(b, f); /* write blue */
-            }
-         }
-      }
-      else {
-         /*ASCII*/
-         int counter = 0;
-         fprintf(f,"P3\n");
-         fprintf(f,"# ascii ppm file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width, height);
-         fprintf(f,"255\n");
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               int r, g, b;
-               i = (y*width + x) * 4;
-               r = (int) (ptr[i+0] * 255.0);
-               g = (int) (ptr[i+1] * 255.0);
-               b = (int) (ptr[i+2] * 255.0);
-               if (r > 255) r = 255;
-               if (g > 255) g = 255;
-               if (b > 255) b = 255;
-               fprintf(f, " %3d %3d %3d", r, g, b);
-               counter++;
-               if (counter % 5 == 0)
-                  fprintf(f, "\n");
-            }
-         }
-      }
-      fclose(f);
+   enum imagewrite_format format =
+      imagewrite_format_for_name(filename, IMAGEWRITE_PPM);
+#endif
+   GLubyte *rgba = (GLubyte *) malloc(width * height * 4);
+   int i;
+
+   if (!rgba)
+      return;
+   for (i = 0; i < width * height * 4; i++) {
+      GLfloat v = buffer[i] * 255.0F + 0.5F;
+      rgba[i] = v < 0.0F ? 0 : v > 255.0F ? 255 : (GLubyte) v;
    }
+   if (!imagewrite_file(filename, format, rgba, width, height,
+                        IMAGEWRITE_BOTTOM_UP))
+      fprintf(stderr, "error writing %s\n", filename);
+   free(rgba);
 }
 
-#endif
-
 
 int main( int argc, char *argv[] )
 {
@@ -249,11 +165,7 @@ int main( int argc, char *argv[] )
    render_image();
 
    if (argc>1) {
-#ifdef SAVE_TARGA
-      write_targa(argv[1], buffer, WIDTH, HEIGHT);
-#else
-      write_ppm(argv[1], buffer, WIDTH, HEIGHT);
-#endif
+      write_image(argv[1], buffer, WIDTH, HEIGHT);
    }
    else {
       printf("Specify a filename if you want to make an image file\n");
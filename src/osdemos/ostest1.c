@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "GL/osmesa.h"
+#include "imagewrite.h"
 
 
 #define WIDTH 600
@@ -305,46 +306,11 @@ init_context(void)
 static void
 write_ppm(const char *filename, const GLubyte *buffer, int width, int height)
 {
-   const int binary = 0;
-   FILE *f = fopen( filename, "w" );
-   if (f) {
-      int i, x, y;
-      const GLubyte *ptr = buffer;
-      if (binary) {
-         fprintf(f,"P6\n");
-         fprintf(f,"# ppm-file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width,height);
-         fprintf(f,"255\n");
-         fclose(f);
-         f = fopen( filename, "ab" );  /* reopen in binary append mode */
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               fputc(ptr[i], f);   /* write red */
-               fputc(ptr[i+1], f); /* write green */
-               fputc(ptr[i+2], f); /* write blue */
-            }
-         }
-      }
-      else {
-         /*ASCII*/
-         int counter = 0;
-         fprintf(f,"P3\n");
-         fprintf(f,"# ascii ppm file created by osdemo.c\n");
-         fprintf(f,"%i %i\n", width, height);
-         fprintf(f,"255\n");
-         for (y=height-1; y>=0; y--) {
-            for (x=0; x<width; x++) {
-               i = (y*width + x) * 4;
-               fprintf(f, " %3d %3d %3d", ptr[i], ptr[i+1], ptr[i+2]);
-               counter++;
-               if (counter % 5 == 0)
-                  fprintf(f, "\n");
-            }
-         }
-      }
-      fclose(f);
-   }
+   if (!imagewrite_file(filename,
+                        imagewrite_format_for_name(filename, IMAGEWRITE_PPM),
+                        buffer, width, height,
+                        IMAGEWRITE_BOTTOM_UP))
+      fprintf(stderr, "error writing %s\n", filename);
 }
 
 
@@ -27,120 +27,550 @@
  * Simple test to measure the overhead of making GL calls.
  *
  * The main purpose of this test is to measure the difference in calling
- * overhead of different dispatch methods.  Since it uses asm/timex.h to
- * access the Pentium's cycle counters, it will probably only compile on
- * Linux (though most architectures have a get_cycles function in timex.h).
- * That is why it isn't in the default Makefile.
+ * overhead of different dispatch methods (libGL, glvnd, glad, ...).  Each
+ * entry point in the Tests table is called in a tight loop, a few times
+ * over, and the best time per call is reported as JSON on stdout, which
+ * api_speed.py can compare between libraries.  The "(indirect call)"
+ * entry calls an empty function through a pointer, which is the floor
+ * for any glad call.
+ *
+ * Times come from the monotonic clock of timer_get_ns(); on x86 the
+ * time stamp counter ticks per call are reported as well.
+ *
+ * With -egl the context comes from a surfaceless (or device) EGL display
+ * instead of a GLUT window, so the test runs without a window system.
  *
  * \author Ian Romanick <idr@us.ibm.com>
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "glad/gl.h"
 #include "glut_wrap.h"
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include "stats.h"
+#include "timer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define HAVE_TSC 1
+#endif
 
-#define inline __inline__
-#include <asm/timex.h>
+#define MAX_REPS 100
 
-static float Width = 400;
-static float Height = 400;
-static unsigned count = 1000000;
+static int Width = 64;
+static int Height = 64;
+static unsigned Count = 1000000;
+static unsigned Reps = 5;
+static const char *Filter = NULL;
 
+static GLuint Program, Vbo, Ebo;
+static GLint LocScale, LocColor, LocMatrix;
 
-static void Idle( void )
+static const GLfloat V[16] = {
+   1.0, 0.0, 0.0, 1.0,
+   0.0, 1.0, 0.0, 0.0,
+   0.0, 0.0, 1.0, 0.0,
+   0.0, 0.0, 0.0, 1.0
+};
+static GLint IV[16];
+static GLfloat FV[16];
+
+
+static void GLAPIENTRY
+noop(const GLfloat *v)
 {
-   glutPostRedisplay();
+   (void) v;
 }
 
-#define DO_FUNC(f,p) \
-   do { \
-      t0 = get_cycles(); \
-      for ( i = 0 ; i < count ; i++ ) { \
-	 f p ; \
+static void (GLAPIENTRY * volatile NoopPtr)(const GLfloat *) = noop;
+
+
+/**
+ * What has to be set up around the calls of a test.
+ */
+enum group {
+   BASELINE,
+   IMMEDIATE,   /**< between glBegin(GL_POINTS) and glEnd() */
+   STATE,
+   UNIFORM,     /**< with Program in use */
+   DRAW,        /**< with Vbo and Ebo bound as a vertex array */
+   QUERY,
+};
+
+static const char *GroupNames[] = {
+   "baseline", "immediate", "state", "uniform", "draw", "query"
+};
+
+#define BENCH(id, call) \
+   static void bench_##id(unsigned count) \
+   { \
+      unsigned i; \
+      for (i = 0; i < count; i++) { \
+         call; \
       } \
-      t1 = get_cycles(); \
-      printf("%u calls to % 20s required %llu cycles.\n", count, # f, t1 - t0); \
-   } while( 0 )
+   }
+
+BENCH(noop, NoopPtr(V))
+
+BENCH(color3fv, glColor3fv(V))
+BENCH(color4ub, glColor4ub(255, (GLubyte) i, 0, 255))
+BENCH(normal3fv, glNormal3fv(V))
+BENCH(texcoord2fv, glTexCoord2fv(V))
+BENCH(texcoord3fv, glTexCoord3fv(V))
+BENCH(multitexcoord2fv, glMultiTexCoord2fv(GL_TEXTURE0, V))
+BENCH(multitexcoord2f, glMultiTexCoord2f(GL_TEXTURE0, 0.0, 0.0))
+BENCH(fogcoordf, glFogCoordf(0.5))
+BENCH(vertex3fv, glVertex3fv(V))
+
+BENCH(enable, glEnable(GL_DEPTH_TEST))
+BENCH(depthfunc, glDepthFunc(i & 1 ? GL_LESS : GL_LEQUAL))
+BENCH(blendfunc, glBlendFunc(GL_ONE, i & 1 ? GL_ZERO : GL_ONE))
+BENCH(colormask, glColorMask(1, 1, 1, i & 1))
+BENCH(viewport, glViewport(0, 0, Width, Height))
+BENCH(activetexture, glActiveTexture(GL_TEXTURE0 + (i & 1)))
+BENCH(bindbuffer, glBindBuffer(GL_ARRAY_BUFFER, Vbo))
+BENCH(useprogram, glUseProgram(Program))
+
+BENCH(uniform1f, glUniform1f(LocScale, (GLfloat) i))
+BENCH(uniform4fv, glUniform4fv(LocColor, 1, V))
+BENCH(uniformmatrix4fv, glUniformMatrix4fv(LocMatrix, 1, GL_FALSE, V))
+
+BENCH(drawpoints, glDrawArrays(GL_POINTS, 0, 1))
+BENCH(drawtriangles, glDrawArrays(GL_TRIANGLES, 0, 3))
+BENCH(drawelements, glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, NULL))
+
+BENCH(geterror, glGetError())
+BENCH(isenabled, glIsEnabled(GL_DEPTH_TEST))
+BENCH(getintegerv, glGetIntegerv(GL_VIEWPORT, IV))
+BENCH(getfloatv, glGetFloatv(GL_MODELVIEW_MATRIX, FV))
+BENCH(getuniformlocation, glGetUniformLocation(Program, "color"))
+
 
 /**
- * Main display function.  This is the place to add more API calls.
+ * The tests, in the order they are run.  This is the place to add more
+ * API calls.  Each test runs Count / divisor calls per repetition, so
+ * that the slow ones don't take all day.
  */
-static void Display( void )
+static const struct test {
+   const char *name;
+   enum group group;
+   int version;         /**< GL version needed, times 10 */
+   unsigned divisor;
+   void (*func)(unsigned count);
+} Tests[] = {
+   { "(indirect call)", BASELINE, 10, 1, bench_noop },
+
+   { "glColor3fv", IMMEDIATE, 10, 1, bench_color3fv },
+   { "glColor4ub", IMMEDIATE, 10, 1, bench_color4ub },
+   { "glNormal3fv", IMMEDIATE, 10, 1, bench_normal3fv },
+   { "glTexCoord2fv", IMMEDIATE, 10, 1, bench_texcoord2fv },
+   { "glTexCoord3fv", IMMEDIATE, 10, 1, bench_texcoord3fv },
+   { "glMultiTexCoord2fv", IMMEDIATE, 13, 1, bench_multitexcoord2fv },
+   { "glMultiTexCoord2f", IMMEDIATE, 13, 1, bench_multitexcoord2f },
+   { "glFogCoordf", IMMEDIATE, 14, 1, bench_fogcoordf },
+   { "glVertex3fv", IMMEDIATE, 10, 1, bench_vertex3fv },
+
+   { "glEnable", STATE, 10, 1, bench_enable },
+   { "glDepthFunc", STATE, 10, 1, bench_depthfunc },
+   { "glBlendFunc", STATE, 10, 1, bench_blendfunc },
+   { "glColorMask", STATE, 10, 1, bench_colormask },
+   { "glViewport", STATE, 10, 1, bench_viewport },
+   { "glActiveTexture", STATE, 13, 1, bench_activetexture },
+   { "glBindBuffer", STATE, 15, 1, bench_bindbuffer },
+   { "glUseProgram", STATE, 20, 1, bench_useprogram },
+
+   { "glUniform1f", UNIFORM, 20, 1, bench_uniform1f },
+   { "glUniform4fv", UNIFORM, 20, 1, bench_uniform4fv },
+   { "glUniformMatrix4fv", UNIFORM, 20, 1, bench_uniformmatrix4fv },
+
+   { "glDrawArrays(GL_POINTS, 1)", DRAW, 15, 16, bench_drawpoints },
+   { "glDrawArrays(GL_TRIANGLES, 3)", DRAW, 15, 16, bench_drawtriangles },
+   { "glDrawElements(GL_TRIANGLES, 3)", DRAW, 15, 16, bench_drawelements },
+
+   { "glGetError", QUERY, 10, 1, bench_geterror },
+   { "glIsEnabled", QUERY, 10, 1, bench_isenabled },
+   { "glGetIntegerv", QUERY, 10, 1, bench_getintegerv },
+   { "glGetFloatv", QUERY, 10, 1, bench_getfloatv },
+   { "glGetUniformLocation", QUERY, 20, 4, bench_getuniformlocation },
+};
+
+
+static void
+SetupObjects(int version)
 {
-   int i;
-   const float v[3] = { 1.0, 0.0, 0.0 };
-   cycles_t t0;
-   cycles_t t1;
+   static const GLfloat verts[] = {
+      -0.5, -0.5, 0.0,
+       0.5, -0.5, 0.0,
+       0.0,  0.5, 0.0
+   };
+   static const GLushort indices[] = { 0, 1, 2 };
+   static const char *vs_source =
+      "uniform float scale;\n"
+      "uniform mat4 matrix;\n"
+      "void main() {\n"
+      "   gl_Position = matrix * (gl_Vertex * scale);\n"
+      "}\n";
+   static const char *fs_source =
+      "uniform vec4 color;\n"
+      "void main() {\n"
+      "   gl_FragColor = color;\n"
+      "}\n";
+
+   if (version >= 15) {
+      glGenBuffers(1, &Vbo);
+      glBindBuffer(GL_ARRAY_BUFFER, Vbo);
+      glBufferData(GL_ARRAY_BUFFER, sizeof(verts), verts, GL_STATIC_DRAW);
+      glGenBuffers(1, &Ebo);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Ebo);
+      glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+                   GL_STATIC_DRAW);
+   }
+
+   if (version >= 20) {
+      GLuint vs = glCreateShader(GL_VERTEX_SHADER);
+      GLuint fs = glCreateShader(GL_FRAGMENT_SHADER);
+
+      glShaderSource(vs, 1, &vs_source, NULL);
+      glCompileShader(vs);
+      glShaderSource(fs, 1, &fs_source, NULL);
+      glCompileShader(fs);
+      Program = glCreateProgram();
+      glAttachShader(Program, vs);
+      glAttachShader(Program, fs);
+      glLinkProgram(Program);
+      glDeleteShader(vs);
+      glDeleteShader(fs);
+
+      LocScale = glGetUniformLocation(Program, "scale");
+      LocColor = glGetUniformLocation(Program, "color");
+      LocMatrix = glGetUniformLocation(Program, "matrix");
+   }
+}
+
+
+static void
+BeginGroup(enum group group)
+{
+   switch (group) {
+   case IMMEDIATE:
+      glBegin(GL_POINTS);
+      break;
+   case UNIFORM:
+      glUseProgram(Program);
+      break;
+   case DRAW:
+      glBindBuffer(GL_ARRAY_BUFFER, Vbo);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, Ebo);
+      glVertexPointer(3, GL_FLOAT, 0, NULL);
+      glEnableClientState(GL_VERTEX_ARRAY);
+      break;
+   default:
+      break;
+   }
+}
+
+
+static void
+EndGroup(enum group group)
+{
+   switch (group) {
+   case IMMEDIATE:
+      glEnd();
+      break;
+   case UNIFORM:
+      glUseProgram(0);
+      break;
+   case DRAW:
+      glDisableClientState(GL_VERTEX_ARRAY);
+      break;
+   default:
+      break;
+   }
+}
+
+
+static int
+Matches(const char *name)
+{
+   const char *f = Filter;
+
+   /* a comma-separated list of substrings */
+   while (f && *f) {
+      const char *end = strchr(f, ',');
+      size_t len = end ? (size_t) (end - f) : strlen(f);
+      const char *p;
+
+      for (p = name; *p; p++) {
+         if (strncmp(p, f, len) == 0)
+            return 1;
+      }
+      f = end ? end + 1 : NULL;
+   }
+   return !Filter;
+}
+
+
+static void
+PrintString(const char *s)
+{
+   putchar('"');
+   for (; s && *s; s++) {
+      if (*s == '"' || *s == '\\')
+         printf("\\%c", *s);
+      else if ((unsigned char) *s < 0x20)
+         printf("\\u%04x", *s);
+      else
+         putchar(*s);
+   }
+   putchar('"');
+}
+
+
+/**
+ * Runs the tests in the current context, with glad loaded for it.
+ * glad_version is what the glad loader returned.
+ */
+static void
+RunTests(const char *context, int glad_version)
+{
+   int version = GLAD_VERSION_MAJOR(glad_version) * 10 +
+                 GLAD_VERSION_MINOR(glad_version);
+   double ns[MAX_REPS];
+#ifdef HAVE_TSC
+   double ticks[MAX_REPS];
+#endif
+   const char *sep = "";
+   unsigned t, r;
 
-   glBegin(GL_TRIANGLE_STRIP);
+   if (!version) {
+      fprintf(stderr, "api_speed: failed to load GL\n");
+      exit(1);
+   }
+
+   SetupObjects(version);
+   glViewport(0, 0, Width, Height);
+
+   printf("{\n");
+   printf("  \"context\": \"%s\",\n", context);
+   printf("  \"vendor\": ");
+   PrintString((const char *) glGetString(GL_VENDOR));
+   printf(",\n  \"renderer\": ");
+   PrintString((const char *) glGetString(GL_RENDERER));
+   printf(",\n  \"version\": ");
+   PrintString((const char *) glGetString(GL_VERSION));
+   printf(",\n  \"calls\": %u,\n", Count);
+   printf("  \"repetitions\": %u,\n", Reps);
+   printf("  \"tests\": [");
+
+   for (t = 0; t < sizeof(Tests) / sizeof(Tests[0]); t++) {
+      const struct test *test = &Tests[t];
+      unsigned count = Count / test->divisor ? Count / test->divisor : 1;
+      struct stats s;
+
+      if (version < test->version || !Matches(test->name))
+         continue;
+
+      for (r = 0; r < Reps; r++) {
+         uint64_t t0, t1;
+#ifdef HAVE_TSC
+         uint64_t c0, c1;
+#endif
+
+         /* nothing queued by the previous run may be counted */
+         glFinish();
 
-   DO_FUNC( glColor3fv, (v) );
-   DO_FUNC( glNormal3fv, (v) );
-   DO_FUNC( glTexCoord2fv, (v) );
-   DO_FUNC( glTexCoord3fv, (v) );
-   DO_FUNC( glMultiTexCoord2fv, (GL_TEXTURE0, v) );
-   DO_FUNC( glMultiTexCoord2f, (GL_TEXTURE0, 0.0, 0.0) );
-   DO_FUNC( glFogCoordfvEXT, (v) );
-   DO_FUNC( glFogCoordfEXT, (0.5) );
+         BeginGroup(test->group);
+         t0 = timer_get_ns();
+#ifdef HAVE_TSC
+         c0 = __rdtsc();
+#endif
+         test->func(count);
+#ifdef HAVE_TSC
+         c1 = __rdtsc();
+#endif
+         t1 = timer_get_ns();
+         EndGroup(test->group);
+
+         ns[r] = (double) (t1 - t0) / count;
+#ifdef HAVE_TSC
+         ticks[r] = (double) (c1 - c0) / count;
+#endif
+      }
+
+      /* the best run is the one least disturbed by anything else */
+      stats_compute(ns, Reps, &s);
+      printf("%s\n    { \"name\": \"%s\", \"group\": \"%s\", \"calls\": %u, "
+             "\"ns_per_call\": %.3f, \"median_ns_per_call\": %.3f",
+             sep, test->name, GroupNames[test->group], count,
+             s.min, s.median);
+#ifdef HAVE_TSC
+      stats_compute(ticks, Reps, &s);
+      printf(", \"tsc_per_call\": %.3f", s.min);
+#endif
+      printf(" }");
+      sep = ",";
+   }
+   printf("\n  ]\n}\n");
+
+   if (glGetError() != GL_NO_ERROR)
+      fprintf(stderr, "api_speed: GL error during the tests\n");
+}
 
-   glEnd();
 
+static void Display( void )
+{
+   RunTests("glut", gladLoaderLoadGL());
    exit(0);
 }
 
 
-static void Reshape( int width, int height )
+#ifdef HAVE_EGL
+static EGLDisplay
+GetEglDisplay(void)
 {
-   Width = width;
-   Height = height;
-   glViewport( 0, 0, width, height );
-   glMatrixMode( GL_PROJECTION );
-   glLoadIdentity();
-   glOrtho(0.0, width, 0.0, height, -1.0, 1.0);
-   glMatrixMode( GL_MODELVIEW );
-   glLoadIdentity();
+   const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+   PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+      eglGetProcAddress("eglGetPlatformDisplayEXT");
+   EGLDisplay dpy = EGL_NO_DISPLAY;
+
+   if (!extensions || !get_platform_display)
+      return EGL_NO_DISPLAY;
+
+   if (strstr(extensions, "EGL_MESA_platform_surfaceless"))
+      dpy = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA,
+                                 EGL_DEFAULT_DISPLAY, NULL);
+   if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, NULL, NULL))
+      return dpy;
+
+   if (strstr(extensions, "EGL_EXT_platform_device")) {
+      PFNEGLQUERYDEVICESEXTPROC query_devices = (PFNEGLQUERYDEVICESEXTPROC)
+         eglGetProcAddress("eglQueryDevicesEXT");
+      EGLDeviceEXT devices[16];
+      EGLint num_devices, i;
+
+      if (query_devices && query_devices(16, devices, &num_devices)) {
+         for (i = 0; i < num_devices; i++) {
+            dpy = get_platform_display(EGL_PLATFORM_DEVICE_EXT,
+                                       devices[i], NULL);
+            if (dpy != EGL_NO_DISPLAY && eglInitialize(dpy, NULL, NULL))
+               return dpy;
+         }
+      }
+   }
+   return EGL_NO_DISPLAY;
 }
 
 
-static void Key( unsigned char key, int x, int y )
+static void
+RunEgl(void)
 {
-   (void) x;
-   (void) y;
-   switch (key) {
-      case 27:
-         exit(0);
-         break;
+   static const EGLint config_attribs[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_RED_SIZE, 8,
+      EGL_GREEN_SIZE, 8,
+      EGL_BLUE_SIZE, 8,
+      EGL_NONE
+   };
+   EGLint surface_attribs[] = {
+      EGL_WIDTH, Width,
+      EGL_HEIGHT, Height,
+      EGL_NONE
+   };
+   EGLDisplay dpy = GetEglDisplay();
+   EGLConfig config;
+   EGLContext ctx;
+   EGLSurface surf;
+   EGLint n;
+
+   if (dpy == EGL_NO_DISPLAY) {
+      fprintf(stderr, "api_speed: no surfaceless or device EGL display\n");
+      exit(1);
+   }
+   if (!eglBindAPI(EGL_OPENGL_API) ||
+       !eglChooseConfig(dpy, config_attribs, &config, 1, &n) || n == 0 ||
+       !(ctx = eglCreateContext(dpy, config, EGL_NO_CONTEXT, NULL)) ||
+       !(surf = eglCreatePbufferSurface(dpy, config, surface_attribs)) ||
+       !eglMakeCurrent(dpy, surf, surf, ctx)) {
+      fprintf(stderr, "api_speed: failed to create an EGL OpenGL context\n");
+      exit(1);
    }
-   glutPostRedisplay();
+
+   RunTests("egl", gladLoadGL((GLADloadfunc) eglGetProcAddress));
+
+   eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+   eglDestroySurface(dpy, surf);
+   eglDestroyContext(dpy, ctx);
+   eglTerminate(dpy);
+}
+#endif
+
+
+static void
+Usage(const char *name)
+{
+   fprintf(stderr, "Usage: %s [options] [iterations]\n", name);
+   fprintf(stderr, "  -n N         calls per repetition (default 1000000)\n");
+   fprintf(stderr, "  -r N         repetitions, the best is reported (default 5)\n");
+   fprintf(stderr, "  -t A,B,...   only the tests with one of these in the name\n");
+#ifdef HAVE_EGL
+   fprintf(stderr, "  -egl         use a surfaceless EGL context, not a window\n");
+#endif
+   exit(1);
 }
 
 
 int main( int argc, char *argv[] )
 {
+   int use_egl = 0;
+   int i;
+
+   for (i = 1; i < argc; i++) {
+      if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+         Count = strtoul(argv[++i], NULL, 0);
+      else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+         Reps = strtoul(argv[++i], NULL, 0);
+      else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+         Filter = argv[++i];
+#ifdef HAVE_EGL
+      else if (strcmp(argv[i], "-egl") == 0)
+         use_egl = 1;
+#endif
+      else if (argv[i][0] != '-')
+         Count = strtoul(argv[i], NULL, 0);
+      else
+         Usage(argv[0]);
+   }
+   if (Count == 0 || Reps == 0 || Reps > MAX_REPS)
+      Usage(argv[0]);
+
+#ifdef HAVE_EGL
+   if (use_egl) {
+      RunEgl();
+      return 0;
+   }
+#endif
+
    glutInit( &argc, argv );
-   glutInitWindowSize( (int) Width, (int) Height );
+   glutInitWindowSize( Width, Height );
    glutInitWindowPosition( 0, 0 );
 
    glutInitDisplayMode( GLUT_RGB );
 
    glutCreateWindow( argv[0] );
-   gladLoaderLoadGL();
-
-   if ( argc > 1 ) {
-      count = strtoul( argv[1], NULL, 0 );
-      if ( count == 0 ) {
-	 fprintf( stderr, "Usage: %s [iterations]\n", argv[0] );
-	 exit(1);
-      }
-   }
 
-   glutReshapeFunc( Reshape );
-   glutKeyboardFunc( Key );
    glutDisplayFunc( Display );
-   glutIdleFunc( Idle );
 
    glutMainLoop();
-   gladLoaderUnloadGL();
    return 0;
 }
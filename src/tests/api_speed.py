@@ -1,4 +1,4 @@
-#!/usr/bin/env python2
+#!/usr/bin/env python3
 
 # (C) Copyright IBM Corporation 2004
 # All Rights Reserved.
@@ -31,84 +31,74 @@
 # details on how to use it.
 
 
-import re, os, sys, getopt
+import json, os, subprocess, sys, getopt
 
 class results:
 	def process_file(self, f):
-		self.cycles = {}
-		self.iterations = -1
-
-		for line in f.readlines():
-			m = re.match("(\d+) calls to (.{20}) required (\d+) cycles.", line)
-
-			if self.iterations != -1 and int(m.group(1)) != self.iterations:
-				raise
-
-			# This could be done with lstrip, but the version of
-			# the Python library on my system doesn't have it.
-			# The installed version of Python is quite old. :(
-
-			temp = m.group(2)
-			function_name = None
-			for i in range(len(temp)):
-				if temp[i] != ' ':
-					function_name = temp[i:]
-					break
-
-			if function_name == None:
-				raise
-
-			self.cycles[ function_name ] = int(m.group(3))
-			self.iterations = int(m.group(1))
+		data = json.load(f)
+		self.renderer = data["renderer"]
+		self.ns = {}
+		for test in data["tests"]:
+			self.ns[ test["name"] ] = test["ns_per_call"]
 
 
 	def show_results(self):
-		for name in self.cycles:
-			print "%s -> %f" % (name, float(self.cycles[name]) / self.iterations)
+		print("%s" % (self.renderer))
+		for name in self.ns:
+			print("%-32s %8.2f ns" % (name, self.ns[name]))
 
 
 	def compare_results(self, other):
-		for name in self.cycles:
-			if other.cycles.has_key(name):
-				a = float(self.cycles[name])  / float(self.iterations)
-				b = float(other.cycles[name]) / float(other.iterations)
+		for name in self.ns:
+			if name in other.ns:
+				a = self.ns[name]
+				b = other.ns[name]
 				if abs( a ) < 0.000001:
-				    print "a = %f, b = %f" % (a, b)
+				    print("a = %f, b = %f" % (a, b))
 				else:
 				    p = (100.0 * b / a) - 100.0
-				    print "%- 20s %7.2f - %7.2f = % -6.2f (%+.1f%%)" % (name, a, b, a - b, p)
+				    print("%-32s %8.2f - %8.2f = % -8.2f (%+.1f%%)" % (name, a, b, a - b, p))
 		return
 
 
-def make_execution_string(lib, iterations):
+def make_execution_string(lib, iterations, extra):
+	s = "./api_speed -n %u %s" % (iterations, extra)
 	if lib == None:
-		return "./api_speed %u" % (iterations)
+		return s
 	else:
-		return "LD_PRELOAD=%s ./api_speed %u" % (lib, iterations)
+		return "LD_PRELOAD=%s %s" % (lib, s)
 
 
 def show_usage():
-	print """Usage: %s [-i iterations] {library ...}
+	print("""Usage: %s [-i iterations] [-e] [-t tests] {library ...}
 
 The full path to one or more libGL libraries (including the full name of the
 library) can be included on the command-line.  Each library will be tested,
 and the results compared.  The first library listed will be used as the
-"base line" for all comparisons.""" % (sys.argv[0])
+"base line" for all comparisons.  Times are the best nanoseconds per call.
+
+-e runs api_speed on a surfaceless EGL context rather than a GLUT window,
+and -t is passed on to select the tests.""" % (sys.argv[0]))
 	sys.exit(1)
 
 
 if __name__ == '__main__':
 	try:
-		(args, trail) = getopt.getopt(sys.argv[1:], "i:")
-	except Exception,e:
+		(args, trail) = getopt.getopt(sys.argv[1:], "i:et:")
+	except Exception as e:
 		show_usage()
 
 	iterations = 1000000
+	extra = ""
 	try:
 		for (arg,val) in args:
 			if arg == "-i":
 				iterations = int(val)
-	except Exception,e:
+			elif arg == "-e":
+				extra += " -egl"
+			elif arg == "-t":
+				extra += " -t '%s'" % (val)
+	except Exception as e:
 		show_usage()
 
 
@@ -123,9 +113,10 @@ if __name__ == '__main__':
 	names = []
 
 	for lib in trail:
-		s = make_execution_string( lib, iterations )
+		s = make_execution_string( lib, iterations, extra )
 		r = results()
-		r.process_file( os.popen(s) )
+		with subprocess.Popen(s, shell=True, stdout=subprocess.PIPE, text=True) as p:
+			r.process_file( p.stdout )
 		names.append(lib)
 		result_array.append(r)
 
@@ -138,6 +129,6 @@ if __name__ == '__main__':
 		result_array[0].show_results()
 	else:
 		for i in range(1, len( result_array )):
-			print "%s vs. %s" % (names[0], names[i])
+			print("%s vs. %s" % (names[0], names[i]))
 			result_array[0].compare_results( result_array[i] )
-			print ""
+			print("")
@@ -30,9 +30,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "glad/gl.h"
 #include "glut_wrap.h"
+#include "shaderutil.h"
+#include "timer.h"
 
 
 /* OpenGL texture info */
@@ -40,14 +48,23 @@ struct gl_texture_t
 {
   GLsizei width;
   GLsizei height;
+  GLsizei layers;               /* array elements, times 6 for cube maps */
 
+  GLenum target;
   GLenum format;
-  GLint internalFormat;
+  GLint blockSize;
+  const char *formatName;
   GLuint id;
 
-  GLubyte *texels;
+  const GLubyte *texels;        /* in the file mapping */
+  size_t size;                  /* of all texels */
 
   GLint numMipmaps;
+
+  /* the whole file */
+  void *map;
+  size_t mapSize;
+  int mapped;
 };
 
 /* DirectDraw's structures */
@@ -101,6 +118,25 @@ struct DDSurfaceDesc
   GLuint textureStage;
 };
 
+/* Direct3D 10 extension of the header, when fourCC is "DX10" */
+struct DDSHeaderDX10
+{
+  GLuint dxgiFormat;
+  GLuint resourceDimension;
+  GLuint miscFlag;
+  GLuint arraySize;
+  GLuint miscFlags2;
+};
+
+#define DDSD_MIPMAPCOUNT 0x20000
+#define DDSCAPS2_CUBEMAP 0x200
+#define DDSCAPS2_VOLUME 0x200000
+#define DDS_DIMENSION_TEXTURE2D 3
+#define DDS_RESOURCE_MISC_TEXTURECUBE 0x4
+
+/* Largest width or height accepted from a file */
+#define MAX_DIMENSION 16384
+
 #ifndef MAKEFOURCC
 #define MAKEFOURCC(ch0, ch1, ch2, ch3) \
   (GLuint)( \
@@ -113,9 +149,58 @@ struct DDSurfaceDesc
 #define FOURCC_DXT1 MAKEFOURCC('D', 'X', 'T', '1')
 #define FOURCC_DXT3 MAKEFOURCC('D', 'X', 'T', '3')
 #define FOURCC_DXT5 MAKEFOURCC('D', 'X', 'T', '5')
+#define FOURCC_ATI1 MAKEFOURCC('A', 'T', 'I', '1')
+#define FOURCC_BC4U MAKEFOURCC('B', 'C', '4', 'U')
+#define FOURCC_BC4S MAKEFOURCC('B', 'C', '4', 'S')
+#define FOURCC_ATI2 MAKEFOURCC('A', 'T', 'I', '2')
+#define FOURCC_BC5U MAKEFOURCC('B', 'C', '5', 'U')
+#define FOURCC_BC5S MAKEFOURCC('B', 'C', '5', 'S')
+#define FOURCC_DX10 MAKEFOURCC('D', 'X', '1', '0')
+
+/* Compressed formats, by legacy fourCC or DXGI format */
+static const struct
+{
+  GLuint fourCC;
+  GLuint dxgiFormat;
+  GLenum format;
+  GLint blockSize;
+  const char *name;
+} Formats[] = {
+  { FOURCC_DXT1, 71, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8, "BC1" },
+  { 0, 70, GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8, "BC1" },
+  { 0, 72, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT, 8, "BC1 sRGB" },
+  { FOURCC_DXT3, 74, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16, "BC2" },
+  { 0, 73, GL_COMPRESSED_RGBA_S3TC_DXT3_EXT, 16, "BC2" },
+  { 0, 75, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT, 16, "BC2 sRGB" },
+  { FOURCC_DXT5, 77, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16, "BC3" },
+  { 0, 76, GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16, "BC3" },
+  { 0, 78, GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT, 16, "BC3 sRGB" },
+  { FOURCC_ATI1, 80, GL_COMPRESSED_RED_RGTC1, 8, "BC4" },
+  { FOURCC_BC4U, 79, GL_COMPRESSED_RED_RGTC1, 8, "BC4" },
+  { FOURCC_BC4S, 81, GL_COMPRESSED_SIGNED_RED_RGTC1, 8, "BC4 snorm" },
+  { FOURCC_ATI2, 83, GL_COMPRESSED_RG_RGTC2, 16, "BC5" },
+  { FOURCC_BC5U, 82, GL_COMPRESSED_RG_RGTC2, 16, "BC5" },
+  { FOURCC_BC5S, 84, GL_COMPRESSED_SIGNED_RG_RGTC2, 16, "BC5 snorm" },
+  { 0, 95, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16, "BC6H ufloat" },
+  { 0, 94, GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT, 16, "BC6H ufloat" },
+  { 0, 96, GL_COMPRESSED_RGB_BPTC_SIGNED_FLOAT, 16, "BC6H sfloat" },
+  { 0, 98, GL_COMPRESSED_RGBA_BPTC_UNORM, 16, "BC7" },
+  { 0, 97, GL_COMPRESSED_RGBA_BPTC_UNORM, 16, "BC7" },
+  { 0, 99, GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM, 16, "BC7 sRGB" },
+};
+
+#define NUM_FORMATS (sizeof (Formats) / sizeof (Formats[0]))
+
+/* loaded textures */
+static struct gl_texture_t **Textures;
+static int NumTextures;
+static int CurTexture;
+static int CurLayer;
 
-/* texture Id */
-GLuint texId;
+static GLboolean UsePBO = GL_FALSE;
+
+/* for array textures, which fixed function can't sample */
+static GLuint ArrayProg, CubeArrayProg;
 
 
 #ifndef max
@@ -126,151 +211,433 @@ max (int a, int b)
 }
 #endif
 
+/* Map (or, without mmap, read) the whole file */
+static int
+MapFile (const char *filename, struct gl_texture_t *texinfo)
+{
+  struct stat st;
+#ifndef _WIN32
+  int fd = open (filename, O_RDONLY);
+
+  if (fd < 0)
+    return 0;
+  if (fstat (fd, &st) == 0 && st.st_size > 0)
+    {
+      texinfo->map = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (texinfo->map != MAP_FAILED)
+        {
+          texinfo->mapSize = st.st_size;
+          texinfo->mapped = 1;
+          close (fd);
+          return 1;
+        }
+    }
+  texinfo->map = NULL;
+  close (fd);
+#endif
+  {
+    FILE *fp = fopen (filename, "rb");
+
+    if (!fp)
+      return 0;
+    if (stat (filename, &st) == 0 && st.st_size > 0)
+      texinfo->map = malloc (st.st_size);
+    if (texinfo->map &&
+        fread (texinfo->map, 1, st.st_size, fp) == (size_t) st.st_size)
+      texinfo->mapSize = st.st_size;
+    else
+      {
+        free (texinfo->map);
+        texinfo->map = NULL;
+      }
+    fclose (fp);
+    return texinfo->map != NULL;
+  }
+}
+
+static void
+FreeDDSFile (struct gl_texture_t *texinfo)
+{
+#ifndef _WIN32
+  if (texinfo->mapped)
+    munmap (texinfo->map, texinfo->mapSize);
+  else
+#endif
+    free (texinfo->map);
+  texinfo->map = NULL;
+  texinfo->texels = NULL;
+}
+
+/* Levels of a full mipmap chain down to 1x1 */
+static GLint
+FullMipmapCount (GLsizei width, GLsizei height)
+{
+  GLsizei size = max (width, height);
+  GLint count = 1;
+
+  while (size > 1)
+    {
+      size >>= 1;
+      count++;
+    }
+  return count;
+}
+
+/* Bytes of one mipmap level of one layer */
+static size_t
+LevelSize (const struct gl_texture_t *texinfo, GLint mip)
+{
+  GLsizei w = max (texinfo->width >> mip, 1);
+  GLsizei h = max (texinfo->height >> mip, 1);
+
+  return (size_t) ((w + 3) / 4) * ((h + 3) / 4) * texinfo->blockSize;
+}
+
+/* Bytes of one layer with all its mipmaps */
+static size_t
+LayerSize (const struct gl_texture_t *texinfo)
+{
+  size_t size = 0;
+  GLint mip;
+
+  for (mip = 0; mip < texinfo->numMipmaps; ++mip)
+    size += LevelSize (texinfo, mip);
+  return size;
+}
+
 static struct gl_texture_t *
 ReadDDSFile (const char *filename)
 {
   struct DDSurfaceDesc ddsd;
+  struct DDSHeaderDX10 dx10;
   struct gl_texture_t *texinfo;
-  FILE *fp;
-  char magic[4];
-  long bufferSize, curr, end;
+  size_t offset = 4 + sizeof (ddsd);
+  GLuint fourCC, dxgiFormat = 0;
+  unsigned i;
+
+  texinfo = (struct gl_texture_t *)
+    calloc (sizeof (struct gl_texture_t), 1);
+  if (!texinfo)
+    return NULL;
 
-  /* Open the file */
-  fp = fopen (filename, "rb");
-  if (!fp)
+  /* Map the file */
+  if (!MapFile (filename, texinfo))
     {
       fprintf (stderr, "error: couldn't open \"%s\"!\n", filename);
+      free (texinfo);
       return NULL;
     }
 
-  /* Read magic number and check if valid .dds file */
-  fread (&magic, sizeof (char), 4, fp);
-
-  if (strncmp (magic, "DDS ", 4) != 0)
+  /* Check the magic number and get the surface descriptor */
+  if (texinfo->mapSize < offset ||
+      memcmp (texinfo->map, "DDS ", 4) != 0)
     {
-      fprintf (stderr, "the file \"%s\" doesn't appear to be"
+      fprintf (stderr, "the file \"%s\" doesn't appear to be "
 	       "a valid .dds file!\n", filename);
-      fclose (fp);
-      return NULL;
+      goto fail;
     }
+  memcpy (&ddsd, (GLubyte *) texinfo->map + 4, sizeof (ddsd));
 
-  /* Get the surface descriptor */
-  fread (&ddsd, sizeof (ddsd), 1, fp);
-
-  texinfo = (struct gl_texture_t *)
-    calloc (sizeof (struct gl_texture_t), 1);
   texinfo->width = ddsd.width;
   texinfo->height = ddsd.height;
-  texinfo->numMipmaps = ddsd.mipMapLevels;
+  texinfo->numMipmaps = (ddsd.flags & DDSD_MIPMAPCOUNT) ?
+    max (ddsd.mipMapLevels, 1) : 1;
+  texinfo->layers = 1;
+  texinfo->target = GL_TEXTURE_2D;
+  fourCC = ddsd.format.fourCC;
 
-  switch (ddsd.format.fourCC)
+  if (fourCC == FOURCC_DX10)
     {
-    case FOURCC_DXT1:
-      /* DXT1's compression ratio is 8:1 */
-      texinfo->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
-      texinfo->internalFormat = 3;
-      break;
-
-    case FOURCC_DXT3:
-      /* DXT3's compression ratio is 4:1 */
-      texinfo->format = GL_COMPRESSED_RGBA_S3TC_DXT3_EXT;
-      texinfo->internalFormat = 4;
-      break;
-
-    case FOURCC_DXT5:
-      /* DXT5's compression ratio is 4:1 */
-      texinfo->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
-      texinfo->internalFormat = 4;
-      break;
+      if (texinfo->mapSize < offset + sizeof (dx10))
+        goto bad;
+      memcpy (&dx10, (GLubyte *) texinfo->map + offset, sizeof (dx10));
+      offset += sizeof (dx10);
+
+      if (dx10.resourceDimension != DDS_DIMENSION_TEXTURE2D)
+        {
+          fprintf (stderr, "\"%s\": only 2D textures are supported\n",
+                   filename);
+          goto fail;
+        }
+      dxgiFormat = dx10.dxgiFormat;
+      fourCC = 0;
+      texinfo->layers = max (dx10.arraySize, 1);
+      if (dx10.miscFlag & DDS_RESOURCE_MISC_TEXTURECUBE)
+        {
+          texinfo->target = texinfo->layers > 1 ?
+            GL_TEXTURE_CUBE_MAP_ARRAY : GL_TEXTURE_CUBE_MAP;
+          texinfo->layers *= 6;
+        }
+      else if (texinfo->layers > 1)
+        texinfo->target = GL_TEXTURE_2D_ARRAY;
+    }
+  else if (ddsd.caps.caps2 & DDSCAPS2_VOLUME)
+    {
+      fprintf (stderr, "\"%s\": volume textures are not supported\n",
+               filename);
+      goto fail;
+    }
+  else if (ddsd.caps.caps2 & DDSCAPS2_CUBEMAP)
+    {
+      texinfo->target = GL_TEXTURE_CUBE_MAP;
+      texinfo->layers = 6;
+    }
 
-    default:
+  for (i = 0; i < NUM_FORMATS; i++)
+    {
+      if ((fourCC && Formats[i].fourCC == fourCC) ||
+          (dxgiFormat && Formats[i].dxgiFormat == dxgiFormat))
+        break;
+    }
+  if (i == NUM_FORMATS)
+    {
       /* Bad fourCC, unsupported or bad format */
-      fprintf (stderr, "the file \"%s\" doesn't appear to be"
-	       "compressed using DXT1, DXT3, or DXT5! [%i]\n",
-	       filename, ddsd.format.fourCC);
-      free (texinfo);
-      fclose (fp);
-      return NULL;
+      fprintf (stderr, "the file \"%s\" doesn't appear to be "
+	       "compressed using BC1-BC7! [%i/%i]\n",
+	       filename, ddsd.format.fourCC, dxgiFormat);
+      goto fail;
     }
+  texinfo->format = Formats[i].format;
+  texinfo->blockSize = Formats[i].blockSize;
+  texinfo->formatName = Formats[i].name;
+
+  /* All layers, each with its mipmaps, must be in the file; the size
+   * limits keep LayerSize () and the product below from overflowing */
+  if (texinfo->width < 1 || texinfo->height < 1 ||
+      texinfo->width > MAX_DIMENSION || texinfo->height > MAX_DIMENSION ||
+      texinfo->numMipmaps > 32 || texinfo->layers > 65536)
+    goto bad;
+  /* GL rejects more levels than the full chain down to 1x1 */
+  if (texinfo->numMipmaps > FullMipmapCount (texinfo->width,
+                                              texinfo->height))
+    texinfo->numMipmaps = FullMipmapCount (texinfo->width, texinfo->height);
+  if (LayerSize (texinfo) > (texinfo->mapSize - offset) / texinfo->layers)
+    goto bad;
+  texinfo->size = LayerSize (texinfo) * texinfo->layers;
+
+  texinfo->texels = (GLubyte *) texinfo->map + offset;
+  return texinfo;
 
-  /* Calculate pixel data size */
-  curr = ftell (fp);
-  fseek (fp, 0, SEEK_END);
-  end = ftell (fp);
-  fseek (fp, curr, SEEK_SET);
-  bufferSize = end - curr;
+bad:
+  fprintf (stderr, "the file \"%s\" is truncated or corrupt!\n", filename);
+fail:
+  FreeDDSFile (texinfo);
+  free (texinfo);
+  return NULL;
+}
 
-  /* Read pixel data with mipmaps */
-  texinfo->texels = (GLubyte *)malloc (bufferSize * sizeof (GLubyte));
-  fread (texinfo->texels, sizeof (GLubyte), bufferSize, fp);
+static GLboolean
+FormatSupported (const struct gl_texture_t *texinfo)
+{
+  switch (texinfo->format)
+    {
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+      return GLAD_GL_EXT_texture_compression_s3tc;
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+      return GLAD_GL_EXT_texture_compression_s3tc && GLAD_GL_EXT_texture_sRGB;
+    case GL_COMPRESSED_RED_RGTC1:
+    case GL_COMPRESSED_SIGNED_RED_RGTC1:
+    case GL_COMPRESSED_RG_RGTC2:
+    case GL_COMPRESSED_SIGNED_RG_RGTC2:
+      return GLAD_GL_VERSION_3_0 || GLAD_GL_ARB_texture_compression_rgtc;
+    default:
+      return GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_compression_bptc;
+    }
+}
 
-  /* Close the file */
-  fclose (fp);
-  return texinfo;
+static GLboolean
+TargetSupported (GLenum target)
+{
+  switch (target)
+    {
+    case GL_TEXTURE_2D_ARRAY:
+      return GLAD_GL_VERSION_3_0 || GLAD_GL_EXT_texture_array;
+    case GL_TEXTURE_CUBE_MAP_ARRAY:
+      return GLAD_GL_VERSION_4_0 || GLAD_GL_ARB_texture_cube_map_array;
+    default:
+      return GL_TRUE;
+    }
 }
 
 static GLuint
-loadDDSTexture (const char *filename)
+loadDDSTexture (const char *filename, struct gl_texture_t **info)
 {
   struct gl_texture_t *compressed_texture = NULL;
-  GLsizei mipWidth, mipHeight, mipSize;
-  int blockSize, offset;
-  GLuint tex_id = 0;
-  GLint mip;
-
-  /* Read texture from file */
+  GLsizei mipWidth, mipHeight;
+  const GLubyte *src;
+  size_t offset, mipSize;
+  GLboolean arrayTarget, storage;
+  GLuint pbo = 0;
+  GLint mip, layer;
+
+  /* Map texture from file */
   compressed_texture = ReadDDSFile (filename);
+  if (!compressed_texture)
+    return 0;
 
-  if (compressed_texture && compressed_texture->texels)
+  if (!FormatSupported (compressed_texture) ||
+      !TargetSupported (compressed_texture->target))
     {
-      /* Generate new texture */
-      glGenTextures (1, &compressed_texture->id);
-      glBindTexture (GL_TEXTURE_2D, compressed_texture->id);
+      fprintf (stderr, "error: \"%s\": %s %s textures aren't supported "
+               "by this GL\n", filename, compressed_texture->formatName,
+               compressed_texture->target == GL_TEXTURE_2D ? "2D" :
+               compressed_texture->target == GL_TEXTURE_CUBE_MAP ? "cube map" :
+               "array");
+      FreeDDSFile (compressed_texture);
+      free (compressed_texture);
+      return 0;
+    }
+
+  arrayTarget = compressed_texture->target == GL_TEXTURE_2D_ARRAY ||
+    compressed_texture->target == GL_TEXTURE_CUBE_MAP_ARRAY;
+  storage = GLAD_GL_VERSION_4_2 || GLAD_GL_ARB_texture_storage;
+
+  /* Generate new texture */
+  glGenTextures (1, &compressed_texture->id);
+  glBindTexture (compressed_texture->target, compressed_texture->id);
+
+  /* Setup some parameters for texture filters and mipmapping */
+  glTexParameteri (compressed_texture->target, GL_TEXTURE_MIN_FILTER,
+                   compressed_texture->numMipmaps > 1 ?
+                   GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+  glTexParameteri (compressed_texture->target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  /* files may stop short of the 1x1 level */
+  glTexParameteri (compressed_texture->target, GL_TEXTURE_MAX_LEVEL,
+                   compressed_texture->numMipmaps - 1);
+
+  /* Allocate all levels up front where the upload goes by sub-images */
+  if (storage && arrayTarget)
+    glTexStorage3D (compressed_texture->target,
+                    compressed_texture->numMipmaps, compressed_texture->format,
+                    compressed_texture->width, compressed_texture->height,
+                    compressed_texture->layers);
+  else if (storage)
+    glTexStorage2D (compressed_texture->target,
+                    compressed_texture->numMipmaps, compressed_texture->format,
+                    compressed_texture->width, compressed_texture->height);
+  else if (arrayTarget)
+    {
+      for (mip = 0; mip < compressed_texture->numMipmaps; ++mip)
+        glCompressedTexImage3D (compressed_texture->target, mip,
+                                compressed_texture->format,
+                                max (compressed_texture->width >> mip, 1),
+                                max (compressed_texture->height >> mip, 1),
+                                compressed_texture->layers, 0,
+                                LevelSize (compressed_texture, mip) *
+                                compressed_texture->layers, NULL);
+    }
 
-      /* Setup some parameters for texture filters and mipmapping */
-      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-      glTexParameteri (GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  /* Upload straight from the mapping, or have the GL copy it all into
+   * a pixel buffer in one go and upload from there */
+  src = compressed_texture->texels;
+  if (UsePBO)
+    {
+      glGenBuffers (1, &pbo);
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, pbo);
+      glBufferData (GL_PIXEL_UNPACK_BUFFER, compressed_texture->size,
+                    compressed_texture->texels, GL_STREAM_DRAW);
+      src = NULL;
+    }
 
+  /* Upload mipmaps to video memory; the file has each layer (or cube
+   * face) with all its mipmaps in turn */
+  offset = 0;
+  for (layer = 0; layer < compressed_texture->layers; ++layer)
+    {
       mipWidth = compressed_texture->width;
       mipHeight = compressed_texture->height;
-      blockSize = (compressed_texture->format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) ? 8 : 16;
-      offset = 0;
 
-      /* Upload mipmaps to video memory */
       for (mip = 0; mip < compressed_texture->numMipmaps; ++mip)
 	{
-	  mipSize = ((mipWidth + 3) / 4) * ((mipHeight + 3) / 4) * blockSize;
-
-	  glCompressedTexImage2D (GL_TEXTURE_2D, mip, compressed_texture->format,
-				  mipWidth, mipHeight, 0, mipSize,
-				  compressed_texture->texels + offset);
+	  mipSize = LevelSize (compressed_texture, mip);
+
+          if (arrayTarget)
+            glCompressedTexSubImage3D (compressed_texture->target, mip,
+                                       0, 0, layer, mipWidth, mipHeight, 1,
+                                       compressed_texture->format, mipSize,
+                                       src + offset);
+          else
+            {
+              GLenum target = compressed_texture->target == GL_TEXTURE_CUBE_MAP ?
+                GL_TEXTURE_CUBE_MAP_POSITIVE_X + layer : GL_TEXTURE_2D;
+
+              if (storage)
+                glCompressedTexSubImage2D (target, mip, 0, 0,
+                                           mipWidth, mipHeight,
+                                           compressed_texture->format,
+                                           mipSize, src + offset);
+              else
+                glCompressedTexImage2D (target, mip, compressed_texture->format,
+                                        mipWidth, mipHeight, 0, mipSize,
+                                        src + offset);
+            }
 
 	  mipWidth = max (mipWidth >> 1, 1);
 	  mipHeight = max (mipHeight >> 1, 1);
 
 	  offset += mipSize;
 	}
+    }
 
-      tex_id = compressed_texture->id;
-
-      /* Opengl has its own copy of pixels */
-      free (compressed_texture->texels);
-      free (compressed_texture);
+  if (pbo)
+    {
+      glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+      glDeleteBuffers (1, &pbo);
     }
 
-  return tex_id;
+  /* Opengl has its own copy of pixels */
+  FreeDDSFile (compressed_texture);
+  *info = compressed_texture;
+
+  return compressed_texture->id;
 }
 
 static void
 cleanup (void)
 {
-  glDeleteTextures (1, &texId);
+  int i;
+
+  for (i = 0; i < NumTextures; i++)
+    {
+      glDeleteTextures (1, &Textures[i]->id);
+      free (Textures[i]);
+    }
+  free (Textures);
+}
+
+static GLuint
+MakeArrayProgram (const char *samplerType, const char *lookup)
+{
+  static const char *fragShader =
+    "#version 130\n"
+    "#extension GL_ARB_texture_cube_map_array : enable\n"
+    "uniform %s tex;\n"
+    "uniform float layer;\n"
+    "void main()\n"
+    "{\n"
+    "   gl_FragColor = texture(tex, %s);\n"
+    "}\n";
+  char text[1000];
+  GLuint fs, prog;
+
+  snprintf (text, sizeof (text), fragShader, samplerType, lookup);
+  fs = CompileShaderText (GL_FRAGMENT_SHADER, text);
+  prog = LinkShaders (0, fs);
+  glUseProgram (prog);
+  glUniform1i (glGetUniformLocation (prog, "tex"), 0);
+  glUseProgram (0);
+  return prog;
 }
 
 static void
-init (const char *filename)
+init (int numFiles, char **files)
 {
-  const char *glexts = (const char *)glGetString (GL_EXTENSIONS);
+  double totalBytes = 0.0, totalTime = 0.0;
+  int i;
 
   /* Initialize OpenGL */
   glClearColor (0.5f, 0.5f, 0.5f, 1.0f);
@@ -281,19 +648,43 @@ init (const char *filename)
   glEnable (GL_BLEND);
   glBlendFunc (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  /* Check for S3TC support */
-  if (!strstr (glexts, "GL_EXT_texture_compression_s3tc"))
+  if (UsePBO && !GLAD_GL_VERSION_2_1 && !GLAD_GL_ARB_pixel_buffer_object)
     {
-      fprintf (stderr, "error: GL_EXT_texture_compression_s3tc "
-	       "extension is required for DDS textures!\n");
-      exit(-1);
+      fprintf (stderr, "warning: pixel buffer objects aren't supported\n");
+      UsePBO = GL_FALSE;
     }
 
+  /* Load DDS textures from files */
+  Textures = (struct gl_texture_t **)
+    calloc (numFiles, sizeof (struct gl_texture_t *));
+  for (i = 0; i < numFiles; i++)
+    {
+      struct gl_texture_t *info;
+      uint64_t start, elapsed;
+
+      start = timer_get_ns ();
+      if (!loadDDSTexture (files[i], &info))
+        continue;
+      glFinish ();
+      elapsed = timer_get_ns () - start;
+
+      printf ("%s: %s %dx%d, %d level(s), %d layer(s), %.2f MB in %.3f ms"
+              " (%.1f MB/s)\n", files[i], info->formatName,
+              info->width, info->height, info->numMipmaps, info->layers,
+              info->size / 1e6, elapsed * 1e-6,
+              info->size / (elapsed * 1e-9) / 1e6);
+
+      totalBytes += info->size;
+      totalTime += elapsed * 1e-9;
+      Textures[NumTextures++] = info;
+    }
 
-  /* Load DDS texture from file */
-  texId = loadDDSTexture (filename);
-  if (!texId)
+  if (!NumTextures)
     exit (EXIT_FAILURE);
+  if (numFiles > 1 && totalTime > 0.0)
+    printf ("total: %d texture(s), %.2f MB in %.3f ms (%.1f MB/s)\n",
+            NumTextures, totalBytes / 1e6, totalTime * 1e3,
+            totalBytes / totalTime / 1e6);
 }
 
 static void
@@ -317,32 +708,82 @@ reshape (int w, int h)
   glutPostRedisplay ();
 }
 
+/* Texture coordinates of a quad corner, for cube map face 'face' */
+static void
+CubeTexCoord (int face, float s, float t)
+{
+  /* s, t in [-1, 1] to a direction through the face */
+  static const float axes[6][3][3] = {
+    /*  s axis        t axis        normal */
+    { {  0,  0, -1 }, {  0, -1,  0 }, {  1,  0,  0 } },
+    { {  0,  0,  1 }, {  0, -1,  0 }, { -1,  0,  0 } },
+    { {  1,  0,  0 }, {  0,  0,  1 }, {  0,  1,  0 } },
+    { {  1,  0,  0 }, {  0,  0, -1 }, {  0, -1,  0 } },
+    { {  1,  0,  0 }, {  0, -1,  0 }, {  0,  0,  1 } },
+    { { -1,  0,  0 }, {  0, -1,  0 }, {  0,  0, -1 } },
+  };
+  const float (*a)[3] = axes[face];
+
+  glTexCoord3f (s * a[0][0] + t * a[1][0] + a[2][0],
+                s * a[0][1] + t * a[1][1] + a[2][1],
+                s * a[0][2] + t * a[1][2] + a[2][2]);
+}
+
 static void
 display (void)
 {
+  const struct gl_texture_t *tex = Textures[CurTexture];
+  static const float corners[4][2] = {
+    { 0.0f, 0.0f }, { 1.0f, 0.0f }, { 1.0f, 1.0f }, { 0.0f, 1.0f }
+  };
+  GLboolean cube = tex->target == GL_TEXTURE_CUBE_MAP ||
+    tex->target == GL_TEXTURE_CUBE_MAP_ARRAY;
+  int i;
+
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   glLoadIdentity ();
 
-  glEnable (GL_TEXTURE_2D);
-  glBindTexture (GL_TEXTURE_2D, texId);
+  glBindTexture (tex->target, tex->id);
+  if (tex->target == GL_TEXTURE_2D_ARRAY)
+    {
+      if (!ArrayProg)
+        ArrayProg = MakeArrayProgram ("sampler2DArray",
+                                      "vec3(gl_TexCoord[0].st, layer)");
+      glUseProgram (ArrayProg);
+      glUniform1f (glGetUniformLocation (ArrayProg, "layer"), CurLayer);
+    }
+  else if (tex->target == GL_TEXTURE_CUBE_MAP_ARRAY)
+    {
+      if (!CubeArrayProg)
+        CubeArrayProg = MakeArrayProgram ("samplerCubeArray",
+                                          "vec4(gl_TexCoord[0].stp, layer)");
+      glUseProgram (CubeArrayProg);
+      glUniform1f (glGetUniformLocation (CubeArrayProg, "layer"),
+                   CurLayer / 6);
+    }
+  else
+    glEnable (tex->target);
 
   /* Draw textured quad */
   glTranslatef (0.0, 0.0, 0.5);
   glBegin (GL_QUADS);
-    glTexCoord2f (0.0f, 0.0f);
-    glVertex3f (-1.0f, -1.0f, 0.0f);
-
-    glTexCoord2f (1.0f, 0.0f);
-    glVertex3f (1.0f, -1.0f, 0.0f);
-
-    glTexCoord2f (1.0f, 1.0f);
-    glVertex3f (1.0f, 1.0f, 0.0f);
-
-    glTexCoord2f (0.0f, 1.0f);
-    glVertex3f (-1.0f, 1.0f, 0.0f);
+  for (i = 0; i < 4; i++)
+    {
+      if (cube)
+        CubeTexCoord (CurLayer % 6, corners[i][0] * 2.0f - 1.0f,
+                      1.0f - corners[i][1] * 2.0f);
+      else
+        glTexCoord2fv (corners[i]);
+      glVertex3f (corners[i][0] * 2.0f - 1.0f, corners[i][1] * 2.0f - 1.0f,
+                  0.0f);
+    }
   glEnd  ();
 
-  glDisable (GL_TEXTURE_2D);
+  if (tex->target == GL_TEXTURE_2D_ARRAY ||
+      tex->target == GL_TEXTURE_CUBE_MAP_ARRAY)
+    glUseProgram (0);
+  else
+    glDisable (tex->target);
 
   glutSwapBuffers ();
 }
@@ -350,17 +791,42 @@ display (void)
 static void
 keyboard (unsigned char key, int x, int y)
 {
-  /* Escape */
-  if (key == 27)
-    exit (0);
+  switch (key)
+    {
+    case 'n':
+      /* next texture */
+      CurTexture = (CurTexture + 1) % NumTextures;
+      CurLayer = 0;
+      break;
+    case 'l':
+      /* next array layer or cube face */
+      CurLayer = (CurLayer + 1) % Textures[CurTexture]->layers;
+      break;
+    case 27:
+      /* Escape */
+      exit (0);
+    }
+  glutPostRedisplay ();
 }
 
 int
 main (int argc, char *argv[])
 {
+  int i, j;
+
+  /* take out -pbo, keeping argv[0] for glutInit() and the usage */
+  for (i = j = 1; i < argc; i++)
+    {
+      if (strcmp (argv[i], "-pbo") == 0)
+        UsePBO = GL_TRUE;
+      else
+        argv[j++] = argv[i];
+    }
+  argc = j;
+  argv[argc] = NULL;
   if (argc < 2)
     {
-      fprintf (stderr, "usage: %s <filename.dds>\n", argv[0]);
+      fprintf (stderr, "usage: %s [-pbo] <filename.dds> [...]\n", argv[0]);
       return -1;
     }
 
@@ -373,7 +839,9 @@ main (int argc, char *argv[])
   gladLoaderLoadGL();
 
   atexit (cleanup);
-  init (argv[1]);
+  init (argc - 1, argv + 1);
+
+  printf ("keys: n = next texture, l = next layer or face\n");
 
   glutReshapeFunc (reshape);
   glutDisplayFunc (display);
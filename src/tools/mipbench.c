@@ -0,0 +1,168 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * mipbench -- time building mipmap chains for SGI .rgb images
+ *
+ * Usage: mipbench [-threads n] [file.rgb ...]
+ *
+ * With no files the images in the demos data directory are used.
+ * -threads sets the number of threads used by the CPU generator and the
+ * compressor (default: one per CPU).  Each image is turned into a full
+ * mipmap chain with gluBuild2DMipmaps(), the CPU generator with each of
+ * its filters, the CPU generator with BC and ETC2 compression of each
+ * level (with the compression cache off) and GL_GENERATE_MIPMAP, for
+ * about half a second each, and the time per chain (including the
+ * upload and a glFinish) is reported.  Methods the GL can't do,
+ * including GL_GENERATE_MIPMAP where the generator would fall back to
+ * the CPU, are skipped.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "glad/gl.h"
+#include "glut_wrap.h"
+#include "mipmap.h"
+#include "readtex.h"
+#include "texcompress.h"
+#include "timer.h"
+
+
+static const char *DefaultFiles[] = {
+   DEMOS_DATA_DIR "arch.rgb",
+   DEMOS_DATA_DIR "bw.rgb",
+   DEMOS_DATA_DIR "girl.rgb",
+   DEMOS_DATA_DIR "girl2.rgb",
+   DEMOS_DATA_DIR "reflect.rgb",
+   DEMOS_DATA_DIR "s128.rgb",
+   DEMOS_DATA_DIR "tile.rgb",
+   DEMOS_DATA_DIR "tree3.rgb",
+   DEMOS_DATA_DIR "wrs_logo.rgb",
+};
+
+static const struct {
+   const char *name;
+   enum mipmap_generator generator;
+   enum mipmap_filter filter;
+   int srgb;
+   enum texcompress_mode compress;
+} Methods[] = {
+   { "glu",          MIPMAP_GENERATOR_GLU, MIPMAP_FILTER_BOX,    0, TEXCOMPRESS_OFF },
+   { "cpu box",      MIPMAP_GENERATOR_CPU, MIPMAP_FILTER_BOX,    0, TEXCOMPRESS_OFF },
+   { "cpu box srgb", MIPMAP_GENERATOR_CPU, MIPMAP_FILTER_BOX,    1, TEXCOMPRESS_OFF },
+   { "cpu kaiser",   MIPMAP_GENERATOR_CPU, MIPMAP_FILTER_KAISER, 0, TEXCOMPRESS_OFF },
+   { "cpu bc",       MIPMAP_GENERATOR_CPU, MIPMAP_FILTER_BOX,    0, TEXCOMPRESS_BC },
+   { "cpu etc2",     MIPMAP_GENERATOR_CPU, MIPMAP_FILTER_BOX,    0, TEXCOMPRESS_ETC2 },
+   { "gl",           MIPMAP_GENERATOR_GL,  MIPMAP_FILTER_BOX,    0, TEXCOMPRESS_OFF },
+};
+
+#define NUM_METHODS (sizeof(Methods) / sizeof(Methods[0]))
+
+
+static double
+Bench(const GLubyte *image, GLint width, GLint height, GLenum format)
+{
+   uint64_t start, elapsed;
+   int count = 0;
+
+   start = timer_get_ns();
+   do {
+      mipmap_build_2d(GL_TEXTURE_2D, format, width, height, format, image);
+      glFinish();
+      count++;
+      elapsed = timer_get_ns() - start;
+   } while (elapsed < 500000000);
+
+   return elapsed * 1e-6 / count;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+   const char **files = DefaultFiles;
+   int numFiles = sizeof(DefaultFiles) / sizeof(DefaultFiles[0]);
+   double total[NUM_METHODS];
+   GLuint tex;
+   unsigned m;
+   int i;
+
+   glutInit(&argc, argv);
+   glutInitDisplayMode(GLUT_RGB);
+   glutInitWindowSize(64, 64);
+   glutCreateWindow(argv[0]);
+   gladLoaderLoadGL();
+
+   texcompress_set_cache_dir(NULL);
+   if (argc > 2 && !strcmp(argv[1], "-threads")) {
+      mipmap_set_threads(atoi(argv[2]));
+      texcompress_set_threads(atoi(argv[2]));
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc > 1) {
+      files = (const char **) argv + 1;
+      numFiles = argc - 1;
+   }
+
+   printf("GL_RENDERER = %s\n\n", (const char *) glGetString(GL_RENDERER));
+   printf("%-40s %9s", "image", "size");
+   for (m = 0; m < NUM_METHODS; m++) {
+      printf(" %12s", Methods[m].name);
+      total[m] = 0.0;
+   }
+   printf("   (ms/chain)\n");
+
+   glGenTextures(1, &tex);
+   glBindTexture(GL_TEXTURE_2D, tex);
+
+   for (i = 0; i < numFiles; i++) {
+      GLint width, height;
+      GLenum format;
+      GLubyte *image;
+
+      image = LoadRGBImage(files[i], &width, &height, &format);
+      if (!image) {
+         fprintf(stderr, "mipbench: couldn't load %s\n", files[i]);
+         continue;
+      }
+
+      printf("%-40s %4dx%-4d", files[i], width, height);
+      fflush(stdout);
+      for (m = 0; m < NUM_METHODS; m++) {
+         double ms;
+
+         texcompress_set_mode(Methods[m].compress);
+         if (Methods[m].compress != TEXCOMPRESS_OFF &&
+             texcompress_choose(format, format) == TEXCOMPRESS_NONE) {
+            printf(" %12s", "-");
+            continue;
+         }
+         if (Methods[m].generator == MIPMAP_GENERATOR_GL &&
+             !mipmap_gl_generates(GL_TEXTURE_2D, format, format)) {
+            printf(" %12s", "-");
+            continue;
+         }
+         mipmap_set_generator(Methods[m].generator);
+         mipmap_set_filter(Methods[m].filter, Methods[m].srgb);
+         /* gluBuild2DMipmaps() reads rows with the unpack alignment */
+         glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+         ms = Bench(image, width, height, format);
+         printf(" %12.3f", ms);
+         fflush(stdout);
+         total[m] += ms;
+      }
+      printf("\n");
+
+      free(image);
+   }
+
+   printf("%-40s %9s", "total", "");
+   for (m = 0; m < NUM_METHODS; m++)
+      printf(" %12.3f", total[m]);
+   printf("\n");
+
+   glDeleteTextures(1, &tex);
+   return 0;
+}
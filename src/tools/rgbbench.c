@@ -0,0 +1,93 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * rgbbench -- time decoding of SGI .rgb images with LoadRGBImage()
+ *
+ * Usage: rgbbench [-threads n] [file.rgb ...]
+ *
+ * With no files the images in the demos data directory are used.
+ * -threads sets the number of decoding threads (default: one per CPU).
+ * Each image is decoded repeatedly for about half a second and the
+ * decoded (interleaved) bytes per second are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "readtex.h"
+#include "sgiimage.h"
+#include "timer.h"
+
+
+static const char *DefaultFiles[] = {
+   DEMOS_DATA_DIR "arch.rgb",
+   DEMOS_DATA_DIR "bw.rgb",
+   DEMOS_DATA_DIR "girl.rgb",
+   DEMOS_DATA_DIR "girl2.rgb",
+   DEMOS_DATA_DIR "reflect.rgb",
+   DEMOS_DATA_DIR "s128.rgb",
+   DEMOS_DATA_DIR "tile.rgb",
+   DEMOS_DATA_DIR "tree3.rgb",
+   DEMOS_DATA_DIR "wrs_logo.rgb",
+};
+
+
+int
+main(int argc, char *argv[])
+{
+   const char **files = DefaultFiles;
+   int numFiles = sizeof(DefaultFiles) / sizeof(DefaultFiles[0]);
+   double totalBytes = 0.0, totalTime = 0.0;
+   int i;
+
+   if (argc > 2 && !strcmp(argv[1], "-threads")) {
+      sgi_image_set_threads(atoi(argv[2]));
+      argc -= 2;
+      argv += 2;
+   }
+   if (argc > 1) {
+      files = (const char **) argv + 1;
+      numFiles = argc - 1;
+   }
+
+   printf("%-40s %9s %8s %10s %9s\n",
+          "image", "size", "decodes", "ms/decode", "MB/s");
+
+   for (i = 0; i < numFiles; i++) {
+      GLint width, height;
+      GLenum format;
+      GLubyte *image;
+      uint64_t start, elapsed;
+      double bytes;
+      int count = 0;
+
+      image = LoadRGBImage(files[i], &width, &height, &format);
+      if (!image) {
+         fprintf(stderr, "rgbbench: couldn't load %s\n", files[i]);
+         continue;
+      }
+      free(image);
+      bytes = (double) width * height * (format == GL_RGBA ? 4 : 3);
+
+      start = timer_get_ns();
+      do {
+         free(LoadRGBImage(files[i], &width, &height, &format));
+         count++;
+         elapsed = timer_get_ns() - start;
+      } while (elapsed < 500000000);
+
+      printf("%-40s %4dx%-4d %8d %10.3f %9.1f\n", files[i], width, height,
+             count, elapsed * 1e-6 / count,
+             bytes * count / (elapsed * 1e-9) / 1e6);
+
+      totalBytes += bytes * count;
+      totalTime += elapsed * 1e-9;
+   }
+
+   if (totalTime > 0.0)
+      printf("%-40s %9s %8s %10s %9.1f\n", "total", "", "", "",
+             totalBytes / totalTime / 1e6);
+
+   return 0;
+}
@@ -0,0 +1,605 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Image file writers for rendered frames.
+ *
+ * Rows are converted to the file's channel order (with SSSE3 byte
+ * shuffles where the CPU has them) into a small buffer that is
+ * written out in large pieces, so the cost is close to that of copying
+ * the image once.  PNG files use stored deflate blocks, which needs no
+ * zlib and takes no time to "compress"; the price is files as big as
+ * the raw image.  QOI gives smaller files at a speed not far from that.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define popen _popen
+#define pclose _pclose
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+/* GCC and clang build the shuffles for SSSE3 even when the rest of the
+ * file targets plain x86-64, and check the CPU before using them */
+#if defined(__SSSE3__) || \
+    ((defined(__GNUC__) || defined(__clang__)) && \
+     (defined(__x86_64__) || defined(__i386__)))
+#define HAVE_SSSE3_ROWS
+#include <tmmintrin.h>
+#endif
+
+#include "imagewrite.h"
+
+#define SINK_SIZE (256 * 1024)
+
+/* largest stored deflate block */
+#define STORED_MAX 65535
+
+struct sink
+{
+   FILE *f;
+   unsigned char *buf;
+   size_t len;
+   int crc_active;              /* inside a PNG chunk */
+   uint32_t crc;
+   int error;
+};
+
+static uint32_t crc_table[4][256];
+#ifdef HAVE_PTHREAD
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+#else
+static int crc_ready = 0;
+#endif
+
+
+static void
+init_crc_table(void)
+{
+   uint32_t c;
+   unsigned i, k;
+
+   for (i = 0; i < 256; i++) {
+      c = i;
+      for (k = 0; k < 8; k++)
+         c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      crc_table[0][i] = c;
+   }
+   /* tables for four bytes at a time */
+   for (i = 0; i < 256; i++) {
+      c = crc_table[0][i];
+      for (k = 1; k < 4; k++) {
+         c = crc_table[0][c & 0xff] ^ (c >> 8);
+         crc_table[k][i] = c;
+      }
+   }
+}
+
+
+static uint32_t
+crc32_update(uint32_t crc, const unsigned char *p, size_t n)
+{
+   crc = ~crc;
+   while (n >= 4) {
+      crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+      crc = crc_table[3][crc & 0xff] ^ crc_table[2][(crc >> 8) & 0xff] ^
+            crc_table[1][(crc >> 16) & 0xff] ^ crc_table[0][crc >> 24];
+      p += 4;
+      n -= 4;
+   }
+   while (n--)
+      crc = crc_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+   return ~crc;
+}
+
+
+static uint32_t
+adler32_update(uint32_t adler, const unsigned char *p, size_t n)
+{
+   uint32_t a = adler & 0xffff, b = adler >> 16;
+
+   while (n) {
+      /* the most bytes before the sums can overflow */
+      size_t chunk = n < 5552 ? n : 5552;
+
+      n -= chunk;
+      while (chunk--) {
+         a += *p++;
+         b += a;
+      }
+      a %= 65521;
+      b %= 65521;
+   }
+   return b << 16 | a;
+}
+
+
+static void
+sink_flush(struct sink *s)
+{
+   if (s->len && fwrite(s->buf, 1, s->len, s->f) != s->len)
+      s->error = 1;
+   s->len = 0;
+}
+
+
+static void
+sink_put(struct sink *s, const void *data, size_t n)
+{
+   if (s->crc_active)
+      s->crc = crc32_update(s->crc, (const unsigned char *) data, n);
+
+   if (s->len + n > SINK_SIZE)
+      sink_flush(s);
+   if (n >= SINK_SIZE) {
+      if (fwrite(data, 1, n, s->f) != n)
+         s->error = 1;
+      return;
+   }
+   memcpy(s->buf + s->len, data, n);
+   s->len += n;
+}
+
+
+static void
+sink_byte(struct sink *s, unsigned char c)
+{
+   sink_put(s, &c, 1);
+}
+
+
+static void
+sink_be32(struct sink *s, uint32_t v)
+{
+   unsigned char b[4] = { v >> 24, (v >> 16) & 0xff, (v >> 8) & 0xff, v & 0xff };
+
+   sink_put(s, b, 4);
+}
+
+
+#ifdef HAVE_SSSE3_ROWS
+/* convert_row() for the pixels in whole groups of four; returns how many */
+#ifndef __SSSE3__
+__attribute__((target("ssse3")))
+#endif
+static unsigned
+convert_row_ssse3(const unsigned char *src, unsigned width, unsigned channels,
+                  int swap, unsigned char *dst)
+{
+   const __m128i shuffle = channels == 4 ?
+      _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15) :
+      swap ?
+      _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1) :
+      _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+   unsigned x;
+
+   for (x = 0; x + 4 <= width; x += 4) {
+      __m128i p = _mm_loadu_si128((const __m128i *) (src + x * 4));
+      _mm_storeu_si128((__m128i *) (dst + x * channels),
+                       _mm_shuffle_epi8(p, shuffle));
+   }
+   return x;
+}
+#endif
+
+
+/*
+ * Convert a row of four byte pixels to channels (3 or 4) bytes per pixel,
+ * swapping red and blue if swap is set.  dst must have 16 bytes of room
+ * past the end of the row.
+ */
+static void
+convert_row(const unsigned char *src, unsigned width, unsigned channels,
+            int swap, unsigned char *dst)
+{
+   unsigned x = 0;
+
+   if (channels == 4 && !swap) {
+      memcpy(dst, src, (size_t) width * 4);
+      return;
+   }
+
+#if defined(__SSSE3__)
+   x = convert_row_ssse3(src, width, channels, swap, dst);
+#elif defined(HAVE_SSSE3_ROWS)
+   if (__builtin_cpu_supports("ssse3"))
+      x = convert_row_ssse3(src, width, channels, swap, dst);
+#endif
+
+   for (; x < width; x++) {
+      const unsigned char *p = src + x * 4;
+      unsigned char *q = dst + x * channels;
+
+      q[0] = p[swap ? 2 : 0];
+      q[1] = p[1];
+      q[2] = p[swap ? 0 : 2];
+      if (channels == 4)
+         q[3] = p[3];
+   }
+}
+
+
+static const unsigned char *
+row_pointer(const unsigned char *pixels, unsigned width, unsigned height,
+            unsigned flags, unsigned y)
+{
+   if (flags & IMAGEWRITE_BOTTOM_UP)
+      y = height - 1 - y;
+   return pixels + (size_t) y * width * 4;
+}
+
+
+static void
+write_rows(struct sink *s, const unsigned char *pixels,
+           unsigned width, unsigned height, unsigned flags,
+           unsigned channels, int bgr, unsigned char *row)
+{
+   int swap = !(flags & IMAGEWRITE_BGRA) != !bgr;
+   unsigned y;
+
+   for (y = 0; y < height && !s->error; y++) {
+      convert_row(row_pointer(pixels, width, height, flags, y), width,
+                  channels, swap, row);
+      sink_put(s, row, (size_t) width * channels);
+   }
+}
+
+
+static void
+write_tga(struct sink *s, const unsigned char *pixels,
+          unsigned width, unsigned height, unsigned flags,
+          unsigned channels, unsigned char *row)
+{
+   unsigned char header[18];
+   int swap = !(flags & IMAGEWRITE_BGRA);
+   unsigned y;
+
+   memset(header, 0, sizeof(header));
+   header[2] = 0x02;            /* uncompressed true-color */
+   header[12] = width & 0xff;
+   header[13] = (width >> 8) & 0xff;
+   header[14] = height & 0xff;
+   header[15] = (height >> 8) & 0xff;
+   header[16] = channels * 8;
+   /* alpha bits, and rows top first unless they're bottom first */
+   header[17] = (channels == 4 ? 0x08 : 0) |
+                (flags & IMAGEWRITE_BOTTOM_UP ? 0 : 0x20);
+   sink_put(s, header, sizeof(header));
+
+   /* rows go out in the order they're in */
+   for (y = 0; y < height && !s->error; y++) {
+      convert_row(pixels + (size_t) y * width * 4, width, channels, swap, row);
+      sink_put(s, row, (size_t) width * channels);
+   }
+}
+
+
+static void
+write_qoi(struct sink *s, const unsigned char *pixels,
+          unsigned width, unsigned height, unsigned flags,
+          unsigned channels, unsigned char *row)
+{
+   static const unsigned char end[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+   unsigned char index[64][4], prev[4] = { 0, 0, 0, 255 };
+   unsigned char *out = row + (size_t) width * 4 + 16;
+   unsigned run = 0, x, y;
+
+   sink_put(s, "qoif", 4);
+   sink_be32(s, width);
+   sink_be32(s, height);
+   sink_byte(s, channels);
+   sink_byte(s, 0);             /* sRGB with linear alpha */
+   memset(index, 0, sizeof(index));
+
+   for (y = 0; y < height && !s->error; y++) {
+      unsigned char *q = out;
+
+      /* always four channels here, with alpha kept at 255 for RGB */
+      convert_row(row_pointer(pixels, width, height, flags, y), width, 4,
+                  (flags & IMAGEWRITE_BGRA) != 0, row);
+
+      for (x = 0; x < width; x++) {
+         unsigned char *p = row + x * 4;
+         unsigned h;
+
+         if (channels == 3)
+            p[3] = 255;
+
+         if (!memcmp(p, prev, 4)) {
+            if (++run == 62) {
+               *q++ = 0xc0 | (run - 1);
+               run = 0;
+            }
+            continue;
+         }
+         if (run) {
+            *q++ = 0xc0 | (run - 1);
+            run = 0;
+         }
+
+         h = (p[0] * 3 + p[1] * 5 + p[2] * 7 + p[3] * 11) & 63;
+         if (!memcmp(index[h], p, 4))
+            *q++ = h;
+         else {
+            memcpy(index[h], p, 4);
+            if (p[3] == prev[3]) {
+               signed char vr = p[0] - prev[0];
+               signed char vg = p[1] - prev[1];
+               signed char vb = p[2] - prev[2];
+               signed char vg_r = vr - vg, vg_b = vb - vg;
+
+               if (vr > -3 && vr < 2 && vg > -3 && vg < 2 &&
+                   vb > -3 && vb < 2)
+                  *q++ = 0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+               else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 &&
+                        vg_b > -9 && vg_b < 8) {
+                  *q++ = 0x80 | (vg + 32);
+                  *q++ = (vg_r + 8) << 4 | (vg_b + 8);
+               }
+               else {
+                  *q++ = 0xfe;
+                  *q++ = p[0];
+                  *q++ = p[1];
+                  *q++ = p[2];
+               }
+            }
+            else {
+               *q++ = 0xff;
+               memcpy(q, p, 4);
+               q += 4;
+            }
+         }
+         memcpy(prev, p, 4);
+      }
+      sink_put(s, out, q - out);
+   }
+
+   if (run)
+      sink_byte(s, 0xc0 | (run - 1));
+   sink_put(s, end, sizeof(end));
+}
+
+
+static void
+png_begin_chunk(struct sink *s, uint32_t length, const char *type)
+{
+   sink_be32(s, length);
+   s->crc = 0;
+   s->crc_active = 1;
+   sink_put(s, type, 4);
+}
+
+
+static void
+png_end_chunk(struct sink *s)
+{
+   s->crc_active = 0;
+   sink_be32(s, s->crc);
+}
+
+
+static void
+write_png(struct sink *s, const unsigned char *pixels,
+          unsigned width, unsigned height, unsigned flags,
+          unsigned channels, unsigned char *row)
+{
+   static const unsigned char signature[8] = {
+      0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+   };
+   unsigned char ihdr[13], block[5];
+   uint64_t raw = (uint64_t) height * (1 + (uint64_t) width * channels);
+   uint64_t blocks = (raw + STORED_MAX - 1) / STORED_MAX;
+   uint64_t idat = 2 + raw + 5 * blocks + 4;
+   uint64_t raw_left = raw;
+   uint32_t adler = 1, block_left = 0;
+   int swap = (flags & IMAGEWRITE_BGRA) != 0;
+   unsigned y;
+
+   if (idat >= 0x80000000u) {
+      s->error = 1;
+      return;
+   }
+
+   sink_put(s, signature, sizeof(signature));
+
+   ihdr[0] = width >> 24;
+   ihdr[1] = (width >> 16) & 0xff;
+   ihdr[2] = (width >> 8) & 0xff;
+   ihdr[3] = width & 0xff;
+   ihdr[4] = height >> 24;
+   ihdr[5] = (height >> 16) & 0xff;
+   ihdr[6] = (height >> 8) & 0xff;
+   ihdr[7] = height & 0xff;
+   ihdr[8] = 8;                 /* bits per channel */
+   ihdr[9] = channels == 4 ? 6 : 2;   /* RGBA or RGB */
+   ihdr[10] = ihdr[11] = ihdr[12] = 0;
+   png_begin_chunk(s, sizeof(ihdr), "IHDR");
+   sink_put(s, ihdr, sizeof(ihdr));
+   png_end_chunk(s);
+
+   /* a zlib stream of stored blocks, holding rows that each start with
+    * filter type 0 */
+   png_begin_chunk(s, (uint32_t) idat, "IDAT");
+   sink_byte(s, 0x78);
+   sink_byte(s, 0x01);
+   for (y = 0; y < height && !s->error; y++) {
+      const unsigned char *p = row;
+      size_t n = 1 + (size_t) width * channels;
+
+      row[0] = 0;
+      convert_row(row_pointer(pixels, width, height, flags, y), width,
+                  channels, swap, row + 1);
+      adler = adler32_update(adler, row, n);
+
+      while (n) {
+         uint32_t chunk;
+
+         if (!block_left) {
+            block_left = raw_left < STORED_MAX ? (uint32_t) raw_left : STORED_MAX;
+            block[0] = block_left == raw_left;   /* last block */
+            block[1] = block_left & 0xff;
+            block[2] = block_left >> 8;
+            block[3] = ~block_left & 0xff;
+            block[4] = (~block_left >> 8) & 0xff;
+            sink_put(s, block, sizeof(block));
+         }
+         chunk = n < block_left ? (uint32_t) n : block_left;
+         sink_put(s, p, chunk);
+         p += chunk;
+         n -= chunk;
+         block_left -= chunk;
+         raw_left -= chunk;
+      }
+   }
+   sink_be32(s, adler);
+   png_end_chunk(s);
+
+   png_begin_chunk(s, 0, "IEND");
+   png_end_chunk(s);
+}
+
+
+enum imagewrite_format
+imagewrite_format_for_name(const char *name, enum imagewrite_format fallback)
+{
+   static const struct {
+      const char *ext;
+      enum imagewrite_format format;
+   } exts[] = {
+      { ".ppm", IMAGEWRITE_PPM },
+      { ".pnm", IMAGEWRITE_PPM },
+      { ".tga", IMAGEWRITE_TGA },
+      { ".qoi", IMAGEWRITE_QOI },
+      { ".png", IMAGEWRITE_PNG },
+      { ".raw", IMAGEWRITE_RAW },
+      { ".rgba", IMAGEWRITE_RAW },
+   };
+   const char *dot = strrchr(name, '.');
+   unsigned i;
+
+   for (i = 0; dot && i < sizeof(exts) / sizeof(exts[0]); i++) {
+      const char *a = dot, *b = exts[i].ext;
+
+      /* case-insensitive, and the extension must end the name */
+      while (*a && *b && (*a | 0x20) == *b) {
+         a++;
+         b++;
+      }
+      if (!*a && !*b)
+         return exts[i].format;
+   }
+   return fallback;
+}
+
+
+FILE *
+imagewrite_open(const char *name)
+{
+   if (!strcmp(name, "-")) {
+#ifdef _WIN32
+      _setmode(_fileno(stdout), _O_BINARY);
+#endif
+      return stdout;
+   }
+   if (name[0] == '|') {
+#ifdef _WIN32
+      return popen(name + 1, "wb");
+#else
+      return popen(name + 1, "w");
+#endif
+   }
+   return fopen(name, "wb");
+}
+
+
+int
+imagewrite_close(FILE *f, const char *name)
+{
+   if (!strcmp(name, "-"))
+      return fflush(f) == 0;
+   if (name[0] == '|')
+      return pclose(f) == 0;
+   return fclose(f) == 0;
+}
+
+
+int
+imagewrite(FILE *f, enum imagewrite_format format,
+           const unsigned char *pixels, unsigned width, unsigned height,
+           unsigned flags)
+{
+   unsigned channels = flags & IMAGEWRITE_ALPHA ? 4 : 3;
+   struct sink s;
+   unsigned char *row;
+
+#ifdef HAVE_PTHREAD
+   pthread_once(&crc_once, init_crc_table);
+#else
+   if (!crc_ready) {
+      init_crc_table();
+      crc_ready = 1;
+   }
+#endif
+
+   /* a converted row with room to spare for the SIMD stores, and for QOI
+    * the worst case encoding of a row after that */
+   row = (unsigned char *) malloc((size_t) width * 4 + 16 +
+                                  (size_t) width * 5 + 1);
+   memset(&s, 0, sizeof(s));
+   s.f = f;
+   s.buf = (unsigned char *) malloc(SINK_SIZE);
+   if (!row || !s.buf) {
+      free(row);
+      free(s.buf);
+      return 0;
+   }
+
+   switch (format) {
+   case IMAGEWRITE_PPM:
+   {
+      char header[64];
+      int n = snprintf(header, sizeof(header), "P6\n%u %u\n255\n",
+                       width, height);
+
+      sink_put(&s, header, n);
+      write_rows(&s, pixels, width, height, flags, 3, 0, row);
+      break;
+   }
+   case IMAGEWRITE_TGA:
+      write_tga(&s, pixels, width, height, flags, channels, row);
+      break;
+   case IMAGEWRITE_QOI:
+      write_qoi(&s, pixels, width, height, flags, channels, row);
+      break;
+   case IMAGEWRITE_PNG:
+      write_png(&s, pixels, width, height, flags, channels, row);
+      break;
+   case IMAGEWRITE_RAW:
+      write_rows(&s, pixels, width, height, flags, channels, 0, row);
+      break;
+   }
+   sink_flush(&s);
+
+   free(row);
+   free(s.buf);
+   return !s.error;
+}
+
+
+int
+imagewrite_file(const char *name, enum imagewrite_format format,
+                const unsigned char *pixels, unsigned width, unsigned height,
+                unsigned flags)
+{
+   FILE *f = imagewrite_open(name);
+   int ok;
+
+   if (!f)
+      return 0;
+   ok = imagewrite(f, format, pixels, width, height, flags);
+   return imagewrite_close(f, name) && ok;
+}
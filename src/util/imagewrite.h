@@ -0,0 +1,90 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef IMAGEWRITE_H
+#define IMAGEWRITE_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * File formats imagewrite() can produce.
+ */
+enum imagewrite_format
+{
+   IMAGEWRITE_PPM,          /**< binary PPM (P6) */
+   IMAGEWRITE_TGA,          /**< uncompressed Targa */
+   IMAGEWRITE_QOI,          /**< the "Quite OK Image" format */
+   IMAGEWRITE_PNG,          /**< PNG with uncompressed (stored) deflate */
+   IMAGEWRITE_RAW,          /**< rows of RGB(A) bytes, top row first */
+};
+
+/**
+ * Layout of the pixels passed to imagewrite().
+ */
+enum imagewrite_flags
+{
+   IMAGEWRITE_BGRA = 1 << 0,        /**< B, G, R, A rather than R, G, B, A */
+   IMAGEWRITE_BOTTOM_UP = 1 << 1,   /**< bottom row first, as from GL */
+   IMAGEWRITE_ALPHA = 1 << 2,       /**< keep alpha where the format can */
+};
+
+/**
+ * Guesses the format from the extension of name (.ppm, .pnm, .tga,
+ * .qoi, .png, .raw or .rgba).
+ *
+ * @return the format, or fallback for other names
+ */
+enum imagewrite_format
+imagewrite_format_for_name(const char *name, enum imagewrite_format fallback);
+
+/**
+ * Opens name for writing images to.  "-" is stdout, and a name starting
+ * with '|' runs the rest as a shell command that reads the images on
+ * its stdin, so frames can be fed to an encoder without going to disk,
+ * e.g. "|ffmpeg -f image2pipe -i - out.mp4".  Anything else is a file.
+ *
+ * @return the stream, or NULL on failure
+ */
+FILE *
+imagewrite_open(const char *name);
+
+/**
+ * Closes a stream returned by imagewrite_open(name).
+ *
+ * @return 1 on success, 0 if writing failed or the command failed
+ */
+int
+imagewrite_close(FILE *f, const char *name);
+
+/**
+ * Writes one width x height image to f.  pixels are four bytes each,
+ * in rows without padding, laid out as given by flags.  Several images
+ * can be written to the same stream, e.g. PPM or raw frames to a pipe.
+ *
+ * @return 1 on success, 0 on a write error
+ */
+int
+imagewrite(FILE *f, enum imagewrite_format format,
+           const unsigned char *pixels, unsigned width, unsigned height,
+           unsigned flags);
+
+/**
+ * imagewrite_open(), imagewrite() and imagewrite_close() in one call.
+ *
+ * @return 1 on success, 0 on failure
+ */
+int
+imagewrite_file(const char *name, enum imagewrite_format format,
+                const unsigned char *pixels, unsigned width, unsigned height,
+                unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* IMAGEWRITE_H */
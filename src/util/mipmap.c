@@ -0,0 +1,711 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Mipmap generation on the CPU, as a replacement for gluBuild2DMipmaps().
+ *
+ * Each level is computed from the one above it.  The common case, a 2x2
+ * box filter over a level with even dimensions, is done with integer
+ * SSE2 code.  Everything else (odd sizes, the Kaiser filter, filtering
+ * in linear space for sRGB data) goes through a separable filter with
+ * per-axis weight tables.  Large levels are split into bands of rows
+ * that are filtered on several threads.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "mipmap.h"
+#include "parallel.h"
+#include "texcompress.h"
+
+#ifndef GL_GENERATE_MIPMAP
+#define GL_GENERATE_MIPMAP 0x8191
+#endif
+
+/* levels with fewer texels than this per thread are done serially */
+#define MIN_TEXELS_PER_THREAD (64 * 1024)
+
+/* dst rows filtered together by the separable filter */
+#define TILE_ROWS 16
+
+/* Kaiser filter radius (in destination texels) and shape */
+#define KAISER_RADIUS 2.0
+#define KAISER_ALPHA 4.0
+
+static enum mipmap_filter filter = MIPMAP_FILTER_BOX;
+static int srgb_filter = 0;
+static int generator = -1;     /* not chosen yet */
+static unsigned num_threads = 0;
+
+static float to_linear[256];
+static GLubyte from_linear[4096];
+#ifdef HAVE_PTHREAD
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+#else
+static int tables_ready = 0;
+#endif
+
+
+/* Filter weights along one axis: dst texel i is the sum of weights[k] *
+ * src[index[k]] for k in [i * taps, (i + 1) * taps).  Unused taps have
+ * weight 0.
+ */
+struct axis
+{
+   unsigned taps;
+   unsigned *index;
+   float *weights;
+};
+
+struct band
+{
+   const GLubyte *src;
+   unsigned width, height, channels;
+   GLubyte *dst;
+   unsigned dst_width, dst_height;
+   unsigned first, last;       /* dst rows [first, last) */
+   const struct axis *x, *y;
+   int ok;
+};
+
+
+static void
+init_tables(void)
+{
+   unsigned i;
+
+   for (i = 0; i < 256; i++) {
+      double c = i / 255.0;
+      to_linear[i] = (float) (c <= 0.04045 ? c / 12.92 :
+                              pow((c + 0.055) / 1.055, 2.4));
+   }
+   for (i = 0; i < 4096; i++) {
+      double l = i / 4095.0;
+      double c = l <= 0.0031308 ? l * 12.92 :
+                 1.055 * pow(l, 1.0 / 2.4) - 0.055;
+      from_linear[i] = (GLubyte) (c * 255.0 + 0.5);
+   }
+}
+
+
+static double
+bessel_i0(double x)
+{
+   double sum = 1.0, term = 1.0;
+   int k;
+
+   for (k = 1; k < 32; k++) {
+      term *= (x / (2.0 * k)) * (x / (2.0 * k));
+      sum += term;
+      if (term < sum * 1e-12)
+         break;
+   }
+   return sum;
+}
+
+
+static double
+kaiser(double t)
+{
+   double sinc, r = t / KAISER_RADIUS;
+
+   if (r <= -1.0 || r >= 1.0)
+      return 0.0;
+   sinc = t == 0.0 ? 1.0 : sin(M_PI * t) / (M_PI * t);
+   return sinc * bessel_i0(KAISER_ALPHA * sqrt(1.0 - r * r)) /
+          bessel_i0(KAISER_ALPHA);
+}
+
+
+static int
+make_axis(struct axis *a, unsigned n, unsigned dst_n)
+{
+   double scale = (double) n / dst_n;
+   unsigned i, k;
+
+   if (n == dst_n)
+      a->taps = 1;
+   else if (filter == MIPMAP_FILTER_KAISER)
+      a->taps = 2 * (unsigned) ceil(KAISER_RADIUS * scale) + 2;
+   else
+      a->taps = (unsigned) ceil(scale) + 1;
+
+   a->index = (unsigned *) calloc(dst_n * a->taps, sizeof(unsigned));
+   a->weights = (float *) calloc(dst_n * a->taps, sizeof(float));
+   if (!a->index || !a->weights)
+      return 0;
+
+   for (i = 0; i < dst_n; i++) {
+      unsigned *index = a->index + i * a->taps;
+      float *weights = a->weights + i * a->taps;
+      double sum = 0.0;
+      long j, lo, hi;
+
+      if (n == dst_n) {
+         index[0] = i;
+         weights[0] = 1.0f;
+         continue;
+      }
+
+      if (filter == MIPMAP_FILTER_KAISER) {
+         double center = (i + 0.5) * scale;
+         lo = (long) floor(center - KAISER_RADIUS * scale);
+         hi = (long) ceil(center + KAISER_RADIUS * scale);
+         for (j = lo, k = 0; j < hi && k < a->taps; j++, k++) {
+            index[k] = j < 0 ? 0 : (j >= (long) n ? n - 1 : (unsigned) j);
+            weights[k] = (float) kaiser((j + 0.5 - center) / scale);
+            sum += weights[k];
+         }
+      } else {
+         /* each src texel weighted by how much of it dst texel i covers */
+         double start = i * scale, end = (i + 1) * scale;
+         lo = (long) floor(start);
+         hi = (long) ceil(end);
+         for (j = lo, k = 0; j < hi && k < a->taps; j++, k++) {
+            double w = (end < j + 1 ? end : j + 1) - (start > j ? start : j);
+            index[k] = j >= (long) n ? n - 1 : (unsigned) j;
+            weights[k] = (float) w;
+            sum += w;
+         }
+      }
+
+      for (k = 0; k < a->taps; k++)
+         weights[k] = (float) (weights[k] / sum);
+   }
+
+   return 1;
+}
+
+
+static void
+free_axis(struct axis *a)
+{
+   free(a->index);
+   free(a->weights);
+}
+
+
+/* 2x2 box filter of a level with even dimensions, rounding to nearest */
+static void
+box_rows(const struct band *b)
+{
+   const unsigned c = b->channels;
+   const size_t src_stride = (size_t) b->width * c;
+   const size_t dst_stride = (size_t) b->dst_width * c;
+   unsigned y;
+
+   for (y = b->first; y < b->last; y++) {
+      const GLubyte *r0 = b->src + 2 * y * src_stride;
+      const GLubyte *r1 = r0 + src_stride;
+      GLubyte *d = b->dst + y * dst_stride;
+      unsigned x = 0, k;
+
+#if defined(__SSE2__)
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i two = _mm_set1_epi16(2);
+
+      if (c == 4) {
+         /* four src texels, two dst texels at a time */
+         for (; x + 2 <= b->dst_width; x += 2) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (r0 + 8 * x));
+            __m128i e = _mm_loadu_si128((const __m128i *) (r1 + 8 * x));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(e, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(e, zero));
+            __m128i s;
+
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+            s = _mm_unpacklo_epi64(lo, hi);
+            s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            _mm_storel_epi64((__m128i *) (d + 4 * x), _mm_packus_epi16(s, s));
+         }
+      } else if (c == 2) {
+         /* eight src texels, four dst texels at a time */
+         for (; x + 4 <= b->dst_width; x += 4) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (r0 + 4 * x));
+            __m128i e = _mm_loadu_si128((const __m128i *) (r1 + 4 * x));
+            __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                       _mm_unpacklo_epi8(e, zero));
+            __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                       _mm_unpackhi_epi8(e, zero));
+            __m128i s;
+
+            lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 4));
+            hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 4));
+            lo = _mm_shuffle_epi32(lo, _MM_SHUFFLE(2, 0, 2, 0));
+            hi = _mm_shuffle_epi32(hi, _MM_SHUFFLE(2, 0, 2, 0));
+            s = _mm_unpacklo_epi64(lo, hi);
+            s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            _mm_storel_epi64((__m128i *) (d + 2 * x), _mm_packus_epi16(s, s));
+         }
+      } else if (c == 1) {
+         /* sixteen src texels, eight dst texels at a time */
+         const __m128i mask = _mm_set1_epi16(0xff);
+
+         for (; x + 8 <= b->dst_width; x += 8) {
+            __m128i a = _mm_loadu_si128((const __m128i *) (r0 + 2 * x));
+            __m128i e = _mm_loadu_si128((const __m128i *) (r1 + 2 * x));
+            __m128i s = _mm_add_epi16(
+               _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+               _mm_add_epi16(_mm_and_si128(e, mask), _mm_srli_epi16(e, 8)));
+
+            s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            _mm_storel_epi64((__m128i *) (d + x), _mm_packus_epi16(s, s));
+         }
+      } else if (c == 3) {
+         /* two src texels (6 of 8 bytes loaded) per dst texel; the last
+          * dst texel of the row is left to the scalar code so the loads
+          * and the 4 byte stores stay inside the rows
+          */
+         for (; x + 1 < b->dst_width; x++) {
+            __m128i a = _mm_loadl_epi64((const __m128i *) (r0 + 6 * x));
+            __m128i e = _mm_loadl_epi64((const __m128i *) (r1 + 6 * x));
+            __m128i s = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                      _mm_unpacklo_epi8(e, zero));
+            int texel;
+
+            s = _mm_add_epi16(s, _mm_srli_si128(s, 6));
+            s = _mm_srli_epi16(_mm_add_epi16(s, two), 2);
+            texel = _mm_cvtsi128_si32(_mm_packus_epi16(s, s));
+            memcpy(d + 3 * x, &texel, 3);
+         }
+      }
+#endif
+
+      for (; x < b->dst_width; x++) {
+         for (k = 0; k < c; k++) {
+            unsigned s = r0[2 * x * c + k] + r0[(2 * x + 1) * c + k] +
+                         r1[2 * x * c + k] + r1[(2 * x + 1) * c + k];
+            d[x * c + k] = (GLubyte) ((s + 2) >> 2);
+         }
+      }
+   }
+}
+
+
+/* separable filtering through the weight tables, a tile of rows at a time */
+static int
+filter_rows(const struct band *b)
+{
+   const unsigned c = b->channels;
+   const unsigned color = (c == 2 || c == 4) ? c - 1 : c;
+   const size_t src_stride = (size_t) b->width * c;
+   const size_t dst_stride = (size_t) b->dst_width * c;
+   const struct axis *ax = b->x, *ay = b->y;
+   unsigned max_rows;
+   float *row, *tmp;
+   unsigned y0;
+
+   /* src rows one tile of dst rows can reach */
+   max_rows = (unsigned) ceil((double) TILE_ROWS * b->height / b->dst_height)
+              + ay->taps + 1;
+   if (max_rows > b->height)
+      max_rows = b->height;
+
+   row = (float *) malloc(src_stride * sizeof(float));
+   tmp = (float *) malloc((size_t) max_rows * dst_stride * sizeof(float));
+   if (!row || !tmp) {
+      free(row);
+      free(tmp);
+      return 0;
+   }
+
+   for (y0 = b->first; y0 < b->last; y0 += TILE_ROWS) {
+      unsigned y1 = y0 + TILE_ROWS < b->last ? y0 + TILE_ROWS : b->last;
+      unsigned lo = b->height, hi = 0, y, x, k, t, r;
+
+      for (t = y0 * ay->taps; t < y1 * ay->taps; t++) {
+         if (ay->weights[t] == 0.0f)
+            continue;
+         if (ay->index[t] < lo)
+            lo = ay->index[t];
+         if (ay->index[t] > hi)
+            hi = ay->index[t];
+      }
+
+      /* horizontal pass over the src rows this tile needs */
+      for (r = lo; r <= hi; r++) {
+         const GLubyte *s = b->src + r * src_stride;
+         float *out = tmp + (r - lo) * dst_stride;
+
+         for (x = 0; x < b->width; x++) {
+            for (k = 0; k < color; k++)
+               row[x * c + k] = srgb_filter ? to_linear[s[x * c + k]] :
+                                              s[x * c + k] * (1.0f / 255.0f);
+            for (; k < c; k++)
+               row[x * c + k] = s[x * c + k] * (1.0f / 255.0f);
+         }
+
+         for (x = 0; x < b->dst_width; x++) {
+            const unsigned *index = ax->index + x * ax->taps;
+            const float *weights = ax->weights + x * ax->taps;
+            float acc[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            for (t = 0; t < ax->taps; t++)
+               for (k = 0; k < c; k++)
+                  acc[k] += weights[t] * row[index[t] * c + k];
+            for (k = 0; k < c; k++)
+               out[x * c + k] = acc[k];
+         }
+      }
+
+      /* vertical pass */
+      for (y = y0; y < y1; y++) {
+         const unsigned *index = ay->index + y * ay->taps;
+         const float *weights = ay->weights + y * ay->taps;
+         GLubyte *d = b->dst + y * dst_stride;
+
+         for (x = 0; x < dst_stride; x++) {
+            float v = 0.0f;
+
+            for (t = 0; t < ay->taps; t++)
+               if (weights[t] != 0.0f)
+                  v += weights[t] * tmp[(index[t] - lo) * dst_stride + x];
+
+            v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+            if (srgb_filter && x % c < color)
+               d[x] = from_linear[(unsigned) (v * 4095.0f + 0.5f)];
+            else
+               d[x] = (GLubyte) (v * 255.0f + 0.5f);
+         }
+      }
+   }
+
+   free(row);
+   free(tmp);
+   return 1;
+}
+
+
+static void
+downsample_band(void *data, unsigned i)
+{
+   struct band *b = (struct band *) data + i;
+
+   if (b->x)
+      b->ok = filter_rows(b);
+   else {
+      box_rows(b);
+      b->ok = 1;
+   }
+}
+
+
+void
+mipmap_set_filter(enum mipmap_filter f, int srgb)
+{
+   filter = f;
+   srgb_filter = srgb;
+}
+
+
+void
+mipmap_set_generator(enum mipmap_generator g)
+{
+   generator = g;
+}
+
+
+void
+mipmap_set_threads(unsigned count)
+{
+   num_threads = count;
+}
+
+
+int
+mipmap_downsample(const GLubyte *src, unsigned width, unsigned height,
+                  unsigned channels, GLubyte *dst,
+                  unsigned dst_width, unsigned dst_height)
+{
+   struct band bands[UTIL_MAX_THREADS];
+   struct axis ax, ay;
+   int separable, ok = 1;
+   unsigned n, i;
+
+   separable = filter != MIPMAP_FILTER_BOX || srgb_filter ||
+               width != 2 * dst_width || height != 2 * dst_height;
+   if (separable) {
+#ifdef HAVE_PTHREAD
+      pthread_once(&tables_once, init_tables);
+#else
+      if (!tables_ready) {
+         init_tables();
+         tables_ready = 1;
+      }
+#endif
+      memset(&ax, 0, sizeof(ax));
+      memset(&ay, 0, sizeof(ay));
+      if (!make_axis(&ax, width, dst_width) ||
+          !make_axis(&ay, height, dst_height)) {
+         fprintf(stderr, "Out of memory!\n");
+         free_axis(&ax);
+         free_axis(&ay);
+         return 0;
+      }
+   }
+
+   n = util_parallel_count(num_threads, (size_t) dst_width * dst_height,
+                           MIN_TEXELS_PER_THREAD, dst_height);
+   for (i = 0; i < n; i++) {
+      bands[i].src = src;
+      bands[i].width = width;
+      bands[i].height = height;
+      bands[i].channels = channels;
+      bands[i].dst = dst;
+      bands[i].dst_width = dst_width;
+      bands[i].dst_height = dst_height;
+      bands[i].first = (unsigned) ((size_t) dst_height * i / n);
+      bands[i].last = (unsigned) ((size_t) dst_height * (i + 1) / n);
+      bands[i].x = separable ? &ax : NULL;
+      bands[i].y = separable ? &ay : NULL;
+      bands[i].ok = 0;
+   }
+
+   util_parallel_bands(n, downsample_band, bands);
+
+   for (i = 0; i < n; i++)
+      ok &= bands[i].ok;
+   if (!ok)
+      fprintf(stderr, "Out of memory!\n");
+
+   if (separable) {
+      free_axis(&ax);
+      free_axis(&ay);
+   }
+   return ok;
+}
+
+
+static unsigned
+format_channels(GLenum format)
+{
+   switch (format) {
+   case GL_RGBA:
+   case GL_BGRA:
+      return 4;
+   case GL_RGB:
+   case GL_BGR:
+      return 3;
+   case GL_LUMINANCE_ALPHA:
+      return 2;
+   case GL_LUMINANCE:
+   case GL_ALPHA:
+   case GL_INTENSITY:
+   case GL_RED:
+   case GL_GREEN:
+   case GL_BLUE:
+      return 1;
+   default:
+      return 0;
+   }
+}
+
+
+static int
+gl_version_at_least(int major, int minor)
+{
+   const char *version = (const char *) glGetString(GL_VERSION);
+   int ma = 0, mi = 0;
+
+   if (!version || sscanf(version, "%d.%d", &ma, &mi) != 2)
+      return 0;
+   return ma > major || (ma == major && mi >= minor);
+}
+
+
+static int
+gl_has_extension(const char *name)
+{
+   const char *ext = (const char *) glGetString(GL_EXTENSIONS);
+   size_t len = strlen(name);
+
+   while (ext && (ext = strstr(ext, name))) {
+      if (ext[len] == ' ' || ext[len] == '\0')
+         return 1;
+      ext += len;
+   }
+   return 0;
+}
+
+
+static unsigned
+power_of_two(unsigned n)
+{
+   unsigned p = 1;
+
+   /* nearest, as gluBuild2DMipmaps() does */
+   while (p * 2 <= n)
+      p *= 2;
+   if (p * 2 - n < n - p)
+      p *= 2;
+   return p;
+}
+
+
+/* glTexImage2D(), or a compressed upload where texcompress is on */
+static GLint
+tex_image(GLenum target, GLint lvl, GLint internalFormat,
+          enum texcompress_format compress, unsigned w, unsigned h,
+          GLenum format, unsigned channels, const GLubyte *pixels)
+{
+   if (compress != TEXCOMPRESS_NONE)
+      return texcompress_tex_image_2d(target, lvl, compress, w, h, channels,
+                                      pixels) ? GLU_OUT_OF_MEMORY : 0;
+
+   glTexImage2D(target, lvl, internalFormat, w, h, 0, format,
+                GL_UNSIGNED_BYTE, pixels);
+   return 0;
+}
+
+
+static void
+choose_generator(void)
+{
+   const char *env = getenv("MIPMAP_GENERATOR");
+
+   generator = MIPMAP_GENERATOR_CPU;
+   if (env && !strcmp(env, "gl"))
+      generator = MIPMAP_GENERATOR_GL;
+   else if (env && !strcmp(env, "glu"))
+      generator = MIPMAP_GENERATOR_GLU;
+}
+
+
+/* whether GL_GENERATE_MIPMAP can build the levels */
+static int
+gl_can_generate(GLenum target, enum texcompress_format compress)
+{
+   return target == GL_TEXTURE_2D && compress == TEXCOMPRESS_NONE &&
+          (gl_version_at_least(1, 4) ||
+           gl_has_extension("GL_SGIS_generate_mipmap"));
+}
+
+
+int
+mipmap_gl_generates(GLenum target, GLint internalFormat, GLenum format)
+{
+   return gl_can_generate(target, texcompress_choose(internalFormat, format));
+}
+
+
+GLint
+mipmap_build_2d(GLenum target, GLint internalFormat,
+                GLsizei width, GLsizei height,
+                GLenum format, const GLubyte *pixels)
+{
+   unsigned channels = format_channels(format);
+   unsigned w = width, h = height;
+   enum texcompress_format compress;
+   GLubyte *scaled = NULL, *level[2] = { NULL, NULL };
+   const GLubyte *cur;
+   GLint max_size, error = 0;
+   GLint lvl;
+
+   if (!channels)
+      return GLU_INVALID_ENUM;
+   if (width < 1 || height < 1)
+      return GLU_INVALID_VALUE;
+
+   if (generator < 0)
+      choose_generator();
+   if (generator == MIPMAP_GENERATOR_GLU)
+      return gluBuild2DMipmaps(target, internalFormat, width, height,
+                               format, GL_UNSIGNED_BYTE, pixels);
+
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+   glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+   glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+   glPixelStorei(GL_UNPACK_SWAP_BYTES, GL_FALSE);
+   glPixelStorei(GL_PACK_ALIGNMENT, 1);
+   glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+   glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+   glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+   glPixelStorei(GL_PACK_SWAP_BYTES, GL_FALSE);
+
+   /* only rescale where the GL needs it */
+   if (!gl_version_at_least(2, 0) &&
+       !gl_has_extension("GL_ARB_texture_non_power_of_two")) {
+      w = power_of_two(w);
+      h = power_of_two(h);
+   }
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+   while (max_size > 0 && (w > (unsigned) max_size || h > (unsigned) max_size)) {
+      w = w > 1 ? w / 2 : 1;
+      h = h > 1 ? h / 2 : 1;
+   }
+   cur = pixels;
+   if (w != (unsigned) width || h != (unsigned) height) {
+      scaled = (GLubyte *) malloc((size_t) w * h * channels);
+      if (!scaled) {
+         error = GLU_OUT_OF_MEMORY;
+         goto done;
+      }
+      error = gluScaleImage(format, width, height, GL_UNSIGNED_BYTE, pixels,
+                            w, h, GL_UNSIGNED_BYTE, scaled);
+      if (error)
+         goto done;
+      cur = scaled;
+   }
+
+   compress = texcompress_choose(internalFormat, format);
+
+   if (generator == MIPMAP_GENERATOR_GL && gl_can_generate(target, compress)) {
+      glTexParameteri(target, GL_GENERATE_MIPMAP, GL_TRUE);
+      glTexImage2D(target, 0, internalFormat, w, h, 0, format,
+                   GL_UNSIGNED_BYTE, cur);
+      glTexParameteri(target, GL_GENERATE_MIPMAP, GL_FALSE);
+      goto done;
+   }
+
+   error = tex_image(target, 0, internalFormat, compress, w, h, format,
+                     channels, cur);
+   if (error)
+      goto done;
+
+   /* each level is made from the previous one, in two ping-pong buffers */
+   level[0] = (GLubyte *) malloc((size_t) (w > 1 ? w / 2 : 1) *
+                                 (h > 1 ? h / 2 : 1) * channels);
+   level[1] = (GLubyte *) malloc((size_t) (w > 3 ? w / 4 : 1) *
+                                 (h > 3 ? h / 4 : 1) * channels);
+   if (!level[0] || !level[1]) {
+      error = GLU_OUT_OF_MEMORY;
+      goto done;
+   }
+
+   for (lvl = 1; w > 1 || h > 1; lvl++) {
+      unsigned dw = w > 1 ? w / 2 : 1, dh = h > 1 ? h / 2 : 1;
+      GLubyte *next = level[(lvl - 1) & 1];
+
+      if (!mipmap_downsample(cur, w, h, channels, next, dw, dh)) {
+         error = GLU_OUT_OF_MEMORY;
+         goto done;
+      }
+      error = tex_image(target, lvl, internalFormat, compress, dw, dh,
+                        format, channels, next);
+      if (error)
+         goto done;
+      cur = next;
+      w = dw;
+      h = dh;
+   }
+
+done:
+   glPopClientAttrib();
+   free(scaled);
+   free(level[0]);
+   free(level[1]);
+   return error;
+}
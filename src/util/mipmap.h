@@ -0,0 +1,98 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef MIPMAP_H
+#define MIPMAP_H
+
+#include "gl_wrap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Filters used to compute each mipmap level from the one above it.
+ */
+enum mipmap_filter
+{
+   MIPMAP_FILTER_BOX,       /**< average of 2x2 texels */
+   MIPMAP_FILTER_KAISER,    /**< Kaiser-windowed sinc, radius 2 texels of
+                                 the smaller level (10 taps per axis
+                                 for 2:1) */
+};
+
+/**
+ * Where mipmap_build_2d() gets the levels from.
+ */
+enum mipmap_generator
+{
+   MIPMAP_GENERATOR_CPU,    /**< mipmap_downsample() on the CPU */
+   MIPMAP_GENERATOR_GL,     /**< GL_GENERATE_MIPMAP, where supported */
+   MIPMAP_GENERATOR_GLU,    /**< gluBuild2DMipmaps() */
+};
+
+/**
+ * Selects the filter for the CPU generator.  With srgb set the color
+ * channels are averaged in linear space (alpha never is).
+ */
+void
+mipmap_set_filter(enum mipmap_filter filter, int srgb);
+
+/**
+ * Selects the generator used by mipmap_build_2d().  MIPMAP_GENERATOR_GL
+ * falls back to the CPU where the driver or target can't do it.  The
+ * MIPMAP_GENERATOR environment variable (cpu, gl or glu) overrides the
+ * default of cpu.
+ */
+void
+mipmap_set_generator(enum mipmap_generator generator);
+
+/**
+ * Sets the number of threads used per level.  0, the default, uses one
+ * per CPU for levels large enough to be worth it.
+ */
+void
+mipmap_set_threads(unsigned count);
+
+/**
+ * Computes a dst_width x dst_height level from a width x height one
+ * with the current filter.  Both are tightly packed, with channels
+ * unsigned bytes per texel.
+ *
+ * @return 1 on success, 0 if out of memory (dst is then undefined)
+ */
+int
+mipmap_downsample(const GLubyte *src, unsigned width, unsigned height,
+                  unsigned channels, GLubyte *dst,
+                  unsigned dst_width, unsigned dst_height);
+
+/**
+ * Whether MIPMAP_GENERATOR_GL really has the current GL context build
+ * the levels of such a texture, rather than falling back to the CPU.
+ * internalFormat and format are as for mipmap_build_2d(), and the
+ * current texcompress mode applies.
+ */
+int
+mipmap_gl_generates(GLenum target, GLint internalFormat, GLenum format);
+
+/**
+ * Drop-in replacement for gluBuild2DMipmaps() with GL_UNSIGNED_BYTE
+ * data: uploads the image and all its smaller levels to target with
+ * glTexImage2D().  pixels are tightly packed.  Images are only scaled
+ * to a power of two size where the GL can't do without it.  Unless the
+ * GLU generator is used, levels are block compressed when
+ * texcompress_choose() picks a format for them.
+ *
+ * @return 0 on success, or a GL or GLU error code
+ */
+GLint
+mipmap_build_2d(GLenum target, GLint internalFormat,
+                GLsizei width, GLsizei height,
+                GLenum format, const GLubyte *pixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MIPMAP_H */
@@ -0,0 +1,259 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Spreading work over threads: bands of an image on threads started
+ * for the occasion, and jobs on a pool that is kept for every frame.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "parallel.h"
+
+#ifdef HAVE_PTHREAD
+static pthread_key_t limit_key;
+static pthread_once_t limit_once = PTHREAD_ONCE_INIT;
+
+struct band_thread
+{
+   util_band_func fn;
+   void *arg;
+   unsigned band;
+   pthread_t thread;
+};
+
+struct util_pool
+{
+   pthread_mutex_t lock;
+   pthread_cond_t work, done;
+   unsigned threads;
+   unsigned generation;
+   unsigned count, next, finished;
+   util_band_func fn;
+   void *arg;
+};
+
+
+static void
+create_limit_key(void)
+{
+   pthread_key_create(&limit_key, NULL);
+}
+
+
+static unsigned
+cpu_count(void)
+{
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+   return cpus > 0 ? (unsigned) cpus : 1;
+}
+
+
+static void *
+band_main(void *data)
+{
+   struct band_thread *t = (struct band_thread *) data;
+
+   t->fn(t->arg, t->band);
+   return NULL;
+}
+
+
+/* Runs jobs until there are none left; called with the lock held */
+static void
+run_jobs(struct util_pool *pool)
+{
+   while (pool->next < pool->count) {
+      unsigned job = pool->next++;
+
+      pthread_mutex_unlock(&pool->lock);
+      pool->fn(pool->arg, job);
+      pthread_mutex_lock(&pool->lock);
+
+      if (++pool->finished == pool->count)
+         pthread_cond_signal(&pool->done);
+   }
+}
+
+
+static void *
+pool_main(void *data)
+{
+   struct util_pool *pool = (struct util_pool *) data;
+   unsigned generation = 0;
+
+   pthread_mutex_lock(&pool->lock);
+   for (;;) {
+      while (generation == pool->generation)
+         pthread_cond_wait(&pool->work, &pool->lock);
+      generation = pool->generation;
+      run_jobs(pool);
+   }
+   return NULL;
+}
+#else
+struct util_pool
+{
+   unsigned threads;
+};
+#endif
+
+
+unsigned
+util_parallel_count(unsigned threads, size_t work, size_t min_work,
+                    unsigned rows)
+{
+   unsigned n = threads;
+
+#ifdef HAVE_PTHREAD
+   unsigned limit;
+
+   pthread_once(&limit_once, create_limit_key);
+   limit = (unsigned) (uintptr_t) pthread_getspecific(limit_key);
+
+   if (!n)
+      n = cpu_count();
+   if (min_work && n > work / min_work)
+      n = (unsigned) (work / min_work);
+   if (n > rows)
+      n = rows;
+   if (n > UTIL_MAX_THREADS)
+      n = UTIL_MAX_THREADS;
+   if (limit && n > limit)
+      n = limit;
+#else
+   (void) work;
+   (void) min_work;
+   (void) rows;
+   n = 1;
+#endif
+
+   return n ? n : 1;
+}
+
+
+void
+util_parallel_bands(unsigned count, util_band_func fn, void *arg)
+{
+#ifdef HAVE_PTHREAD
+   struct band_thread threads[UTIL_MAX_THREADS];
+   unsigned i;
+
+   if (count > UTIL_MAX_THREADS) {
+      for (i = UTIL_MAX_THREADS; i < count; i++)
+         fn(arg, i);
+      count = UTIL_MAX_THREADS;
+   }
+
+   for (i = 1; i < count; i++) {
+      threads[i].fn = fn;
+      threads[i].arg = arg;
+      threads[i].band = i;
+      if (pthread_create(&threads[i].thread, NULL, band_main, &threads[i]))
+         threads[i].thread = pthread_self();
+   }
+   if (count)
+      fn(arg, 0);
+   for (i = 1; i < count; i++) {
+      if (pthread_equal(threads[i].thread, pthread_self()))
+         fn(arg, i);
+      else
+         pthread_join(threads[i].thread, NULL);
+   }
+#else
+   unsigned i;
+
+   for (i = 0; i < count; i++)
+      fn(arg, i);
+#endif
+}
+
+
+void
+util_parallel_set_thread_limit(unsigned limit)
+{
+#ifdef HAVE_PTHREAD
+   pthread_once(&limit_once, create_limit_key);
+   pthread_setspecific(limit_key, (void *) (uintptr_t) limit);
+#else
+   (void) limit;
+#endif
+}
+
+
+struct util_pool *
+util_pool_create(unsigned threads)
+{
+   struct util_pool *pool = (struct util_pool *) calloc(1, sizeof(*pool));
+
+   if (!pool)
+      return NULL;
+
+#ifdef HAVE_PTHREAD
+   if (!threads)
+      threads = cpu_count();
+   if (threads > UTIL_MAX_THREADS)
+      threads = UTIL_MAX_THREADS;
+
+   pthread_mutex_init(&pool->lock, NULL);
+   pthread_cond_init(&pool->work, NULL);
+   pthread_cond_init(&pool->done, NULL);
+
+   /* the workers live as long as the program */
+   for (pool->threads = 1; pool->threads < threads; pool->threads++) {
+      pthread_t thread;
+
+      if (pthread_create(&thread, NULL, pool_main, pool))
+         break;
+      pthread_detach(thread);
+   }
+#else
+   (void) threads;
+   pool->threads = 1;
+#endif
+
+   return pool;
+}
+
+
+unsigned
+util_pool_threads(const struct util_pool *pool)
+{
+   return pool ? pool->threads : 1;
+}
+
+
+void
+util_pool_run(struct util_pool *pool, unsigned count, util_band_func fn,
+              void *arg)
+{
+   unsigned i;
+
+#ifdef HAVE_PTHREAD
+   /* this thread takes jobs too, and only returns when all are done, so
+    * the workers never see the next run's jobs early */
+   if (pool && pool->threads > 1) {
+      pthread_mutex_lock(&pool->lock);
+      pool->fn = fn;
+      pool->arg = arg;
+      pool->count = count;
+      pool->next = 0;
+      pool->finished = 0;
+      pool->generation++;
+      pthread_cond_broadcast(&pool->work);
+      run_jobs(pool);
+      while (pool->finished < count)
+         pthread_cond_wait(&pool->done, &pool->lock);
+      pthread_mutex_unlock(&pool->lock);
+      return;
+   }
+#endif
+
+   for (i = 0; i < count; i++)
+      fn(arg, i);
+}
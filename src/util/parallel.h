@@ -0,0 +1,84 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Most bands util_parallel_count() returns, and threads in a pool */
+#define UTIL_MAX_THREADS 16
+
+/**
+ * Work function: processes band (or job) number band of the ones
+ * described by arg.
+ */
+typedef void (*util_band_func)(void *arg, unsigned band);
+
+/**
+ * Returns how many bands to split some work into.
+ *
+ * @param threads   bands wanted, or 0 for one per CPU
+ * @param work      size of the work, in any unit
+ * @param min_work  least work worth a thread of its own
+ * @param rows      most bands the work can be split into
+ * @return at least 1, and no more than UTIL_MAX_THREADS or the calling
+ *         thread's limit
+ */
+unsigned
+util_parallel_count(unsigned threads, size_t work, size_t min_work,
+                    unsigned rows);
+
+/**
+ * Calls fn(arg, band) for every band in [0, count), band 0 on the
+ * calling thread and each of the others on a thread of its own (or on
+ * the calling thread, if one can't be started).  Returns when all the
+ * bands are done.
+ */
+void
+util_parallel_bands(unsigned count, util_band_func fn, void *arg);
+
+/**
+ * Limits util_parallel_count() on the calling thread, so that work
+ * already spread over a pool of threads doesn't start more from each
+ * of them.  0, the default, is no limit.
+ */
+void
+util_parallel_set_thread_limit(unsigned limit);
+
+struct util_pool;
+
+/**
+ * Starts a pool of threads that stays around between runs, for work
+ * done every frame.  The calling thread counts as one of them.
+ *
+ * @param threads  size of the pool, or 0 for one per CPU
+ */
+struct util_pool *
+util_pool_create(unsigned threads);
+
+/**
+ * Returns the number of threads that run the pool's jobs.
+ */
+unsigned
+util_pool_threads(const struct util_pool *pool);
+
+/**
+ * Calls fn(arg, job) for every job in [0, count) on the pool, the
+ * calling thread included, and returns when all are done.  A NULL pool
+ * runs them all on the calling thread.
+ */
+void
+util_pool_run(struct util_pool *pool, unsigned count, util_band_func fn,
+              void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,454 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * SGI .rgb image decoding, shared by readtex.c and imagesgi.cpp.
+ *
+ * The whole file is mapped (or read) into memory once and rows are
+ * decoded straight out of it.  RLE rows are independently addressable
+ * through the row start table, so large images are decoded in bands of
+ * rows on several threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "parallel.h"
+#include "sgiimage.h"
+
+/* .rgb files are big-endian */
+#define GET_SHORT(p)  ((unsigned) (((p)[0] << 8) | (p)[1]))
+#define GET_LONG(p)   (((unsigned) (p)[0] << 24) | ((unsigned) (p)[1] << 16) | \
+                       ((unsigned) (p)[2] << 8) | (unsigned) (p)[3])
+
+#define HEADER_SIZE 512
+
+/* images with fewer pixels than this per thread are decoded serially */
+#define MIN_PIXELS_PER_THREAD (128 * 1024)
+
+static unsigned num_threads = 0;
+
+struct sgi_file
+{
+   const unsigned char *data;
+   size_t size;
+   int mapped;
+};
+
+struct sgi_decoder
+{
+   const struct sgi_file *file;
+   const struct sgi_image_info *info;
+   unsigned char *pixels;
+};
+
+struct sgi_band
+{
+   const struct sgi_decoder *decoder;
+   unsigned first, last;     /* rows [first, last) */
+   int ok;
+};
+
+
+static int
+map_file(struct sgi_file *file, const char *filename)
+{
+   FILE *f;
+   long size;
+   unsigned char *data;
+
+#ifndef _WIN32
+   {
+      struct stat st;
+      void *map;
+      int fd;
+
+      fd = open(filename, O_RDONLY);
+      if (fd < 0)
+         return 0;
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+         map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+         if (map != MAP_FAILED) {
+            file->data = (const unsigned char *) map;
+            file->size = st.st_size;
+            file->mapped = 1;
+            close(fd);
+            return 1;
+         }
+      }
+      close(fd);
+   }
+#endif
+
+   f = fopen(filename, "rb");
+   if (!f)
+      return 0;
+   fseek(f, 0, SEEK_END);
+   size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   data = size > 0 ? (unsigned char *) malloc(size) : NULL;
+   if (!data || fread(data, 1, size, f) != (size_t) size) {
+      free(data);
+      fclose(f);
+      return 0;
+   }
+   fclose(f);
+
+   file->data = data;
+   file->size = size;
+   file->mapped = 0;
+   return 1;
+}
+
+
+static void
+unmap_file(struct sgi_file *file)
+{
+#ifndef _WIN32
+   if (file->mapped) {
+      munmap((void *) file->data, file->size);
+      return;
+   }
+#endif
+   free((void *) file->data);
+}
+
+
+/*
+ * Expand one RLE row.  Each run is copied or filled in one go; runs
+ * that would go past the end of the row or of the file are clipped so
+ * a damaged file can't write out of bounds.  out must have 16 bytes
+ * of slack after width.
+ */
+static void
+decode_rle(const unsigned char *in, size_t in_size, unsigned char *out,
+           unsigned width)
+{
+   const unsigned char *in_end = in + in_size;
+   unsigned char *out_end = out + width;
+
+   while (in < in_end) {
+      unsigned char pixel = *in++;
+      size_t count = pixel & 0x7F;
+
+      if (!count)
+         break;
+      if (count > (size_t) (out_end - out))
+         count = out_end - out;
+      if (pixel & 0x80) {
+         if (count > (size_t) (in_end - in))
+            count = in_end - in;
+         /* most literal runs are short: copy those 16 bytes at a time
+          * when the input and the 16 bytes of slack after the row allow
+          */
+         if (count <= 16 && in_end - in >= 16) {
+            unsigned char block[16];
+            memcpy(block, in, 16);
+            memcpy(out, block, 16);
+         }
+         else
+            memcpy(out, in, count);
+         in += count;
+      } else {
+         if (in == in_end)
+            break;
+         memset(out, *in++, count);
+      }
+      out += count;
+   }
+
+   if (out < out_end)
+      memset(out, 0, out_end - out);
+}
+
+/*
+ * Interleave n planar channel rows into n-byte pixels.
+ */
+static void
+interleave(const unsigned char * const *src, unsigned n, unsigned char *dst,
+           unsigned width)
+{
+   unsigned j = 0;
+
+   switch (n) {
+   case 1:
+      memcpy(dst, src[0], width);
+      return;
+   case 2:
+#if defined(__SSE2__)
+      for (; j + 16 <= width; j += 16) {
+         __m128i a = _mm_loadu_si128((const __m128i *) (src[0] + j));
+         __m128i b = _mm_loadu_si128((const __m128i *) (src[1] + j));
+         _mm_storeu_si128((__m128i *) (dst + 2 * j),
+                          _mm_unpacklo_epi8(a, b));
+         _mm_storeu_si128((__m128i *) (dst + 2 * j + 16),
+                          _mm_unpackhi_epi8(a, b));
+      }
+#elif defined(__ARM_NEON)
+      for (; j + 16 <= width; j += 16) {
+         uint8x16x2_t v;
+         v.val[0] = vld1q_u8(src[0] + j);
+         v.val[1] = vld1q_u8(src[1] + j);
+         vst2q_u8(dst + 2 * j, v);
+      }
+#endif
+      for (; j < width; j++) {
+         dst[2 * j] = src[0][j];
+         dst[2 * j + 1] = src[1][j];
+      }
+      return;
+   case 3:
+#if defined(__SSE2__)
+      /* Build RGBx pixels, squeeze each pair of them into the low six
+       * bytes of a 64-bit lane and store the lanes eight bytes at a
+       * time, six bytes apart.  The last two bytes written by each store
+       * are overwritten by the next, so stop while there is room.
+       */
+      {
+         const __m128i lo24 = _mm_set1_epi64x(0xFFFFFF);
+         const __m128i hi24 = _mm_set1_epi64x(0xFFFFFF000000ll);
+         for (; j + 16 < width; j += 16) {
+            __m128i r = _mm_loadu_si128((const __m128i *) (src[0] + j));
+            __m128i g = _mm_loadu_si128((const __m128i *) (src[1] + j));
+            __m128i b = _mm_loadu_si128((const __m128i *) (src[2] + j));
+            __m128i rg0 = _mm_unpacklo_epi8(r, g);
+            __m128i rg1 = _mm_unpackhi_epi8(r, g);
+            __m128i b0 = _mm_unpacklo_epi8(b, b);
+            __m128i b1 = _mm_unpackhi_epi8(b, b);
+            __m128i p[4];
+            unsigned char *d = dst + 3 * j;
+            int k;
+
+            p[0] = _mm_unpacklo_epi16(rg0, b0);
+            p[1] = _mm_unpackhi_epi16(rg0, b0);
+            p[2] = _mm_unpacklo_epi16(rg1, b1);
+            p[3] = _mm_unpackhi_epi16(rg1, b1);
+            for (k = 0; k < 4; k++) {
+               __m128i v = _mm_or_si128(_mm_and_si128(p[k], lo24),
+                                        _mm_and_si128(_mm_srli_epi64(p[k], 8),
+                                                      hi24));
+               _mm_storel_epi64((__m128i *) d, v);
+               _mm_storel_epi64((__m128i *) (d + 6),
+                                _mm_unpackhi_epi64(v, v));
+               d += 12;
+            }
+         }
+      }
+#elif defined(__ARM_NEON)
+      for (; j + 16 <= width; j += 16) {
+         uint8x16x3_t v;
+         v.val[0] = vld1q_u8(src[0] + j);
+         v.val[1] = vld1q_u8(src[1] + j);
+         v.val[2] = vld1q_u8(src[2] + j);
+         vst3q_u8(dst + 3 * j, v);
+      }
+#endif
+      for (; j < width; j++) {
+         dst[3 * j] = src[0][j];
+         dst[3 * j + 1] = src[1][j];
+         dst[3 * j + 2] = src[2][j];
+      }
+      return;
+   case 4:
+#if defined(__SSE2__)
+      for (; j + 16 <= width; j += 16) {
+         __m128i r = _mm_loadu_si128((const __m128i *) (src[0] + j));
+         __m128i g = _mm_loadu_si128((const __m128i *) (src[1] + j));
+         __m128i b = _mm_loadu_si128((const __m128i *) (src[2] + j));
+         __m128i a = _mm_loadu_si128((const __m128i *) (src[3] + j));
+         __m128i rg0 = _mm_unpacklo_epi8(r, g);
+         __m128i rg1 = _mm_unpackhi_epi8(r, g);
+         __m128i ba0 = _mm_unpacklo_epi8(b, a);
+         __m128i ba1 = _mm_unpackhi_epi8(b, a);
+         unsigned char *d = dst + 4 * j;
+
+         _mm_storeu_si128((__m128i *) d, _mm_unpacklo_epi16(rg0, ba0));
+         _mm_storeu_si128((__m128i *) (d + 16), _mm_unpackhi_epi16(rg0, ba0));
+         _mm_storeu_si128((__m128i *) (d + 32), _mm_unpacklo_epi16(rg1, ba1));
+         _mm_storeu_si128((__m128i *) (d + 48), _mm_unpackhi_epi16(rg1, ba1));
+      }
+#elif defined(__ARM_NEON)
+      for (; j + 16 <= width; j += 16) {
+         uint8x16x4_t v;
+         v.val[0] = vld1q_u8(src[0] + j);
+         v.val[1] = vld1q_u8(src[1] + j);
+         v.val[2] = vld1q_u8(src[2] + j);
+         v.val[3] = vld1q_u8(src[3] + j);
+         vst4q_u8(dst + 4 * j, v);
+      }
+#endif
+      for (; j < width; j++) {
+         dst[4 * j] = src[0][j];
+         dst[4 * j + 1] = src[1][j];
+         dst[4 * j + 2] = src[2][j];
+         dst[4 * j + 3] = src[3][j];
+      }
+      return;
+   }
+}
+
+
+/*
+ * Returns row y of channel z, decoding it into buf if the image is RLE
+ * compressed or pointing straight into the file if it isn't.
+ */
+static const unsigned char *
+get_row(const struct sgi_decoder *d, unsigned char *buf, unsigned y,
+        unsigned z)
+{
+   const struct sgi_image_info *info = d->info;
+   const struct sgi_file *file = d->file;
+
+   if (info->rle) {
+      const unsigned char *tables = file->data + HEADER_SIZE;
+      size_t row = y + (size_t) z * info->height;
+      size_t start = GET_LONG(tables + 4 * row);
+      size_t size = GET_LONG(tables + 4 * (row + (size_t) info->height *
+                                           info->channels));
+
+      if (start > file->size)
+         start = size = 0;
+      else if (size > file->size - start)
+         size = file->size - start;
+      decode_rle(file->data + start, size, buf, info->width);
+      return buf;
+   } else {
+      return file->data + HEADER_SIZE +
+             (y + (size_t) z * info->height) * info->width;
+   }
+}
+
+
+static void
+decode_band(void *data, unsigned i)
+{
+   struct sgi_band *band = (struct sgi_band *) data + i;
+   const struct sgi_decoder *d = band->decoder;
+   const struct sgi_image_info *info = d->info;
+   size_t stride = (size_t) info->width * info->channels;
+   const unsigned char *rows[4];
+   unsigned char *tmp;
+   unsigned y, z;
+
+   /* one decoded row per channel, plus slack for decode_rle() */
+   tmp = (unsigned char *) malloc(info->width * 4 + 16);
+   if (!tmp)
+      return;
+
+   for (y = band->first; y < band->last; y++) {
+      for (z = 0; z < info->channels; z++)
+         rows[z] = get_row(d, tmp + z * info->width, y, z);
+      interleave(rows, info->channels, d->pixels + y * stride, info->width);
+   }
+
+   free(tmp);
+   band->ok = 1;
+}
+
+
+void
+sgi_image_set_threads(unsigned count)
+{
+   num_threads = count;
+}
+
+
+unsigned char *
+sgi_image_load(const char *filename, struct sgi_image_info *info)
+{
+   struct sgi_file file;
+   struct sgi_decoder decoder;
+   struct sgi_band bands[UTIL_MAX_THREADS];
+   const unsigned char *h;
+   unsigned type, n, i;
+   size_t needed;
+   int ok = 1;
+
+   if (!map_file(&file, filename)) {
+      const char *baseName = strrchr(filename, '/');
+      if (!baseName || !map_file(&file, baseName + 1)) {
+         perror(filename);
+         return NULL;
+      }
+   }
+
+   h = file.data;
+   if (file.size < HEADER_SIZE || GET_SHORT(h) != 474) {
+      fprintf(stderr, "%s: not an SGI image\n", filename);
+      unmap_file(&file);
+      return NULL;
+   }
+
+   type = GET_SHORT(h + 2);
+   memset(info, 0, sizeof(*info));
+   info->rle = (type & 0xFF00) == 0x0100;
+   info->bytes_per_channel = type & 0xFF;
+   info->dimension = GET_SHORT(h + 4);
+   info->width = GET_SHORT(h + 6);
+   info->height = GET_SHORT(h + 8);
+   info->channels = GET_SHORT(h + 10);
+   info->min = (int) GET_LONG(h + 12);
+   info->max = (int) GET_LONG(h + 16);
+   memcpy(info->name, h + 24, 79);
+   info->colormap = (int) GET_LONG(h + 104);
+
+   /* only one byte per channel is supported */
+   if (info->rle)
+      needed = HEADER_SIZE + 8 * (size_t) info->height * info->channels;
+   else
+      needed = HEADER_SIZE +
+               (size_t) info->width * info->height * info->channels;
+   if (info->bytes_per_channel != 1 || info->channels < 1 ||
+       info->channels > 4 || !info->width || !info->height ||
+       file.size < needed) {
+      fprintf(stderr, "%s: unsupported or truncated SGI image\n", filename);
+      unmap_file(&file);
+      return NULL;
+   }
+
+   decoder.file = &file;
+   decoder.info = info;
+   decoder.pixels = (unsigned char *)
+      malloc((size_t) info->width * info->height * info->channels);
+   if (!decoder.pixels) {
+      fprintf(stderr, "Out of memory!\n");
+      unmap_file(&file);
+      return NULL;
+   }
+
+   n = util_parallel_count(num_threads,
+                           (size_t) info->width * info->height,
+                           MIN_PIXELS_PER_THREAD, info->height);
+   for (i = 0; i < n; i++) {
+      bands[i].decoder = &decoder;
+      bands[i].first = (unsigned) ((size_t) info->height * i / n);
+      bands[i].last = (unsigned) ((size_t) info->height * (i + 1) / n);
+      bands[i].ok = 0;
+   }
+
+   util_parallel_bands(n, decode_band, bands);
+
+   for (i = 0; i < n; i++)
+      ok &= bands[i].ok;
+
+   unmap_file(&file);
+
+   if (!ok) {
+      fprintf(stderr, "Out of memory!\n");
+      free(decoder.pixels);
+      return NULL;
+   }
+
+   return decoder.pixels;
+}
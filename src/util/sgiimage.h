@@ -0,0 +1,53 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef SGIIMAGE_H
+#define SGIIMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Header fields of an SGI .rgb image, in host byte order.
+ */
+struct sgi_image_info
+{
+   unsigned width, height;
+   unsigned channels;            /**< 1 to 4 */
+   unsigned dimension;
+   unsigned bytes_per_channel;   /**< only 1 is supported */
+   int rle;                      /**< rows are run-length encoded */
+   int min, max;
+   int colormap;
+   char name[80];
+};
+
+/**
+ * Decodes an SGI .rgb image.
+ *
+ * The channels are interleaved, so the result is width * height pixels
+ * of channels bytes each, starting with the bottom row.  Large images
+ * are decoded on several threads.
+ *
+ * @param filename  the file to read; if it can't be opened, its base
+ *                  name is tried in the current directory
+ * @param info      returns the image header
+ * @return the pixels, to be released with free(), or NULL on error
+ */
+unsigned char *
+sgi_image_load(const char *filename, struct sgi_image_info *info);
+
+/**
+ * Sets the number of threads sgi_image_load() may use.  0, the default,
+ * uses one per CPU.
+ */
+void
+sgi_image_set_threads(unsigned count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SGIIMAGE_H */
@@ -0,0 +1,66 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+   double x = *(const double *) a, y = *(const double *) b;
+
+   return (x > y) - (x < y);
+}
+
+void
+stats_compute(double *samples, unsigned count, struct stats *s)
+{
+   double sum = 0.0, sq = 0.0;
+   unsigned i;
+
+   memset(s, 0, sizeof(*s));
+   s->count = count;
+   if (!count)
+      return;
+
+   qsort(samples, count, sizeof(double), compare_doubles);
+
+   for (i = 0; i < count; i++)
+      sum += samples[i];
+   s->mean = sum / count;
+
+   for (i = 0; i < count; i++)
+      sq += (samples[i] - s->mean) * (samples[i] - s->mean);
+   if (count > 1)
+      s->stddev = sqrt(sq / (count - 1));
+
+   s->min = samples[0];
+   s->max = samples[count - 1];
+   s->median = stats_percentile(samples, count, 50.0);
+}
+
+double
+stats_percentile(const double *sorted, unsigned count, double p)
+{
+   double rank;
+   unsigned lo;
+
+   if (!count)
+      return 0.0;
+
+   if (p <= 0.0)
+      return sorted[0];
+   if (p >= 100.0)
+      return sorted[count - 1];
+
+   rank = p / 100.0 * (count - 1);
+   lo = (unsigned) rank;
+   if (lo + 1 >= count)
+      return sorted[count - 1];
+
+   return sorted[lo] + (rank - lo) * (sorted[lo + 1] - sorted[lo]);
+}
@@ -0,0 +1,45 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Summary of a set of timing samples.
+ */
+struct stats
+{
+   unsigned count;
+   double min, max;
+   double mean;
+   double stddev;   /**< sample standard deviation (n - 1) */
+   double median;
+};
+
+/**
+ * Sorts the samples in place and summarizes them.
+ *
+ * @param samples  the samples, sorted on return
+ * @param count    number of samples
+ * @param s        returns the summary
+ */
+void
+stats_compute(double *samples, unsigned count, struct stats *s);
+
+/**
+ * Returns the p-th percentile (0 to 100) of sorted samples,
+ * interpolating linearly between the two closest ranks.
+ */
+double
+stats_percentile(const double *sorted, unsigned count, double p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* STATS_H */
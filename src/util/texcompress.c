@@ -0,0 +1,972 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Block compression of 8 bit RGB(A) images on the CPU, so that textures
+ * loaded by the demos can be stored in a quarter (or, for RGBA, half)
+ * of the memory they'd take uncompressed.
+ *
+ * BC1 color picks its endpoints along the principal axis of the block's
+ * colors, then refines them with a least squares fit to the chosen
+ * indices; matching texels to the palette is done four texels at a time
+ * with SSE2.  BC3 and EAC alpha fit the block's alpha range.  ETC2 RGB
+ * blocks only use the ETC1 modes, with the subblock averages as base
+ * colors and an exhaustive search of the modifier tables.
+ *
+ * Rows of blocks are encoded on several threads, and the results are
+ * cached on disk under a hash of the image, so a demo only pays for the
+ * compression the first time it runs.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#else
+#include <unistd.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "glad/gl.h"
+#include "parallel.h"
+#include "texcompress.h"
+
+/* images with fewer blocks than this per thread are done serially */
+#define MIN_BLOCKS_PER_THREAD 1024
+
+/* bump when the encoders change, to invalidate cached images */
+#define ENCODER_VERSION 1
+
+struct cache_header
+{
+   char magic[4];
+   uint32_t format;
+   uint32_t width, height;
+};
+
+struct band
+{
+   enum texcompress_format format;
+   const GLubyte *src;
+   unsigned width, height, channels;
+   GLubyte *dst;
+   unsigned first, last;       /* block rows [first, last) */
+};
+
+static int mode = -1;          /* not chosen yet */
+static unsigned num_threads = 0;
+static char *cache_dir = NULL;
+static int cache_dir_set = 0;
+
+static const int etc_modifiers[8][4] = {
+   {  2,   8,  -2,   -8 },
+   {  5,  17,  -5,  -17 },
+   {  9,  29,  -9,  -29 },
+   { 13,  42, -13,  -42 },
+   { 18,  60, -18,  -60 },
+   { 24,  80, -24,  -80 },
+   { 33, 106, -33, -106 },
+   { 47, 183, -47, -183 },
+};
+
+static const int eac_modifiers[16][8] = {
+   { -3, -6,  -9, -15, 2, 5, 8, 14 },
+   { -3, -7, -10, -13, 2, 6, 9, 12 },
+   { -2, -5,  -8, -13, 1, 4, 7, 12 },
+   { -2, -4,  -6, -13, 1, 3, 5, 12 },
+   { -3, -6,  -8, -12, 2, 5, 7, 11 },
+   { -3, -7,  -9, -11, 2, 6, 8, 10 },
+   { -4, -7,  -8, -11, 3, 6, 7, 10 },
+   { -3, -5,  -8, -11, 2, 4, 7, 10 },
+   { -2, -6,  -8, -10, 1, 5, 7,  9 },
+   { -2, -5,  -8, -10, 1, 4, 7,  9 },
+   { -2, -4,  -8, -10, 1, 3, 7,  9 },
+   { -2, -5,  -7, -10, 1, 4, 6,  9 },
+   { -3, -4,  -7, -10, 2, 3, 6,  9 },
+   { -1, -2,  -3, -10, 0, 1, 2,  9 },
+   { -4, -6,  -8,  -9, 3, 5, 7,  8 },
+   { -3, -5,  -7,  -9, 2, 4, 6,  8 },
+};
+
+
+static inline int
+clamp255(int x)
+{
+   return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+
+/* The 4x4 block at (bx, by) as RGBA texels in row-major order, with the
+ * edge texels repeated where the block sticks out of the image. */
+static void
+fetch_block(const struct band *b, unsigned bx, unsigned by,
+            GLubyte block[64])
+{
+   unsigned x, y;
+
+   for (y = 0; y < 4; y++) {
+      unsigned sy = by * 4 + y < b->height ? by * 4 + y : b->height - 1;
+
+      for (x = 0; x < 4; x++) {
+         unsigned sx = bx * 4 + x < b->width ? bx * 4 + x : b->width - 1;
+         const GLubyte *p = b->src + ((size_t) sy * b->width + sx) * b->channels;
+         GLubyte *t = block + (y * 4 + x) * 4;
+
+         t[0] = p[0];
+         t[1] = p[1];
+         t[2] = p[2];
+         t[3] = b->channels == 4 ? p[3] : 255;
+      }
+   }
+}
+
+
+/*
+ * BC1 color
+ */
+
+static unsigned
+pack565(const float c[3])
+{
+   int r = clamp255((int) (c[0] + 0.5f));
+   int g = clamp255((int) (c[1] + 0.5f));
+   int b = clamp255((int) (c[2] + 0.5f));
+
+   return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 |
+          ((b * 31 + 127) / 255);
+}
+
+
+static void
+unpack565(unsigned c, int rgb[3])
+{
+   int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+
+   rgb[0] = (r << 3) | (r >> 2);
+   rgb[1] = (g << 2) | (g >> 4);
+   rgb[2] = (b << 3) | (b >> 2);
+}
+
+
+static void
+bc1_palette(unsigned c0, unsigned c1, int palette[4][3])
+{
+   int i;
+
+   unpack565(c0, palette[0]);
+   unpack565(c1, palette[1]);
+   for (i = 0; i < 3; i++) {
+      palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+      palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+   }
+}
+
+
+/* Chooses the nearest of the four colors for each texel by projecting
+ * it on the line between the endpoints. */
+static uint32_t
+bc1_match(const GLubyte block[64], int palette[4][3])
+{
+   int dir[3], stops[4];
+   int c0_point, half_point, c3_point;
+   uint32_t mask = 0;
+   int i;
+
+   for (i = 0; i < 3; i++)
+      dir[i] = palette[0][i] - palette[1][i];
+   for (i = 0; i < 4; i++)
+      stops[i] = palette[i][0] * dir[0] + palette[i][1] * dir[1] +
+                 palette[i][2] * dir[2];
+
+   /* twice the midpoints between neighbouring colors along dir, in
+    * the order 1, 3, 2, 0 */
+   c0_point = stops[1] + stops[3];
+   half_point = stops[3] + stops[2];
+   c3_point = stops[2] + stops[0];
+
+#if defined(__SSE2__)
+   {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i d = _mm_setr_epi16(dir[0], dir[1], dir[2], 0,
+                                       dir[0], dir[1], dir[2], 0);
+      const __m128i c0 = _mm_set1_epi32(c0_point);
+      const __m128i half = _mm_set1_epi32(half_point);
+      const __m128i c3 = _mm_set1_epi32(c3_point);
+      const __m128i one = _mm_set1_epi32(1), two = _mm_set1_epi32(2);
+      const __m128i three = _mm_set1_epi32(3);
+
+      for (i = 0; i < 4; i++) {
+         __m128i t = _mm_loadu_si128((const __m128i *) (block + i * 16));
+         __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(t, zero), d);
+         __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(t, zero), d);
+         /* add the r*dr + g*dg and b*db halves of each texel */
+         __m128 even = _mm_shuffle_ps(_mm_castsi128_ps(lo),
+                                      _mm_castsi128_ps(hi),
+                                      _MM_SHUFFLE(2, 0, 2, 0));
+         __m128 odd = _mm_shuffle_ps(_mm_castsi128_ps(lo),
+                                     _mm_castsi128_ps(hi),
+                                     _MM_SHUFFLE(3, 1, 3, 1));
+         __m128i dot = _mm_slli_epi32(_mm_add_epi32(_mm_castps_si128(even),
+                                                    _mm_castps_si128(odd)), 1);
+         __m128i below_half = _mm_cmplt_epi32(dot, half);
+         __m128i below_c0 = _mm_cmplt_epi32(dot, c0);
+         __m128i below_c3 = _mm_cmplt_epi32(dot, c3);
+         __m128i low = _mm_or_si128(_mm_and_si128(below_c0, one),
+                                    _mm_andnot_si128(below_c0, three));
+         __m128i high = _mm_and_si128(below_c3, two);
+         int bits[4], j;
+
+         _mm_storeu_si128((__m128i *) bits,
+                          _mm_or_si128(_mm_and_si128(below_half, low),
+                                       _mm_andnot_si128(below_half, high)));
+         for (j = 0; j < 4; j++)
+            mask |= (uint32_t) bits[j] << (2 * (i * 4 + j));
+      }
+   }
+#else
+   for (i = 0; i < 16; i++) {
+      const GLubyte *t = block + i * 4;
+      int dot = 2 * (t[0] * dir[0] + t[1] * dir[1] + t[2] * dir[2]);
+      uint32_t bits;
+
+      if (dot < half_point)
+         bits = dot < c0_point ? 1 : 3;
+      else
+         bits = dot < c3_point ? 2 : 0;
+      mask |= bits << (2 * i);
+   }
+#endif
+
+   return mask;
+}
+
+
+static unsigned
+bc1_error(const GLubyte block[64], int palette[4][3], uint32_t mask)
+{
+   unsigned error = 0;
+   int i, j;
+
+   for (i = 0; i < 16; i++) {
+      const int *c = palette[(mask >> (2 * i)) & 3];
+
+      for (j = 0; j < 3; j++) {
+         int d = block[i * 4 + j] - c[j];
+         error += d * d;
+      }
+   }
+   return error;
+}
+
+
+/* Least squares endpoints for the texel to palette mapping in mask.
+ * Returns 0 if the texels all map to the same interpolation weight. */
+static int
+bc1_refine(const GLubyte block[64], uint32_t mask, float e0[3], float e1[3])
+{
+   static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+   float aa = 0.0f, bb = 0.0f, ab = 0.0f, ax[3] = { 0 }, bx[3] = { 0 };
+   float det;
+   int i, j;
+
+   for (i = 0; i < 16; i++) {
+      float a = weights[(mask >> (2 * i)) & 3], b = 1.0f - a;
+
+      aa += a * a;
+      bb += b * b;
+      ab += a * b;
+      for (j = 0; j < 3; j++) {
+         ax[j] += a * block[i * 4 + j];
+         bx[j] += b * block[i * 4 + j];
+      }
+   }
+
+   det = aa * bb - ab * ab;
+   if (det < 1e-3f)
+      return 0;
+   for (j = 0; j < 3; j++) {
+      e0[j] = (bb * ax[j] - ab * bx[j]) / det;
+      e1[j] = (aa * bx[j] - ab * ax[j]) / det;
+   }
+   return 1;
+}
+
+
+static void
+encode_bc1(const GLubyte block[64], GLubyte out[8])
+{
+   float mean[3] = { 0 }, cov[6] = { 0 }, axis[3], e0[3], e1[3];
+   float min_dot = 1e30f, max_dot = -1e30f;
+   int lo = 0, hi = 0, palette[4][3];
+   unsigned c0, c1, error;
+   uint32_t mask;
+   int i, j;
+
+   for (i = 0; i < 16; i++)
+      for (j = 0; j < 3; j++)
+         mean[j] += block[i * 4 + j] * (1.0f / 16.0f);
+   for (i = 0; i < 16; i++) {
+      float r = block[i * 4] - mean[0];
+      float g = block[i * 4 + 1] - mean[1];
+      float b = block[i * 4 + 2] - mean[2];
+
+      cov[0] += r * r;
+      cov[1] += r * g;
+      cov[2] += r * b;
+      cov[3] += g * g;
+      cov[4] += g * b;
+      cov[5] += b * b;
+   }
+
+   /* principal axis by power iteration */
+   axis[0] = axis[1] = axis[2] = 1.0f;
+   for (i = 0; i < 4; i++) {
+      float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+      float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+      float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+      float m = x * x > y * y ? x : y;
+
+      if (z * z > m * m)
+         m = z;
+      if (m * m < 1e-12f)
+         break;
+      axis[0] = x / m;
+      axis[1] = y / m;
+      axis[2] = z / m;
+   }
+
+   for (i = 0; i < 16; i++) {
+      float dot = block[i * 4] * axis[0] + block[i * 4 + 1] * axis[1] +
+                  block[i * 4 + 2] * axis[2];
+
+      if (dot < min_dot) {
+         min_dot = dot;
+         lo = i;
+      }
+      if (dot > max_dot) {
+         max_dot = dot;
+         hi = i;
+      }
+   }
+   for (j = 0; j < 3; j++) {
+      e0[j] = block[hi * 4 + j];
+      e1[j] = block[lo * 4 + j];
+   }
+
+   c0 = pack565(e0);
+   c1 = pack565(e1);
+   bc1_palette(c0, c1, palette);
+   mask = bc1_match(block, palette);
+   error = bc1_error(block, palette, mask);
+
+   if (c0 != c1 && bc1_refine(block, mask, e0, e1)) {
+      unsigned r0 = pack565(e0), r1 = pack565(e1), r_error;
+      uint32_t r_mask;
+
+      if (r0 != r1) {
+         bc1_palette(r0, r1, palette);
+         r_mask = bc1_match(block, palette);
+         r_error = bc1_error(block, palette, r_mask);
+         if (r_error < error) {
+            c0 = r0;
+            c1 = r1;
+            mask = r_mask;
+         }
+      }
+   }
+
+   /* the four color mode needs c0 > c1 */
+   if (c0 < c1) {
+      unsigned t = c0;
+
+      c0 = c1;
+      c1 = t;
+      mask ^= 0x55555555;
+   }
+   else if (c0 == c1)
+      mask = 0;
+
+   out[0] = c0 & 0xff;
+   out[1] = c0 >> 8;
+   out[2] = c1 & 0xff;
+   out[3] = c1 >> 8;
+   out[4] = mask & 0xff;
+   out[5] = (mask >> 8) & 0xff;
+   out[6] = (mask >> 16) & 0xff;
+   out[7] = mask >> 24;
+}
+
+
+/*
+ * BC3 alpha
+ */
+
+static void
+encode_bc3_alpha(const GLubyte block[64], GLubyte out[8])
+{
+   int min = 255, max = 0, range;
+   uint64_t bits = 0;
+   int i;
+
+   for (i = 0; i < 16; i++) {
+      int a = block[i * 4 + 3];
+
+      if (a < min)
+         min = a;
+      if (a > max)
+         max = a;
+   }
+
+   /* eight values from max (index 0) down to min (index 1) */
+   range = max - min;
+   if (range) {
+      for (i = 0; i < 16; i++) {
+         int step = ((block[i * 4 + 3] - min) * 7 + range / 2) / range;
+         uint64_t index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+
+         bits |= index << (3 * i);
+      }
+   }
+
+   out[0] = max;
+   out[1] = min;
+   for (i = 0; i < 6; i++)
+      out[2 + i] = (bits >> (8 * i)) & 0xff;
+}
+
+
+/*
+ * ETC2 color, in the ETC1 individual and differential modes
+ */
+
+/* Best modifier table for a subblock around base, with the indices and
+ * error of each texel in it. */
+static unsigned
+etc_fit_subblock(const GLubyte block[64], const int base[3],
+                 unsigned subblock, int flip, int *table, int indices[16])
+{
+   unsigned best_error = ~0u;
+   int t, i;
+
+   for (t = 0; t < 8; t++) {
+      int index[16];
+      unsigned error = 0;
+
+      for (i = 0; i < 16; i++) {
+         int x = i & 3, y = i >> 2;
+         unsigned best = ~0u;
+         int m;
+
+         if ((unsigned) ((flip ? y : x) >= 2) != subblock)
+            continue;
+         for (m = 0; m < 4; m++) {
+            int mod = etc_modifiers[t][m];
+            int dr = clamp255(base[0] + mod) - block[i * 4];
+            int dg = clamp255(base[1] + mod) - block[i * 4 + 1];
+            int db = clamp255(base[2] + mod) - block[i * 4 + 2];
+            unsigned e = dr * dr + dg * dg + db * db;
+
+            if (e < best) {
+               best = e;
+               index[i] = m;
+            }
+         }
+         error += best;
+         if (error >= best_error)
+            break;
+      }
+
+      if (error < best_error) {
+         best_error = error;
+         *table = t;
+         for (i = 0; i < 16; i++)
+            if ((unsigned) (((flip ? i >> 2 : i & 3) >= 2)) == subblock)
+               indices[i] = index[i];
+      }
+   }
+   return best_error;
+}
+
+
+static void
+encode_etc(const GLubyte block[64], GLubyte out[8])
+{
+   unsigned best_error = ~0u;
+   int flip;
+
+   for (flip = 0; flip < 2; flip++) {
+      int avg[2][3] = { { 0 } }, q[2][3], base[2][3];
+      int table[2], indices[16];
+      unsigned error;
+      int diff = 1;
+      int s, c, i;
+
+      for (i = 0; i < 16; i++) {
+         s = ((flip ? i >> 2 : i & 3) >= 2);
+         for (c = 0; c < 3; c++)
+            avg[s][c] += block[i * 4 + c];
+      }
+
+      /* 5 bit colors with a 3 bit difference if they're close enough,
+       * else two 4 bit colors */
+      for (s = 0; s < 2; s++)
+         for (c = 0; c < 3; c++)
+            q[s][c] = (avg[s][c] * 31 + 8 * 255 / 2) / (8 * 255);
+      for (c = 0; c < 3; c++)
+         if (q[1][c] - q[0][c] < -4 || q[1][c] - q[0][c] > 3)
+            diff = 0;
+      for (s = 0; s < 2; s++) {
+         for (c = 0; c < 3; c++) {
+            if (diff)
+               base[s][c] = (q[s][c] << 3) | (q[s][c] >> 2);
+            else {
+               q[s][c] = (avg[s][c] * 15 + 8 * 255 / 2) / (8 * 255);
+               base[s][c] = q[s][c] * 17;
+            }
+         }
+      }
+
+      error = etc_fit_subblock(block, base[0], 0, flip, &table[0], indices);
+      if (error >= best_error)
+         continue;
+      error += etc_fit_subblock(block, base[1], 1, flip, &table[1], indices);
+      if (error >= best_error)
+         continue;
+      best_error = error;
+
+      for (c = 0; c < 3; c++) {
+         if (diff)
+            out[c] = q[0][c] << 3 | ((q[1][c] - q[0][c]) & 7);
+         else
+            out[c] = q[0][c] << 4 | q[1][c];
+      }
+      out[3] = table[0] << 5 | table[1] << 2 | diff << 1 | flip;
+
+      /* index bits go column by column, msbs first */
+      {
+         unsigned msb = 0, lsb = 0;
+
+         for (i = 0; i < 16; i++) {
+            int k = (i & 3) * 4 + (i >> 2);
+
+            msb |= (unsigned) (indices[i] >> 1) << k;
+            lsb |= (unsigned) (indices[i] & 1) << k;
+         }
+         out[4] = msb >> 8;
+         out[5] = msb & 0xff;
+         out[6] = lsb >> 8;
+         out[7] = lsb & 0xff;
+      }
+   }
+}
+
+
+/*
+ * EAC alpha
+ */
+
+static void
+encode_eac_alpha(const GLubyte block[64], GLubyte out[8])
+{
+   unsigned best_error = ~0u;
+   int min = 255, max = 0, base;
+   int best_table = 13, best_mult = 1;
+   int index[16], best_index[16];
+   uint64_t bits = 0;
+   int t, i;
+
+   for (i = 0; i < 16; i++) {
+      int a = block[i * 4 + 3];
+
+      if (a < min)
+         min = a;
+      if (a > max)
+         max = a;
+      best_index[i] = 4;        /* table 13, modifier 0 */
+   }
+   base = (min + max + 1) / 2;
+
+   for (t = 0; t < 16 && max != min; t++) {
+      int span = eac_modifiers[t][7] - eac_modifiers[t][3];
+      int mult = (max - min + span / 2) / span, m;
+
+      for (m = mult; m <= mult + 1; m++) {
+         unsigned error = 0;
+
+         if (m < 1 || m > 15)
+            continue;
+         for (i = 0; i < 16 && error < best_error; i++) {
+            int a = block[i * 4 + 3], k;
+            unsigned best = ~0u;
+
+            for (k = 0; k < 8; k++) {
+               int d = clamp255(base + eac_modifiers[t][k] * m) - a;
+
+               if ((unsigned) (d * d) < best) {
+                  best = d * d;
+                  index[i] = k;
+               }
+            }
+            error += best;
+         }
+         if (error < best_error) {
+            best_error = error;
+            best_table = t;
+            best_mult = m;
+            memcpy(best_index, index, sizeof(index));
+         }
+      }
+   }
+
+   out[0] = base;
+   out[1] = best_mult << 4 | best_table;
+   for (i = 0; i < 16; i++) {
+      int k = (i & 3) * 4 + (i >> 2);
+
+      bits |= (uint64_t) best_index[i] << (45 - 3 * k);
+   }
+   for (i = 0; i < 6; i++)
+      out[2 + i] = (bits >> (40 - 8 * i)) & 0xff;
+}
+
+
+static unsigned
+block_size(enum texcompress_format format)
+{
+   switch (format) {
+   case TEXCOMPRESS_BC1:
+   case TEXCOMPRESS_ETC2_RGB8:
+      return 8;
+   case TEXCOMPRESS_BC3:
+   case TEXCOMPRESS_ETC2_RGBA8:
+      return 16;
+   default:
+      return 0;
+   }
+}
+
+
+static void
+encode_band(void *data, unsigned i)
+{
+   const struct band *b = (const struct band *) data + i;
+   unsigned blocks_x = (b->width + 3) / 4, size = block_size(b->format);
+   unsigned bx, by;
+   GLubyte block[64];
+
+   for (by = b->first; by < b->last; by++) {
+      GLubyte *out = b->dst + (size_t) by * blocks_x * size;
+
+      for (bx = 0; bx < blocks_x; bx++, out += size) {
+         fetch_block(b, bx, by, block);
+         switch (b->format) {
+         case TEXCOMPRESS_BC1:
+            encode_bc1(block, out);
+            break;
+         case TEXCOMPRESS_BC3:
+            encode_bc3_alpha(block, out);
+            encode_bc1(block, out + 8);
+            break;
+         case TEXCOMPRESS_ETC2_RGB8:
+            encode_etc(block, out);
+            break;
+         case TEXCOMPRESS_ETC2_RGBA8:
+            encode_eac_alpha(block, out);
+            encode_etc(block, out + 8);
+            break;
+         default:
+            break;
+         }
+      }
+   }
+}
+
+
+/*
+ * Disk cache
+ */
+
+static uint64_t
+hash_image(const GLubyte *p, size_t size, uint64_t h)
+{
+   size_t i;
+
+   for (i = 0; i + 8 <= size; i += 8) {
+      uint64_t v;
+
+      memcpy(&v, p + i, 8);
+      h = (h ^ v) * 0xff51afd7ed558ccdull;
+      h ^= h >> 32;
+   }
+   for (; i < size; i++)
+      h = (h ^ p[i]) * 0x100000001b3ull;
+
+   h ^= h >> 33;
+   h *= 0xc4ceb9fe1a85ec53ull;
+   h ^= h >> 33;
+   return h;
+}
+
+
+static void
+default_cache_dir(void)
+{
+   const char *env = getenv("TEXCOMPRESS_CACHE");
+   const char *base;
+   char path[4096];
+
+   cache_dir_set = 1;
+   if (env) {
+      if (*env) {
+         mkdir(env, 0755);
+         cache_dir = strdup(env);
+      }
+      return;
+   }
+
+   if ((base = getenv("XDG_CACHE_HOME")) && *base)
+      snprintf(path, sizeof(path), "%s", base);
+   else if ((base = getenv("HOME")) && *base)
+      snprintf(path, sizeof(path), "%s/.cache", base);
+   else
+      return;
+   mkdir(path, 0755);
+   strncat(path, "/mesa-demos", sizeof(path) - strlen(path) - 1);
+   mkdir(path, 0755);
+   cache_dir = strdup(path);
+}
+
+
+static void
+cache_path(char *path, size_t size, uint64_t key)
+{
+   snprintf(path, size, "%s/%08x%08x.txc", cache_dir,
+            (unsigned) (key >> 32), (unsigned) key);
+}
+
+
+static int
+cache_read(uint64_t key, enum texcompress_format format,
+           unsigned width, unsigned height, GLubyte *dst, size_t size)
+{
+   struct cache_header header;
+   char path[4096];
+   FILE *f;
+   int ok;
+
+   cache_path(path, sizeof(path), key);
+   f = fopen(path, "rb");
+   if (!f)
+      return 0;
+   ok = fread(&header, sizeof(header), 1, f) == 1 &&
+        !memcmp(header.magic, "TXC1", 4) && header.format == format &&
+        header.width == width && header.height == height &&
+        fread(dst, 1, size, f) == size;
+   fclose(f);
+   return ok;
+}
+
+
+static void
+cache_write(uint64_t key, enum texcompress_format format,
+            unsigned width, unsigned height, const GLubyte *data, size_t size)
+{
+   struct cache_header header;
+   char path[4096], tmp[4200];
+   FILE *f;
+   int ok;
+
+   /* written under another name first, so that readers never see a
+    * partial file */
+   cache_path(path, sizeof(path), key);
+#ifdef _WIN32
+   snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+#else
+   snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+#endif
+   f = fopen(tmp, "wb");
+   if (!f)
+      return;
+
+   memcpy(header.magic, "TXC1", 4);
+   header.format = format;
+   header.width = width;
+   header.height = height;
+   ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(data, 1, size, f) == size;
+   ok = fclose(f) == 0 && ok;
+   if (!ok || rename(tmp, path) != 0)
+      remove(tmp);
+}
+
+
+static void
+choose_mode(void)
+{
+   const char *env = getenv("TEXCOMPRESS");
+
+   mode = TEXCOMPRESS_OFF;
+   if (env && !strcmp(env, "bc"))
+      mode = TEXCOMPRESS_BC;
+   else if (env && !strcmp(env, "etc2"))
+      mode = TEXCOMPRESS_ETC2;
+   else if (env && !strcmp(env, "auto"))
+      mode = TEXCOMPRESS_AUTO;
+}
+
+
+void
+texcompress_set_mode(enum texcompress_mode m)
+{
+   mode = m;
+}
+
+
+void
+texcompress_set_threads(unsigned count)
+{
+   num_threads = count;
+}
+
+
+void
+texcompress_set_cache_dir(const char *dir)
+{
+   free(cache_dir);
+   cache_dir = dir ? strdup(dir) : NULL;
+   cache_dir_set = 1;
+}
+
+
+size_t
+texcompress_size(enum texcompress_format format,
+                 unsigned width, unsigned height)
+{
+   return (size_t) ((width + 3) / 4) * ((height + 3) / 4) *
+          block_size(format);
+}
+
+
+GLenum
+texcompress_gl_format(enum texcompress_format format)
+{
+   switch (format) {
+   case TEXCOMPRESS_BC1:
+      return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+   case TEXCOMPRESS_BC3:
+      return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+   case TEXCOMPRESS_ETC2_RGB8:
+      return GL_COMPRESSED_RGB8_ETC2;
+   case TEXCOMPRESS_ETC2_RGBA8:
+      return GL_COMPRESSED_RGBA8_ETC2_EAC;
+   default:
+      return GL_NONE;
+   }
+}
+
+
+void
+texcompress_encode(enum texcompress_format format,
+                   const GLubyte *src, unsigned width, unsigned height,
+                   unsigned channels, GLubyte *dst)
+{
+   struct band bands[UTIL_MAX_THREADS];
+   unsigned blocks_y = (height + 3) / 4;
+   unsigned n, i;
+
+   if (!block_size(format) || !width || !height)
+      return;
+
+   n = util_parallel_count(num_threads, (size_t) (width + 3) / 4 * blocks_y,
+                           MIN_BLOCKS_PER_THREAD, blocks_y);
+   for (i = 0; i < n; i++) {
+      bands[i].format = format;
+      bands[i].src = src;
+      bands[i].width = width;
+      bands[i].height = height;
+      bands[i].channels = channels;
+      bands[i].dst = dst;
+      bands[i].first = (unsigned) ((size_t) blocks_y * i / n);
+      bands[i].last = (unsigned) ((size_t) blocks_y * (i + 1) / n);
+   }
+
+   util_parallel_bands(n, encode_band, bands);
+}
+
+
+enum texcompress_format
+texcompress_choose(GLint internalFormat, GLenum format)
+{
+   int alpha;
+
+   if (mode < 0)
+      choose_mode();
+   if (mode == TEXCOMPRESS_OFF || !glCompressedTexImage2D)
+      return TEXCOMPRESS_NONE;
+   if (format != GL_RGB && format != GL_RGBA)
+      return TEXCOMPRESS_NONE;
+
+   switch (internalFormat) {
+   case 3:
+   case GL_RGB:
+   case GL_RGB8:
+      alpha = 0;
+      break;
+   case 4:
+   case GL_RGBA:
+   case GL_RGBA8:
+      alpha = format == GL_RGBA;
+      break;
+   default:
+      return TEXCOMPRESS_NONE;
+   }
+
+   if ((mode == TEXCOMPRESS_BC || mode == TEXCOMPRESS_AUTO) &&
+       GLAD_GL_EXT_texture_compression_s3tc)
+      return alpha ? TEXCOMPRESS_BC3 : TEXCOMPRESS_BC1;
+   if ((mode == TEXCOMPRESS_ETC2 || mode == TEXCOMPRESS_AUTO) &&
+       (GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_ES3_compatibility))
+      return alpha ? TEXCOMPRESS_ETC2_RGBA8 : TEXCOMPRESS_ETC2_RGB8;
+   return TEXCOMPRESS_NONE;
+}
+
+
+GLenum
+texcompress_tex_image_2d(GLenum target, GLint level,
+                         enum texcompress_format format,
+                         unsigned width, unsigned height,
+                         unsigned channels, const GLubyte *pixels)
+{
+   size_t size = texcompress_size(format, width, height);
+   GLubyte *data;
+   uint64_t key = 0;
+
+   data = (GLubyte *) malloc(size);
+   if (!data)
+      return GL_OUT_OF_MEMORY;
+
+   if (!cache_dir_set)
+      default_cache_dir();
+   if (cache_dir) {
+      key = hash_image(pixels, (size_t) width * height * channels,
+                       (uint64_t) ENCODER_VERSION << 56 ^
+                       (uint64_t) format << 48 ^ (uint64_t) channels << 40 ^
+                       (uint64_t) width << 20 ^ height);
+   }
+
+   if (!cache_dir || !cache_read(key, format, width, height, data, size)) {
+      texcompress_encode(format, pixels, width, height, channels, data);
+      if (cache_dir)
+         cache_write(key, format, width, height, data, size);
+   }
+
+   glCompressedTexImage2D(target, level, texcompress_gl_format(format),
+                          width, height, 0, (GLsizei) size, data);
+   free(data);
+   return 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TEXCOMPRESS_H
+#define TEXCOMPRESS_H
+
+#include <stddef.h>
+
+#include "gl_wrap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Block compressed formats the encoder produces.
+ */
+enum texcompress_format
+{
+   TEXCOMPRESS_NONE,
+   TEXCOMPRESS_BC1,         /**< GL_COMPRESSED_RGB_S3TC_DXT1_EXT */
+   TEXCOMPRESS_BC3,         /**< GL_COMPRESSED_RGBA_S3TC_DXT5_EXT */
+   TEXCOMPRESS_ETC2_RGB8,   /**< GL_COMPRESSED_RGB8_ETC2 */
+   TEXCOMPRESS_ETC2_RGBA8,  /**< GL_COMPRESSED_RGBA8_ETC2_EAC */
+};
+
+/**
+ * Which formats texcompress_choose() may pick.
+ */
+enum texcompress_mode
+{
+   TEXCOMPRESS_OFF,         /**< upload textures uncompressed */
+   TEXCOMPRESS_BC,          /**< BC1 or BC3, where S3TC is supported */
+   TEXCOMPRESS_ETC2,        /**< ETC2 or ETC2 + EAC alpha, where supported */
+   TEXCOMPRESS_AUTO,        /**< BC where supported, else ETC2 */
+};
+
+/**
+ * Selects the mode.  The TEXCOMPRESS environment variable (off, bc,
+ * etc2 or auto) overrides the default of off.
+ */
+void
+texcompress_set_mode(enum texcompress_mode mode);
+
+/**
+ * Sets the number of threads used per image.  0, the default, uses one
+ * per CPU for images large enough to be worth it.
+ */
+void
+texcompress_set_threads(unsigned count);
+
+/**
+ * Sets the directory where compressed images are cached, keyed by a
+ * hash of their contents, or disables the cache with NULL.  The
+ * default is $TEXCOMPRESS_CACHE if set (an empty value disables the
+ * cache), else mesa-demos/ in $XDG_CACHE_HOME or ~/.cache.
+ */
+void
+texcompress_set_cache_dir(const char *dir);
+
+/**
+ * @return the size in bytes of a width x height image in format
+ */
+size_t
+texcompress_size(enum texcompress_format format,
+                 unsigned width, unsigned height);
+
+/**
+ * @return the GL internal format for format
+ */
+GLenum
+texcompress_gl_format(enum texcompress_format format);
+
+/**
+ * Encodes a width x height image, tightly packed with channels (3 or 4)
+ * unsigned bytes per texel in RGB(A) order, into dst, which must hold
+ * texcompress_size() bytes.  Alpha is dropped for the RGB formats.
+ */
+void
+texcompress_encode(enum texcompress_format format,
+                   const GLubyte *src, unsigned width, unsigned height,
+                   unsigned channels, GLubyte *dst);
+
+/**
+ * Picks the format to store an image with the given internal format
+ * and GL_RGB or GL_RGBA data in, according to the mode and to what the
+ * current context supports.  Only generic 8 bit RGB and RGBA internal
+ * formats are compressed.  Compression also requires the GL functions
+ * to have been loaded with glad.
+ *
+ * @return the format, or TEXCOMPRESS_NONE to upload uncompressed
+ */
+enum texcompress_format
+texcompress_choose(GLint internalFormat, GLenum format);
+
+/**
+ * Encodes an image (or fetches it from the cache) and uploads it as
+ * level of target with glCompressedTexImage2D().  The arguments are as
+ * for texcompress_encode().
+ *
+ * @return 0 on success, or GL_OUT_OF_MEMORY
+ */
+GLenum
+texcompress_tex_image_2d(GLenum target, GLint level,
+                         enum texcompress_format format,
+                         unsigned width, unsigned height,
+                         unsigned channels, const GLubyte *pixels);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEXCOMPRESS_H */
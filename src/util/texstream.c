@@ -0,0 +1,884 @@
+/*
+ * SPDX-License-Identifier: MIT
+ *
+ * Texture loading in the background.
+ *
+ * Images are decoded, flipped and mipmapped on a pool of threads.
+ * Finished images are uploaded by a thread owning a second GL context
+ * that shares objects with the application's one, through a pixel
+ * buffer object, and a fence tells the application's thread when the
+ * texture may be used.  Without GLX or EGL, or if the shared context
+ * can't be made, texstream_poll() does the uploads instead, one texture
+ * per call.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "glad/gl.h"
+#ifdef HAVE_GLX
+#include <X11/Xlib.h>
+#include <GL/glx.h>
+#endif
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#endif
+
+#include "mipmap.h"
+#include "parallel.h"
+#include "readtex.h"
+#include "texstream.h"
+
+#define MAX_THREADS 16
+
+
+struct image
+{
+   GLubyte *pixels;             /* all levels, largest first */
+   GLsizei width, height;
+   GLenum format;
+   unsigned channels;
+   unsigned levels;
+};
+
+struct job
+{
+   struct job *next;
+   GLenum target;
+   GLint internal_format;
+   unsigned flags;
+   void *data;
+   char *filenames[6];
+   struct image images[6];
+   unsigned num_images;
+   unsigned next_image;         /* next image to decode */
+   unsigned decoded;            /* images decoded so far */
+   int failed;
+   GLuint texture;
+   GLsync fence;
+};
+
+struct queue
+{
+   struct job *head, *tail;
+};
+
+static int initialized = 0;
+static int shared_context = 0;
+static int quit = 0;
+static unsigned pending = 0;
+
+static struct queue decode_queue;   /* jobs with images left to decode */
+static struct queue upload_queue;   /* decoded, waiting for an upload */
+static struct queue done_queue;     /* uploaded, waiting for the app */
+
+/* limits of the application's context, for the decoding threads */
+static GLint max_size, max_cube_size;
+static int npot;
+static int have_pbo, have_sync;
+
+static GLuint pbo;              /* one per uploading context */
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t decode_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t upload_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t started_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t decoders[MAX_THREADS];
+static unsigned num_decoders;
+static pthread_t uploader;
+static int uploader_state;      /* 0 starting, 1 running, -1 failed */
+#define LOCK()   pthread_mutex_lock(&lock)
+#define UNLOCK() pthread_mutex_unlock(&lock)
+#else
+#define LOCK()
+#define UNLOCK()
+#endif
+
+#ifdef HAVE_GLX
+static Display *glx_dpy;
+static GLXContext glx_ctx;
+static GLXPbuffer glx_pbuf;
+#endif
+#ifdef HAVE_EGL
+static EGLDisplay egl_dpy = EGL_NO_DISPLAY;
+static EGLContext egl_ctx = EGL_NO_CONTEXT;
+static EGLSurface egl_surf = EGL_NO_SURFACE;
+#endif
+
+
+static void
+push(struct queue *q, struct job *job)
+{
+   job->next = NULL;
+   if (q->tail)
+      q->tail->next = job;
+   else
+      q->head = job;
+   q->tail = job;
+}
+
+
+static struct job *
+pop(struct queue *q)
+{
+   struct job *job = q->head;
+
+   if (job) {
+      q->head = job->next;
+      if (!q->head)
+         q->tail = NULL;
+   }
+   return job;
+}
+
+
+static void
+free_job(struct job *job)
+{
+   unsigned i;
+
+   for (i = 0; i < job->num_images; i++) {
+      free(job->filenames[i]);
+      free(job->images[i].pixels);
+   }
+   free(job);
+}
+
+
+static GLsizei
+level_dim(GLsizei size, unsigned level)
+{
+   return size >> level ? size >> level : 1;
+}
+
+
+static size_t
+level_size(const struct image *img, unsigned level)
+{
+   return (size_t) level_dim(img->width, level) *
+          level_dim(img->height, level) * img->channels;
+}
+
+
+static size_t
+image_size(const struct image *img)
+{
+   size_t size = 0;
+   unsigned level;
+
+   for (level = 0; level < img->levels; level++)
+      size += level_size(img, level);
+   return size;
+}
+
+
+static void
+flip(struct image *img, unsigned flags)
+{
+   const size_t stride = (size_t) img->width * img->channels;
+   const unsigned c = img->channels;
+   GLubyte *row, *tmp;
+   GLsizei x, y;
+
+   if (flags & TEXSTREAM_FLIP_Y) {
+      tmp = (GLubyte *) malloc(stride);
+      if (tmp) {
+         for (y = 0; y < img->height / 2; y++) {
+            GLubyte *a = img->pixels + y * stride;
+            GLubyte *b = img->pixels + (img->height - y - 1) * stride;
+            memcpy(tmp, a, stride);
+            memcpy(a, b, stride);
+            memcpy(b, tmp, stride);
+         }
+         free(tmp);
+      }
+   }
+
+   if (flags & TEXSTREAM_FLIP_X) {
+      for (y = 0; y < img->height; y++) {
+         row = img->pixels + y * stride;
+         for (x = 0; x < img->width / 2; x++) {
+            GLubyte *a = row + x * c, *b = row + (img->width - x - 1) * c;
+            GLubyte t[4];
+            memcpy(t, a, c);
+            memcpy(a, b, c);
+            memcpy(b, t, c);
+         }
+      }
+   }
+}
+
+
+static GLsizei
+fit(GLsizei size, GLint max)
+{
+   GLsizei p = 1;
+
+   if (!npot) {
+      while (p * 2 <= size)
+         p *= 2;
+      size = p;
+   }
+   while (size > max)
+      size /= 2;
+   return size;
+}
+
+
+/* load, flip, resize and mipmap one image */
+static int
+decode(struct job *job, unsigned i)
+{
+   struct image *img = &job->images[i];
+   GLint max = job->target == GL_TEXTURE_CUBE_MAP ? max_cube_size : max_size;
+   GLsizei w, h;
+   unsigned level;
+
+   img->pixels = LoadRGBImage(job->filenames[i], &img->width, &img->height,
+                              &img->format);
+   if (!img->pixels) {
+      fprintf(stderr, "Error: couldn't load texture image %s\n",
+              job->filenames[i]);
+      return 0;
+   }
+   img->channels = img->format == GL_RGBA ? 4 : 3;
+
+   flip(img, job->flags);
+
+   w = fit(img->width, max);
+   h = fit(img->height, max);
+   if (w != img->width || h != img->height) {
+      GLubyte *scaled = (GLubyte *) malloc((size_t) w * h * img->channels);
+      if (!scaled ||
+          !mipmap_downsample(img->pixels, img->width, img->height,
+                             img->channels, scaled, w, h)) {
+         free(scaled);
+         return 0;
+      }
+      free(img->pixels);
+      img->pixels = scaled;
+      img->width = w;
+      img->height = h;
+   }
+
+   img->levels = 1;
+   if (job->flags & TEXSTREAM_MIPMAP) {
+      while ((img->width >> img->levels) || (img->height >> img->levels))
+         img->levels++;
+   }
+   if (img->levels > 1) {
+      GLubyte *pixels = (GLubyte *) realloc(img->pixels, image_size(img));
+      size_t offset = 0;
+
+      if (!pixels)
+         return 0;
+      img->pixels = pixels;
+
+      for (level = 1; level < img->levels; level++) {
+         size_t next = offset + level_size(img, level - 1);
+
+         if (!mipmap_downsample(pixels + offset,
+                                level_dim(img->width, level - 1),
+                                level_dim(img->height, level - 1),
+                                img->channels, pixels + next,
+                                level_dim(img->width, level),
+                                level_dim(img->height, level)))
+            return 0;
+         offset = next;
+      }
+   }
+
+   return 1;
+}
+
+
+/* create the texture of a decoded job in the current context */
+static void
+upload(struct job *job)
+{
+   const GLenum bind = job->target;
+   const GLenum binding = bind == GL_TEXTURE_CUBE_MAP ?
+                          GL_TEXTURE_BINDING_CUBE_MAP : GL_TEXTURE_BINDING_2D;
+   GLubyte *mapped = NULL;
+   GLint prev = 0;
+   size_t size = 0, offset;
+   unsigned i, level;
+
+   for (i = 0; i < job->num_images; i++)
+      size += image_size(&job->images[i]);
+
+   /* with everything in a buffer object the glTexImage2D() calls don't
+    * have to wait for the copies into the texture
+    */
+   if (have_pbo) {
+      if (!pbo)
+         glGenBuffers(1, &pbo);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+      mapped = (GLubyte *) glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+      if (mapped) {
+         for (offset = 0, i = 0; i < job->num_images; i++) {
+            memcpy(mapped + offset, job->images[i].pixels,
+                   image_size(&job->images[i]));
+            offset += image_size(&job->images[i]);
+         }
+         if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+            mapped = NULL;
+      }
+      if (!mapped)
+         glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+   }
+
+   glGetIntegerv(binding, &prev);
+   glGenTextures(1, &job->texture);
+   glBindTexture(bind, job->texture);
+   glTexParameteri(bind, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+   glTexParameteri(bind, GL_TEXTURE_MIN_FILTER,
+                   job->images[0].levels > 1 ? GL_LINEAR_MIPMAP_LINEAR :
+                                               GL_LINEAR);
+
+   glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+   glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+   glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+   glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+   glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+
+   for (offset = 0, i = 0; i < job->num_images; i++) {
+      const struct image *img = &job->images[i];
+      const GLenum target = bind == GL_TEXTURE_CUBE_MAP ?
+                            GL_TEXTURE_CUBE_MAP_POSITIVE_X + i : bind;
+      const size_t base = offset;
+
+      for (level = 0; level < img->levels; level++) {
+         const void *pixels = mapped ? (const void *) offset :
+                              (const void *) (img->pixels + offset - base);
+
+         glTexImage2D(target, level, job->internal_format,
+                      level_dim(img->width, level),
+                      level_dim(img->height, level), 0,
+                      img->format, GL_UNSIGNED_BYTE, pixels);
+         offset += level_size(img, level);
+      }
+   }
+
+   glPopClientAttrib();
+   glBindTexture(bind, prev);
+   if (mapped)
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+#ifdef HAVE_EGL
+static int
+create_egl_context(void)
+{
+   static const EGLint pbuffer_attribs[] = {
+      EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE
+   };
+   EGLDisplay dpy = eglGetCurrentDisplay();
+   EGLContext cur = eglGetCurrentContext();
+   EGLint attribs[] = { EGL_CONFIG_ID, 0, EGL_NONE };
+   EGLConfig config = NULL;     /* EGL_NO_CONFIG_KHR */
+   EGLint n = 0;
+   const char *exts;
+
+   if (cur == EGL_NO_CONTEXT || eglQueryAPI() != EGL_OPENGL_API)
+      return 0;
+   /* contexts made without a config (EGL_KHR_no_config_context) have
+    * no id, the new one is made the same way
+    */
+   if (eglQueryContext(dpy, cur, EGL_CONFIG_ID, &attribs[1]) &&
+       attribs[1] > 0 &&
+       (!eglChooseConfig(dpy, attribs, &config, 1, &n) || n < 1))
+      return 0;
+
+   egl_ctx = eglCreateContext(dpy, config, cur, NULL);
+   if (egl_ctx == EGL_NO_CONTEXT)
+      return 0;
+
+   exts = eglQueryString(dpy, EGL_EXTENSIONS);
+   if (!exts || !strstr(exts, "EGL_KHR_surfaceless_context")) {
+      if (!config) {
+         eglDestroyContext(dpy, egl_ctx);
+         egl_ctx = EGL_NO_CONTEXT;
+         return 0;
+      }
+      egl_surf = eglCreatePbufferSurface(dpy, config, pbuffer_attribs);
+      if (egl_surf == EGL_NO_SURFACE) {
+         eglDestroyContext(dpy, egl_ctx);
+         egl_ctx = EGL_NO_CONTEXT;
+         return 0;
+      }
+   }
+
+   egl_dpy = dpy;
+   return 1;
+}
+#endif
+
+
+#ifdef HAVE_GLX
+static int glx_error;
+
+static int
+glx_error_handler(Display *dpy, XErrorEvent *event)
+{
+   (void) dpy;
+   (void) event;
+   glx_error = 1;
+   return 0;
+}
+
+
+static int
+create_glx_context(void)
+{
+   static const int pbuffer_attribs[] = {
+      GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None
+   };
+   Display *app_dpy = glXGetCurrentDisplay();
+   GLXContext cur = glXGetCurrentContext();
+   int attribs[] = { GLX_FBCONFIG_ID, 0, None };
+   int (*old_handler)(Display *, XErrorEvent *);
+   GLXFBConfig *configs;
+   Display *dpy;
+   int screen = 0, n = 0;
+
+   if (!app_dpy || !cur)
+      return 0;
+   if (glXQueryContext(app_dpy, cur, GLX_FBCONFIG_ID, &attribs[1]) != Success)
+      return 0;
+   glXQueryContext(app_dpy, cur, GLX_SCREEN, &screen);
+
+   /* the uploader gets a connection of its own: the application's one
+    * is used by its thread, and nothing has called XInitThreads()
+    */
+   dpy = XOpenDisplay(DisplayString(app_dpy));
+   if (!dpy)
+      return 0;
+   configs = glXChooseFBConfig(dpy, screen, attribs, &n);
+   if (!configs) {
+      XCloseDisplay(dpy);
+      return 0;
+   }
+
+   /* failures are X errors, which would otherwise end the program */
+   XSync(dpy, False);
+   glx_error = 0;
+   old_handler = XSetErrorHandler(glx_error_handler);
+   glx_ctx = glXCreateNewContext(dpy, configs[0], GLX_RGBA_TYPE, cur,
+                                 glXIsDirect(app_dpy, cur));
+   if (glx_ctx)
+      glx_pbuf = glXCreatePbuffer(dpy, configs[0], pbuffer_attribs);
+   XSync(dpy, False);
+   XSetErrorHandler(old_handler);
+   XFree(configs);
+
+   if (glx_error || !glx_ctx || !glx_pbuf) {
+      if (glx_pbuf)
+         glXDestroyPbuffer(dpy, glx_pbuf);
+      if (glx_ctx)
+         glXDestroyContext(dpy, glx_ctx);
+      XCloseDisplay(dpy);
+      glx_ctx = NULL;
+      glx_pbuf = 0;
+      return 0;
+   }
+
+   glx_dpy = dpy;
+   return 1;
+}
+#endif
+
+
+static int
+create_shared_context(void)
+{
+#ifdef HAVE_EGL
+   if (create_egl_context())
+      return 1;
+#endif
+#ifdef HAVE_GLX
+   if (create_glx_context())
+      return 1;
+#endif
+   return 0;
+}
+
+
+static void
+destroy_shared_context(void)
+{
+#ifdef HAVE_EGL
+   if (egl_ctx != EGL_NO_CONTEXT) {
+      if (egl_surf != EGL_NO_SURFACE)
+         eglDestroySurface(egl_dpy, egl_surf);
+      eglDestroyContext(egl_dpy, egl_ctx);
+      egl_surf = EGL_NO_SURFACE;
+      egl_ctx = EGL_NO_CONTEXT;
+   }
+#endif
+#ifdef HAVE_GLX
+   if (glx_ctx) {
+      glXDestroyPbuffer(glx_dpy, glx_pbuf);
+      glXDestroyContext(glx_dpy, glx_ctx);
+      XCloseDisplay(glx_dpy);
+      glx_dpy = NULL;
+      glx_pbuf = 0;
+      glx_ctx = NULL;
+   }
+#endif
+}
+
+
+#ifdef HAVE_PTHREAD
+static int
+bind_shared_context(int bind)
+{
+#ifdef HAVE_EGL
+   if (egl_ctx != EGL_NO_CONTEXT) {
+      /* the bound API is per thread */
+      if (!eglBindAPI(EGL_OPENGL_API))
+         return 0;
+      return bind ? eglMakeCurrent(egl_dpy, egl_surf, egl_surf, egl_ctx) :
+                    eglMakeCurrent(egl_dpy, EGL_NO_SURFACE, EGL_NO_SURFACE,
+                                   EGL_NO_CONTEXT);
+   }
+#endif
+#ifdef HAVE_GLX
+   if (glx_ctx) {
+      return bind ? glXMakeContextCurrent(glx_dpy, glx_pbuf, glx_pbuf, glx_ctx) :
+                    glXMakeContextCurrent(glx_dpy, None, None, NULL);
+   }
+#endif
+   (void) bind;
+   return 0;
+}
+
+
+static void *
+decode_main(void *arg)
+{
+   (void) arg;
+
+   /* the decoders already keep the CPUs busy, so the image helpers
+    * must not start threads of their own from each of them */
+   util_parallel_set_thread_limit(1);
+
+   LOCK();
+   while (!quit) {
+      struct job *job = decode_queue.head;
+      unsigned i;
+      int ok;
+
+      if (!job) {
+         pthread_cond_wait(&decode_cond, &lock);
+         continue;
+      }
+      i = job->next_image++;
+      if (job->next_image == job->num_images)
+         pop(&decode_queue);
+      UNLOCK();
+
+      ok = decode(job, i);
+
+      LOCK();
+      if (!ok)
+         job->failed = 1;
+      if (++job->decoded == job->num_images) {
+         push(&upload_queue, job);
+         pthread_cond_signal(&upload_cond);
+      }
+   }
+   UNLOCK();
+
+   return NULL;
+}
+
+
+static void *
+upload_main(void *arg)
+{
+   int ok;
+
+   (void) arg;
+
+   /* texstream_init() waits for this, so the window system connection
+    * isn't used by two threads at once
+    */
+   ok = bind_shared_context(1);
+   LOCK();
+   uploader_state = ok ? 1 : -1;
+   pthread_cond_signal(&started_cond);
+
+   while (ok && !quit) {
+      struct job *job = pop(&upload_queue);
+
+      if (!job) {
+         pthread_cond_wait(&upload_cond, &lock);
+         continue;
+      }
+      UNLOCK();
+
+      if (!job->failed) {
+         upload(job);
+         if (have_sync)
+            job->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+         if (job->fence)
+            glFlush();
+         else
+            glFinish();
+      }
+
+      LOCK();
+      push(&done_queue, job);
+   }
+   UNLOCK();
+
+   if (ok) {
+      if (pbo)
+         glDeleteBuffers(1, &pbo);
+      pbo = 0;
+      bind_shared_context(0);
+   }
+   return NULL;
+}
+#endif
+
+
+int
+texstream_init(unsigned threads)
+{
+   if (initialized)
+      return shared_context;
+   initialized = 1;
+
+   glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+   max_cube_size = max_size;
+   if (GLAD_GL_VERSION_1_3 || GLAD_GL_ARB_texture_cube_map)
+      glGetIntegerv(GL_MAX_CUBE_MAP_TEXTURE_SIZE, &max_cube_size);
+   npot = GLAD_GL_VERSION_2_0 || GLAD_GL_ARB_texture_non_power_of_two;
+   have_pbo = GLAD_GL_VERSION_2_1 ||
+              (GLAD_GL_VERSION_1_5 && GLAD_GL_ARB_pixel_buffer_object);
+   have_sync = GLAD_GL_VERSION_3_2 || GLAD_GL_ARB_sync;
+
+#ifdef HAVE_PTHREAD
+   {
+      const char *env = getenv("TEXSTREAM_SHARED_CONTEXT");
+      unsigned i;
+
+      if (!threads) {
+         long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+         threads = cpus > 0 ? (unsigned) cpus : 1;
+      }
+      if (threads > MAX_THREADS)
+         threads = MAX_THREADS;
+      for (i = 0; i < threads; i++) {
+         if (!pthread_create(&decoders[num_decoders], NULL, decode_main, NULL))
+            num_decoders++;
+      }
+
+      if ((!env || strcmp(env, "0")) && create_shared_context()) {
+         uploader_state = 0;
+         if (!pthread_create(&uploader, NULL, upload_main, NULL)) {
+            LOCK();
+            while (uploader_state == 0)
+               pthread_cond_wait(&started_cond, &lock);
+            shared_context = uploader_state > 0;
+            UNLOCK();
+            if (!shared_context)
+               pthread_join(uploader, NULL);
+         }
+         if (!shared_context)
+            destroy_shared_context();
+      }
+   }
+#else
+   (void) threads;
+#endif
+
+   return shared_context;
+}
+
+
+static void
+free_queue(struct queue *q)
+{
+   struct job *job;
+
+   while ((job = pop(q))) {
+      if (job->fence)
+         glDeleteSync(job->fence);
+      if (job->texture)
+         glDeleteTextures(1, &job->texture);
+      free_job(job);
+   }
+}
+
+
+void
+texstream_shutdown(void)
+{
+   if (!initialized)
+      return;
+
+#ifdef HAVE_PTHREAD
+   {
+      unsigned i;
+
+      LOCK();
+      quit = 1;
+      pthread_cond_broadcast(&decode_cond);
+      pthread_cond_broadcast(&upload_cond);
+      UNLOCK();
+
+      for (i = 0; i < num_decoders; i++)
+         pthread_join(decoders[i], NULL);
+      num_decoders = 0;
+      if (shared_context) {
+         pthread_join(uploader, NULL);
+         destroy_shared_context();
+      }
+   }
+#endif
+
+   free_queue(&decode_queue);
+   free_queue(&upload_queue);
+   free_queue(&done_queue);
+
+   if (pbo)
+      glDeleteBuffers(1, &pbo);
+   pbo = 0;
+   pending = 0;
+   quit = 0;
+   shared_context = 0;
+   initialized = 0;
+}
+
+
+static void
+load(GLenum target, const char *const *filenames, unsigned count,
+     GLint internalFormat, unsigned flags, void *data)
+{
+   struct job *job;
+   unsigned i;
+
+   if (!initialized)
+      texstream_init(0);
+
+   job = (struct job *) calloc(1, sizeof(*job));
+   if (!job) {
+      fprintf(stderr, "Out of memory!\n");
+      return;
+   }
+   job->target = target;
+   job->internal_format = internalFormat;
+   job->flags = flags;
+   job->data = data;
+   job->num_images = count;
+   for (i = 0; i < count; i++)
+      job->filenames[i] = strdup(filenames[i]);
+
+   LOCK();
+   pending++;
+#ifdef HAVE_PTHREAD
+   if (num_decoders) {
+      push(&decode_queue, job);
+      pthread_cond_broadcast(&decode_cond);
+      UNLOCK();
+      return;
+   }
+#endif
+   UNLOCK();
+
+   /* no threads: decode now, upload from texstream_poll() */
+   for (i = 0; i < count; i++) {
+      if (!decode(job, i))
+         job->failed = 1;
+   }
+   job->decoded = count;
+   LOCK();
+   push(&upload_queue, job);
+#ifdef HAVE_PTHREAD
+   pthread_cond_signal(&upload_cond);
+#endif
+   UNLOCK();
+}
+
+
+void
+texstream_load_2d(const char *filename, GLint internalFormat,
+                  unsigned flags, void *data)
+{
+   load(GL_TEXTURE_2D, &filename, 1, internalFormat, flags, data);
+}
+
+
+void
+texstream_load_cube(const char *const filenames[6], GLint internalFormat,
+                    unsigned flags, void *data)
+{
+   load(GL_TEXTURE_CUBE_MAP, filenames, 6, internalFormat, flags, data);
+}
+
+
+int
+texstream_poll(struct texstream_result *result)
+{
+   struct job *job;
+
+   LOCK();
+   if (!shared_context && (job = pop(&upload_queue))) {
+      UNLOCK();
+      if (!job->failed)
+         upload(job);
+      LOCK();
+      push(&done_queue, job);
+   }
+
+   job = done_queue.head;
+   if (job && job->fence) {
+      if (glClientWaitSync(job->fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+         job = NULL;
+      } else {
+         glDeleteSync(job->fence);
+         job->fence = NULL;
+      }
+   }
+   if (job) {
+      pop(&done_queue);
+      pending--;
+   }
+   UNLOCK();
+
+   if (!job)
+      return 0;
+
+   result->data = job->data;
+   result->texture = job->failed ? 0 : job->texture;
+   result->target = job->target;
+   result->width = job->failed ? 0 : job->images[0].width;
+   result->height = job->failed ? 0 : job->images[0].height;
+   free_job(job);
+   return 1;
+}
+
+
+unsigned
+texstream_pending(void)
+{
+   unsigned n;
+
+   LOCK();
+   n = pending;
+   UNLOCK();
+   return n;
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TEXSTREAM_H
+#define TEXSTREAM_H
+
+#include "glad/gl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Flags for texstream_load_2d() and texstream_load_cube().
+ */
+enum texstream_flags
+{
+   TEXSTREAM_MIPMAP = 1 << 0,   /**< build and upload all mipmap levels */
+   TEXSTREAM_FLIP_X = 1 << 1,   /**< mirror images left to right */
+   TEXSTREAM_FLIP_Y = 1 << 2,   /**< mirror images top to bottom */
+};
+
+/**
+ * A finished load, as returned by texstream_poll().
+ */
+struct texstream_result
+{
+   void *data;                  /**< as passed to texstream_load_*() */
+   GLuint texture;              /**< 0 if an image couldn't be loaded */
+   GLenum target;               /**< GL_TEXTURE_2D or GL_TEXTURE_CUBE_MAP */
+   GLsizei width, height;
+};
+
+/**
+ * Starts the decoding threads and, where the window system allows it,
+ * an upload thread with a GL context sharing objects with the current
+ * one.  Must be called with the application's context current; the
+ * first texstream_load_*() call does it with the defaults.
+ *
+ * threads is the number of decoding threads, 0 for one per CPU.
+ * Setting the TEXSTREAM_SHARED_CONTEXT environment variable to 0 makes
+ * texstream_poll() do the uploads instead of the upload thread.
+ *
+ * @return 1 if uploads happen on a shared context, 0 otherwise
+ */
+int
+texstream_init(unsigned threads);
+
+/**
+ * Stops the threads and destroys the shared context.  Requests that
+ * haven't completed are dropped.  Must be called with the application's
+ * context current.
+ */
+void
+texstream_shutdown(void);
+
+/**
+ * Queues loading the .rgb file filename into a new GL_TEXTURE_2D
+ * texture.  The texture comes back from texstream_poll() with data.
+ */
+void
+texstream_load_2d(const char *filename, GLint internalFormat,
+                  unsigned flags, void *data);
+
+/**
+ * Queues loading six .rgb files, in the +X, -X, +Y, -Y, +Z, -Z face
+ * order, into a new GL_TEXTURE_CUBE_MAP texture.
+ */
+void
+texstream_load_cube(const char *const filenames[6], GLint internalFormat,
+                    unsigned flags, void *data);
+
+/**
+ * Returns one completed load, if any, in result.  Call it once in a
+ * while (e.g. each frame) from the thread of the application's context.
+ * Textures are ready to use by that context when they come back.
+ *
+ * @return 1 if result was filled in, 0 if nothing has completed
+ */
+int
+texstream_poll(struct texstream_result *result);
+
+/**
+ * @return the number of loads not yet returned by texstream_poll()
+ */
+unsigned
+texstream_pending(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TEXSTREAM_H */
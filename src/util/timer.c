@@ -0,0 +1,40 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "timer.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+uint64_t
+timer_get_ns(void)
+{
+#ifdef _WIN32
+   static LARGE_INTEGER freq;
+   LARGE_INTEGER count;
+
+   if (!freq.QuadPart)
+      QueryPerformanceFrequency(&freq);
+   QueryPerformanceCounter(&count);
+
+   /* split to avoid overflowing 64 bits for long uptimes */
+   return (uint64_t) (count.QuadPart / freq.QuadPart) * 1000000000ull +
+          (uint64_t) (count.QuadPart % freq.QuadPart) * 1000000000ull /
+          freq.QuadPart;
+#else
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+double
+timer_get_seconds(void)
+{
+   return timer_get_ns() * 1e-9;
+}
@@ -0,0 +1,38 @@
+/*
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Reads a monotonic clock.
+ *
+ * The origin is arbitrary, so only differences between two readings are
+ * meaningful.  Unlike glutGet(GLUT_ELAPSED_TIME) this does not need a
+ * window system connection and has sub-microsecond resolution.
+ *
+ * @return the current time in nanoseconds
+ */
+uint64_t
+timer_get_ns(void);
+
+/**
+ * Reads the same clock as timer_get_ns().
+ *
+ * @return the current time in seconds
+ */
+double
+timer_get_seconds(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TIMER_H */
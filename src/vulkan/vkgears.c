@@ -30,12 +30,17 @@
 #include <string.h>
 #include <math.h>
 
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
 #include "wsi/wsi.h"
 
+#include "stats.h"
+#include "timer.h"
+
 #ifndef VK_API_VERSION_MAJOR
 /* retain compatibility with old vulkan headers */
 #define VK_API_VERSION_MAJOR VK_VERSION_MAJOR
@@ -61,6 +66,7 @@ static VkQueue queue;
 /* swap chain */
 static int width, height, new_width, new_height;
 static bool fullscreen;
+static bool headless;
 static VkPresentModeKHR desidered_present_mode;
 static VkSampleCountFlagBits sample_count;
 static uint32_t image_count;
@@ -76,21 +82,52 @@ static VkSwapchainKHR swap_chain;
 static VkImage color_msaa, depth_image;
 static VkImageView color_msaa_view, depth_view;
 static VkDeviceMemory color_msaa_memory, depth_memory;
-static VkSemaphore back_buffer_semaphore, present_semaphore;
 
 struct {
    VkImage image;
    VkImageView view;
    VkFramebuffer framebuffer;
-   VkFence fence;
+   /* signaled when rendering to the image is done, waited on by present;
+    * per image since it can only be reused once the image is reacquired */
+   VkSemaphore present_semaphore;
+   VkDeviceMemory memory;          /* headless images only */
+} swap_chain_data[8];
+
+/* frames in flight: the CPU records frame n + 1 while the GPU renders n */
+#define MAX_FRAMES_IN_FLIGHT 8
+static uint32_t frames_in_flight = 2;
+
+struct {
+   VkSemaphore acquire_semaphore;
+   VkFence fence;                  /* signaled when the frame is rendered */
    VkCommandBuffer cmd_buffer;
-} swap_chain_data[5];
+   struct ubo *ubo;                /* this frame's slice of ubo_buffer */
+} frame_data[MAX_FRAMES_IN_FLIGHT];
 
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
+/* headless GPU timing: a begin and end timestamp per frame in flight */
+static VkQueryPool query_pool;
+static uint64_t timestamp_mask;
+static float timestamp_period;
+
+/* pipeline cache, kept on disk across runs */
+static bool use_pipeline_cache = true;
+static VkPipelineCache pipeline_cache;
+static size_t pipeline_cache_loaded;    /* bytes of initial data, 0 if cold */
+static double pipeline_ms;              /* vkCreateGraphicsPipelines time */
+
+/* startup trace */
+static struct {
+   const char *name;
+   double ms;
+} startup_steps[8];
+static unsigned startup_count;
+
 /* gear data */
 static VkDescriptorSet descriptor_set;
 static VkDeviceMemory ubo_mem;
+static VkDeviceSize ubo_stride;
 static VkDeviceMemory vertex_mem;
 static VkBuffer ubo_buffer;
 static VkBuffer vertex_buffer;
@@ -123,6 +160,33 @@ error(const char *format, ...)
    va_end(args);
 }
 
+/* Records a startup step that began at start; returns the time now */
+static uint64_t
+startup_step(const char *name, uint64_t start)
+{
+   uint64_t now = timer_get_ns();
+
+   assert(startup_count < ARRAY_SIZE(startup_steps));
+   startup_steps[startup_count].name = name;
+   startup_steps[startup_count].ms = (now - start) * 1e-6;
+   startup_count++;
+   return now;
+}
+
+static void
+print_startup(uint64_t start)
+{
+   printf("startup:");
+   for (unsigned i = 0; i < startup_count; i++)
+      printf(" %s %.2f ms,", startup_steps[i].name, startup_steps[i].ms);
+   printf(" total %.2f ms\n", (timer_get_ns() - start) * 1e-6);
+   printf("pipeline: %.2f ms, cache %s", pipeline_ms,
+          !use_pipeline_cache ? "disabled" : pipeline_cache_loaded ? "warm" : "cold");
+   if (pipeline_cache_loaded)
+      printf(" (%zu bytes)", pipeline_cache_loaded);
+   printf("\n");
+}
+
 /* Returns the time passed between tv0 and tv1 in seconds */
 static float
 delta_time(struct timeval *tv0, struct timeval *tv1)
@@ -170,6 +234,8 @@ init_vk(const char *extension)
    VkQueueFamilyProperties props[count];
    vkGetPhysicalDeviceQueueFamilyProperties(physical_device, &count, props);
    assert(props[0].queueFlags & VK_QUEUE_GRAPHICS_BIT);
+   timestamp_mask = props[0].timestampValidBits >= 64 ? UINT64_MAX :
+                    (UINT64_C(1) << props[0].timestampValidBits) - 1;
 
    vkCreateDevice(physical_device,
       &(VkDeviceCreateInfo) {
@@ -182,7 +248,7 @@ init_vk(const char *extension)
             .flags = 0,
             .pQueuePriorities = (float []) { 1.0f },
          },
-         .enabledExtensionCount = 1,
+         .enabledExtensionCount = extension ? 1 : 0,
          .ppEnabledExtensionNames = (const char * const []) {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME,
          },
@@ -207,13 +273,6 @@ init_vk(const char *extension)
       },
       NULL,
       &cmd_pool);
-
-   vkCreateSemaphore(device,
-      &(VkSemaphoreCreateInfo) {
-         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-      },
-      NULL,
-      &present_semaphore);
 }
 
 static int
@@ -345,7 +404,8 @@ create_render_pass()
                .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
                .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
                .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-               .finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+               .finalLayout = headless ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL :
+                                         VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
             },
             {
                .format = depth_format,
@@ -427,6 +487,16 @@ create_render_pass()
       &render_pass);
 }
 
+static void
+choose_depth_format()
+{
+   // either VK_FORMAT_D32_SFLOAT or VK_FORMAT_X8_D24_UNORM_PACK32 needs to be supported; find out which one
+   VkFormatProperties props;
+   vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_D32_SFLOAT, &props);
+   depth_format = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) ?
+      VK_FORMAT_D32_SFLOAT : VK_FORMAT_X8_D24_UNORM_PACK32;
+}
+
 static void
 configure_swapchain()
 {
@@ -485,15 +555,54 @@ configure_swapchain()
       }
    }
 
-   // either VK_FORMAT_D32_SFLOAT or VK_FORMAT_X8_D24_UNORM_PACK32 needs to be supported; find out which one
+   choose_depth_format();
+}
+
+static void
+configure_offscreen()
+{
    VkFormatProperties props;
-   vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_D32_SFLOAT, &props);
-   depth_format = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) ?
-      VK_FORMAT_D32_SFLOAT : VK_FORMAT_X8_D24_UNORM_PACK32;
+   vkGetPhysicalDeviceFormatProperties(physical_device, VK_FORMAT_B8G8R8A8_SRGB, &props);
+   image_format = (props.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT) ?
+      VK_FORMAT_B8G8R8A8_SRGB : VK_FORMAT_R8G8B8A8_SRGB;
+
+   choose_depth_format();
 }
 
 static void
-create_swapchain()
+create_offscreen_images(VkImage *images)
+{
+   /* one per frame in flight, so a frame's fence covers its image too */
+   image_count = frames_in_flight;
+
+   for (uint32_t i = 0; i < image_count; i++) {
+      int res = create_image(image_format,
+         (VkExtent3D) {
+            .width = width,
+            .height = height,
+            .depth = 1,
+         },
+         VK_SAMPLE_COUNT_1_BIT,
+         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+         &images[i]);
+      if (res)
+         error("Failed to create offscreen image");
+
+      VkMemoryRequirements reqs;
+      vkGetImageMemoryRequirements(device, images[i], &reqs);
+      int memory_type = find_memory_type(&reqs, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+      if (memory_type < 0)
+         memory_type = find_memory_type(&reqs, 0);
+      if (memory_type < 0)
+         error("find_memory_type failed");
+      res = image_allocate(images[i], reqs, memory_type, &swap_chain_data[i].memory);
+      if (res)
+         error("Failed to allocate memory for the offscreen image");
+   }
+}
+
+static void
+create_swapchain_images(VkImage *images)
 {
    vkCreateSwapchainKHR(device,
       &(VkSwapchainCreateInfoKHR) {
@@ -517,10 +626,22 @@ create_swapchain()
    vkGetSwapchainImagesKHR(device, swap_chain,
                            &image_count, NULL);
    assert(image_count > 0);
-   VkImage swap_chain_images[image_count];
+   if (image_count > ARRAY_SIZE(swap_chain_data))
+      error("Too many swapchain images (is: %d, max: %d)",
+            image_count, ARRAY_SIZE(swap_chain_data));
    vkGetSwapchainImagesKHR(device, swap_chain,
-                           &image_count, swap_chain_images);
+                           &image_count, images);
+}
+
+static void
+create_swapchain()
+{
+   VkImage swap_chain_images[ARRAY_SIZE(swap_chain_data)];
 
+   if (headless)
+      create_offscreen_images(swap_chain_images);
+   else
+      create_swapchain_images(swap_chain_images);
 
    int res;
    if (sample_count != VK_SAMPLE_COUNT_1_BIT) {
@@ -632,40 +753,26 @@ create_swapchain()
          NULL,
          &swap_chain_data[i].framebuffer);
 
-      vkCreateFence(device,
-         &(VkFenceCreateInfo) {
-            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-            .flags = 0
+      vkCreateSemaphore(device,
+         &(VkSemaphoreCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
          },
          NULL,
-         &swap_chain_data[i].fence);
-
-      vkAllocateCommandBuffers(device,
-         &(VkCommandBufferAllocateInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-            .commandPool = cmd_pool,
-            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-            .commandBufferCount = 1,
-         },
-         &swap_chain_data[i].cmd_buffer);
+         &swap_chain_data[i].present_semaphore);
    }
-
-   vkCreateSemaphore(device,
-      &(VkSemaphoreCreateInfo) {
-         .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-      },
-      NULL,
-      &back_buffer_semaphore);
 }
 
 static void
 free_swapchain_data()
 {
    for (uint32_t i = 0; i < image_count; i++) {
-      vkFreeCommandBuffers(device, cmd_pool, 1, &swap_chain_data[i].cmd_buffer);
-      vkDestroyFence(device, swap_chain_data[i].fence, NULL);
+      vkDestroySemaphore(device, swap_chain_data[i].present_semaphore, NULL);
       vkDestroyFramebuffer(device, swap_chain_data[i].framebuffer, NULL);
       vkDestroyImageView(device, swap_chain_data[i].view, NULL);
+      if (headless) {
+         vkDestroyImage(device, swap_chain_data[i].image, NULL);
+         vkFreeMemory(device, swap_chain_data[i].memory, NULL);
+      }
    }
 
    vkDestroyImageView(device, depth_view, NULL);
@@ -677,13 +784,13 @@ free_swapchain_data()
       vkDestroyImage(device, color_msaa, NULL);
       vkFreeMemory(device, color_msaa_memory, NULL);
    }
-
-   vkDestroySemaphore(device, back_buffer_semaphore, NULL);
 }
 
 static void
 recreate_swapchain()
 {
+   /* the old images may still be in use by frames in flight */
+   vkDeviceWaitIdle(device);
    free_swapchain_data();
    vkDestroySwapchainKHR(device, swap_chain, NULL);
    width = new_width, height = new_height;
@@ -937,6 +1044,117 @@ create_gear(float verts[],
 }
 
 
+/*
+ * The cache file is named after the driver's pipelineCacheUUID, so a
+ * driver update starts a new one, in $XDG_CACHE_HOME/mesa-demos or
+ * ~/.cache/mesa-demos.
+ */
+static bool
+pipeline_cache_path(char *path, size_t size,
+                    const VkPhysicalDeviceProperties *properties)
+{
+   const char *base;
+   char dir[4096];
+
+   if ((base = getenv("XDG_CACHE_HOME")) && *base)
+      snprintf(dir, sizeof(dir), "%s", base);
+   else if ((base = getenv("HOME")) && *base)
+      snprintf(dir, sizeof(dir), "%s/.cache", base);
+   else
+      return false;
+   mkdir(dir, 0755);
+   strncat(dir, "/mesa-demos", sizeof(dir) - strlen(dir) - 1);
+   mkdir(dir, 0755);
+
+   int n = snprintf(path, size, "%s/vkgears-", dir);
+   for (int i = 0; i < VK_UUID_SIZE && (size_t) n + 3 < size; i++)
+      n += snprintf(path + n, size - n, "%02x", properties->pipelineCacheUUID[i]);
+   snprintf(path + n, size - n, ".bin");
+   return true;
+}
+
+static void
+create_pipeline_cache()
+{
+   VkPhysicalDeviceProperties properties;
+   void *data = NULL;
+   size_t size = 0;
+   char path[4200];
+
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+   FILE *f = use_pipeline_cache &&
+             pipeline_cache_path(path, sizeof(path), &properties) ?
+             fopen(path, "rb") : NULL;
+   if (f) {
+      if (fseek(f, 0, SEEK_END) == 0 && (long) (size = ftell(f)) > 0 &&
+          fseek(f, 0, SEEK_SET) == 0 && (data = malloc(size)) &&
+          fread(data, 1, size, f) == size) {
+         /* the header must be for this device and driver; the driver
+          * checks it too, but not every driver is careful about it */
+         VkPipelineCacheHeaderVersionOne header;
+         if (size < sizeof(header)) {
+            size = 0;
+         } else {
+            memcpy(&header, data, sizeof(header));
+            if (header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+                header.vendorID != properties.vendorID ||
+                header.deviceID != properties.deviceID ||
+                memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID,
+                       VK_UUID_SIZE))
+               size = 0;
+         }
+      } else {
+         size = 0;
+      }
+      fclose(f);
+   }
+
+   VkResult res = vkCreatePipelineCache(device,
+      &(VkPipelineCacheCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+         .initialDataSize = size,
+         .pInitialData = size ? data : NULL,
+      },
+      NULL,
+      &pipeline_cache);
+   free(data);
+   if (res != VK_SUCCESS)
+      error("Failed to create pipeline cache");
+
+   pipeline_cache_loaded = size;
+}
+
+static void
+save_pipeline_cache()
+{
+   VkPhysicalDeviceProperties properties;
+   char path[4200], tmp[4300];
+   size_t size;
+   void *data;
+
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   if (!use_pipeline_cache ||
+       !pipeline_cache_path(path, sizeof(path), &properties) ||
+       vkGetPipelineCacheData(device, pipeline_cache, &size, NULL) != VK_SUCCESS ||
+       size == pipeline_cache_loaded || !(data = malloc(size)))
+      return;
+
+   if (vkGetPipelineCacheData(device, pipeline_cache, &size, data) == VK_SUCCESS) {
+      /* written under another name first, so that readers never see a
+       * partial file */
+      snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid());
+      FILE *f = fopen(tmp, "wb");
+      if (f) {
+         bool ok = fwrite(data, 1, size, f) == size;
+         ok = fclose(f) == 0 && ok;
+         if (!ok || rename(tmp, path) != 0)
+            remove(tmp);
+      }
+   }
+   free(data);
+}
+
 static void
 init_gears()
 {
@@ -949,7 +1167,7 @@ init_gears()
          .bindingCount = 1,
          .pBindings = (VkDescriptorSetLayoutBinding[]) {
             {
-               .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+               .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
                .descriptorCount = 1,
                .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
                .pImmutableSamplers = NULL
@@ -996,8 +1214,11 @@ init_gears()
       NULL,
       &fs_module);
 
+   create_pipeline_cache();
+   uint64_t pipeline_start = timer_get_ns();
+
    vkCreateGraphicsPipelines(device,
-      (VkPipelineCache) { VK_NULL_HANDLE },
+      pipeline_cache,
       1,
       &(VkGraphicsPipelineCreateInfo) {
          .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
@@ -1109,6 +1330,10 @@ init_gears()
       NULL,
       &pipeline);
 
+   pipeline_ms = (timer_get_ns() - pipeline_start) * 1e-6;
+   save_pipeline_cache();
+   vkDestroyPipelineCache(device, pipeline_cache, NULL);
+
 #define MAX_VERTS 10000
    float verts[MAX_VERTS * GEAR_VERTEX_STRIDE];
 
@@ -1126,11 +1351,18 @@ init_gears()
    unsigned mem_size = sizeof(float) * GEAR_VERTEX_STRIDE * num_verts;
    vertex_offset = 0;
    normals_offset = sizeof(float) * 3;
-   ubo_buffer = create_buffer(sizeof(struct ubo), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
-                                                  VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+
+   /* one UBO slice per frame in flight, selected with a dynamic offset */
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+   VkDeviceSize align = properties.limits.minUniformBufferOffsetAlignment;
+   ubo_stride = (sizeof(struct ubo) + align - 1) / align * align;
+
+   ubo_buffer = create_buffer(ubo_stride * frames_in_flight,
+                              VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
    vertex_buffer = create_buffer(mem_size, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
 
-   ubo_mem = allocate_buffer_mem(ubo_buffer, sizeof(struct ubo));
+   ubo_mem = allocate_buffer_mem(ubo_buffer, ubo_stride * frames_in_flight);
    vertex_mem = allocate_buffer_mem(vertex_buffer, mem_size);
 
    void *map;
@@ -1143,6 +1375,13 @@ init_gears()
    vkBindBufferMemory(device, ubo_buffer, ubo_mem, 0);
    vkBindBufferMemory(device, vertex_buffer, vertex_mem, 0);
 
+   /* the UBO stays mapped; its memory is host coherent */
+   r = vkMapMemory(device, ubo_mem, 0, ubo_stride * frames_in_flight, 0, &map);
+   if (r != VK_SUCCESS)
+      error("vkMapMemory failed");
+   for (uint32_t i = 0; i < frames_in_flight; i++)
+      frame_data[i].ubo = (struct ubo *) ((char *) map + i * ubo_stride);
+
    VkDescriptorPool desc_pool;
    const VkDescriptorPoolCreateInfo create_info = {
       .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
@@ -1152,7 +1391,7 @@ init_gears()
       .poolSizeCount = 1,
       .pPoolSizes = (VkDescriptorPoolSize[]) {
          {
-            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             .descriptorCount = 1
          },
       }
@@ -1176,7 +1415,7 @@ init_gears()
             .dstBinding = 0,
             .dstArrayElement = 0,
             .descriptorCount = 1,
-            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
             .pBufferInfo = &(VkDescriptorBufferInfo) {
                .buffer = ubo_buffer,
                .offset = 0,
@@ -1187,6 +1426,37 @@ init_gears()
       0, NULL);
 }
 
+static void
+create_frames()
+{
+   for (uint32_t i = 0; i < frames_in_flight; i++) {
+      vkCreateSemaphore(device,
+         &(VkSemaphoreCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+         },
+         NULL,
+         &frame_data[i].acquire_semaphore);
+
+      /* signaled, so that the first wait for each frame returns at once */
+      vkCreateFence(device,
+         &(VkFenceCreateInfo) {
+            .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+            .flags = VK_FENCE_CREATE_SIGNALED_BIT
+         },
+         NULL,
+         &frame_data[i].fence);
+
+      vkAllocateCommandBuffers(device,
+         &(VkCommandBufferAllocateInfo) {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = cmd_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            .commandBufferCount = 1,
+         },
+         &frame_data[i].cmd_buffer);
+   }
+}
+
 static void
 draw_gear(VkCommandBuffer cmdbuf, const float view[16],
           float position[2], float angle,
@@ -1220,7 +1490,7 @@ float angle = 0.0f;
 #define G2L(x) ((x) < 0.04045 ? (x) / 12.92 : powf(((x) + 0.055) / 1.055, 2.4))
 
 static void
-draw_gears(VkCommandBuffer cmdbuf, const float view[16])
+draw_gears(VkCommandBuffer cmdbuf, uint32_t frame, const float view[16])
 {
    vkCmdBindVertexBuffers(cmdbuf, 0, 2,
       (VkBuffer[]) {
@@ -1238,7 +1508,8 @@ draw_gears(VkCommandBuffer cmdbuf, const float view[16])
       VK_PIPELINE_BIND_POINT_GRAPHICS,
       pipeline_layout,
       0, 1,
-      &descriptor_set, 0, NULL);
+      &descriptor_set,
+      1, (uint32_t[]) { frame * ubo_stride });
 
    vkCmdSetViewport(cmdbuf, 0, 1,
       &(VkViewport) {
@@ -1280,6 +1551,180 @@ draw_gears(VkCommandBuffer cmdbuf, const float view[16])
    }
 }
 
+/* Records the commands to draw frame (in flight) into image index */
+static void
+record_frame(uint32_t frame, uint32_t index)
+{
+   VkCommandBuffer cmd_buffer = frame_data[frame].cmd_buffer;
+   int attachment_count = sample_count != VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
+
+   vkResetCommandBuffer(cmd_buffer, 0);
+   vkBeginCommandBuffer(cmd_buffer,
+      &(VkCommandBufferBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+      });
+
+   if (query_pool) {
+      vkCmdResetQueryPool(cmd_buffer, query_pool, frame * 2, 2);
+      vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          query_pool, frame * 2);
+   }
+
+   /* projection matrix, written straight into the frame's UBO slice;
+    * the GPU is done with it and the submit makes the write visible */
+   float h = (float) height / width;
+   mat4_identity(frame_data[frame].ubo->projection);
+   mat4_frustum_vk(frame_data[frame].ubo->projection,
+                   -1.0f, 1.0f, -h, +h, 5.0f, 60.0f);
+
+   /* Translate and rotate the view */
+   float view[16];
+   mat4_identity(view);
+   mat4_translate(view, 0, 0, -40);
+   mat4_rotate(view, 2.0f * M_PIf * view_rot[0] / 360.0f, 1, 0, 0);
+   mat4_rotate(view, 2.0f * M_PIf * view_rot[1] / 360.0f, 0, 1, 0);
+   mat4_rotate(view, 2.0f * M_PIf * view_rot[2] / 360.0f, 0, 0, 1);
+
+   vkCmdBeginRenderPass(cmd_buffer,
+      &(VkRenderPassBeginInfo) {
+         .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+         .renderPass = render_pass,
+         .framebuffer = swap_chain_data[index].framebuffer,
+         .renderArea = { { 0, 0 }, { width, height } },
+         .clearValueCount = attachment_count,
+         .pClearValues = (VkClearValue []) {
+            { .color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } } },
+            { .depthStencil.depth = 1.0f },
+            { .color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } } },
+         }
+      },
+      VK_SUBPASS_CONTENTS_INLINE);
+
+   draw_gears(cmd_buffer, frame, view);
+
+   vkCmdEndRenderPass(cmd_buffer);
+
+   if (query_pool)
+      vkCmdWriteTimestamp(cmd_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                          query_pool, frame * 2 + 1);
+
+   vkEndCommandBuffer(cmd_buffer);
+}
+
+static void
+create_query_pool()
+{
+   VkPhysicalDeviceProperties properties;
+   vkGetPhysicalDeviceProperties(physical_device, &properties);
+
+   if (!timestamp_mask || !properties.limits.timestampComputeAndGraphics) {
+      printf("timestamps not supported, GPU times will not be reported\n");
+      return;
+   }
+   timestamp_period = properties.limits.timestampPeriod;
+
+   vkCreateQueryPool(device,
+      &(VkQueryPoolCreateInfo) {
+         .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+         .queryType = VK_QUERY_TYPE_TIMESTAMP,
+         .queryCount = frames_in_flight * 2,
+      },
+      NULL,
+      &query_pool);
+}
+
+/* Reads the GPU time of the frame last submitted in slot frame, in ms */
+static bool
+read_gpu_time(uint32_t frame, double *ms)
+{
+   uint64_t ts[2];
+
+   if (vkGetQueryPoolResults(device, query_pool, frame * 2, 2, sizeof(ts), ts,
+                             sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+      return false;
+
+   *ms = ((ts[1] - ts[0]) & timestamp_mask) * timestamp_period * 1e-6;
+   return true;
+}
+
+static void
+print_times(const char *name, double *times, unsigned count)
+{
+   struct stats s;
+
+   stats_compute(times, count, &s);
+   printf("%-5s median %.3f ms, min %.3f, 95%% %.3f, 99%% %.3f, max %.3f\n",
+          name, s.median, s.min, stats_percentile(times, count, 95.0),
+          stats_percentile(times, count, 99.0), s.max);
+}
+
+/*
+ * Renders frame_count frames offscreen as fast as possible, then reports
+ * the frame rate, the CPU time to record and submit each frame, and the
+ * GPU time of each frame from timestamps written around its commands.
+ */
+static void
+run_headless(unsigned frame_count)
+{
+   double *cpu_times = calloc(frame_count, sizeof(double));
+   double *gpu_times = calloc(frame_count, sizeof(double));
+   unsigned gpu_count = 0;
+
+   if (!cpu_times || !gpu_times)
+      error("Failed to allocate memory");
+
+   create_query_pool();
+
+   uint64_t start = timer_get_ns();
+   for (unsigned n = 0; n < frame_count; n++) {
+      uint32_t frame = n % frames_in_flight;
+
+      vkWaitForFences(device, 1, &frame_data[frame].fence, VK_TRUE, UINT64_MAX);
+      if (query_pool && n >= frames_in_flight &&
+          read_gpu_time(frame, &gpu_times[gpu_count]))
+         gpu_count++;
+      vkResetFences(device, 1, &frame_data[frame].fence);
+
+      uint64_t record_start = timer_get_ns();
+
+      /* a fixed step, so every run draws the same frames */
+      if (animate)
+         angle = fmodf(angle + 70.0f / 60.0f, 3600.0f);
+
+      record_frame(frame, frame);
+
+      vkQueueSubmit(queue, 1,
+         &(VkSubmitInfo) {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &frame_data[frame].cmd_buffer,
+         }, frame_data[frame].fence);
+
+      cpu_times[n] = (timer_get_ns() - record_start) * 1e-6;
+   }
+   vkDeviceWaitIdle(device);
+   double elapsed = (timer_get_ns() - start) * 1e-9;
+
+   /* the frames still in flight at the end */
+   if (query_pool) {
+      unsigned first = frame_count > frames_in_flight ? frame_count - frames_in_flight : 0;
+      for (unsigned n = first; n < frame_count; n++) {
+         if (read_gpu_time(n % frames_in_flight, &gpu_times[gpu_count]))
+            gpu_count++;
+      }
+   }
+
+   printf("%u frames of %dx%d in %.3f seconds = %6.3f FPS\n",
+          frame_count, width, height, elapsed, frame_count / elapsed);
+   print_times("cpu:", cpu_times, frame_count);
+   if (gpu_count)
+      print_times("gpu:", gpu_times, gpu_count);
+
+   free(cpu_times);
+   free(gpu_times);
+}
+
 static const char *
 get_devtype_str(VkPhysicalDeviceType devtype)
 {
@@ -1310,6 +1755,11 @@ usage(void)
    printf("  -fullscreen             run in fullscreen mode\n");
    printf("  -info                   display Vulkan device info\n");
    printf("  -size WxH               window size\n");
+   printf("  -frames-in-flight N     frames recorded ahead of the GPU (1-%d, default 2)\n",
+          MAX_FRAMES_IN_FLIGHT);
+   printf("  -headless               render offscreen, without a window system\n");
+   printf("  -frames N               number of frames to render headless (default 500)\n");
+   printf("  -no-pipeline-cache      don't load or save the on-disk pipeline cache\n");
 }
 
 static void
@@ -1434,33 +1884,6 @@ static struct wsi_callbacks wsi_callbacks = {
    .exit = wsi_exit,
 };
 
-static void
-buffer_barrier(VkCommandBuffer cmd_buffer,
-               VkPipelineStageFlags src_flags,
-               VkPipelineStageFlags dst_flags,
-               VkAccessFlags src_access,
-               VkAccessFlags dst_access,
-               VkBuffer buffer,
-               VkDeviceSize offset,
-               VkDeviceSize size)
-{
-   vkCmdPipelineBarrier(cmd_buffer,
-      src_flags, dst_flags,
-      0, 0, NULL,
-      1, &(VkBufferMemoryBarrier) {
-         .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-         .pNext = NULL,
-         .srcAccessMask = src_access,
-         .dstAccessMask = dst_access,
-         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-         .buffer = buffer,
-         .offset = offset,
-         .size = size,
-      },
-      0, NULL);
-}
-
 /**
  * Drop in replacement for atoi in arg parsing with error checking.
  * Will call exit in case of error.
@@ -1482,6 +1905,7 @@ int
 main(int argc, char *argv[])
 {
    bool printInfo = false;
+   unsigned frame_count = 500;
    sample_count = VK_SAMPLE_COUNT_1_BIT;
    desidered_present_mode = VK_PRESENT_MODE_FIFO_KHR;
    width = 300;
@@ -1516,6 +1940,25 @@ main(int argc, char *argv[])
       else if (strcmp(argv[i], "-fullscreen") == 0) {
          fullscreen = true;
       }
+      else if (strcmp(argv[i], "-headless") == 0) {
+         headless = true;
+      }
+      else if (strcmp(argv[i], "-frames") == 0 && i + 1 < argc) {
+         i++;
+         int frames = (int) strtol(argv[i], NULL, 10);
+         if (frames < 1)
+            error("Invalid number of frames: %s", argv[i]);
+         frame_count = frames;
+      }
+      else if (strcmp(argv[i], "-no-pipeline-cache") == 0) {
+         use_pipeline_cache = false;
+      }
+      else if (strcmp(argv[i], "-frames-in-flight") == 0 && i + 1 < argc) {
+         i++;
+         frames_in_flight = gearsAtoi(argv[i]);
+         if (frames_in_flight < 1 || frames_in_flight > MAX_FRAMES_IN_FLIGHT)
+            error("Invalid number of frames in flight: %s", argv[i]);
+      }
       else {
          usage();
          return -1;
@@ -1524,31 +1967,62 @@ main(int argc, char *argv[])
 
    new_width = width, new_height = height;
 
-   wsi = get_wsi_interface();
-   wsi.set_wsi_callbacks(wsi_callbacks);
+   uint64_t startup_start = timer_get_ns(), t = startup_start;
+   if (headless) {
+      init_vk(NULL);
+      t = startup_step("init_vk", t);
+   } else {
+      wsi = get_wsi_interface();
+      if (!wsi.init_display)
+         error("No window system support, use -headless");
+      wsi.set_wsi_callbacks(wsi_callbacks);
 
-   wsi.init_display();
-   wsi.init_window("vkgears", width, height, fullscreen);
+      wsi.init_display();
+      wsi.init_window("vkgears", width, height, fullscreen);
+      t = startup_step("init_window", t);
 
-   init_vk(wsi.required_extension_name);
+      init_vk(wsi.required_extension_name);
+      t = startup_step("init_vk", t);
+   }
 
    if (!check_sample_count_support(sample_count))
       error("Sample count not supported");
 
-   int attachment_count = sample_count != VK_SAMPLE_COUNT_1_BIT ? 3 : 2;
-
    if (printInfo)
       print_info();
+   t = timer_get_ns();
+
+   if (headless) {
+      configure_offscreen();
+      create_render_pass();
+      t = startup_step("create_render_pass", t);
+      create_swapchain();
+      t = startup_step("create_swapchain", t);
+      init_gears();
+      t = startup_step("init_gears", t);
+      create_frames();
+      print_startup(startup_start);
+      run_headless(frame_count);
+      return 0;
+   }
 
    if (!wsi.create_surface(physical_device, instance, &surface))
       error("Failed to create surface!");
 
    configure_swapchain();
+   t = startup_step("create_surface", t);
    create_render_pass();
+   t = startup_step("create_render_pass", t);
    create_swapchain();
+   t = startup_step("create_swapchain", t);
    init_gears();
+   t = startup_step("init_gears", t);
+   create_frames();
+   print_startup(startup_start);
 
    int frames = 0;
+   uint32_t frame_index = 0;
+   bool swapchain_stale = false;
    float dt, dt0;
    struct timeval tv0, tvPrev, tvNow;
    gettimeofday(&tv0, NULL);
@@ -1564,29 +2038,35 @@ main(int argc, char *argv[])
          break;
       }
 
-      static uint32_t index = -1;
-
-      /* back_buffer_semaphore must be unsignaled when we call vkAcquireNextImageKHR */
-      if (index != -1){
-         vkWaitForFences(device, 1, &swap_chain_data[index].fence, VK_TRUE, UINT64_MAX);
-         vkResetFences(device, 1, &swap_chain_data[index].fence);
+      if (width != new_width || height != new_height || swapchain_stale) {
+         recreate_swapchain();
+         swapchain_stale = false;
       }
 
+      /* wait until the GPU is done with the frame's last use */
+      uint32_t frame = frame_index;
+      vkWaitForFences(device, 1, &frame_data[frame].fence, VK_TRUE, UINT64_MAX);
+
+      uint32_t index;
       VkResult result =
          vkAcquireNextImageKHR(device, swap_chain, UINT64_MAX,
-                               back_buffer_semaphore, VK_NULL_HANDLE,
-                               &index);
-      if (result == VK_SUBOPTIMAL_KHR ||
-          width != new_width || height != new_height) {
-         recreate_swapchain();
-         index = -1; /* reset index to avoid waiting on the fence */
+                               frame_data[frame].acquire_semaphore,
+                               VK_NULL_HANDLE, &index);
+      if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+         /* nothing was acquired and the semaphore stays unsignaled */
+         swapchain_stale = true;
          continue;
       }
-
-      assert(result == VK_SUCCESS);
+      /* a suboptimal image was acquired, so it still has to be presented */
+      if (result == VK_SUBOPTIMAL_KHR)
+         swapchain_stale = true;
+      else
+         assert(result == VK_SUCCESS);
 
       assert(index < ARRAY_SIZE(swap_chain_data));
 
+      vkResetFences(device, 1, &frame_data[frame].fence);
+
       if (animate) {
          /* advance rotation for next frame */
          angle += 70.0f * dt;  /* 70 degrees per second */
@@ -1594,86 +2074,35 @@ main(int argc, char *argv[])
             angle = fmodf(angle, 3600.0f);
       }
 
-      vkBeginCommandBuffer(swap_chain_data[index].cmd_buffer,
-         &(VkCommandBufferBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-            .flags = 0
-         });
-
-      /* projection matrix */
-      float h = (float) height / width;
-      struct ubo ubo;
-      mat4_identity(ubo.projection);
-      mat4_frustum_vk(ubo.projection, -1.0f, 1.0f, -h, +h, 5.0f, 60.0f);
-
-      buffer_barrier(swap_chain_data[index].cmd_buffer,
-         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-         VK_PIPELINE_STAGE_TRANSFER_BIT,
-         0, 0,
-         ubo_buffer, 0, sizeof(ubo));
-
-      vkCmdUpdateBuffer(swap_chain_data[index].cmd_buffer, ubo_buffer, 0, sizeof(ubo), &ubo);
-
-      buffer_barrier(swap_chain_data[index].cmd_buffer,
-         VK_PIPELINE_STAGE_TRANSFER_BIT,
-         VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
-         VK_ACCESS_TRANSFER_WRITE_BIT,
-         VK_ACCESS_UNIFORM_READ_BIT,
-         ubo_buffer, 0, sizeof(ubo));
-
-      /* Translate and rotate the view */
-      float view[16];
-      mat4_identity(view);
-      mat4_translate(view, 0, 0, -40);
-      mat4_rotate(view, 2.0f * M_PIf * view_rot[0] / 360.0f, 1, 0, 0);
-      mat4_rotate(view, 2.0f * M_PIf * view_rot[1] / 360.0f, 0, 1, 0);
-      mat4_rotate(view, 2.0f * M_PIf * view_rot[2] / 360.0f, 0, 0, 1);
-
-      vkCmdBeginRenderPass(swap_chain_data[index].cmd_buffer,
-         &(VkRenderPassBeginInfo) {
-            .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
-            .renderPass = render_pass,
-            .framebuffer = swap_chain_data[index].framebuffer,
-            .renderArea = { { 0, 0 }, { width, height } },
-            .clearValueCount = attachment_count,
-            .pClearValues = (VkClearValue []) {
-               { .color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } } },
-               { .depthStencil.depth = 1.0f },
-               { .color = { .float32 = { 0.0f, 0.0f, 0.0f, 1.0f } } },
-            }
-         },
-         VK_SUBPASS_CONTENTS_INLINE);
-
-      draw_gears(swap_chain_data[index].cmd_buffer, view);
-
-      vkCmdEndRenderPass(swap_chain_data[index].cmd_buffer);
-      vkEndCommandBuffer(swap_chain_data[index].cmd_buffer);
+      record_frame(frame, index);
 
       vkQueueSubmit(queue, 1,
          &(VkSubmitInfo) {
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
             .waitSemaphoreCount = 1,
-            .pWaitSemaphores = &back_buffer_semaphore,
+            .pWaitSemaphores = &frame_data[frame].acquire_semaphore,
             .signalSemaphoreCount = 1,
-            .pSignalSemaphores = &present_semaphore,
+            .pSignalSemaphores = &swap_chain_data[index].present_semaphore,
             .pWaitDstStageMask = (VkPipelineStageFlags []) {
                VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
             },
             .commandBufferCount = 1,
-            .pCommandBuffers = &swap_chain_data[index].cmd_buffer,
-         }, swap_chain_data[index].fence);
+            .pCommandBuffers = &frame_data[frame].cmd_buffer,
+         }, frame_data[frame].fence);
 
-      vkQueuePresentKHR(queue,
+      result = vkQueuePresentKHR(queue,
          &(VkPresentInfoKHR) {
             .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
-            .pWaitSemaphores = &present_semaphore,
+            .pWaitSemaphores = &swap_chain_data[index].present_semaphore,
             .waitSemaphoreCount = 1,
             .swapchainCount = 1,
             .pSwapchains = (VkSwapchainKHR[]) { swap_chain, },
             .pImageIndices = (uint32_t[]) { index, },
-            .pResults = &result,
          });
+      if (result == VK_SUBOPTIMAL_KHR || result == VK_ERROR_OUT_OF_DATE_KHR)
+         swapchain_stale = true;
 
+      frame_index = (frame_index + 1) % frames_in_flight;
       frames++;
       tvPrev = tvNow;
 
@@ -1687,6 +2116,7 @@ main(int argc, char *argv[])
       }
    }
 
+   vkDeviceWaitIdle(device);
    wsi.fini_window();
    wsi.fini_display();
    return 0;
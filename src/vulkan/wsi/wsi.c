@@ -34,5 +34,8 @@ get_wsi_interface(void)
    return wayland_wsi_interface();
 #elif defined(XCB_SUPPORT)
    return xcb_wsi_interface();
+#else
+   /* no window system; only headless rendering is possible */
+   return (struct wsi_interface) { 0 };
 #endif
 }